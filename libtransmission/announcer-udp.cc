@@ -51,31 +51,17 @@ static void tau_sockaddr_setport(struct sockaddr* sa, tr_port port)
     }
 }
 
-static int tau_sendto(tr_session const* session, struct evutil_addrinfo* ai, tr_port port, void const* buf, size_t buflen)
+static int tau_sendto(tr_session* session, struct evutil_addrinfo* ai, tr_port port, void const* buf, size_t buflen)
 {
-    auto sockfd = tr_socket_t{};
-
-    if (ai->ai_addr->sa_family == AF_INET)
-    {
-        sockfd = session->udp_socket;
-    }
-    else if (ai->ai_addr->sa_family == AF_INET6)
-    {
-        sockfd = session->udp6_socket;
-    }
-    else
-    {
-        sockfd = TR_BAD_SOCKET;
-    }
+    tau_sockaddr_setport(ai->ai_addr, port);
 
-    if (sockfd == TR_BAD_SOCKET)
+    if (int const err = tr_udpSendTo(session, buf, buflen, ai->ai_addr, ai->ai_addrlen); err != 0)
     {
-        errno = EAFNOSUPPORT;
+        errno = err;
         return -1;
     }
 
-    tau_sockaddr_setport(ai->ai_addr, port);
-    return sendto(sockfd, static_cast<char const*>(buf), buflen, 0, ai->ai_addr, ai->ai_addrlen);
+    return buflen;
 }
 
 /****
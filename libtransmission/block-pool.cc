@@ -0,0 +1,211 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint> /* uintptr_t */
+#include <cstdlib> /* posix_memalign(), free() */
+#include <mutex>
+#include <new> /* std::bad_alloc */
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h> /* _aligned_malloc(), _aligned_free() */
+#else
+#include <sys/mman.h> /* madvise() */
+#endif
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+#include "block-pool.h"
+#include "peer-common.h" /* MAX_BLOCK_SIZE */
+#include "tr-assert.h"
+
+static_assert(TR_BLOCK_POOL_BLOCK_SIZE == MAX_BLOCK_SIZE);
+
+/***
+****
+***/
+
+namespace
+{
+
+auto constexpr BlockSize = TR_BLOCK_POOL_BLOCK_SIZE;
+
+/* Slabs are aligned to their size, so a block's slab can be found from its address.
+ * The normal size is that of a huge page on most systems. */
+#ifdef TR_LIGHTWEIGHT
+auto constexpr SlabSize = size_t{ 256 * 1024 };
+#else
+auto constexpr SlabSize = size_t{ 2 * 1024 * 1024 };
+#endif
+
+auto constexpr BlocksPerSlab = SlabSize / BlockSize;
+
+struct slab
+{
+    char* mem = nullptr;
+
+    /* blocks that were given back, linked through their first bytes */
+    void* free_list = nullptr;
+
+    /* how many blocks from the beginning of the slab have ever been handed out.
+     * The system may not have backed the rest with memory yet, so they're left alone */
+    size_t n_carved = 0;
+
+    size_t n_used = 0;
+};
+
+} // namespace
+
+static std::mutex pool_mutex_;
+
+/* The pool belongs to the process rather than to a session, so these are
+ * never destroyed: an evbuffer can give a block back after every session is
+ * gone, even while static objects are being destroyed at exit. */
+
+/* keyed by the slabs' addresses */
+static auto& slabs_{ *new std::unordered_map<uintptr_t, slab>{} };
+
+/* the slabs that have free blocks. Blocks are taken from the last one */
+static auto& partial_slabs_{ *new std::vector<slab*>{} };
+
+static size_t n_used_blocks_ = 0;
+
+static void* slabMemAlloc()
+{
+#ifdef _WIN32
+    void* const mem = _aligned_malloc(SlabSize, SlabSize);
+#else
+    void* mem = nullptr;
+    if (posix_memalign(&mem, SlabSize, SlabSize) != 0)
+    {
+        mem = nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    else
+    {
+        /* only a hint, so it doesn't matter if transparent huge pages are turned off */
+        madvise(mem, SlabSize, MADV_HUGEPAGE);
+    }
+#endif
+#endif
+
+    if (mem == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return mem;
+}
+
+static void slabMemFree(void* mem)
+{
+#ifdef _WIN32
+    _aligned_free(mem);
+#else
+    free(mem);
+#endif
+}
+
+static uintptr_t getSlabKey(void const* block)
+{
+    return reinterpret_cast<uintptr_t>(block) & ~uintptr_t{ SlabSize - 1 };
+}
+
+void* tr_blockPoolAlloc()
+{
+    auto const lock = std::lock_guard(pool_mutex_);
+
+    if (std::empty(partial_slabs_))
+    {
+        auto* const mem = static_cast<char*>(slabMemAlloc());
+        auto* const s = &slabs_[reinterpret_cast<uintptr_t>(mem)];
+        s->mem = mem;
+        partial_slabs_.push_back(s);
+    }
+
+    auto* const s = partial_slabs_.back();
+    void* block = nullptr;
+
+    if (s->free_list != nullptr)
+    {
+        block = s->free_list;
+        s->free_list = *static_cast<void**>(block);
+    }
+    else
+    {
+        TR_ASSERT(s->n_carved < BlocksPerSlab);
+        block = s->mem + s->n_carved * BlockSize;
+        ++s->n_carved;
+    }
+
+    ++n_used_blocks_;
+
+    if (++s->n_used == BlocksPerSlab)
+    {
+        partial_slabs_.pop_back();
+    }
+
+    return block;
+}
+
+void tr_blockPoolFree(void* block)
+{
+    if (block == nullptr)
+    {
+        return;
+    }
+
+    auto const lock = std::lock_guard(pool_mutex_);
+    auto const it = slabs_.find(getSlabKey(block));
+    TR_ASSERT(it != std::end(slabs_));
+    auto* const s = &it->second;
+    TR_ASSERT(s->n_used > 0);
+
+    *static_cast<void**>(block) = s->free_list;
+    s->free_list = block;
+    --n_used_blocks_;
+
+    if (s->n_used-- == BlocksPerSlab)
+    {
+        /* it was full. Put it at the front so that the slab that's being used up stays at the back */
+        partial_slabs_.insert(std::begin(partial_slabs_), s);
+    }
+
+    /* keep one slab around for reuse, but give the other empty ones back */
+    if (s->n_used == 0 && std::size(partial_slabs_) > 1)
+    {
+        partial_slabs_.erase(std::find(std::begin(partial_slabs_), std::end(partial_slabs_), s));
+        slabMemFree(s->mem);
+        slabs_.erase(it);
+    }
+}
+
+static void onReferenceDone(void const* /*data*/, size_t /*len*/, void* block)
+{
+    tr_blockPoolFree(block);
+}
+
+void tr_blockPoolAddToEvbuffer(struct evbuffer* buf, void* block, size_t len)
+{
+    TR_ASSERT(len <= BlockSize);
+
+    if (evbuffer_add_reference(buf, block, len, onReferenceDone, block) != 0)
+    {
+        tr_blockPoolFree(block);
+    }
+}
+
+tr_block_pool_stats tr_blockPoolGetStats()
+{
+    auto const lock = std::lock_guard(pool_mutex_);
+
+    return { std::size(slabs_) * SlabSize, n_used_blocks_ * BlockSize };
+}
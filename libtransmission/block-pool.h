@@ -0,0 +1,58 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+
+struct evbuffer;
+
+/**
+ * @addtogroup utils Utilities
+ * @{
+ */
+
+/** @brief The size of the pool's blocks, which is the biggest block that peers send */
+auto inline constexpr TR_BLOCK_POOL_BLOCK_SIZE = size_t{ 1024 * 16 };
+
+/**
+ * @brief Get a block of TR_BLOCK_POOL_BLOCK_SIZE bytes.
+ *
+ * The blocks are carved out of big slabs, which are backed by huge pages where
+ * the system allows it, so that the many short-lived block buffers of the cache
+ * and of the peers' uploads don't fragment the heap.
+ */
+void* tr_blockPoolAlloc();
+
+/** @brief Give a block back to the pool */
+void tr_blockPoolFree(void* block);
+
+/**
+ * @brief Add a block's first `len` bytes to an evbuffer without copying them.
+ *
+ * The evbuffer takes ownership of the block, which goes back to the pool
+ * when the evbuffer is done with it.
+ */
+void tr_blockPoolAddToEvbuffer(struct evbuffer* buf, void* block, size_t len);
+
+struct tr_block_pool_stats
+{
+    /* the memory that's been taken from the system */
+    size_t n_bytes;
+
+    /* the memory that's in blocks that are being used */
+    size_t n_used_bytes;
+};
+
+tr_block_pool_stats tr_blockPoolGetStats();
+
+/* @} */
@@ -6,17 +6,30 @@
  *
  */
 
-#include <cstdlib> /* qsort() */
+#include <algorithm>
+#include <cerrno>
+#include <cstring> /* memcpy() */
 #include <ctime>
+#include <limits>
+#include <list>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <event2/buffer.h>
 
 #include "transmission.h"
+#include "block-pool.h"
 #include "cache.h"
+#include "crypto-utils.h" /* tr_sha1_update() */
+#include "disk-io.h"
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
-#include "ptrarray.h"
+#include "platform.h" /* tr_getAvailableMemory() */
+#include "session.h"
 #include "torrent.h"
 #include "tr-assert.h"
 #include "trevent.h"
@@ -26,234 +39,955 @@
 
 #define dbgmsg(...) tr_logAddDeepNamed(MY_NAME, __VA_ARGS__)
 
+/* An auto-sized write cache holds about this many seconds of downloading,
+ * so that the quarter of it that cacheTrim() flushes is about a second's worth */
+static auto constexpr AutoSizeSecs = uint64_t{ 4 };
+
+/* ...but no more than this share of the memory that's available */
+static auto constexpr AutoSizeMemoryDivisor = uint64_t{ 8 };
+
+/* ...or than this, if the available memory isn't known */
+static auto constexpr AutoSizeFallbackMax = uint64_t{ 256 * 1024 * 1024 };
+
+/* Like the kernel's dirty_expire_centisecs: runs that were first written
+ * this long ago are flushed, even if the cache isn't full */
+static auto constexpr DirtyExpireSecs = time_t{ 30 };
+
+/* Like the kernel's dirty_background_ratio: an auto-sized cache is flushed
+ * down to this much of its limit once a second, so that bursts have room */
+static auto constexpr DirtyBackgroundPercent = size_t{ 50 };
+
+/* the writes that the disk workers haven't finished can take up at least this much
+ * before tr_cacheIsWriteBacklogged() says so */
+static auto constexpr MinWriteBacklog = size_t{ 1024 * 1024 };
+
 /****
 *****
 ****/
 
 struct cache_block
 {
-    tr_torrent* tor;
-
     tr_piece_index_t piece;
     uint32_t offset;
     uint32_t length;
 
+    /* from the block pool */
+    uint8_t* data;
+};
+
+/* a run of contiguous blocks [begin, end) from one torrent */
+struct cache_run
+{
+    tr_torrent* tor;
+
+    tr_block_index_t begin;
+    tr_block_index_t end;
+
+    /* when a block was last added to or rewritten in the run */
     time_t time;
-    tr_block_index_t block;
 
-    struct evbuffer* evbuf;
+    /* when the run's oldest block was written */
+    time_t dirtied;
+
+    /* whether the piece holding the run's last block is complete */
+    bool is_piece_done;
+
+    /* whether the run spans more than one piece */
+    bool is_multi_piece;
+};
+
+/* Orders runs by how badly they need to be flushed, neediest first.
+ *   - Runs that end in a completed piece come first, since they're unlikely to grow.
+ *   - Then runs that span pieces.
+ *   - Then long runs and stale runs. A run gains the equivalent of one block for
+ *     every 32 seconds it goes without growing; comparing `32 * length - time`
+ *     keeps that ordering without depending on the current time. */
+struct CompareRuns
+{
+    bool operator()(cache_run const* a, cache_run const* b) const
+    {
+        if (a->is_piece_done != b->is_piece_done)
+        {
+            return a->is_piece_done;
+        }
+
+        if (a->is_multi_piece != b->is_multi_piece)
+        {
+            return a->is_multi_piece;
+        }
+
+        auto const a_score = 32 * int64_t(a->end - a->begin) - int64_t(a->time);
+        auto const b_score = 32 * int64_t(b->end - b->begin) - int64_t(b->time);
+        if (a_score != b_score)
+        {
+            return a_score > b_score;
+        }
+
+        if (a->tor->uniqueId != b->tor->uniqueId)
+        {
+            return a->tor->uniqueId < b->tor->uniqueId;
+        }
+
+        return a->begin < b->begin;
+    }
+};
+
+/* one torrent's blocks */
+struct torrent_cache
+{
+    tr_torrent* tor = nullptr;
+
+    std::map<tr_block_index_t, cache_block> blocks;
+
+    /* the runs in `blocks`, keyed by their first block */
+    std::map<tr_block_index_t, cache_run> runs;
+
+    /* pieces that have been written to since the runs' `is_piece_done` flags were checked */
+    std::vector<tr_piece_index_t> changed_pieces;
+};
+
+/* a run of blocks that has left the cache but is still being written by a disk worker */
+struct pending_write
+{
+    tr_cache* cache;
+    tr_torrent* tor;
+
+    /* the byte span [begin, end) inside the torrent */
+    uint64_t begin;
+    uint64_t end;
+
+    struct evbuffer* buf;
+};
+
+/* a piece in the read cache */
+struct read_entry
+{
+    uint64_t key;
+
+    std::vector<uint8_t> buf;
+
+    /* true while a disk worker is reading the piece into `buf` */
+    bool is_loading;
+
+    /* true if the entry was dropped from the cache while it was loading */
+    bool is_detached;
+
+    /* which queue it's in, and where */
+    bool is_hot;
+    std::list<read_entry*>::iterator pos;
+};
+
+/* a tr_cacheReadBlockAsync() call waiting on a piece that's being loaded */
+struct read_waiter
+{
+    read_entry const* entry;
+    void const* owner;
+
+    uint32_t offset;
+    uint32_t len;
+    uint8_t* setme;
+
+    tr_session* session;
+    tr_io_done_func callback;
+    void* user_data;
+    int err;
+};
+
+/* The read cache is a 2Q cache of whole pieces.
+ *   - A piece that's read for the first time goes in `recent`, a FIFO
+ *     that's kept to a quarter of the cache.
+ *   - A piece that's asked for again after falling out of `recent`
+ *     goes in `hot`, an LRU that gets the rest of the cache.
+ * Reading a lot of pieces once, e.g. for a peer that's downloading
+ * the whole torrent, only churns `recent` and can't push out the
+ * pieces that many peers want. `ghosts` remembers the keys of the
+ * pieces that recently fell out of `recent`. */
+struct read_cache
+{
+    size_t max_bytes = 0;
+
+    /* the size of every entry, including those still loading */
+    size_t bytes = 0;
+    size_t recent_bytes = 0;
+
+    /* keyed by pieceKey() */
+    std::map<uint64_t, read_entry*> entries;
+
+    std::list<read_entry*> recent;
+    std::list<read_entry*> hot;
+
+    /* keys and sizes of pieces that fell out of `recent`, newest first */
+    std::list<std::pair<uint64_t, size_t>> ghosts;
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, size_t>>::iterator> ghost_index;
+    size_t ghost_bytes = 0;
+
+    /* waiting for their pieces to load */
+    std::list<read_waiter> waiters;
+
+    /* their pieces have loaded and their callbacks are about to be called */
+    std::list<read_waiter> ready;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+/* a piece's SHA1, computed as its blocks are written to the cache in order */
+struct piece_hash
+{
+    tr_sha1_ctx_t sha;
+
+    /* how many bytes from the beginning of the piece have been hashed */
+    uint32_t hashed;
 };
 
 struct tr_cache
 {
-    tr_ptrArray blocks;
-    int max_blocks;
-    size_t max_bytes;
+    /* keyed by tr_torrent::uniqueId */
+    std::unordered_map<int, torrent_cache> torrents;
+
+    /* every torrent's runs, ordered by CompareRuns */
+    std::set<cache_run*, CompareRuns> runs;
+
+    size_t n_blocks = 0;
+    size_t max_blocks = 0;
+    size_t max_bytes = 0;
+
+    /* when auto-sizing, the limit that the download rate calls for.
+     * The real limit is this or `max_bytes`, whichever is bigger */
+    bool is_auto_size = false;
+    size_t auto_bytes = 0;
 
-    size_t disk_writes;
-    size_t disk_write_bytes;
-    size_t cache_writes;
-    size_t cache_write_bytes;
+    size_t disk_writes = 0;
+    size_t disk_write_bytes = 0;
+    size_t cache_writes = 0;
+    size_t cache_write_bytes = 0;
+
+    std::vector<pending_write*> pending_writes;
+    size_t pending_write_bytes = 0;
+
+    read_cache read;
+
+    /* keyed by pieceKey() */
+    std::unordered_map<uint64_t, piece_hash> hashes;
 };
 
 /****
 *****
 ****/
 
-struct run_info
+static pending_write const* findPendingWrite(tr_cache const* cache, tr_torrent const* tor, uint64_t begin, uint64_t end)
+{
+    for (auto const* const pw : cache->pending_writes)
+    {
+        if (pw->tor == tor && pw->begin < end && begin < pw->end)
+        {
+            return pw;
+        }
+    }
+
+    return nullptr;
+}
+
+/* Wait for the torrent's pending writes to [begin, end) to reach the disk, or all
+ * of them by default. Only those writes are waited for, not the other torrents'
+ * writes or the peers' reads that the disk workers have queued */
+static void waitForPendingWrites(
+    tr_cache const* cache,
+    tr_torrent const* tor,
+    uint64_t begin = 0,
+    uint64_t end = std::numeric_limits<uint64_t>::max())
+{
+    struct span
+    {
+        tr_cache const* cache;
+        tr_torrent const* tor;
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    auto const is_written = [](void const* vspan)
+    {
+        auto const* const s = static_cast<span const*>(vspan);
+        return findPendingWrite(s->cache, s->tor, s->begin, s->end) == nullptr;
+    };
+
+    if (auto const pending = span{ cache, tor, begin, end }; !is_written(&pending))
+    {
+        tr_diskIoWaitFor(tor->session->diskIo, is_written, &pending);
+    }
+}
+
+static void onPendingWriteDone(tr_session* /*session*/, int /*err*/, void* vpw)
+{
+    /* any error has already been logged and set on the torrent by inout */
+    auto* const pw = static_cast<pending_write*>(vpw);
+    auto& pending = pw->cache->pending_writes;
+
+    pending.erase(std::remove(std::begin(pending), std::end(pending), pw), std::end(pending));
+    pw->cache->pending_write_bytes -= pw->end - pw->begin;
+    evbuffer_free(pw->buf);
+    delete pw;
+}
+
+/* evbuffer_copyout_from() needs libevent 2.1, so walk the chain by hand */
+static void copyFromPendingWrite(pending_write const* pw, size_t offset, size_t len, uint8_t* setme)
+{
+    struct evbuffer_ptr ptr;
+    evbuffer_ptr_set(pw->buf, &ptr, offset, EVBUFFER_PTR_SET);
+
+    while (len > 0)
+    {
+        struct evbuffer_iovec vec;
+        if (evbuffer_peek(pw->buf, len, &ptr, &vec, 1) < 1)
+        {
+            break;
+        }
+
+        size_t const n = std::min(len, vec.iov_len);
+        memcpy(setme, vec.iov_base, n);
+        setme += n;
+        len -= n;
+        evbuffer_ptr_set(pw->buf, &ptr, n, EVBUFFER_PTR_ADD);
+    }
+}
+
+/****
+*****
+****/
+
+static uint64_t pieceKey(tr_torrent const* tor, tr_piece_index_t piece)
+{
+    return (uint64_t{ uint32_t(tor->uniqueId) } << 32) | piece;
+}
+
+static torrent_cache* findTorrentCache(tr_cache* cache, tr_torrent const* tor)
+{
+    auto const it = cache->torrents.find(tor->uniqueId);
+    return it != std::end(cache->torrents) ? &it->second : nullptr;
+}
+
+/* forget about a torrent once all of its blocks have been flushed */
+static void pruneTorrentCache(tr_cache* cache, tr_torrent const* tor)
+{
+    if (auto const it = cache->torrents.find(tor->uniqueId); it != std::end(cache->torrents) && std::empty(it->second.blocks))
+    {
+        cache->torrents.erase(it);
+    }
+}
+
+/* find the run that holds `block` */
+static cache_run* findRun(torrent_cache* tc, tr_block_index_t block)
+{
+    auto it = tc->runs.upper_bound(block);
+
+    if (it == std::begin(tc->runs))
+    {
+        return nullptr;
+    }
+
+    --it;
+    return block < it->second.end ? &it->second : nullptr;
+}
+
+/* a run's place in cache->runs depends on all of its fields,
+ * so it must be unranked before it's changed and ranked again afterwards */
+static void rankRun(tr_cache* cache, cache_run* run)
+{
+    auto const* const tor = run->tor;
+    auto const first_piece = tor->pieceForBlock(run->begin);
+    auto const last_piece = tor->pieceForBlock(run->end - 1);
+    run->is_multi_piece = first_piece != last_piece;
+    run->is_piece_done = tor->hasPiece(last_piece);
+
+    cache->runs.insert(run);
+}
+
+static void unrankRun(tr_cache* cache, cache_run* run)
+{
+    cache->runs.erase(run);
+}
+
+/* add a new block to the runs, growing or joining its neighbors if it touches them */
+static void addBlockToRuns(tr_cache* cache, torrent_cache* tc, tr_block_index_t block, time_t now)
+{
+    auto* const prev = block > 0 ? findRun(tc, block - 1) : nullptr;
+    auto const next = tc->runs.find(block + 1);
+    cache_run* run = nullptr;
+
+    if (prev != nullptr)
+    {
+        unrankRun(cache, prev);
+        prev->end = block + 1;
+
+        if (next != std::end(tc->runs))
+        {
+            unrankRun(cache, &next->second);
+            prev->end = next->second.end;
+            prev->dirtied = std::min(prev->dirtied, next->second.dirtied);
+            tc->runs.erase(next);
+        }
+
+        run = prev;
+    }
+    else if (next != std::end(tc->runs))
+    {
+        unrankRun(cache, &next->second);
+        auto node = tc->runs.extract(next);
+        node.key() = block;
+        node.mapped().begin = block;
+        run = &tc->runs.insert(std::move(node)).position->second;
+    }
+    else
+    {
+        run = &tc->runs.try_emplace(block, cache_run{ tc->tor, block, block + 1, now, now, false, false }).first->second;
+    }
+
+    run->time = now;
+    rankRun(cache, run);
+}
+
+/* Completing a piece changes the rank of the runs that end in it.
+ * That happens after the block is written to the cache, so instead
+ * of ranking them then, remember which pieces to look at before the next flush. */
+static void rerankChangedRuns(tr_cache* cache)
+{
+    for (auto& [id, tc] : cache->torrents)
+    {
+        for (auto const piece : tc.changed_pieces)
+        {
+            auto const [begin, end] = tc.tor->blockSpanForPiece(piece);
+            auto it = tc.runs.upper_bound(begin);
+            if (it != std::begin(tc.runs))
+            {
+                --it;
+            }
+
+            for (; it != std::end(tc.runs) && it->first < end; ++it)
+            {
+                auto* const run = &it->second;
+
+                if (begin < run->end && run->end <= end)
+                {
+                    unrankRun(cache, run);
+                    rankRun(cache, run);
+                }
+            }
+        }
+
+        tc.changed_pieces.clear();
+    }
+}
+
+static int flushRun(tr_cache* cache, cache_run* run)
+{
+    int err = 0;
+    tr_torrent* const tor = run->tor;
+    auto* const tc = findTorrentCache(cache, tor);
+    auto const begin = run->begin;
+    auto const end = run->end;
+
+    unrankRun(cache, run);
+    tc->runs.erase(begin);
+
+    auto it = tc->blocks.find(begin);
+    TR_ASSERT(it != std::end(tc->blocks));
+    tr_piece_index_t const piece = it->second.piece;
+    uint32_t const offset = it->second.offset;
+
+    /* chain the blocks' memory together instead of copying it into one flat buffer.
+     * They go back to the pool when the write is done with them */
+    struct evbuffer* buf = evbuffer_new();
+    while (it != std::end(tc->blocks) && it->first < end)
+    {
+        tr_blockPoolAddToEvbuffer(buf, it->second.data, it->second.length);
+        it = tc->blocks.erase(it);
+    }
+
+    cache->n_blocks -= end - begin;
+
+    auto const len = evbuffer_get_length(buf);
+    auto* const io = tor->session->diskIo;
+
+    if (io == nullptr)
+    {
+        err = tr_ioWriteBuf(tor, piece, offset, buf);
+        evbuffer_free(buf);
+    }
+    else
+    {
+        auto* const pw = new pending_write{ cache, tor, tor->offset(piece, offset), tor->offset(piece, offset) + len, buf };
+
+        /* don't let two writes to the same bytes race each other */
+        waitForPendingWrites(cache, tor, pw->begin, pw->end);
+
+        err = tr_ioWriteAsync(tor, cache, piece, offset, buf, onPendingWriteDone, pw);
+
+        if (err == 0)
+        {
+            cache->pending_writes.push_back(pw);
+            cache->pending_write_bytes += len;
+        }
+        else
+        {
+            evbuffer_free(buf);
+            delete pw;
+        }
+    }
+
+    ++cache->disk_writes;
+    cache->disk_write_bytes += len;
+    return err;
+}
+
+static int cacheTrim(tr_cache* cache)
+{
+    int err = 0;
+
+    if (cache->n_blocks > cache->max_blocks)
+    {
+        /* Amount of cache that should be removed by the flush. This influences how large
+         * runs can grow as well as how often flushes will happen. */
+        size_t const cacheCutoff = 1 + cache->max_blocks / 4;
+        size_t n_flushed = 0;
+
+        rerankChangedRuns(cache);
+
+        while (err == 0 && n_flushed < cacheCutoff && !std::empty(cache->runs))
+        {
+            auto* const run = *std::begin(cache->runs);
+            tr_torrent const* const tor = run->tor;
+            n_flushed += run->end - run->begin;
+            err = flushRun(cache, run);
+            pruneTorrentCache(cache, tor);
+        }
+    }
+
+    return err;
+}
+
+/***
+****  Read cache
+***/
+
+static read_entry* findReadEntry(read_cache* rc, uint64_t key)
+{
+    auto const it = rc->entries.find(key);
+    return it != std::end(rc->entries) ? it->second : nullptr;
+}
+
+/* remember about half a cache's worth of pieces that fell out of `recent` */
+static void trimGhosts(read_cache* rc)
+{
+    while (rc->ghost_bytes > rc->max_bytes / 2)
+    {
+        auto const& [key, len] = rc->ghosts.back();
+        rc->ghost_bytes -= len;
+        rc->ghost_index.erase(key);
+        rc->ghosts.pop_back();
+    }
+}
+
+static void addGhost(read_cache* rc, uint64_t key, size_t len)
+{
+    rc->ghosts.emplace_front(key, len);
+    rc->ghost_index[key] = std::begin(rc->ghosts);
+    rc->ghost_bytes += len;
+    trimGhosts(rc);
+}
+
+static bool takeGhost(read_cache* rc, uint64_t key)
+{
+    auto const it = rc->ghost_index.find(key);
+
+    if (it == std::end(rc->ghost_index))
+    {
+        return false;
+    }
+
+    rc->ghost_bytes -= it->second->second;
+    rc->ghosts.erase(it->second);
+    rc->ghost_index.erase(it);
+    return true;
+}
+
+static read_entry* newReadEntry(read_cache* rc, tr_torrent const* tor, tr_piece_index_t piece)
+{
+    auto* const entry = new read_entry{};
+    entry->key = pieceKey(tor, piece);
+    entry->buf.resize(tor->pieceSize(piece));
+
+    /* a piece that's wanted again soon after it was evicted is a hot one */
+    entry->is_hot = takeGhost(rc, entry->key);
+
+    rc->entries.emplace(entry->key, entry);
+    rc->bytes += std::size(entry->buf);
+    return entry;
+}
+
+static void enqueueReadEntry(read_cache* rc, read_entry* entry)
+{
+    auto& queue = entry->is_hot ? rc->hot : rc->recent;
+    queue.push_front(entry);
+    entry->pos = std::begin(queue);
+
+    if (!entry->is_hot)
+    {
+        rc->recent_bytes += std::size(entry->buf);
+    }
+}
+
+/* take an entry out of the cache. If a disk worker is still
+ * filling it in, it's freed when the worker is done. */
+static void dropReadEntry(read_cache* rc, read_entry* entry)
+{
+    rc->entries.erase(entry->key);
+    rc->bytes -= std::size(entry->buf);
+
+    if (entry->is_loading)
+    {
+        entry->is_detached = true;
+        return;
+    }
+
+    if (entry->is_hot)
+    {
+        rc->hot.erase(entry->pos);
+    }
+    else
+    {
+        rc->recent.erase(entry->pos);
+        rc->recent_bytes -= std::size(entry->buf);
+    }
+
+    delete entry;
+}
+
+static void evictReadEntries(read_cache* rc)
+{
+    while (rc->bytes > rc->max_bytes)
+    {
+        if (!std::empty(rc->recent) && (rc->recent_bytes > rc->max_bytes / 4 || std::empty(rc->hot)))
+        {
+            auto* const entry = rc->recent.back();
+            addGhost(rc, entry->key, std::size(entry->buf));
+            dropReadEntry(rc, entry);
+        }
+        else if (!std::empty(rc->hot))
+        {
+            dropReadEntry(rc, rc->hot.back());
+        }
+        else
+        {
+            /* everything that's left is still loading */
+            break;
+        }
+    }
+}
+
+/* 2Q only reorders the hot queue; `recent` stays in the order the pieces arrived */
+static void touchReadEntry(read_cache* rc, read_entry* entry)
+{
+    if (entry->is_hot)
+    {
+        rc->hot.splice(std::begin(rc->hot), rc->hot, entry->pos);
+    }
+}
+
+static void dropReadTorrent(read_cache* rc, tr_torrent const* tor)
+{
+    auto const first = pieceKey(tor, 0);
+    auto const last = first | UINT32_MAX;
+
+    for (auto it = rc->entries.lower_bound(first); it != std::end(rc->entries) && it->first <= last;)
+    {
+        auto* const entry = it->second;
+        ++it;
+        dropReadEntry(rc, entry);
+    }
+}
+
+/* only pieces that we have and that are all on the disk can be cached */
+static bool isReadCacheable(tr_cache* cache, tr_torrent* tor, tr_piece_index_t piece)
+{
+    if (cache->read.max_bytes == 0 || uint64_t{ tor->pieceSize(piece) } * 4 > cache->read.max_bytes ||
+        !tor->hasPiece(piece))
+    {
+        return false;
+    }
+
+    auto const [begin, end] = tor->blockSpanForPiece(piece);
+    if (auto const* const tc = findTorrentCache(cache, tor); tc != nullptr)
+    {
+        auto const it = tc->blocks.lower_bound(begin);
+
+        if (it != std::end(tc->blocks) && it->first < end)
+        {
+            return false;
+        }
+    }
+
+    auto const piece_begin = tor->offset(piece, 0);
+    return findPendingWrite(cache, tor, piece_begin, piece_begin + tor->pieceSize(piece)) == nullptr;
+}
+
+static void dispatchReadyWaiters(read_cache* rc)
 {
-    int pos;
-    int rank;
-    time_t last_block_time;
-    bool is_multi_piece;
-    bool is_piece_done;
-    unsigned int len;
-};
+    /* a callback can cancel other waiters, so take them one at a time */
+    while (!std::empty(rc->ready))
+    {
+        auto const waiter = rc->ready.front();
+        rc->ready.pop_front();
+        waiter.callback(waiter.session, waiter.err, waiter.user_data);
+    }
+}
 
-/* return a count of how many contiguous blocks there are starting at this pos */
-static int getBlockRun(tr_cache const* cache, int pos, struct run_info* info)
+static void onPieceLoaded(tr_session* session, int err, void* ventry)
 {
-    int const n = tr_ptrArraySize(&cache->blocks);
-    struct cache_block const* const* blocks = (struct cache_block const* const*)tr_ptrArrayBase(&cache->blocks);
-    struct cache_block const* ref = blocks[pos];
-    tr_block_index_t block = ref->block;
-    int len = 0;
+    auto* const rc = &session->cache->read;
+    auto* const entry = static_cast<read_entry*>(ventry);
+    entry->is_loading = false;
 
-    for (int i = pos; i < n; ++i)
+    /* give the piece to everyone who was waiting for it */
+    for (auto it = std::begin(rc->waiters), end = std::end(rc->waiters); it != end;)
     {
-        struct cache_block const* b = blocks[i];
+        auto const next = std::next(it);
 
-        if (b->block != block)
+        if (it->entry == entry)
         {
-            break;
-        }
+            if (err == 0)
+            {
+                memcpy(it->setme, std::data(entry->buf) + it->offset, it->len);
+            }
 
-        if (b->tor != ref->tor)
-        {
-            break;
+            it->err = err;
+            rc->ready.splice(std::end(rc->ready), rc->waiters, it);
         }
 
-        ++block;
-        ++len;
+        it = next;
     }
 
-    if (info != nullptr)
+    if (entry->is_detached)
+    {
+        delete entry;
+    }
+    else if (err != 0)
+    {
+        rc->entries.erase(entry->key);
+        rc->bytes -= std::size(entry->buf);
+        delete entry;
+    }
+    else
     {
-        struct cache_block const* b = blocks[pos + len - 1];
-        info->last_block_time = b->time;
-        info->is_piece_done = b->tor->hasPiece(b->piece);
-        info->is_multi_piece = b->piece != blocks[pos]->piece;
-        info->len = len;
-        info->pos = pos;
+        enqueueReadEntry(rc, entry);
+        evictReadEntries(rc);
     }
 
-    return len;
+    dispatchReadyWaiters(rc);
 }
 
-/* higher rank comes before lower rank */
-static int compareRuns(void const* va, void const* vb)
+/* start reading a whole piece into the read cache with a disk worker */
+static read_entry* loadPieceAsync(tr_cache* cache, tr_torrent* tor, tr_piece_index_t piece, int* setme_err)
 {
-    auto* a = static_cast<struct run_info const*>(va);
-    auto* b = static_cast<struct run_info const*>(vb);
-    return b->rank - a->rank;
-}
+    auto* const rc = &cache->read;
+    auto* const entry = newReadEntry(rc, tor, piece);
+    entry->is_loading = true;
 
-enum
-{
-    MULTIFLAG = 0x1000,
-    DONEFLAG = 0x2000,
-    SESSIONFLAG = 0x4000
-};
+    auto const len = uint32_t(std::size(entry->buf));
+    auto const err = tr_ioReadAsync(tor, cache, piece, 0, len, std::data(entry->buf), onPieceLoaded, entry);
 
-/* Calculte runs
- *   - Stale runs, runs sitting in cache for a long time or runs not growing, get priority.
- *     Returns number of runs.
- */
-// TODO: return std::vector
-static int calcRuns(tr_cache const* cache, struct run_info* runs)
-{
-    int const n = tr_ptrArraySize(&cache->blocks);
-    int i = 0;
-    time_t const now = tr_time();
+    if (err != 0)
+    {
+        rc->entries.erase(entry->key);
+        rc->bytes -= std::size(entry->buf);
+        delete entry;
+    }
 
-    for (int pos = 0; pos < n; pos += runs[i++].len)
+    if (setme_err != nullptr)
     {
-        int rank = getBlockRun(cache, pos, &runs[i]);
+        *setme_err = err;
+    }
 
-        /* This adds ~2 to the relative length of a run for every minute it has
-         * languished in the cache. */
-        rank += (now - runs[i].last_block_time) / 32;
+    return err == 0 ? entry : nullptr;
+}
 
-        /* Flushing stale blocks should be a top priority as the probability of them
-         * growing is very small, for blocks on piece boundaries, and nonexistant for
-         * blocks inside pieces. */
-        rank |= runs[i].is_piece_done ? DONEFLAG : 0;
+/* read a whole piece into the read cache, blocking until it's done */
+static read_entry* loadPiece(tr_cache* cache, tr_torrent* tor, tr_piece_index_t piece, int* setme_err)
+{
+    auto* const rc = &cache->read;
+    auto* const entry = newReadEntry(rc, tor, piece);
 
-        /* Move the multi piece runs higher */
-        rank |= runs[i].is_multi_piece ? MULTIFLAG : 0;
+    *setme_err = tr_ioRead(tor, piece, 0, std::size(entry->buf), std::data(entry->buf));
 
-        runs[i].rank = rank;
+    if (*setme_err != 0)
+    {
+        rc->entries.erase(entry->key);
+        rc->bytes -= std::size(entry->buf);
+        delete entry;
+        return nullptr;
     }
 
-    qsort(runs, i, sizeof(struct run_info), compareRuns);
-    return i;
+    enqueueReadEntry(rc, entry);
+    return entry;
 }
 
-static int flushContiguous(tr_cache* cache, int pos, int n)
+int tr_cacheSetReadLimit(tr_cache* cache, int64_t max_bytes)
 {
-    int err = 0;
-    uint8_t* buf = tr_new(uint8_t, n * MAX_BLOCK_SIZE);
-    uint8_t* walk = buf;
-    struct cache_block** blocks = (struct cache_block**)tr_ptrArrayBase(&cache->blocks);
+    auto* const rc = &cache->read;
+    rc->max_bytes = max_bytes;
 
-    struct cache_block* b = blocks[pos];
-    tr_torrent* tor = b->tor;
-    tr_piece_index_t const piece = b->piece;
-    uint32_t const offset = b->offset;
+    tr_logAddNamedDbg(MY_NAME, "Maximum read cache size set to %s", tr_formatter_mem_B(rc->max_bytes).c_str());
 
-    for (int i = 0; i < n; ++i)
-    {
-        b = blocks[pos + i];
-        evbuffer_copyout(b->evbuf, walk, b->length);
-        walk += b->length;
-        evbuffer_free(b->evbuf);
-        tr_free(b);
-    }
-
-    tr_ptrArrayErase(&cache->blocks, pos, pos + n);
+    evictReadEntries(rc);
+    trimGhosts(rc);
+    return 0;
+}
 
-    err = tr_ioWrite(tor, piece, offset, walk - buf, buf);
-    tr_free(buf);
+int64_t tr_cacheGetReadLimit(tr_cache const* cache)
+{
+    return cache->read.max_bytes;
+}
 
-    ++cache->disk_writes;
-    cache->disk_write_bytes += walk - buf;
-    return err;
+void tr_cacheGetReadStats(tr_cache const* cache, uint64_t* hits, uint64_t* misses)
+{
+    *hits = cache->read.hits;
+    *misses = cache->read.misses;
 }
 
-static int flushRuns(tr_cache* cache, struct run_info* runs, int n)
+/***
+****
+***/
+
+/***
+****  Piece hashes
+***/
+
+static void dropPieceHash(tr_cache* cache, decltype(tr_cache::hashes)::iterator it)
 {
-    int err = 0;
+    tr_sha1_final(it->second.sha);
+    cache->hashes.erase(it);
+}
 
-    for (int i = 0; err == 0 && i < n; i++)
+static void dropTorrentHashes(tr_cache* cache, tr_torrent const* tor)
+{
+    for (auto it = std::begin(cache->hashes); it != std::end(cache->hashes);)
     {
-        err = flushContiguous(cache, runs[i].pos, runs[i].len);
+        auto const next = std::next(it);
 
-        for (int j = i + 1; j < n; j++)
+        if ((it->first >> 32) == uint32_t(tor->uniqueId))
         {
-            if (runs[j].pos > runs[i].pos)
-            {
-                runs[j].pos -= runs[i].len;
-            }
+            dropPieceHash(cache, it);
         }
-    }
 
-    return err;
+        it = next;
+    }
 }
 
-static int cacheTrim(tr_cache* cache)
+/* A block was just written to the cache. If it's the next one that the piece's hash
+ * needs, hash it and any blocks after it that are already in the cache, so that by
+ * the time the piece is complete its hash is usually done without reading anything back. */
+static void updatePieceHash(tr_cache* cache, torrent_cache* tc, tr_torrent const* tor, tr_piece_index_t piece, uint32_t offset)
 {
-    int err = 0;
+    auto const key = pieceKey(tor, piece);
+    auto it = cache->hashes.find(key);
 
-    if (tr_ptrArraySize(&cache->blocks) > cache->max_blocks)
+    /* a block that's already been hashed is being rewritten */
+    if (it != std::end(cache->hashes) && offset < it->second.hashed)
     {
-        /* Amount of cache that should be removed by the flush. This influences how large
-         * runs can grow as well as how often flushes will happen. */
-        int const cacheCutoff = 1 + cache->max_blocks / 4;
-        struct run_info* runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
-        int j = 0;
+        dropPieceHash(cache, it);
+        it = std::end(cache->hashes);
+    }
+
+    if (it == std::end(cache->hashes))
+    {
+        if (offset != 0)
+        {
+            return;
+        }
+
+        it = cache->hashes.try_emplace(key, piece_hash{ tr_sha1_init(), 0 }).first;
+    }
 
-        calcRuns(cache, runs);
+    auto& ph = it->second;
+    auto const piece_size = tor->pieceSize(piece);
 
-        while (j < cacheCutoff)
+    for (auto bit = tc->blocks.find(tor->blockOf(piece, ph.hashed)); ph.hashed < piece_size && bit != std::end(tc->blocks);
+         ++bit)
+    {
+        auto const& cb = bit->second;
+
+        if (cb.piece != piece || cb.offset != ph.hashed)
         {
-            j += runs[i++].len;
+            break;
         }
 
-        err = flushRuns(cache, runs, i);
-        tr_free(runs);
+        tr_sha1_update(ph.sha, cb.data, cb.length);
+        ph.hashed += cb.length;
+    }
+}
+
+tr_sha1_ctx_t tr_cacheTakePieceHash(tr_cache* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t* setme_len)
+{
+    auto const it = cache->hashes.find(pieceKey(torrent, piece));
+
+    if (it == std::end(cache->hashes))
+    {
+        *setme_len = 0;
+        return nullptr;
     }
 
-    return err;
+    auto const sha = it->second.sha;
+    *setme_len = it->second.hashed;
+    cache->hashes.erase(it);
+    return sha;
 }
 
 /***
 ****
 ***/
 
-static int getMaxBlocks(int64_t max_bytes)
+static size_t getMaxBlocks(int64_t max_bytes)
 {
     return max_bytes / (double)MAX_BLOCK_SIZE;
 }
 
+static size_t getCurrentLimit(tr_cache const* cache)
+{
+    return cache->is_auto_size ? std::max(cache->max_bytes, cache->auto_bytes) : cache->max_bytes;
+}
+
+static void updateMaxBlocks(tr_cache* cache)
+{
+    cache->max_blocks = getMaxBlocks(getCurrentLimit(cache));
+}
+
+/* size the cache for the download rate, within the memory that's available */
+static void updateAutoSize(tr_cache* cache, uint64_t download_Bps)
+{
+    auto const wanted = download_Bps * AutoSizeSecs;
+
+    /* grow right away, but shrink slowly so that a lull doesn't lead to a burst of small writes */
+    auto bytes = wanted >= cache->auto_bytes ? wanted : (cache->auto_bytes * 7 + wanted) / 8;
+
+    auto const available = tr_getAvailableMemory();
+    bytes = std::min(bytes, available != 0 ? available / AutoSizeMemoryDivisor : AutoSizeFallbackMax);
+
+    if (cache->auto_bytes != bytes)
+    {
+        cache->auto_bytes = bytes;
+        updateMaxBlocks(cache);
+
+        dbgmsg("Cache auto-sized to %s (%zu blocks)", tr_formatter_mem_B(getCurrentLimit(cache)).c_str(), cache->max_blocks);
+    }
+}
+
 int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes)
 {
     cache->max_bytes = max_bytes;
-    cache->max_blocks = getMaxBlocks(max_bytes);
+    updateMaxBlocks(cache);
 
     tr_logAddNamedDbg(
         MY_NAME,
-        "Maximum cache size set to %s (%d blocks)",
+        "Maximum cache size set to %s (%zu blocks)",
         tr_formatter_mem_B(cache->max_bytes).c_str(),
         cache->max_blocks);
 
@@ -265,12 +999,35 @@ int64_t tr_cacheGetLimit(tr_cache const* cache)
     return cache->max_bytes;
 }
 
+int tr_cacheSetAutoSize(tr_cache* cache, bool enabled)
+{
+    cache->is_auto_size = enabled;
+    cache->auto_bytes = 0;
+    updateMaxBlocks(cache);
+
+    return cacheTrim(cache);
+}
+
+bool tr_cacheIsAutoSize(tr_cache const* cache)
+{
+    return cache->is_auto_size;
+}
+
+int64_t tr_cacheGetCurrentLimit(tr_cache const* cache)
+{
+    return getCurrentLimit(cache);
+}
+
+bool tr_cacheIsWriteBacklogged(tr_cache const* cache)
+{
+    return cache->pending_write_bytes > std::max(getCurrentLimit(cache), MinWriteBacklog);
+}
+
 tr_cache* tr_cacheNew(int64_t max_bytes)
 {
-    tr_cache* cache = tr_new0(tr_cache, 1);
-    cache->blocks = {};
+    auto* const cache = new tr_cache{};
     cache->max_bytes = max_bytes;
-    cache->max_blocks = getMaxBlocks(max_bytes);
+    updateMaxBlocks(cache);
     return cache;
 }
 
@@ -280,75 +1037,114 @@ void tr_cacheFree(tr_cache* cache)
     // e.g. if writing to disk failed due to disk full / permission error etc
     // then there is still going to be data sitting in the cache on shutdown.
     // Make this assertion smarter or remove it.
-    TR_ASSERT(tr_ptrArrayEmpty(&cache->blocks));
+    TR_ASSERT(cache->n_blocks == 0);
+    TR_ASSERT(std::empty(cache->pending_writes));
+    TR_ASSERT(std::empty(cache->read.waiters));
+
+    for (auto& [id, tc] : cache->torrents)
+    {
+        for (auto& [block, cb] : tc.blocks)
+        {
+            tr_blockPoolFree(cb.data);
+        }
+    }
 
-    tr_ptrArrayDestruct(&cache->blocks, nullptr);
-    tr_free(cache);
+    while (!std::empty(cache->read.entries))
+    {
+        dropReadEntry(&cache->read, std::begin(cache->read.entries)->second);
+    }
+
+    while (!std::empty(cache->hashes))
+    {
+        dropPieceHash(cache, std::begin(cache->hashes));
+    }
+
+    delete cache;
 }
 
 /***
 ****
 ***/
 
-static int cache_block_compare(void const* va, void const* vb)
+static struct cache_block* findBlock(tr_cache* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t offset)
 {
-    auto const* a = static_cast<struct cache_block const*>(va);
-    auto const* b = static_cast<struct cache_block const*>(vb);
-
-    /* primary key: torrent id */
-    if (a->tor->uniqueId != b->tor->uniqueId)
-    {
-        return a->tor->uniqueId < b->tor->uniqueId ? -1 : 1;
-    }
+    auto* const tc = findTorrentCache(cache, torrent);
 
-    /* secondary key: block # */
-    if (a->block != b->block)
+    if (tc == nullptr)
     {
-        return a->block < b->block ? -1 : 1;
+        return nullptr;
     }
 
-    /* they're equal */
-    return 0;
+    auto const it = tc->blocks.find(torrent->blockOf(piece, offset));
+    return it != std::end(tc->blocks) ? &it->second : nullptr;
 }
 
-static struct cache_block* findBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset)
+int tr_cacheWriteBlock(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t length,
+    struct evbuffer* writeme)
 {
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = torrent->blockOf(piece, offset);
-    return static_cast<struct cache_block*>(tr_ptrArrayFindSorted(&cache->blocks, &key, cache_block_compare));
+    TR_ASSERT(length <= TR_BLOCK_POOL_BLOCK_SIZE);
+
+    auto* const block = tr_blockPoolAlloc();
+    evbuffer_remove(writeme, block, length);
+    return tr_cacheAdoptBlock(cache, torrent, piece, offset, length, block);
 }
 
-int tr_cacheWriteBlock(
+int tr_cacheAdoptBlock(
     tr_cache* cache,
     tr_torrent* torrent,
     tr_piece_index_t piece,
     uint32_t offset,
     uint32_t length,
-    struct evbuffer* writeme)
+    void* block)
 {
     TR_ASSERT(tr_amInEventThread(torrent->session));
+    TR_ASSERT(length <= TR_BLOCK_POOL_BLOCK_SIZE);
 
-    struct cache_block* cb = findBlock(cache, torrent, piece, offset);
+    /* the piece is being downloaded again, so whatever the read cache has is stale */
+    if (auto* const entry = findReadEntry(&cache->read, pieceKey(torrent, piece)); entry != nullptr)
+    {
+        dropReadEntry(&cache->read, entry);
+    }
+
+    auto* const tc = &cache->torrents[torrent->uniqueId];
+    tc->tor = torrent;
 
-    if (cb == nullptr)
+    auto const block_index = torrent->blockOf(piece, offset);
+    auto const now = tr_time();
+    auto const [it, is_new] = tc->blocks.try_emplace(block_index);
+    auto* const cb = &it->second;
+
+    if (is_new)
     {
-        cb = tr_new(struct cache_block, 1);
-        cb->tor = torrent;
         cb->piece = piece;
         cb->offset = offset;
         cb->length = length;
-        cb->block = torrent->blockOf(piece, offset);
-        cb->evbuf = evbuffer_new();
-        tr_ptrArrayInsertSorted(&cache->blocks, cb, cache_block_compare);
+        ++cache->n_blocks;
+        addBlockToRuns(cache, tc, block_index, now);
+    }
+    else
+    {
+        auto* const run = findRun(tc, block_index);
+        unrankRun(cache, run);
+        run->time = now;
+        rankRun(cache, run);
+        tr_blockPoolFree(cb->data);
     }
 
     TR_ASSERT(cb->length == length);
+    cb->data = static_cast<uint8_t*>(block);
 
-    cb->time = tr_time();
+    if (std::empty(tc->changed_pieces) || tc->changed_pieces.back() != piece)
+    {
+        tc->changed_pieces.push_back(piece);
+    }
 
-    evbuffer_drain(cb->evbuf, evbuffer_get_length(cb->evbuf));
-    evbuffer_remove_buffer(writeme, cb->evbuf, cb->length);
+    updatePieceHash(cache, tc, torrent, piece, offset);
 
     cache->cache_writes++;
     cache->cache_write_bytes += cb->length;
@@ -369,22 +1165,159 @@ int tr_cacheReadBlock(
 
     if (cb != nullptr)
     {
-        evbuffer_copyout(cb->evbuf, setme, len);
+        memcpy(setme, cb->data, len);
+        return 0;
     }
-    else
+
+    /* if the block is still on its way to the disk, read it from there */
+    auto const begin = torrent->offset(piece, offset);
+    auto const end = begin + len;
+    if (auto const* const pw = findPendingWrite(cache, torrent, begin, end); pw != nullptr)
+    {
+        if (pw->begin <= begin && end <= pw->end)
+        {
+            copyFromPendingWrite(pw, begin - pw->begin, len, setme);
+            return 0;
+        }
+
+        waitForPendingWrites(cache, torrent, begin, end);
+
+        /* the done callbacks that were called meanwhile may have cached it again */
+        cb = findBlock(cache, torrent, piece, offset);
+        if (cb != nullptr)
+        {
+            memcpy(setme, cb->data, len);
+            return 0;
+        }
+    }
+
+    auto* const rc = &cache->read;
+    auto* entry = findReadEntry(rc, pieceKey(torrent, piece));
+
+    if (entry != nullptr && !entry->is_loading)
+    {
+        ++rc->hits;
+        touchReadEntry(rc, entry);
+        memcpy(setme, std::data(entry->buf) + offset, len);
+        return 0;
+    }
+
+    if (rc->max_bytes != 0)
+    {
+        ++rc->misses;
+    }
+
+    /* read the whole piece so that the rest of its blocks are ready for the next requests */
+    if (entry == nullptr && isReadCacheable(cache, torrent, piece))
     {
-        err = tr_ioRead(torrent, piece, offset, len, setme);
+        if (entry = loadPiece(cache, torrent, piece, &err); entry != nullptr)
+        {
+            memcpy(setme, std::data(entry->buf) + offset, len);
+            evictReadEntries(rc);
+        }
+
+        return err;
     }
 
+    err = tr_ioRead(torrent, piece, offset, len, setme);
+
     return err;
 }
 
+int tr_cacheReadBlockAsync(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    void const* owner,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme,
+    tr_io_done_func callback,
+    void* user_data)
+{
+    TR_ASSERT(!tr_cacheHasBlock(cache, torrent, piece, offset, len));
+
+    auto* const rc = &cache->read;
+    auto* entry = findReadEntry(rc, pieceKey(torrent, piece));
+
+    if (rc->max_bytes != 0)
+    {
+        ++rc->misses;
+    }
+
+    if (entry == nullptr && isReadCacheable(cache, torrent, piece))
+    {
+        if (int err = 0; (entry = loadPieceAsync(cache, torrent, piece, &err)) == nullptr)
+        {
+            return err;
+        }
+    }
+
+    /* the piece can't be cached, so just read the block */
+    if (entry == nullptr)
+    {
+        return tr_ioReadAsync(torrent, owner, piece, offset, len, setme, callback, user_data);
+    }
+
+    rc->waiters.push_back({ entry, owner, offset, len, setme, torrent->session, callback, user_data, 0 });
+    return 0;
+}
+
+void tr_cacheCancel(tr_cache* cache, void const* owner)
+{
+    auto* const rc = &cache->read;
+    auto cancelled = std::list<read_waiter>{};
+
+    for (auto* const waiters : { &rc->waiters, &rc->ready })
+    {
+        for (auto it = std::begin(*waiters), end = std::end(*waiters); it != end;)
+        {
+            auto const next = std::next(it);
+
+            if (it->owner == owner)
+            {
+                cancelled.splice(std::end(cancelled), *waiters, it);
+            }
+
+            it = next;
+        }
+    }
+
+    for (auto const& waiter : cancelled)
+    {
+        waiter.callback(waiter.session, ECANCELED, waiter.user_data);
+    }
+}
+
+bool tr_cacheHasBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
+{
+    auto const begin = torrent->offset(piece, offset);
+
+    if (findBlock(cache, torrent, piece, offset) != nullptr || findPendingWrite(cache, torrent, begin, begin + len) != nullptr)
+    {
+        return true;
+    }
+
+    auto const* const entry = findReadEntry(&cache->read, pieceKey(torrent, piece));
+    return entry != nullptr && !entry->is_loading;
+}
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len)
 {
     int err = 0;
-    struct cache_block const* const cb = findBlock(cache, torrent, piece, offset);
 
-    if (cb == nullptr)
+    if (tr_cacheHasBlock(cache, torrent, piece, offset, len) ||
+        findReadEntry(&cache->read, pieceKey(torrent, piece)) != nullptr)
+    {
+        return 0;
+    }
+
+    /* if there's a disk worker to do it, read the whole piece into the read cache */
+    if (torrent->session->diskIo != nullptr && isReadCacheable(cache, torrent, piece))
+    {
+        loadPieceAsync(cache, torrent, piece, &err);
+    }
+    else
     {
         err = tr_ioPrefetch(torrent, piece, offset, len);
     }
@@ -396,31 +1329,82 @@ int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t
 ****
 ***/
 
-static int findBlockPos(tr_cache const* cache, tr_torrent* torrent, tr_piece_index_t block)
+int tr_cacheFlushDone(tr_cache* cache)
 {
-    struct cache_block key;
-    key.tor = torrent;
-    key.block = block;
-    return tr_ptrArrayLowerBound(&cache->blocks, &key, cache_block_compare, nullptr);
+    int err = 0;
+
+    rerankChangedRuns(cache);
+
+    /* the runs that end in a completed piece or span pieces are all at the front */
+    while (err == 0 && !std::empty(cache->runs))
+    {
+        auto* const run = *std::begin(cache->runs);
+
+        if (!run->is_piece_done && !run->is_multi_piece)
+        {
+            break;
+        }
+
+        tr_torrent const* const tor = run->tor;
+        err = flushRun(cache, run);
+        pruneTorrentCache(cache, tor);
+    }
+
+    return err;
 }
 
-int tr_cacheFlushDone(tr_cache* cache)
+int tr_cacheUpkeep(tr_cache* cache, uint64_t download_Bps)
 {
     int err = 0;
 
-    if (tr_ptrArraySize(&cache->blocks) > 0)
+    if (cache->is_auto_size)
+    {
+        updateAutoSize(cache, download_Bps);
+        err = cacheTrim(cache);
+    }
+
+    rerankChangedRuns(cache);
+
+    /* Flush the runs that have been dirty for too long. They're remembered by their
+     * torrent and first block, since flushing one can wait for a write to finish, and
+     * the done callbacks that are called meanwhile can add, grow or flush runs */
+    auto const expired = tr_time() - DirtyExpireSecs;
+    auto expired_runs = std::vector<std::pair<int, tr_block_index_t>>{};
+    for (auto const* const run : cache->runs)
     {
-        auto* const runs = tr_new(struct run_info, tr_ptrArraySize(&cache->blocks));
-        int i = 0;
-        int const n = calcRuns(cache, runs);
+        if (run->dirtied <= expired)
+        {
+            expired_runs.emplace_back(run->tor->uniqueId, run->begin);
+        }
+    }
+
+    for (auto it = std::begin(expired_runs); err == 0 && it != std::end(expired_runs); ++it)
+    {
+        auto const tc = cache->torrents.find(it->first);
+        if (tc == std::end(cache->torrents))
+        {
+            continue;
+        }
 
-        while (i < n && (runs[i].is_piece_done || runs[i].is_multi_piece))
+        auto const run = tc->second.runs.find(it->second);
+        if (run == std::end(tc->second.runs) || run->second.dirtied > expired)
         {
-            runs[i++].rank |= SESSIONFLAG;
+            continue;
         }
 
-        err = flushRuns(cache, runs, i);
-        tr_free(runs);
+        tr_torrent const* const tor = run->second.tor;
+        err = flushRun(cache, &run->second);
+        pruneTorrentCache(cache, tor);
+    }
+
+    /* an auto-sized cache can be big, so start writing it out well before it's full */
+    auto const background_blocks = cache->max_blocks * DirtyBackgroundPercent / 100;
+    while (err == 0 && cache->is_auto_size && cache->n_blocks > background_blocks && !std::empty(cache->runs))
+    {
+        auto* const run = *std::begin(cache->runs);
+        tr_torrent const* const tor = run->tor;
+        err = flushRun(cache, run);
+        pruneTorrentCache(cache, tor);
     }
 
     return err;
@@ -430,48 +1414,49 @@ int tr_cacheFlushFile(tr_cache* cache, tr_torrent* torrent, tr_file_index_t i)
 {
     auto const [begin, end] = tr_torGetFileBlockSpan(torrent, i);
 
-    int pos = findBlockPos(cache, torrent, begin);
     dbgmsg("flushing file %d from cache to disk: blocks [%zu...%zu)", (int)i, (size_t)begin, (size_t)end);
 
-    /* flush out all the blocks in that file */
+    /* flush out all the runs that touch that file */
     int err = 0;
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
+    for (auto* tc = findTorrentCache(cache, torrent); err == 0 && tc != nullptr;)
     {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
+        auto* run = findRun(tc, begin);
 
-        if (b->tor != torrent)
+        if (run == nullptr)
         {
-            break;
-        }
+            auto const it = tc->runs.lower_bound(begin);
 
-        if (b->block < begin || b->block >= end)
-        {
-            break;
+            if (it == std::end(tc->runs) || it->first >= end)
+            {
+                break;
+            }
+
+            run = &it->second;
         }
 
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
+        err = flushRun(cache, run);
     }
 
+    pruneTorrentCache(cache, torrent);
+    waitForPendingWrites(cache, torrent);
+
     return err;
 }
 
 int tr_cacheFlushTorrent(tr_cache* cache, tr_torrent* torrent)
 {
     int err = 0;
-    int const pos = findBlockPos(cache, torrent, 0);
 
     /* flush out all the blocks in that torrent */
-    while (err == 0 && pos < tr_ptrArraySize(&cache->blocks))
+    for (auto* tc = findTorrentCache(cache, torrent); err == 0 && tc != nullptr && !std::empty(tc->runs);)
     {
-        auto const* b = static_cast<struct cache_block const*>(tr_ptrArrayNth(&cache->blocks, pos));
-
-        if (b->tor != torrent)
-        {
-            break;
-        }
-
-        err = flushContiguous(cache, pos, getBlockRun(cache, pos, nullptr));
+        err = flushRun(cache, &std::begin(tc->runs)->second);
     }
 
+    pruneTorrentCache(cache, torrent);
+    dropReadTorrent(&cache->read, torrent);
+    dropTorrentHashes(cache, torrent);
+    waitForPendingWrites(cache, torrent);
+
     return err;
 }
@@ -14,6 +14,9 @@
 
 #include <cstdint> // intX_t, uintX_t
 
+#include "crypto-utils.h" /* tr_sha1_ctx_t */
+#include "inout.h" /* tr_io_done_func */
+
 struct evbuffer;
 struct tr_cache;
 struct tr_torrent;
@@ -34,6 +37,48 @@ int tr_cacheSetLimit(tr_cache* cache, int64_t max_bytes);
 
 int64_t tr_cacheGetLimit(tr_cache const*);
 
+/**
+ * @brief Size the write cache from the download rate and the available memory.
+ *
+ * The cache then holds a few seconds' worth of downloading, as measured by
+ * tr_cacheUpkeep(), but never less than the limit from tr_cacheSetLimit().
+ */
+int tr_cacheSetAutoSize(tr_cache* cache, bool enabled);
+
+bool tr_cacheIsAutoSize(tr_cache const* cache);
+
+/** @brief The write cache's limit right now, which is more than tr_cacheGetLimit() when it's been auto-sized */
+int64_t tr_cacheGetCurrentLimit(tr_cache const* cache);
+
+/**
+ * @brief Do the write cache's housekeeping. Call this about once a second.
+ *
+ * Re-sizes an auto-sized cache for `download_Bps` and flushes the data that's been
+ * dirty for too long. An auto-sized cache is also flushed down to half of its limit.
+ */
+int tr_cacheUpkeep(tr_cache* cache, uint64_t download_Bps);
+
+/**
+ * @brief True if the disk is falling behind on the cache's writes.
+ *
+ * Flushed data waits in memory until a disk worker writes it, so while
+ * this is true, no more blocks should be requested from peers.
+ */
+bool tr_cacheIsWriteBacklogged(tr_cache const* cache);
+
+/**
+ * @brief Set the size of the read cache, which holds whole pieces for seeding.
+ *
+ * It's separate from the write cache's limit. A piece is only cached if
+ * it's no bigger than a quarter of the read cache. Zero disables it.
+ */
+int tr_cacheSetReadLimit(tr_cache* cache, int64_t max_bytes);
+
+int64_t tr_cacheGetReadLimit(tr_cache const*);
+
+/** @brief How many block reads were served by the read cache and how many weren't */
+void tr_cacheGetReadStats(tr_cache const* cache, uint64_t* hits, uint64_t* misses);
+
 int tr_cacheWriteBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -42,6 +87,20 @@ int tr_cacheWriteBlock(
     uint32_t len,
     struct evbuffer* writeme);
 
+/**
+ * @brief Like tr_cacheWriteBlock(), but the block's data is already in a block from tr_blockPoolAlloc().
+ *
+ * The cache keeps that block instead of copying it, so the block belongs to
+ * the cache after this call, whether or not it succeeds.
+ */
+int tr_cacheAdoptBlock(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    void* block);
+
 int tr_cacheReadBlock(
     tr_cache* cache,
     tr_torrent* torrent,
@@ -50,8 +109,43 @@ int tr_cacheReadBlock(
     uint32_t len,
     uint8_t* setme);
 
+/**
+ * @brief Read a block in a disk worker thread.
+ *
+ * If the piece can go in the read cache, the whole piece is read and cached,
+ * and other requests for the same piece wait for that read instead of doing their own.
+ * Must only be used for blocks that tr_cacheHasBlock() says aren't in memory.
+ * @param owner passed to tr_cacheCancel() to cancel the read
+ * @return 0 if the read was queued, or an errno value on failure, in which case `callback` won't be called.
+ */
+int tr_cacheReadBlockAsync(
+    tr_cache* cache,
+    tr_torrent* torrent,
+    void const* owner,
+    tr_piece_index_t piece,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme,
+    tr_io_done_func callback,
+    void* user_data);
+
+/** @brief Cancel an owner's tr_cacheReadBlockAsync() calls; their callbacks are called with ECANCELED */
+void tr_cacheCancel(tr_cache* cache, void const* owner);
+
+/** @brief Check if a block can be read without going to the disk */
+bool tr_cacheHasBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
+
 int tr_cachePrefetchBlock(tr_cache* cache, tr_torrent* torrent, tr_piece_index_t piece, uint32_t offset, uint32_t len);
 
+/**
+ * @brief Take the SHA1 that was computed as a piece's blocks were written to the cache.
+ *
+ * @param setme_len how much of the piece, from its beginning, has been hashed.
+ *                  The caller hashes the rest and finishes with tr_sha1_final().
+ * @return the SHA1 context, or nullptr if none of the piece has been hashed
+ */
+tr_sha1_ctx_t tr_cacheTakePieceHash(tr_cache* cache, tr_torrent const* torrent, tr_piece_index_t piece, uint32_t* setme_len);
+
 /***
 ****
 ***/
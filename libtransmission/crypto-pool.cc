@@ -0,0 +1,376 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <utility> /* std::exchange(), std::move() */
+#include <vector>
+
+#include "transmission.h"
+#include "crypto.h"
+#include "crypto-pool.h"
+#include "crypto-utils.h"
+#include "log.h"
+#include "platform.h" /* tr_threadNew() */
+#include "session.h"
+#include "tr-assert.h"
+#include "trevent.h"
+
+#define dbgmsg(...) tr_logAddDeepNamed("crypto", __VA_ARGS__)
+
+namespace
+{
+
+struct crypto_pool_key
+{
+    tr_dh_ctx_t dh = nullptr;
+    std::array<uint8_t, KEY_LEN> public_key = {};
+};
+
+struct crypto_pool_job
+{
+    tr_crypto* crypto = nullptr;
+
+    /* the crypto's key pair, which the job has while it runs. nullptr if the worker has to make one */
+    crypto_pool_key key;
+
+    std::array<uint8_t, KEY_LEN> peer_public_key = {};
+    tr_dh_secret_t secret = nullptr;
+
+    tr_crypto_pool_done_func done = nullptr;
+    void* user_data = nullptr;
+
+    bool cancelled = false;
+};
+
+using job_list = std::list<crypto_pool_job>;
+
+} // namespace
+
+struct tr_cryptoPool
+{
+    tr_cryptoPool(tr_session* session_in, size_t n_keys_in)
+        : session{ session_in }
+        , n_keys{ n_keys_in }
+    {
+    }
+
+    tr_session* const session;
+
+    /* how many key pairs to keep ready */
+    size_t const n_keys;
+
+    std::mutex mutex;
+
+    /* signalled when a job is queued, when a key is taken, or when it's time for the workers to exit */
+    std::condition_variable work_cv;
+
+    /* signalled when a worker exits */
+    std::condition_variable idle_cv;
+
+    /* jobs move from `queued` to `running` to `finished` to being dispatched */
+    job_list queued;
+    job_list running;
+    job_list finished;
+
+    std::vector<crypto_pool_key> keys;
+
+    /* how many keys the workers are making right now */
+    size_t n_keys_in_progress = 0;
+
+    /* set if a key couldn't be made, so that the workers don't keep trying */
+    bool keys_failed = false;
+
+    size_t n_workers = 0;
+    bool is_closing = false;
+
+    /* true when there's an onJobsFinished() waiting to be run in the libtransmission thread */
+    bool dispatch_pending = false;
+};
+
+static void freeJob(crypto_pool_job& job)
+{
+    tr_dh_free(job.key.dh);
+    tr_dh_secret_free(job.secret);
+}
+
+static bool wantsMoreKeys(tr_cryptoPool const* pool)
+{
+    return !pool->is_closing && !pool->keys_failed && std::size(pool->keys) + pool->n_keys_in_progress < pool->n_keys;
+}
+
+/***
+****
+***/
+
+static void onJobsFinished(void* vsession)
+{
+    auto* const session = static_cast<tr_session*>(vsession);
+    auto* const pool = session->cryptoPool;
+
+    /* the pool was freed after this was posted */
+    if (pool == nullptr)
+    {
+        return;
+    }
+
+    auto lock = std::unique_lock(pool->mutex);
+    pool->dispatch_pending = false;
+
+    /* take them one at a time: a callback can cancel the jobs that are still in the list */
+    while (!std::empty(pool->finished))
+    {
+        auto job = std::move(pool->finished.front());
+        pool->finished.pop_front();
+        lock.unlock();
+
+        if (job.cancelled)
+        {
+            freeJob(job);
+        }
+        else
+        {
+            auto* const crypto = job.crypto;
+            crypto->dh = job.key.dh;
+            std::copy(std::begin(job.key.public_key), std::end(job.key.public_key), crypto->myPublicKey);
+            crypto->mySecret = job.secret;
+            (*job.done)(job.user_data, job.secret != nullptr);
+        }
+
+        lock.lock();
+    }
+}
+
+static void workerFunc(void* vpool)
+{
+    auto* const pool = static_cast<tr_cryptoPool*>(vpool);
+    auto lock = std::unique_lock(pool->mutex);
+
+    for (;;)
+    {
+        pool->work_cv.wait(lock, [pool]() { return pool->is_closing || !std::empty(pool->queued) || wantsMoreKeys(pool); });
+
+        /* the handshakes that are waiting go before making keys ahead of time */
+        if (!std::empty(pool->queued))
+        {
+            auto const it = std::begin(pool->queued);
+            pool->running.splice(std::end(pool->running), pool->queued, it);
+
+            lock.unlock();
+
+            if (it->key.dh == nullptr)
+            {
+                it->key.dh = tr_cryptoNewKey(std::data(it->key.public_key));
+            }
+
+            if (it->key.dh != nullptr)
+            {
+                it->secret = tr_dh_agree(it->key.dh, std::data(it->peer_public_key), std::size(it->peer_public_key));
+            }
+
+            lock.lock();
+
+            pool->finished.splice(std::end(pool->finished), pool->running, it);
+
+            /* only keep one wakeup in flight at a time */
+            if (!pool->dispatch_pending)
+            {
+                pool->dispatch_pending = true;
+                lock.unlock();
+                tr_runInEventThread(pool->session, onJobsFinished, pool->session);
+                lock.lock();
+            }
+        }
+        else if (wantsMoreKeys(pool))
+        {
+            ++pool->n_keys_in_progress;
+            lock.unlock();
+
+            auto key = crypto_pool_key{};
+            key.dh = tr_cryptoNewKey(std::data(key.public_key));
+
+            lock.lock();
+            --pool->n_keys_in_progress;
+
+            if (key.dh == nullptr)
+            {
+                pool->keys_failed = true;
+            }
+            else
+            {
+                pool->keys.push_back(key);
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    --pool->n_workers;
+    pool->idle_cv.notify_all();
+}
+
+/***
+****
+***/
+
+tr_cryptoPool* tr_cryptoPoolNew(tr_session* session, size_t n_workers, size_t n_keys)
+{
+    TR_ASSERT(n_workers > 0);
+
+    auto* const pool = new tr_cryptoPool{ session, n_keys };
+    pool->keys.reserve(n_keys);
+
+    dbgmsg("starting %zu crypto worker threads", n_workers);
+
+    auto const lock = std::lock_guard(pool->mutex);
+
+    for (size_t i = 0; i < n_workers; ++i)
+    {
+        tr_threadNew(workerFunc, pool);
+        ++pool->n_workers;
+    }
+
+    return pool;
+}
+
+void tr_cryptoPoolFree(tr_cryptoPool* pool)
+{
+    if (pool == nullptr)
+    {
+        return;
+    }
+
+    {
+        auto lock = std::unique_lock(pool->mutex);
+        pool->is_closing = true;
+        pool->work_cv.notify_all();
+        pool->idle_cv.wait(lock, [pool]() { return pool->n_workers == 0; });
+    }
+
+    TR_ASSERT(std::empty(pool->queued));
+    TR_ASSERT(std::empty(pool->running));
+    TR_ASSERT(std::all_of(
+        std::begin(pool->finished),
+        std::end(pool->finished),
+        [](auto const& job) { return job.cancelled; }));
+
+    for (auto& job : pool->finished)
+    {
+        freeJob(job);
+    }
+
+    for (auto const& key : pool->keys)
+    {
+        tr_dh_free(key.dh);
+    }
+
+    delete pool;
+}
+
+bool tr_cryptoPoolTakeKey(tr_cryptoPool* pool, tr_crypto* crypto)
+{
+    TR_ASSERT(pool != nullptr);
+    TR_ASSERT(crypto != nullptr);
+
+    if (crypto->dh != nullptr)
+    {
+        return false;
+    }
+
+    auto key = crypto_pool_key{};
+
+    {
+        auto const lock = std::lock_guard(pool->mutex);
+
+        if (std::empty(pool->keys))
+        {
+            return false;
+        }
+
+        key = pool->keys.back();
+        pool->keys.pop_back();
+        pool->work_cv.notify_one();
+    }
+
+    crypto->dh = key.dh;
+    std::copy(std::begin(key.public_key), std::end(key.public_key), crypto->myPublicKey);
+    return true;
+}
+
+void tr_cryptoPoolComputeSecret(
+    tr_cryptoPool* pool,
+    tr_crypto* crypto,
+    uint8_t const* peer_public_key,
+    tr_crypto_pool_done_func done,
+    void* user_data)
+{
+    TR_ASSERT(pool != nullptr);
+    TR_ASSERT(tr_amInEventThread(pool->session));
+    TR_ASSERT(crypto != nullptr);
+    TR_ASSERT(crypto->mySecret == nullptr);
+    TR_ASSERT(done != nullptr);
+
+    auto job = crypto_pool_job{};
+    job.crypto = crypto;
+    job.key.dh = std::exchange(crypto->dh, nullptr);
+    std::copy_n(crypto->myPublicKey, KEY_LEN, std::begin(job.key.public_key));
+    std::copy_n(peer_public_key, KEY_LEN, std::begin(job.peer_public_key));
+    job.done = done;
+    job.user_data = user_data;
+
+    auto const lock = std::lock_guard(pool->mutex);
+    pool->queued.push_back(std::move(job));
+    pool->work_cv.notify_one();
+}
+
+void tr_cryptoPoolCancel(tr_cryptoPool* pool, tr_crypto const* crypto)
+{
+    TR_ASSERT(pool != nullptr);
+    TR_ASSERT(tr_amInEventThread(pool->session));
+
+    auto const lock = std::lock_guard(pool->mutex);
+
+    auto const is_owned = [crypto](auto const& job)
+    {
+        return job.crypto == crypto;
+    };
+
+    /* jobs that haven't started are dropped right away... */
+    for (auto it = std::begin(pool->queued); it != std::end(pool->queued);)
+    {
+        if (is_owned(*it))
+        {
+            freeJob(*it);
+            it = pool->queued.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    /* ...and the rest are dropped once they're done */
+    for (auto* const list : { &pool->running, &pool->finished })
+    {
+        for (auto& job : *list)
+        {
+            job.cancelled |= is_owned(job);
+        }
+    }
+}
+
+size_t tr_cryptoPoolGetKeyCount(tr_cryptoPool* pool)
+{
+    auto const lock = std::lock_guard(pool->mutex);
+    return std::size(pool->keys);
+}
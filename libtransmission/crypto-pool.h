@@ -0,0 +1,68 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
+
+struct tr_crypto;
+struct tr_cryptoPool;
+struct tr_session;
+
+/**
+*** @addtogroup peers
+*** @{
+**/
+
+/**
+ * @brief Called in the libtransmission thread once tr_cryptoPoolComputeSecret() is done.
+ *
+ * `ok` is false if the secret couldn't be computed. Not called if the job was cancelled.
+ */
+using tr_crypto_pool_done_func = void (*)(void* user_data, bool ok);
+
+/**
+ * @brief Create a pool of `n_workers` threads for the handshake's Diffie-Hellman math.
+ *
+ * When they have nothing else to do, the workers keep `n_keys` key pairs made ahead of time.
+ */
+tr_cryptoPool* tr_cryptoPoolNew(tr_session* session, size_t n_workers, size_t n_keys);
+
+/** @brief Stop the worker threads. Every job must have finished or been cancelled */
+void tr_cryptoPoolFree(tr_cryptoPool* pool);
+
+/**
+ * @brief Give `crypto` one of the key pairs that were made ahead of time.
+ * @return false if `crypto` already has a key pair or if there are none left
+ */
+bool tr_cryptoPoolTakeKey(tr_cryptoPool* pool, tr_crypto* crypto);
+
+/**
+ * @brief Compute `crypto`'s shared secret, and its key pair if it has none, on a worker thread.
+ *
+ * `crypto` must not be used until `done` is called or the job is cancelled.
+ */
+void tr_cryptoPoolComputeSecret(
+    tr_cryptoPool* pool,
+    tr_crypto* crypto,
+    uint8_t const* peer_public_key,
+    tr_crypto_pool_done_func done,
+    void* user_data);
+
+/** @brief Drop `crypto`'s job. Its `done` callback won't be called */
+void tr_cryptoPoolCancel(tr_cryptoPool* pool, tr_crypto const* crypto);
+
+/** @brief How many key pairs are ready to be taken */
+size_t tr_cryptoPoolGetKeyCount(tr_cryptoPool* pool);
+
+/* @} */
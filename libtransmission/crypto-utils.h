@@ -50,6 +50,19 @@ bool tr_sha1_update(tr_sha1_ctx_t handle, void const* data, size_t data_length);
  */
 std::optional<tr_sha1_digest_t> tr_sha1_final(tr_sha1_ctx_t handle);
 
+/**
+ * @brief Generate the SHA1 hashes of several separate chunks of memory.
+ *
+ * This is faster than hashing them one at a time: depending on the CPU,
+ * it uses the CPU's SHA instructions or hashes several chunks at once with SIMD.
+ *
+ * @param[in]  data         The chunks to hash.
+ * @param[in]  data_lengths How long each chunk is.
+ * @param[in]  n            How many chunks there are.
+ * @param[out] setme        Where to put each chunk's hash.
+ */
+void tr_sha1_many(void const* const* data, size_t const* data_lengths, size_t n, tr_sha1_digest_t* setme);
+
 /**
  * @brief Generate a SHA1 hash from one or more chunks of memory.
  */
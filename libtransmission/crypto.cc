@@ -40,15 +40,22 @@ static uint8_t const dh_G[] = { 2 };
 ***
 **/
 
+tr_dh_ctx_t tr_cryptoNewKey(uint8_t* public_key)
+{
+    size_t public_key_length = 0;
+    auto* const dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
+    tr_dh_make_key(dh, DH_PRIVKEY_LEN, public_key, &public_key_length);
+
+    TR_ASSERT(public_key_length == KEY_LEN);
+
+    return dh;
+}
+
 static void ensureKeyExists(tr_crypto* crypto)
 {
     if (crypto->dh == nullptr)
     {
-        size_t public_key_length = 0;
-        crypto->dh = tr_dh_new(dh_P, sizeof(dh_P), dh_G, sizeof(dh_G));
-        tr_dh_make_key(crypto->dh, DH_PRIVKEY_LEN, crypto->myPublicKey, &public_key_length);
-
-        TR_ASSERT(public_key_length == KEY_LEN);
+        crypto->dh = tr_cryptoNewKey(crypto->myPublicKey);
     }
 }
 
@@ -50,6 +50,9 @@ void tr_cryptoSetTorrentHash(tr_crypto* crypto, tr_sha1_digest_t const& torrent_
 
 std::optional<tr_sha1_digest_t> tr_cryptoGetTorrentHash(tr_crypto const* crypto);
 
+/** @brief Make a DH key pair for the handshake. `public_key` must have room for KEY_LEN bytes. Can be called from any thread */
+tr_dh_ctx_t tr_cryptoNewKey(uint8_t* public_key);
+
 bool tr_cryptoComputeSecret(tr_crypto* crypto, uint8_t const* peerPublicKey);
 
 uint8_t const* tr_cryptoGetMyPublicKey(tr_crypto const* crypto, int* setme_len);
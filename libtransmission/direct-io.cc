@@ -0,0 +1,359 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib> /* posix_memalign(), free() */
+#include <cstring> /* memcpy(), memset() */
+#include <mutex>
+#include <new> /* std::bad_alloc */
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h> /* _aligned_malloc(), _aligned_free() */
+#endif
+
+#include "transmission.h"
+#include "direct-io.h"
+#include "error.h"
+#include "file.h"
+#include "tr-assert.h"
+#include "utils.h" /* tr_strerror() */
+
+/***
+****
+***/
+
+namespace
+{
+
+auto constexpr Alignment = uint64_t{ TR_DIRECT_IO_ALIGNMENT };
+
+/* the most that's read or written in one go, and the size of the pooled buffers */
+auto constexpr WindowSize = uint64_t{ 1024 * 1024 };
+
+/* how many idle buffers are kept for reuse; one per busy thread is plenty */
+auto constexpr MaxPooledBuffers = size_t{ 8 };
+
+constexpr uint64_t alignDown(uint64_t n)
+{
+    return n - n % Alignment;
+}
+
+constexpr uint64_t alignUp(uint64_t n)
+{
+    return alignDown(n + Alignment - 1);
+}
+
+/* walks through an iovec array, copying into or out of it */
+class iov_cursor
+{
+public:
+    iov_cursor(evbuffer_iovec const* iov, size_t n_iov)
+        : iov_{ iov }
+        , end_{ iov + n_iov }
+    {
+    }
+
+    /* copy the iovecs' next `len` bytes into `dst` */
+    void gather(char* dst, size_t len)
+    {
+        walk(
+            len,
+            [&dst](char const* vec, size_t n)
+            {
+                std::memcpy(dst, vec, n);
+                dst += n;
+            });
+    }
+
+    /* copy `len` bytes from `src` into the iovecs */
+    void scatter(char const* src, size_t len)
+    {
+        walk(
+            len,
+            [&src](char* vec, size_t n)
+            {
+                std::memcpy(vec, src, n);
+                src += n;
+            });
+    }
+
+private:
+    template<typename Func>
+    void walk(size_t len, Func func)
+    {
+        while (len > 0 && iov_ != end_)
+        {
+            auto const n = std::min(len, iov_->iov_len - skip_);
+            func(static_cast<char*>(iov_->iov_base) + skip_, n);
+            len -= n;
+            skip_ += n;
+
+            if (skip_ == iov_->iov_len)
+            {
+                ++iov_;
+                skip_ = 0;
+            }
+        }
+    }
+
+    evbuffer_iovec const* iov_;
+    evbuffer_iovec const* const end_;
+    size_t skip_ = 0;
+};
+
+} // namespace
+
+/***
+****  Aligned buffer pool
+***/
+
+/* deliberately leaked: verify threads are detached, so one can still be
+ * handing a buffer back while the process exits */
+static auto& buffer_pool{ *new std::vector<void*>{} };
+
+static std::mutex buffer_pool_mutex_;
+
+static void* bufferAcquire()
+{
+    {
+        auto const lock = std::lock_guard(buffer_pool_mutex_);
+
+        if (!std::empty(buffer_pool))
+        {
+            auto* const buf = buffer_pool.back();
+            buffer_pool.pop_back();
+            return buf;
+        }
+    }
+
+#ifdef _WIN32
+    void* const buf = _aligned_malloc(WindowSize, Alignment);
+#else
+    void* buf = nullptr;
+    if (posix_memalign(&buf, Alignment, WindowSize) != 0)
+    {
+        buf = nullptr;
+    }
+#endif
+
+    if (buf == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return buf;
+}
+
+static void bufferRelease(void* buf)
+{
+    {
+        auto const lock = std::lock_guard(buffer_pool_mutex_);
+
+        if (std::size(buffer_pool) < MaxPooledBuffers)
+        {
+            buffer_pool.push_back(buf);
+            return;
+        }
+    }
+
+#ifdef _WIN32
+    _aligned_free(buf);
+#else
+    free(buf);
+#endif
+}
+
+namespace
+{
+
+class pooled_buffer
+{
+public:
+    pooled_buffer()
+        : buf_{ static_cast<char*>(bufferAcquire()) }
+    {
+    }
+
+    ~pooled_buffer()
+    {
+        bufferRelease(buf_);
+    }
+
+    pooled_buffer(pooled_buffer const&) = delete;
+    pooled_buffer& operator=(pooled_buffer const&) = delete;
+
+    [[nodiscard]] char* data() const
+    {
+        return buf_;
+    }
+
+private:
+    char* const buf_;
+};
+
+} // namespace
+
+/***
+****
+***/
+
+/* Writing part of a sector means reading the rest of it first, and nothing
+ * else may write to that sector in between. Most writes are whole blocks
+ * that don't need this, so one lock for every file is enough. */
+static std::mutex partial_sector_mutex_;
+
+/* read [begin, end), zeroing whatever is past the end of the file */
+static bool readWindow(tr_sys_file_t fd, char* buf, uint64_t begin, uint64_t end, tr_error** error)
+{
+    auto n_read = uint64_t{};
+
+    if (!tr_sys_file_read_at(fd, buf, end - begin, begin, &n_read, error))
+    {
+        return false;
+    }
+
+    std::memset(buf + n_read, 0, end - begin - n_read);
+    return true;
+}
+
+static bool writeWindow(tr_sys_file_t fd, char const* buf, uint64_t begin, uint64_t end, tr_error** error)
+{
+    while (begin < end)
+    {
+        auto n_written = uint64_t{};
+
+        if (!tr_sys_file_write_at(fd, buf, end - begin, begin, &n_written, error))
+        {
+            return false;
+        }
+
+        if (n_written == 0)
+        {
+            tr_error_set(error, ENOSPC, tr_strerror(ENOSPC));
+            return false;
+        }
+
+        buf += n_written;
+        begin += n_written;
+    }
+
+    return true;
+}
+
+static uint64_t getIovLength(evbuffer_iovec const* iov, size_t n_iov)
+{
+    auto len = uint64_t{};
+
+    for (size_t i = 0; i < n_iov; ++i)
+    {
+        len += iov[i].iov_len;
+    }
+
+    return len;
+}
+
+bool tr_directIoRead(tr_sys_file_t fd, evbuffer_iovec const* iov, size_t n_iov, uint64_t offset, tr_error** error)
+{
+    TR_ASSERT(fd != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || n_iov == 0);
+
+    auto const end = offset + getIovLength(iov, n_iov);
+    if (offset == end)
+    {
+        return true;
+    }
+
+    auto const buf = pooled_buffer{};
+    auto cursor = iov_cursor{ iov, n_iov };
+
+    for (auto pos = offset; pos < end;)
+    {
+        auto const window_begin = alignDown(pos);
+        auto const window_end = std::min(alignUp(end), window_begin + WindowSize);
+
+        if (!readWindow(fd, buf.data(), window_begin, window_end, error))
+        {
+            return false;
+        }
+
+        auto const chunk_end = std::min(end, window_end);
+        cursor.scatter(buf.data() + (pos - window_begin), chunk_end - pos);
+        pos = chunk_end;
+    }
+
+    return true;
+}
+
+bool tr_directIoWrite(
+    tr_sys_file_t fd,
+    evbuffer_iovec const* iov,
+    size_t n_iov,
+    uint64_t offset,
+    uint64_t file_size,
+    tr_error** error)
+{
+    TR_ASSERT(fd != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || n_iov == 0);
+
+    auto const end = offset + getIovLength(iov, n_iov);
+    TR_ASSERT(end <= file_size);
+
+    if (offset == end)
+    {
+        return true;
+    }
+
+    auto const buf = pooled_buffer{};
+    auto cursor = iov_cursor{ iov, n_iov };
+
+    for (auto pos = offset; pos < end;)
+    {
+        auto const window_begin = alignDown(pos);
+        auto const window_end = std::min(alignUp(end), window_begin + WindowSize);
+        auto const chunk_end = std::min(end, window_end);
+
+        bool const partial_head = pos != window_begin;
+        bool const partial_tail = chunk_end != window_end;
+        auto lock = std::unique_lock(partial_sector_mutex_, std::defer_lock);
+
+        if (partial_head || partial_tail)
+        {
+            lock.lock();
+        }
+
+        if (partial_head && !readWindow(fd, buf.data(), window_begin, window_begin + Alignment, error))
+        {
+            return false;
+        }
+
+        if (auto const tail_begin = window_end - Alignment; partial_tail && (!partial_head || tail_begin != window_begin) &&
+            !readWindow(fd, buf.data() + (tail_begin - window_begin), tail_begin, window_end, error))
+        {
+            return false;
+        }
+
+        cursor.gather(buf.data() + (pos - window_begin), chunk_end - pos);
+
+        if (!writeWindow(fd, buf.data(), window_begin, window_end, error))
+        {
+            return false;
+        }
+
+        // the last sector's padding may have grown the file past its end
+        if (window_end > file_size && !tr_sys_file_truncate(fd, file_size, error))
+        {
+            return false;
+        }
+
+        pos = chunk_end;
+    }
+
+    return true;
+}
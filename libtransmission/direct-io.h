@@ -0,0 +1,56 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
+#include <event2/buffer.h> // evbuffer_iovec
+
+#include "file.h" // tr_sys_file_t
+
+struct tr_error;
+
+/**
+ * @addtogroup file_io File IO
+ * @{
+ */
+
+/** @brief Unbuffered I/O must be aligned to this, in file offsets and lengths as well as in memory */
+auto inline constexpr TR_DIRECT_IO_ALIGNMENT = size_t{ 4096 };
+
+/**
+ * @brief Read from a file that was opened with TR_SYS_FILE_DIRECT.
+ *
+ * The caller's memory, offset, and length don't need to be aligned: the
+ * file is read in aligned windows through a pooled buffer and copied out.
+ * Anything past the end of the file is read as zeroes.
+ */
+bool tr_directIoRead(tr_sys_file_t fd, evbuffer_iovec const* iov, size_t n_iov, uint64_t offset, struct tr_error** error);
+
+/**
+ * @brief Write to a file that was opened with TR_SYS_FILE_DIRECT.
+ *
+ * Sectors that are only partly written are read first so that their other
+ * bytes are kept. If padding the last sector grows the file past `file_size`,
+ * the file is truncated back to `file_size` afterwards.
+ */
+bool tr_directIoWrite(
+    tr_sys_file_t fd,
+    evbuffer_iovec const* iov,
+    size_t n_iov,
+    uint64_t offset,
+    uint64_t file_size,
+    struct tr_error** error);
+
+/* @} */
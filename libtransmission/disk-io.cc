@@ -0,0 +1,1261 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cctype> /* toupper() */
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring> /* memset() */
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility> /* std::pair */
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define WITH_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h> /* struct iovec */
+#include <unistd.h>
+#endif
+#endif
+
+#include <event2/event.h>
+
+#include "transmission.h"
+#include "direct-io.h"
+#include "disk-io.h"
+#include "error.h"
+#include "log.h"
+#include "platform.h" /* tr_threadNew() */
+#include "session.h"
+#include "tr-assert.h"
+#include "trevent.h"
+#include "utils.h" /* tr_env_key_exists() */
+
+#define MY_NAME "DiskIO"
+
+#define dbgmsg(...) tr_logAddDeepNamed(MY_NAME, __VA_ARGS__)
+
+/***
+****
+***/
+
+namespace
+{
+
+struct disk_io_job
+{
+    void const* owner;
+
+    /* nullptr if this is a tr_diskIoSubmitFileOps() job */
+    tr_disk_io_work_func work;
+
+    tr_disk_io_done_func done;
+    void* job;
+    bool cancelled;
+
+    tr_disk_io_file_op* ops;
+    size_t n_ops;
+
+    /* how many of the ops are still in the ring */
+    size_t n_ops_left;
+
+    tr_disk_io_sched sched;
+
+    /* when it was submitted, for the device's latency */
+    uint64_t submitted_usec;
+};
+
+using job_list = std::list<disk_io_job>;
+
+/* one device's queues and stats */
+struct disk_io_device
+{
+    /* one queue per priority class, each sorted by (object, offset) */
+    std::array<job_list, TR_DISK_IO_N_PRIORITIES> queued;
+
+    /* how many times in a row each class has been passed over for a more urgent one */
+    std::array<unsigned, TR_DISK_IO_N_PRIORITIES> n_passed_over = {};
+
+    /* the jobs of each class that are running */
+    std::array<size_t, TR_DISK_IO_N_PRIORITIES> running = {};
+
+    /* where the elevator is: the (object, offset) of the last job that was started */
+    std::pair<uint64_t, uint64_t> head = {};
+
+    uint64_t n_done = 0;
+    uint64_t latency_usec = 0;
+    uint64_t max_latency_usec = 0;
+};
+
+/* how many times a class can be passed over before it gets a turn anyway */
+auto constexpr MaxPassedOver = unsigned{ 8 };
+
+/* the longest that tr_diskIoYield() waits */
+auto constexpr MaxYield = std::chrono::milliseconds{ 50 };
+
+/* how often tr_diskIoWaitFor() looks at the ring while the workers are quiet */
+auto constexpr WaitForPollInterval = std::chrono::milliseconds{ 1 };
+
+#ifdef WITH_IO_URING
+
+/* a file op that's in the ring, or waiting for room in it */
+struct ring_op
+{
+    job_list::iterator job;
+    tr_disk_io_file_op* op;
+
+    /* what's left to do: iov[first...] at offset */
+    std::vector<struct iovec> iov;
+    size_t first;
+    uint64_t offset;
+};
+
+struct io_ring
+{
+    int fd = -1;
+    int event_fd = -1;
+
+    void* sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+
+    void* cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned cq_mask = 0;
+    unsigned cq_entries = 0;
+
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+
+    /* sqes that are in the ring but haven't been handed to the kernel yet */
+    unsigned n_unsubmitted = 0;
+
+    /* sqes that the kernel has, but whose completions haven't been reaped yet.
+     * Along with n_unsubmitted, this is kept under cq_entries so the completion ring can't overflow */
+    unsigned n_inflight = 0;
+
+    /* ops that are waiting for room in the ring */
+    std::deque<ring_op*> backlog;
+
+    /* jobs with ops in the ring or the backlog */
+    job_list jobs;
+
+    struct event* submit_event = nullptr;
+    bool submit_pending = false;
+
+    struct event* completion_event = nullptr;
+};
+
+#endif
+
+} // namespace
+
+struct tr_diskIo
+{
+    explicit tr_diskIo(tr_session* session_in)
+        : session{ session_in }
+    {
+    }
+
+    tr_session* const session;
+
+    std::mutex mutex;
+
+    // signalled when a job is queued or when it's time for the workers to exit
+    std::condition_variable work_cv;
+
+    // signalled when a job finishes or when a worker exits
+    std::condition_variable idle_cv;
+
+    // jobs move from their device's queue to `running` to `finished` to being dispatched
+    std::map<uint64_t, disk_io_device> devices;
+    job_list running;
+    job_list finished;
+
+    // how many jobs are in the devices' queues
+    size_t n_queued = 0;
+
+    // the device that the last job was started for, so that the devices can take turns
+    uint64_t last_device = 0;
+
+    size_t n_workers = 0;
+    bool is_closing = false;
+
+#ifdef WITH_IO_URING
+    // created on first use; nullptr if io_uring isn't usable
+    io_ring* ring = nullptr;
+    bool ring_checked = false;
+#endif
+
+    // true when there's an onJobsFinished() waiting to be run in the libtransmission thread
+    bool dispatch_pending = false;
+
+    // only touched in the libtransmission thread
+    size_t n_pending = 0;
+};
+
+/***
+****  Scheduling
+***/
+
+static uint64_t nowUsec()
+{
+    auto const now = std::chrono::steady_clock::now().time_since_epoch();
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+static std::pair<uint64_t, uint64_t> sortKey(tr_disk_io_sched const& sched)
+{
+    return { sched.object, sched.offset };
+}
+
+/* call with io->mutex locked */
+static void enqueueJob(tr_diskIo* io, disk_io_job&& job)
+{
+    job.submitted_usec = nowUsec();
+
+    auto& queue = io->devices[job.sched.device].queued[job.sched.priority];
+    auto const key = sortKey(job.sched);
+
+    // keep the queue sorted. New jobs usually belong near the back
+    auto it = std::end(queue);
+    while (it != std::begin(queue) && key < sortKey(std::prev(it)->sched))
+    {
+        --it;
+    }
+
+    queue.insert(it, std::move(job));
+    ++io->n_queued;
+    io->work_cv.notify_one();
+}
+
+/* Move the next job to run from its device's queue to `running`.
+ * Call with io->mutex locked and at least one job queued. */
+static job_list::iterator startNextJob(tr_diskIo* io)
+{
+    TR_ASSERT(io->n_queued > 0);
+
+    auto const has_queued = [](auto const& entry)
+    {
+        auto const& queues = entry.second.queued;
+        return std::any_of(std::begin(queues), std::end(queues), [](auto const& queue) { return !std::empty(queue); });
+    };
+
+    // the devices take turns
+    auto dev_it = std::find_if(io->devices.upper_bound(io->last_device), std::end(io->devices), has_queued);
+    if (dev_it == std::end(io->devices))
+    {
+        dev_it = std::find_if(std::begin(io->devices), std::end(io->devices), has_queued);
+    }
+
+    TR_ASSERT(dev_it != std::end(io->devices));
+    io->last_device = dev_it->first;
+    auto& dev = dev_it->second;
+
+    // the most urgent class goes first, unless a less urgent one has waited too long
+    auto priority = size_t{ TR_DISK_IO_N_PRIORITIES };
+    for (size_t i = 0; i < TR_DISK_IO_N_PRIORITIES; ++i)
+    {
+        if (std::empty(dev.queued[i]))
+        {
+            continue;
+        }
+
+        if (priority == TR_DISK_IO_N_PRIORITIES)
+        {
+            priority = i;
+        }
+        else if (++dev.n_passed_over[i] > MaxPassedOver)
+        {
+            priority = i;
+            break;
+        }
+    }
+
+    dev.n_passed_over[priority] = 0;
+
+    // the elevator: the first job at or past the last one, or back to the beginning
+    auto& queue = dev.queued[priority];
+    auto it = std::find_if(
+        std::begin(queue),
+        std::end(queue),
+        [&dev](auto const& job) { return !(sortKey(job.sched) < dev.head); });
+    if (it == std::end(queue))
+    {
+        it = std::begin(queue);
+    }
+
+    dev.head = sortKey(it->sched);
+    ++dev.running[priority];
+    --io->n_queued;
+    io->running.splice(std::end(io->running), queue, it);
+    return it;
+}
+
+/* a job that goes straight to the kernel is running as soon as it's submitted.
+ * Call with io->mutex locked */
+static void onRingJobSubmitted(tr_diskIo* io, disk_io_job& job)
+{
+    job.submitted_usec = nowUsec();
+    ++io->devices[job.sched.device].running[job.sched.priority];
+}
+
+/* call with io->mutex locked */
+static void onJobFinished(tr_diskIo* io, disk_io_job const& job)
+{
+    auto& dev = io->devices[job.sched.device];
+
+    TR_ASSERT(dev.running[job.sched.priority] > 0);
+    --dev.running[job.sched.priority];
+
+    auto const latency = nowUsec() - job.submitted_usec;
+    dev.latency_usec = dev.n_done == 0 ? latency : (dev.latency_usec * 7 + latency) / 8;
+    dev.max_latency_usec = std::max(dev.max_latency_usec, latency);
+    ++dev.n_done;
+
+    io->idle_cv.notify_all();
+}
+
+/***
+****
+***/
+
+static void dispatchFinishedJobs(tr_diskIo* io, job_list& jobs)
+{
+    TR_ASSERT(tr_amInEventThread(io->session));
+
+    for (auto& job : jobs)
+    {
+        TR_ASSERT(io->n_pending > 0);
+        --io->n_pending;
+
+        job.done(io->session, job.job, job.cancelled);
+    }
+
+    jobs.clear();
+}
+
+static void onJobsFinished(void* vsession)
+{
+    auto* const session = static_cast<tr_session*>(vsession);
+    auto* const io = session->diskIo;
+
+    // the pool was freed after this callback was queued; it already dispatched everything
+    if (io == nullptr)
+    {
+        return;
+    }
+
+    auto jobs = job_list{};
+
+    {
+        auto const lock = std::lock_guard(io->mutex);
+        io->dispatch_pending = false;
+        jobs.splice(std::end(jobs), io->finished);
+    }
+
+    dispatchFinishedJobs(io, jobs);
+}
+
+static void workerFunc(void* vio)
+{
+    auto* const io = static_cast<tr_diskIo*>(vio);
+    auto lock = std::unique_lock(io->mutex);
+
+    for (;;)
+    {
+        io->work_cv.wait(lock, [io]() { return io->is_closing || io->n_queued > 0; });
+
+        if (io->n_queued == 0)
+        {
+            break;
+        }
+
+        auto const it = startNextJob(io);
+
+        lock.unlock();
+
+        if (it->work != nullptr)
+        {
+            it->work(it->job);
+        }
+        else
+        {
+            tr_diskIoRunFileOps(it->ops, it->n_ops);
+        }
+
+        lock.lock();
+
+        onJobFinished(io, *it);
+        io->finished.splice(std::end(io->finished), io->running, it);
+
+        // only keep one wakeup in flight at a time so that a busy pool
+        // doesn't flood the libtransmission thread's command pipe
+        if (!io->dispatch_pending)
+        {
+            io->dispatch_pending = true;
+            lock.unlock();
+            tr_runInEventThread(io->session, onJobsFinished, io->session);
+            lock.lock();
+        }
+    }
+
+    --io->n_workers;
+    io->idle_cv.notify_all();
+}
+
+/***
+****  io_uring
+***/
+
+#ifdef WITH_IO_URING
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static auto constexpr RingEntries = unsigned{ 256 };
+
+/* the I/O priority that the kernel gives a class's ops, as in ioprio_set(2) */
+static uint16_t ringIoPriority(tr_disk_io_priority priority)
+{
+    auto constexpr ClassBestEffort = 2;
+    auto constexpr ClassShift = 13;
+
+    // best effort levels go from 0, the most urgent, to 7. 4 is the default
+    auto constexpr Levels = std::array<uint16_t, TR_DISK_IO_N_PRIORITIES>{ 0, 4, 7 };
+
+    return uint16_t((ClassBestEffort << ClassShift) | Levels[priority]);
+}
+
+static int ringSetup(unsigned entries, io_uring_params* params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int ringRegister(int fd, unsigned opcode, void const* arg, unsigned n_args)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, n_args));
+}
+
+template<typename T>
+static T* ringPtr(void* base, uint32_t offset)
+{
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+static void* ringMap(int fd, size_t len, off_t offset)
+{
+    void* const ret = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return ret == MAP_FAILED ? nullptr : ret;
+}
+
+static void ringFree(io_ring* ring)
+{
+    if (ring->completion_event != nullptr)
+    {
+        event_free(ring->completion_event);
+    }
+
+    if (ring->submit_event != nullptr)
+    {
+        event_free(ring->submit_event);
+    }
+
+    if (ring->sqes != nullptr)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+
+    if (ring->cq_ring != nullptr && ring->cq_ring != ring->sq_ring)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+
+    if (ring->sq_ring != nullptr)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+
+    if (ring->event_fd != -1)
+    {
+        close(ring->event_fd);
+    }
+
+    if (ring->fd != -1)
+    {
+        close(ring->fd);
+    }
+
+    delete ring;
+}
+
+static void onRingSubmit(evutil_socket_t fd, short what, void* vio);
+static void onRingCompletion(evutil_socket_t fd, short what, void* vio);
+
+static io_ring* ringNew(tr_diskIo* io)
+{
+    if (tr_env_key_exists("TR_NO_IO_URING"))
+    {
+        dbgmsg("not using io_uring because TR_NO_IO_URING is set");
+        return nullptr;
+    }
+
+    auto* const ring = new io_ring{};
+    auto params = io_uring_params{};
+
+    auto const fail = [ring](char const* what)
+    {
+        dbgmsg("not using io_uring: %s failed: %s", what, tr_strerror(errno));
+        ringFree(ring);
+        return nullptr;
+    };
+
+    ring->fd = ringSetup(RingEntries, &params);
+    if (ring->fd == -1)
+    {
+        return fail("io_uring_setup");
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    // newer kernels map both rings with one mmap()
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+    {
+        ring->sq_ring_size = ring->cq_ring_size = std::max(ring->sq_ring_size, ring->cq_ring_size);
+    }
+
+    ring->sq_ring = ringMap(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == nullptr)
+    {
+        return fail("mmap");
+    }
+
+    ring->cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) != 0 ?
+        ring->sq_ring :
+        ringMap(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == nullptr)
+    {
+        return fail("mmap");
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = static_cast<io_uring_sqe*>(ringMap(ring->fd, ring->sqes_size, IORING_OFF_SQES));
+    if (ring->sqes == nullptr)
+    {
+        return fail("mmap");
+    }
+
+    ring->sq_head = ringPtr<unsigned>(ring->sq_ring, params.sq_off.head);
+    ring->sq_tail = ringPtr<unsigned>(ring->sq_ring, params.sq_off.tail);
+    ring->sq_array = ringPtr<unsigned>(ring->sq_ring, params.sq_off.array);
+    ring->sq_mask = *ringPtr<unsigned>(ring->sq_ring, params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+
+    ring->cq_head = ringPtr<unsigned>(ring->cq_ring, params.cq_off.head);
+    ring->cq_tail = ringPtr<unsigned>(ring->cq_ring, params.cq_off.tail);
+    ring->cqes = ringPtr<io_uring_cqe>(ring->cq_ring, params.cq_off.cqes);
+    ring->cq_mask = *ringPtr<unsigned>(ring->cq_ring, params.cq_off.ring_mask);
+    ring->cq_entries = params.cq_entries;
+
+    // the kernel bumps the eventfd when it posts completions, which wakes up the event loop
+    ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->event_fd == -1)
+    {
+        return fail("eventfd");
+    }
+
+    if (ringRegister(ring->fd, IORING_REGISTER_EVENTFD, &ring->event_fd, 1) == -1)
+    {
+        return fail("IORING_REGISTER_EVENTFD");
+    }
+
+    auto* const base = io->session->event_base;
+    ring->submit_event = event_new(base, -1, 0, onRingSubmit, io);
+    ring->completion_event = event_new(base, ring->event_fd, EV_READ | EV_PERSIST, onRingCompletion, io);
+    if (ring->submit_event == nullptr || ring->completion_event == nullptr || event_add(ring->completion_event, nullptr) == -1)
+    {
+        return fail("event_new");
+    }
+
+    dbgmsg("using io_uring with %u entries", ring->sq_entries);
+    return ring;
+}
+
+static io_ring* getRing(tr_diskIo* io)
+{
+    TR_ASSERT(tr_amInEventThread(io->session));
+
+    if (!io->ring_checked)
+    {
+        io->ring_checked = true;
+        io->ring = ringNew(io);
+    }
+
+    return io->ring;
+}
+
+/* move ops from the backlog into the submission ring while there's room */
+static void ringFill(io_ring* ring)
+{
+    while (!std::empty(ring->backlog) && ring->n_unsubmitted < ring->sq_entries &&
+           ring->n_unsubmitted + ring->n_inflight < ring->cq_entries)
+    {
+        auto* const rop = ring->backlog.front();
+        ring->backlog.pop_front();
+
+        // only this thread writes the tail
+        auto const tail = *ring->sq_tail;
+        auto const index = tail & ring->sq_mask;
+
+        auto* const sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = rop->op->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = rop->op->fd;
+        sqe->off = rop->offset;
+        sqe->addr = reinterpret_cast<uintptr_t>(std::data(rop->iov) + rop->first);
+        sqe->len = static_cast<uint32_t>(std::min(std::size(rop->iov) - rop->first, size_t{ IOV_MAX }));
+        sqe->user_data = reinterpret_cast<uintptr_t>(rop);
+        sqe->ioprio = ringIoPriority(rop->job->sched.priority);
+
+        ring->sq_array[index] = index;
+        __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++ring->n_unsubmitted;
+    }
+}
+
+/* hand the filled-in sqes to the kernel and optionally wait for completions */
+static bool ringEnterAndCount(io_ring* ring, unsigned min_complete)
+{
+    unsigned const flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    for (;;)
+    {
+        int const n = ringEnter(ring->fd, ring->n_unsubmitted, min_complete, flags);
+
+        if (n >= 0)
+        {
+            ring->n_unsubmitted -= n;
+            ring->n_inflight += n;
+            return true;
+        }
+
+        if (errno != EINTR)
+        {
+            dbgmsg("io_uring_enter failed: %s", tr_strerror(errno));
+            return false;
+        }
+    }
+}
+
+/* batch everything that's queued during this pass of the event loop into one io_uring_enter() */
+static void ringScheduleSubmit(io_ring* ring)
+{
+    if (!ring->submit_pending && ring->n_unsubmitted > 0)
+    {
+        ring->submit_pending = true;
+        event_active(ring->submit_event, EV_TIMEOUT, 0);
+    }
+}
+
+static void onRingSubmit(evutil_socket_t /*fd*/, short /*what*/, void* vio)
+{
+    auto* const ring = static_cast<tr_diskIo*>(vio)->ring;
+
+    ring->submit_pending = false;
+
+    if (ring->n_unsubmitted > 0 && !ringEnterAndCount(ring, 0))
+    {
+        // probably EAGAIN or EBUSY; try again in a bit
+        auto constexpr Retry = timeval{ 0, 10000 };
+        ring->submit_pending = true;
+        evtimer_add(ring->submit_event, &Retry);
+    }
+}
+
+static void ringOpCompleted(io_ring* ring, ring_op* rop, int res, job_list& finished)
+{
+    auto* const op = rop->op;
+    bool done = true;
+
+    if (res == -EINTR || res == -EAGAIN)
+    {
+        done = false;
+    }
+    else if (res < 0)
+    {
+        op->err = -res;
+    }
+    else if (res == 0)
+    {
+        // reading past the end of the file leaves the buffer alone, the same as pread()
+        if (op->is_write)
+        {
+            op->err = EIO;
+        }
+    }
+    else
+    {
+        // skip past what was done and resubmit the rest
+        rop->offset += res;
+
+        for (auto n = size_t(res); n > 0 && rop->first < std::size(rop->iov);)
+        {
+            auto& vec = rop->iov[rop->first];
+
+            if (n >= vec.iov_len)
+            {
+                n -= vec.iov_len;
+                ++rop->first;
+            }
+            else
+            {
+                vec.iov_base = static_cast<char*>(vec.iov_base) + n;
+                vec.iov_len -= n;
+                n = 0;
+            }
+        }
+
+        done = rop->first == std::size(rop->iov);
+    }
+
+    if (!done)
+    {
+        ring->backlog.push_front(rop);
+        return;
+    }
+
+    auto const job = rop->job;
+    delete rop;
+
+    if (--job->n_ops_left == 0)
+    {
+        finished.splice(std::end(finished), ring->jobs, job);
+    }
+}
+
+static void ringReap(tr_diskIo* io)
+{
+    auto* const ring = io->ring;
+    auto finished = job_list{};
+
+    // only this thread writes the head
+    auto head = *ring->cq_head;
+    auto const tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head)
+    {
+        auto const& cqe = ring->cqes[head & ring->cq_mask];
+        auto* const rop = reinterpret_cast<ring_op*>(static_cast<uintptr_t>(cqe.user_data));
+        auto const res = cqe.res;
+
+        TR_ASSERT(ring->n_inflight > 0);
+        --ring->n_inflight;
+        ringOpCompleted(ring, rop, res, finished);
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    if (!std::empty(finished))
+    {
+        auto const lock = std::lock_guard(io->mutex);
+
+        for (auto const& job : finished)
+        {
+            onJobFinished(io, job);
+        }
+    }
+
+    ringFill(ring);
+    dispatchFinishedJobs(io, finished);
+    ringScheduleSubmit(ring);
+}
+
+static void onRingCompletion(evutil_socket_t fd, short /*what*/, void* vio)
+{
+    auto value = uint64_t{};
+    [[maybe_unused]] auto const n = read(fd, &value, sizeof(value));
+
+    ringReap(static_cast<tr_diskIo*>(vio));
+}
+
+static void ringSubmitJob(io_ring* ring, disk_io_job&& job)
+{
+    ring->jobs.push_back(std::move(job));
+    auto const it = std::prev(std::end(ring->jobs));
+
+    for (size_t i = 0; i < it->n_ops; ++i)
+    {
+        auto* const op = &it->ops[i];
+        auto* const rop = new ring_op{ it, op, {}, 0, op->offset };
+
+        for (auto const& vec : op->iov)
+        {
+            if (vec.iov_len > 0)
+            {
+                rop->iov.push_back({ vec.iov_base, vec.iov_len });
+            }
+        }
+
+        if (std::empty(rop->iov))
+        {
+            --it->n_ops_left;
+            delete rop;
+        }
+        else
+        {
+            ring->backlog.push_back(rop);
+        }
+    }
+
+    TR_ASSERT(it->n_ops_left > 0);
+
+    ringFill(ring);
+    ringScheduleSubmit(ring);
+}
+
+static void ringWaitIdle(tr_diskIo* io)
+{
+    auto* const ring = io->ring;
+
+    while (ring != nullptr && !std::empty(ring->jobs))
+    {
+        ringFill(ring);
+
+        if (!ringEnterAndCount(ring, ring->n_inflight + ring->n_unsubmitted > 0 ? 1 : 0))
+        {
+            tr_wait_msec(10);
+        }
+
+        ringReap(io);
+    }
+}
+
+static size_t ringFileOpCount(tr_disk_io_file_op const* ops, size_t n_ops)
+{
+    return std::count_if(
+        ops,
+        ops + n_ops,
+        [](auto const& op)
+        {
+            return std::any_of(
+                std::begin(op.iov),
+                std::end(op.iov),
+                [](auto const& vec) { return vec.iov_len > 0; });
+        });
+}
+
+#endif /* WITH_IO_URING */
+
+/***
+****
+***/
+
+tr_diskIo* tr_diskIoNew(tr_session* session, size_t n_workers)
+{
+    TR_ASSERT(n_workers > 0);
+
+    auto* const io = new tr_diskIo{ session };
+
+    dbgmsg("starting %zu disk I/O worker threads", n_workers);
+
+    auto const lock = std::lock_guard(io->mutex);
+
+    for (size_t i = 0; i < n_workers; ++i)
+    {
+        tr_threadNew(workerFunc, io);
+        ++io->n_workers;
+    }
+
+    return io;
+}
+
+void tr_diskIoFree(tr_diskIo* io)
+{
+    if (io == nullptr)
+    {
+        return;
+    }
+
+    tr_diskIoWaitIdle(io);
+
+    {
+        auto lock = std::unique_lock(io->mutex);
+        io->is_closing = true;
+        io->work_cv.notify_all();
+        io->idle_cv.wait(lock, [io]() { return io->n_workers == 0; });
+    }
+
+    // the workers may have finished something after the idle check
+    auto jobs = job_list{};
+    jobs.splice(std::end(jobs), io->finished);
+    dispatchFinishedJobs(io, jobs);
+
+    TR_ASSERT(io->n_pending == 0);
+
+#ifdef WITH_IO_URING
+    if (io->ring != nullptr)
+    {
+        TR_ASSERT(std::empty(io->ring->jobs));
+        ringFree(io->ring);
+    }
+#endif
+
+    delete io;
+}
+
+void tr_diskIoSubmit(
+    tr_diskIo* io,
+    void const* owner,
+    tr_disk_io_sched const& sched,
+    tr_disk_io_work_func work,
+    tr_disk_io_done_func done,
+    void* job)
+{
+    TR_ASSERT(io != nullptr);
+    TR_ASSERT(tr_amInEventThread(io->session));
+    TR_ASSERT(sched.priority < TR_DISK_IO_N_PRIORITIES);
+    TR_ASSERT(work != nullptr);
+    TR_ASSERT(done != nullptr);
+
+    ++io->n_pending;
+
+    auto const lock = std::lock_guard(io->mutex);
+    enqueueJob(io, { owner, work, done, job, false, nullptr, 0, 0, sched, 0 });
+}
+
+void tr_diskIoSubmitFileOps(
+    tr_diskIo* io,
+    void const* owner,
+    tr_disk_io_sched const& sched,
+    tr_disk_io_file_op* ops,
+    size_t n_ops,
+    tr_disk_io_done_func done,
+    void* job)
+{
+    TR_ASSERT(io != nullptr);
+    TR_ASSERT(tr_amInEventThread(io->session));
+    TR_ASSERT(sched.priority < TR_DISK_IO_N_PRIORITIES);
+    TR_ASSERT(ops != nullptr || n_ops == 0);
+    TR_ASSERT(done != nullptr);
+
+    ++io->n_pending;
+
+    for (size_t i = 0; i < n_ops; ++i)
+    {
+        ops[i].err = 0;
+    }
+
+#ifdef WITH_IO_URING
+    // the ring only takes jobs with something to do, and that don't need to be realigned
+    if (ringFileOpCount(ops, n_ops) > 0 &&
+        std::none_of(ops, ops + n_ops, [](auto const& op) { return op.is_direct; }))
+    {
+        if (auto* const ring = getRing(io); ring != nullptr)
+        {
+            auto ring_job = disk_io_job{ owner, nullptr, done, job, false, ops, n_ops, n_ops, sched, 0 };
+
+            {
+                auto const lock = std::lock_guard(io->mutex);
+                onRingJobSubmitted(io, ring_job);
+            }
+
+            ringSubmitJob(ring, std::move(ring_job));
+            return;
+        }
+    }
+#endif
+
+    auto const lock = std::lock_guard(io->mutex);
+    enqueueJob(io, { owner, nullptr, done, job, false, ops, n_ops, 0, sched, 0 });
+}
+
+void tr_diskIoRunFileOps(tr_disk_io_file_op* ops, size_t n_ops)
+{
+    for (size_t i = 0; i < n_ops; ++i)
+    {
+        auto& op = ops[i];
+        tr_error* error = nullptr;
+
+        if (op.is_direct && op.is_write)
+        {
+            tr_directIoWrite(op.fd, std::data(op.iov), std::size(op.iov), op.offset, op.file_size, &error);
+        }
+        else if (op.is_direct)
+        {
+            tr_directIoRead(op.fd, std::data(op.iov), std::size(op.iov), op.offset, &error);
+        }
+        else if (op.is_write)
+        {
+            tr_sys_file_write_at_v(op.fd, std::data(op.iov), std::size(op.iov), op.offset, nullptr, &error);
+        }
+        else
+        {
+            auto offset = op.offset;
+
+            for (auto const& vec : op.iov)
+            {
+                if (!tr_sys_file_read_at(op.fd, vec.iov_base, vec.iov_len, offset, nullptr, &error))
+                {
+                    break;
+                }
+
+                offset += vec.iov_len;
+            }
+        }
+
+        op.err = error != nullptr ? error->code : 0;
+        tr_error_free(error);
+
+        if (op.err != 0)
+        {
+            break;
+        }
+    }
+}
+
+bool tr_diskIoHasRing([[maybe_unused]] tr_diskIo* io)
+{
+#ifdef WITH_IO_URING
+    return getRing(io) != nullptr;
+#else
+    return false;
+#endif
+}
+
+void tr_diskIoCancel(tr_diskIo* io, void const* owner)
+{
+    TR_ASSERT(io != nullptr);
+    TR_ASSERT(tr_amInEventThread(io->session));
+
+    auto jobs = job_list{};
+
+    {
+        auto const lock = std::lock_guard(io->mutex);
+
+        for (auto& entry : io->devices)
+        {
+            for (auto& queue : entry.second.queued)
+            {
+                for (auto it = std::begin(queue), end = std::end(queue); it != end;)
+                {
+                    auto const next = std::next(it);
+
+                    if (it->owner == owner)
+                    {
+                        it->cancelled = true;
+                        jobs.splice(std::end(jobs), queue, it);
+                        --io->n_queued;
+                    }
+
+                    it = next;
+                }
+            }
+        }
+
+        for (auto* list : { &io->running, &io->finished })
+        {
+            for (auto& job : *list)
+            {
+                if (job.owner == owner)
+                {
+                    job.cancelled = true;
+                }
+            }
+        }
+    }
+
+#ifdef WITH_IO_URING
+    // the kernel still has the jobs' buffers, so they're finished when their ops complete
+    if (io->ring != nullptr)
+    {
+        for (auto& job : io->ring->jobs)
+        {
+            if (job.owner == owner)
+            {
+                job.cancelled = true;
+            }
+        }
+    }
+#endif
+
+    dispatchFinishedJobs(io, jobs);
+}
+
+static void waitForWorkers(tr_diskIo* io)
+{
+    auto lock = std::unique_lock(io->mutex);
+
+    for (;;)
+    {
+        io->idle_cv.wait(
+            lock,
+            [io]() { return !std::empty(io->finished) || (io->n_queued == 0 && std::empty(io->running)); });
+
+        if (std::empty(io->finished))
+        {
+            break;
+        }
+
+        // a done callback may submit more jobs, so dispatch without the lock held and look again
+        auto jobs = job_list{};
+        jobs.splice(std::end(jobs), io->finished);
+        lock.unlock();
+        dispatchFinishedJobs(io, jobs);
+        lock.lock();
+    }
+}
+
+void tr_diskIoWaitIdle(tr_diskIo* io)
+{
+    TR_ASSERT(io != nullptr);
+    TR_ASSERT(tr_amInEventThread(io->session));
+
+#ifdef WITH_IO_URING
+    // either kind of job's done callback may submit the other kind
+    do
+    {
+        ringWaitIdle(io);
+        waitForWorkers(io);
+    } while (io->ring != nullptr && !std::empty(io->ring->jobs));
+#else
+    waitForWorkers(io);
+#endif
+}
+
+void tr_diskIoWaitFor(tr_diskIo* io, tr_disk_io_wait_func is_done, void const* arg)
+{
+    TR_ASSERT(io != nullptr);
+    TR_ASSERT(tr_amInEventThread(io->session));
+    TR_ASSERT(is_done != nullptr);
+
+    // once nothing's pending, nothing can make it true
+    while (!is_done(arg) && io->n_pending > 0)
+    {
+#ifdef WITH_IO_URING
+        // don't sleep in the kernel, since what's being waited for may be a worker's
+        if (auto* const ring = io->ring; ring != nullptr && !std::empty(ring->jobs))
+        {
+            ringFill(ring);
+            ringEnterAndCount(ring, 0);
+            ringReap(io);
+        }
+#endif
+
+        auto jobs = job_list{};
+
+        {
+            auto lock = std::unique_lock(io->mutex);
+            io->idle_cv.wait_for(lock, WaitForPollInterval, [io]() { return !std::empty(io->finished); });
+            jobs.splice(std::end(jobs), io->finished);
+        }
+
+        dispatchFinishedJobs(io, jobs);
+    }
+}
+
+size_t tr_diskIoGetPendingCount(tr_diskIo const* io)
+{
+    return io != nullptr ? io->n_pending : 0;
+}
+
+uint64_t tr_diskIoGetDevice(char const* path)
+{
+    TR_ASSERT(path != nullptr);
+
+#ifdef _WIN32
+    // the drive letter
+    return path[0] != '\0' && path[1] == ':' ? uint64_t(toupper(path[0])) : 0;
+#else
+    struct stat sb;
+    return stat(path, &sb) == 0 ? uint64_t(sb.st_dev) : 0;
+#endif
+}
+
+void tr_diskIoYield(tr_diskIo* io, uint64_t device)
+{
+    if (io == nullptr)
+    {
+        return;
+    }
+
+    auto const is_busy = [io, device]()
+    {
+        auto const it = io->devices.find(device);
+        if (it == std::end(io->devices))
+        {
+            return false;
+        }
+
+        auto const& dev = it->second;
+        for (size_t i = 0; i < TR_DISK_IO_BACKGROUND; ++i)
+        {
+            if (!std::empty(dev.queued[i]) || dev.running[i] > 0)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    auto lock = std::unique_lock(io->mutex);
+    io->idle_cv.wait_for(lock, MaxYield, [io, &is_busy]() { return io->is_closing || !is_busy(); });
+}
+
+std::vector<tr_disk_io_device_stats> tr_diskIoGetDeviceStats(tr_diskIo* io)
+{
+    TR_ASSERT(io != nullptr);
+
+    auto ret = std::vector<tr_disk_io_device_stats>{};
+    auto const lock = std::lock_guard(io->mutex);
+    ret.reserve(std::size(io->devices));
+
+    for (auto const& [device, dev] : io->devices)
+    {
+        auto& stats = ret.emplace_back();
+        stats.device = device;
+        stats.running = 0;
+
+        for (size_t i = 0; i < TR_DISK_IO_N_PRIORITIES; ++i)
+        {
+            stats.queued[i] = std::size(dev.queued[i]);
+            stats.running += dev.running[i];
+        }
+
+        stats.n_done = dev.n_done;
+        stats.latency_usec = dev.latency_usec;
+        stats.max_latency_usec = dev.max_latency_usec;
+    }
+
+    return ret;
+}
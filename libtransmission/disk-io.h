@@ -0,0 +1,210 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <array>
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <vector>
+
+#include <event2/buffer.h> // evbuffer_iovec
+
+#include "file.h" // tr_sys_file_t
+
+struct tr_diskIo;
+struct tr_session;
+
+/**
+ * @addtogroup file_io File IO
+ * @{
+ */
+
+/** @brief Does the blocking part of a job. Called from a disk worker thread. */
+using tr_disk_io_work_func = void (*)(void* job);
+
+/** @brief Tells tr_diskIoWaitFor() whether what it's waiting for has happened */
+using tr_disk_io_wait_func = bool (*)(void const* arg);
+
+/**
+ * @brief Finishes a job. Called from the libtransmission thread.
+ *
+ * If `cancelled` is true the job's owner is gone and must not be touched;
+ * the callback should only release the job's own resources.
+ */
+using tr_disk_io_done_func = void (*)(tr_session* session, void* job, bool cancelled);
+
+/** @brief The priority classes that the jobs on each device are run in, most urgent first */
+enum tr_disk_io_priority
+{
+    /* reads that someone is waiting on, such as a high-priority torrent's */
+    TR_DISK_IO_INTERACTIVE,
+
+    /* peers' uploads and downloads */
+    TR_DISK_IO_NORMAL,
+
+    /* verifying and moving torrents */
+    TR_DISK_IO_BACKGROUND,
+
+    TR_DISK_IO_N_PRIORITIES
+};
+
+/** @brief How a job is queued: which device's queue, which class, and where in the elevator order */
+struct tr_disk_io_sched
+{
+    tr_disk_io_priority priority = TR_DISK_IO_NORMAL;
+
+    /* from tr_diskIoGetDevice(), or 0 if it isn't known */
+    uint64_t device = 0;
+
+    /* Where on the device the job goes. Each class's jobs are run in (object, offset)
+     * order, sweeping one way and then starting over, so that a hard drive's head
+     * doesn't have to jump back and forth. */
+    uint64_t object = 0;
+    uint64_t offset = 0;
+};
+
+/** @brief A positional read or write of one file, for tr_diskIoSubmitFileOps() */
+struct tr_disk_io_file_op
+{
+    tr_sys_file_t fd;
+    bool is_write;
+    uint64_t offset;
+
+    /* the memory to read into or write from */
+    std::vector<evbuffer_iovec> iov;
+
+    /* set when the job finishes: 0 or an errno */
+    int err;
+
+    /* whether to use tr_directIoRead() / tr_directIoWrite() */
+    bool is_direct = false;
+
+    /* the file's full size, for tr_directIoWrite() */
+    uint64_t file_size = 0;
+};
+
+/**
+ * @brief Create a pool of `n_workers` disk threads.
+ *
+ * Completed jobs are handed back to the libtransmission thread
+ * with tr_runInEventThread().
+ */
+tr_diskIo* tr_diskIoNew(tr_session* session, size_t n_workers);
+
+/** @brief Finish all the queued jobs, then stop the worker threads. */
+void tr_diskIoFree(tr_diskIo* io);
+
+/**
+ * @brief Queue a job for the worker threads.
+ *
+ * Each device has its own queue. The devices take turns, and within one device
+ * the most urgent class goes first, though a class that's been passed over for
+ * too long gets a turn so that it can't be starved.
+ *
+ * @param owner an opaque tag that can later be passed to tr_diskIoCancel()
+ */
+void tr_diskIoSubmit(
+    tr_diskIo* io,
+    void const* owner,
+    tr_disk_io_sched const& sched,
+    tr_disk_io_work_func work,
+    tr_disk_io_done_func done,
+    void* job);
+
+/**
+ * @brief Queue a job that only reads or writes files.
+ *
+ * On Linux with io_uring, the ops are handed to the kernel along with everything else
+ * that was queued during the same pass of the event loop, and completions come back
+ * to the event loop without a worker thread. The kernel does the ordering then, and the
+ * priority class becomes the ops' I/O priority. Otherwise, or if any of the ops is direct,
+ * the job is queued like tr_diskIoSubmit()'s and its ops are run in order by a worker
+ * thread, stopping at the first error.
+ *
+ * `ops` must stay valid until `done` is called. Each op's `err` is set before then.
+ */
+void tr_diskIoSubmitFileOps(
+    tr_diskIo* io,
+    void const* owner,
+    tr_disk_io_sched const& sched,
+    tr_disk_io_file_op* ops,
+    size_t n_ops,
+    tr_disk_io_done_func done,
+    void* job);
+
+/** @brief Run file ops on the calling thread, in order, stopping at the first error */
+void tr_diskIoRunFileOps(tr_disk_io_file_op* ops, size_t n_ops);
+
+/** @brief True if tr_diskIoSubmitFileOps() is using io_uring */
+bool tr_diskIoHasRing(tr_diskIo* io);
+
+/**
+ * @brief Cancel all of an owner's jobs.
+ *
+ * Jobs that haven't started are dropped and jobs that are running or finished
+ * have their done callbacks called with `cancelled` set to true.
+ * Either way, `owner` will not be seen again by the done callbacks.
+ */
+void tr_diskIoCancel(tr_diskIo* io, void const* owner);
+
+/** @brief Block until every queued job is finished and its done callback has been called. */
+void tr_diskIoWaitIdle(tr_diskIo* io);
+
+/**
+ * @brief Block until `is_done(arg)` returns true, calling finished jobs' done callbacks meanwhile.
+ *
+ * This is for waiting on particular jobs, whose done callbacks make `is_done` true,
+ * without also waiting on everything else that's queued as tr_diskIoWaitIdle() does.
+ * It returns early if there are no jobs left that could.
+ */
+void tr_diskIoWaitFor(tr_diskIo* io, tr_disk_io_wait_func is_done, void const* arg);
+
+/** @brief Number of jobs that have been submitted but whose done callbacks haven't been called yet */
+size_t tr_diskIoGetPendingCount(tr_diskIo const* io);
+
+/** @brief Identify the device that a path is on, for tr_disk_io_sched. Returns 0 if it can't be found */
+uint64_t tr_diskIoGetDevice(char const* path);
+
+/**
+ * @brief Wait until a device has no more urgent work than background work.
+ *
+ * Verifying and moving do their own reading and writing on their own threads,
+ * so they call this between chunks to stay behind the device's queued and
+ * running jobs. It waits a little while at most, so that a busy device slows
+ * background work down without stopping it. Can be called from any thread.
+ */
+void tr_diskIoYield(tr_diskIo* io, uint64_t device);
+
+/** @brief What one device's queues look like, for tr_diskIoGetDeviceStats() */
+struct tr_disk_io_device_stats
+{
+    uint64_t device;
+
+    /* the jobs of each class that are waiting their turn */
+    std::array<size_t, TR_DISK_IO_N_PRIORITIES> queued;
+
+    /* the jobs that are being worked on, or that the kernel has */
+    size_t running;
+
+    /* the jobs that have finished */
+    uint64_t n_done;
+
+    /* from submission to completion: a moving average, and the most it's been */
+    uint64_t latency_usec;
+    uint64_t max_latency_usec;
+};
+
+/** @brief Get the queue depth and latency of each device that jobs have been submitted for */
+std::vector<tr_disk_io_device_stats> tr_diskIoGetDeviceStats(tr_diskIo* io);
+
+/* @} */
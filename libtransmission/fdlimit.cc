@@ -6,19 +6,21 @@
  *
  */
 
-#include <algorithm>
-#include <array>
 #include <cerrno>
 #include <cinttypes>
 #include <ctime>
+#include <unordered_map>
+#include <vector>
 
 #include "transmission.h"
 
 #include "error-types.h"
+#include "disk-io.h" /* tr_diskIoGetDevice() */
 #include "error.h"
 #include "fdlimit.h"
 #include "file.h"
 #include "log.h"
+#include "prealloc.h"
 #include "session.h"
 #include "torrent.h" /* tr_isTorrent() */
 #include "tr-assert.h"
@@ -67,50 +69,6 @@ static bool preallocate_file_sparse(tr_sys_file_t fd, uint64_t length, tr_error*
     return false;
 }
 
-static bool preallocate_file_full(tr_sys_file_t fd, uint64_t length, tr_error** error)
-{
-    tr_error* my_error = nullptr;
-
-    if (length == 0)
-    {
-        return true;
-    }
-
-    if (tr_sys_file_preallocate(fd, length, 0, &my_error))
-    {
-        return true;
-    }
-
-    dbgmsg("Preallocating (full, normal) failed (%d): %s", my_error->code, my_error->message);
-
-    if (!TR_ERROR_IS_ENOSPC(my_error->code))
-    {
-        auto buf = std::array<uint8_t, 4096>{};
-        bool success = true;
-
-        tr_error_clear(&my_error);
-
-        /* fallback: the old-fashioned way */
-        while (success && length > 0)
-        {
-            uint64_t const thisPass = std::min(length, uint64_t{ std::size(buf) });
-            uint64_t bytes_written = 0;
-            success = tr_sys_file_write(fd, std::data(buf), thisPass, &bytes_written, &my_error);
-            length -= bytes_written;
-        }
-
-        if (success)
-        {
-            return true;
-        }
-
-        dbgmsg("Preallocating (full, fallback) failed (%d): %s", my_error->code, my_error->message);
-    }
-
-    tr_error_propagate(error, &my_error);
-    return false;
-}
-
 /*****
 ******
 ******
@@ -123,7 +81,16 @@ struct tr_cached_file
     tr_sys_file_t fd;
     int torrent_id;
     tr_file_index_t file_index;
-    time_t used_at;
+
+    /* the device it's on, for the disk I/O scheduler */
+    uint64_t device;
+
+    /* whether fd was opened with TR_SYS_FILE_DIRECT */
+    bool is_direct;
+
+    /* neighbors in the fileset's LRU list, or in its list of unused slots */
+    struct tr_cached_file* prev;
+    struct tr_cached_file* next;
 };
 
 static constexpr bool cached_file_is_open(struct tr_cached_file const* o)
@@ -152,6 +119,9 @@ static void cached_file_close(struct tr_cached_file* o)
 // TODO: remove goto
 static int cached_file_open(
     struct tr_cached_file* o,
+    tr_session* session,
+    int torrent_id,
+    tr_file_index_t file_index,
     char const* filename,
     bool writable,
     tr_preallocation_mode allocation,
@@ -202,25 +172,18 @@ static int cached_file_open(
         goto FAIL;
     }
 
-    if (writable && !already_existed && allocation != TR_PREALLOCATE_NONE)
+    if (writable && allocation == TR_PREALLOCATE_FULL && (!already_existed || info.size < file_size))
     {
-        bool success = false;
-        char const* type = nullptr;
-
-        if (allocation == TR_PREALLOCATE_FULL)
-        {
-            success = preallocate_file_full(fd, file_size, &error);
-            type = _("full");
-        }
-        else if (allocation == TR_PREALLOCATE_SPARSE)
-        {
-            success = preallocate_file_sparse(fd, file_size, &error);
-            type = _("sparse");
-        }
-
-        TR_ASSERT(type != nullptr);
+        /* This can mean writing out the whole file, so don't wait for it.
+         * A file that's too short was still being preallocated when the
+         * session stopped, so carry on from its end. */
+        tr_preallocAdd(session, torrent_id, file_index, filename, file_size, info.size);
+    }
+    else if (writable && !already_existed && allocation == TR_PREALLOCATE_SPARSE)
+    {
+        char const* const type = _("sparse");
 
-        if (!success)
+        if (!preallocate_file_sparse(fd, file_size, &error))
         {
             tr_logAddError(
                 _("Couldn't preallocate file \"%1$s\" (%2$s, size: %3$" PRIu64 "): %4$s"),
@@ -246,7 +209,31 @@ static int cached_file_open(
         goto FAIL;
     }
 
+    /* Now that the file's set up, reopen it to bypass the page cache.
+     * Some filesystems, such as tmpfs, don't support that, so the file
+     * keeps its buffered descriptor and is read and written normally. */
+    o->is_direct = false;
+
+    if (session->isDirectIoEnabled)
+    {
+        tr_error* direct_error = nullptr;
+        tr_sys_file_t const direct_fd = tr_sys_file_open(filename, flags | TR_SYS_FILE_DIRECT, 0666, &direct_error);
+
+        if (direct_fd != TR_BAD_SYS_FILE)
+        {
+            tr_sys_file_close(fd, nullptr);
+            fd = direct_fd;
+            o->is_direct = true;
+        }
+        else
+        {
+            dbgmsg("couldn't open '%s' for direct I/O: %s", filename, direct_error->message);
+            tr_error_free(direct_error);
+        }
+    }
+
     o->fd = fd;
+    o->device = tr_diskIoGetDevice(filename);
     return 0;
 
 FAIL:
@@ -265,33 +252,75 @@ FAIL:
 ****
 ***/
 
+/* Lookups and evictions happen for every block that's read or written,
+ * and the open file limit may be in the thousands, so they're O(1):
+ * open files are found with a hash map and kept in an LRU list. */
 struct tr_fileset
 {
-    struct tr_cached_file* begin;
-    struct tr_cached_file const* end;
+    std::vector<tr_cached_file> slots;
+    std::unordered_map<uint64_t, tr_cached_file*> open_files;
+
+    /* the open files, most recently used first */
+    struct tr_cached_file* lru_head = nullptr;
+    struct tr_cached_file* lru_tail = nullptr;
+
+    /* slots that don't have a file open, linked through `next` */
+    struct tr_cached_file* unused = nullptr;
+
+    uint64_t n_opened = 0;
+    uint64_t n_closed = 0;
+    uint64_t n_evicted = 0;
 };
 
-static void fileset_construct(struct tr_fileset* set, int n)
+static constexpr uint64_t fileset_key(int torrent_id, tr_file_index_t i)
+{
+    return (uint64_t(uint32_t(torrent_id)) << 32) | i;
+}
+
+static void fileset_lru_unlink(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    (o->prev != nullptr ? o->prev->next : set->lru_head) = o->next;
+    (o->next != nullptr ? o->next->prev : set->lru_tail) = o->prev;
+    o->prev = o->next = nullptr;
+}
+
+static void fileset_lru_push_front(struct tr_fileset* set, struct tr_cached_file* o)
 {
-    set->begin = tr_new(struct tr_cached_file, n);
-    set->end = set->begin + n;
+    o->prev = nullptr;
+    o->next = set->lru_head;
+    (set->lru_head != nullptr ? set->lru_head->prev : set->lru_tail) = o;
+    set->lru_head = o;
+}
+
+static void fileset_construct(struct tr_fileset* set, size_t n)
+{
+    set->slots.assign(n, { false, TR_BAD_SYS_FILE, 0, 0, 0, false, nullptr, nullptr });
+    set->open_files.reserve(n);
 
-    for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+    for (auto& o : set->slots)
     {
-        *o = { false, TR_BAD_SYS_FILE, 0, 0, 0 };
+        o.next = set->unused;
+        set->unused = &o;
     }
 }
 
+static void fileset_close_file(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    cached_file_close(o);
+    set->open_files.erase(fileset_key(o->torrent_id, o->file_index));
+    fileset_lru_unlink(set, o);
+    o->next = set->unused;
+    set->unused = o;
+    ++set->n_closed;
+}
+
 static void fileset_close_all(struct tr_fileset* set)
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        while (set->lru_head != nullptr)
         {
-            if (cached_file_is_open(o))
-            {
-                cached_file_close(o);
-            }
+            fileset_close_file(set, set->lru_head);
         }
     }
 }
@@ -299,20 +328,25 @@ static void fileset_close_all(struct tr_fileset* set)
 static void fileset_destruct(struct tr_fileset* set)
 {
     fileset_close_all(set);
-    tr_free(set->begin);
-    set->end = set->begin = nullptr;
+    set->slots.clear();
+    set->open_files.clear();
+    set->unused = nullptr;
 }
 
 static void fileset_close_torrent(struct tr_fileset* set, int torrent_id)
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        for (struct tr_cached_file* o = set->lru_head; o != nullptr;)
         {
-            if (o->torrent_id == torrent_id && cached_file_is_open(o))
+            struct tr_cached_file* const next = o->next;
+
+            if (o->torrent_id == torrent_id)
             {
-                cached_file_close(o);
+                fileset_close_file(set, o);
             }
+
+            o = next;
         }
     }
 }
@@ -321,46 +355,55 @@ static struct tr_cached_file* fileset_lookup(struct tr_fileset* set, int torrent
 {
     if (set != nullptr)
     {
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
+        if (auto const it = set->open_files.find(fileset_key(torrent_id, i)); it != std::end(set->open_files))
         {
-            if (torrent_id == o->torrent_id && i == o->file_index && cached_file_is_open(o))
-            {
-                return o;
-            }
+            return it->second;
         }
     }
 
     return nullptr;
 }
 
+static void fileset_touch(struct tr_fileset* set, struct tr_cached_file* o)
+{
+    if (set->lru_head != o)
+    {
+        fileset_lru_unlink(set, o);
+        fileset_lru_push_front(set, o);
+    }
+}
+
+/* the slot that fileset_add() will use, making room for it if need be */
 static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set)
 {
-    struct tr_cached_file* cull = nullptr;
+    if (set == nullptr || std::empty(set->slots))
+    {
+        return nullptr;
+    }
 
-    if (set != nullptr && set->begin != nullptr)
+    /* all slots are full... recycle the least recently used */
+    if (set->unused == nullptr)
     {
-        /* try to find an unused slot */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
-        {
-            if (!cached_file_is_open(o))
-            {
-                return o;
-            }
-        }
+        dbgmsg("evicting the least recently used file");
+        fileset_close_file(set, set->lru_tail);
+        ++set->n_evicted;
+    }
 
-        /* all slots are full... recycle the least recently used */
-        for (struct tr_cached_file* o = set->begin; o != set->end; ++o)
-        {
-            if (cull == nullptr || o->used_at < cull->used_at)
-            {
-                cull = o;
-            }
-        }
+    return set->unused;
+}
 
-        cached_file_close(cull);
-    }
+/* start tracking a file that was just opened in the slot from fileset_get_empty_slot() */
+static void fileset_add(struct tr_fileset* set, struct tr_cached_file* o, int torrent_id, tr_file_index_t i)
+{
+    TR_ASSERT(o == set->unused);
+    TR_ASSERT(cached_file_is_open(o));
 
-    return cull;
+    set->unused = o->next;
+    o->torrent_id = torrent_id;
+    o->file_index = i;
+    set->open_files.emplace(fileset_key(torrent_id, i), o);
+    fileset_lru_push_front(set, o);
+    ++set->n_opened;
 }
 
 /***
@@ -371,7 +414,7 @@ static struct tr_cached_file* fileset_get_empty_slot(struct tr_fileset* set)
 
 struct tr_fdInfo
 {
-    int peerCount;
+    int peerCount = 0;
     struct tr_fileset fileset;
 };
 
@@ -381,11 +424,9 @@ static void ensureSessionFdInfoExists(tr_session* session)
 
     if (session->fdInfo == nullptr)
     {
-        int const FILE_CACHE_SIZE = 32;
-
         /* Create the local file cache */
-        auto* const i = tr_new0(struct tr_fdInfo, 1);
-        fileset_construct(&i->fileset, FILE_CACHE_SIZE);
+        auto* const i = new tr_fdInfo{};
+        fileset_construct(&i->fileset, session->openFileLimit);
         session->fdInfo = i;
     }
 }
@@ -396,7 +437,7 @@ void tr_fdClose(tr_session* session)
     {
         struct tr_fdInfo* i = session->fdInfo;
         fileset_destruct(&i->fileset);
-        tr_free(i);
+        delete i;
         session->fdInfo = nullptr;
     }
 }
@@ -416,9 +457,39 @@ static struct tr_fileset* get_fileset(tr_session* session)
     return &session->fdInfo->fileset;
 }
 
+void tr_fdSetFileLimit(tr_session* session, size_t limit)
+{
+    TR_ASSERT(tr_isSession(session));
+    TR_ASSERT(limit > 0);
+    TR_ASSERT(limit <= UINT16_MAX);
+
+    auto const lock = session->unique_lock();
+
+    session->openFileLimit = limit;
+
+    /* the slots can't be moved while files are open in them, so start over */
+    if (session->fdInfo != nullptr)
+    {
+        auto* const set = &session->fdInfo->fileset;
+        fileset_destruct(set);
+        fileset_construct(set, limit);
+    }
+}
+
+void tr_fdGetFileStats(tr_session* session, uint64_t* setme_opened, uint64_t* setme_closed, uint64_t* setme_evicted)
+{
+    auto const lock = session->unique_lock();
+
+    auto const* const set = get_fileset(session);
+    *setme_opened = set->n_opened;
+    *setme_closed = set->n_closed;
+    *setme_evicted = set->n_evicted;
+}
+
 void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
 {
-    tr_cached_file* const o = fileset_lookup(get_fileset(s), tr_torrentId(tor), i);
+    auto* const set = get_fileset(s);
+    tr_cached_file* const o = fileset_lookup(set, tr_torrentId(tor), i);
     if (o != nullptr)
     {
         /* flush writable files so that their mtimes will be
@@ -428,23 +499,38 @@ void tr_fdFileClose(tr_session* s, tr_torrent const* tor, tr_file_index_t i)
             tr_sys_file_flush(o->fd, nullptr);
         }
 
-        cached_file_close(o);
+        fileset_close_file(set, o);
     }
 }
 
 tr_sys_file_t tr_fdFileGetCached(tr_session* s, int torrent_id, tr_file_index_t i, bool writable)
 {
-    struct tr_cached_file* o = fileset_lookup(get_fileset(s), torrent_id, i);
+    auto* const set = get_fileset(s);
+    struct tr_cached_file* o = fileset_lookup(set, torrent_id, i);
 
     if (o == nullptr || (writable && !o->is_writable))
     {
         return TR_BAD_SYS_FILE;
     }
 
-    o->used_at = tr_time();
+    fileset_touch(set, o);
     return o->fd;
 }
 
+uint64_t tr_fdFileGetDevice(tr_session* s, int torrent_id, tr_file_index_t i)
+{
+    struct tr_cached_file const* const o = fileset_lookup(get_fileset(s), torrent_id, i);
+
+    return o != nullptr ? o->device : 0;
+}
+
+bool tr_fdFileIsDirect(tr_session* s, int torrent_id, tr_file_index_t i)
+{
+    struct tr_cached_file const* const o = fileset_lookup(get_fileset(s), torrent_id, i);
+
+    return o != nullptr && o->is_direct;
+}
+
 void tr_fdTorrentClose(tr_session* session, int torrent_id)
 {
     auto const lock = session->unique_lock();
@@ -467,16 +553,21 @@ tr_sys_file_t tr_fdFileCheckout(
 
     if (o != nullptr && writable && !o->is_writable)
     {
-        cached_file_close(o); /* close it so we can reopen in rw mode */
+        fileset_close_file(set, o); /* close it so we can reopen in rw mode */
+        o = nullptr;
     }
-    else if (o == nullptr)
+
+    if (o == nullptr)
     {
         o = fileset_get_empty_slot(set);
-    }
 
-    if (!cached_file_is_open(o))
-    {
-        if (int const err = cached_file_open(o, filename, writable, allocation, file_size); err != 0)
+        if (o == nullptr)
+        {
+            errno = EMFILE;
+            return TR_BAD_SYS_FILE;
+        }
+
+        if (int const err = cached_file_open(o, session, torrent_id, i, filename, writable, allocation, file_size); err != 0)
         {
             errno = err;
             return TR_BAD_SYS_FILE;
@@ -484,12 +575,11 @@ tr_sys_file_t tr_fdFileCheckout(
 
         dbgmsg("opened '%s' writable %c", filename, writable ? 'y' : 'n');
         o->is_writable = writable;
+        fileset_add(set, o, torrent_id, i);
     }
 
     dbgmsg("checking out '%s'", filename);
-    o->torrent_id = torrent_id;
-    o->file_index = i;
-    o->used_at = tr_time();
+    fileset_touch(set, o);
     return o->fd;
 }
 
@@ -51,6 +51,20 @@ tr_sys_file_t tr_fdFileCheckout(
 
 tr_sys_file_t tr_fdFileGetCached(tr_session* session, int torrent_id, tr_file_index_t file_num, bool doWrite);
 
+/**
+ * Gets the device that a cached file is on, as in tr_diskIoGetDevice(),
+ * or 0 if the file isn't cached.
+ */
+uint64_t tr_fdFileGetDevice(tr_session* session, int torrent_id, tr_file_index_t file_num);
+
+/**
+ * Tells whether a cached file was opened to bypass the page cache, and so
+ * must be read and written with tr_directIoRead() and tr_directIoWrite().
+ * That's only tried when direct I/O is enabled, and not every filesystem
+ * allows it.
+ */
+bool tr_fdFileIsDirect(tr_session* session, int torrent_id, tr_file_index_t file_num);
+
 /**
  * Closes a file that's being held by our file repository.
  *
@@ -66,6 +80,19 @@ void tr_fdFileClose(tr_session* session, tr_torrent const* tor, tr_file_index_t
  */
 void tr_fdTorrentClose(tr_session* session, int torrentId);
 
+/**
+ * Sets how many files the repository may keep open at once.
+ * The files that are open now are closed.
+ */
+void tr_fdSetFileLimit(tr_session* session, size_t limit);
+
+/**
+ * Gets how many files the repository has opened, closed, and closed
+ * to make room for others. A high eviction count means the limit is
+ * too low for the files being read from and written to.
+ */
+void tr_fdGetFileStats(tr_session* session, uint64_t* setme_opened, uint64_t* setme_closed, uint64_t* setme_evicted);
+
 /***********************************************************************
  * Sockets
  **********************************************************************/
@@ -25,6 +25,7 @@
 #include <vector>
 
 #include <sys/file.h> /* flock() */
+#include <sys/uio.h> /* pwritev() */
 #include <sys/mman.h> /* mmap(), munmap() */
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -35,7 +36,9 @@
 
 /* OS-specific file copy (copy_file_range, sendfile64, or copyfile). */
 #if defined(__linux__)
+#include <linux/fs.h> /* FICLONE */
 #include <linux/version.h>
+#include <sys/ioctl.h> /* ioctl() */
 /* Linux's copy_file_range(2) is buggy prior to 5.3. */
 #if defined(HAVE_COPY_FILE_RANGE) && LINUX_VERSION_CODE >= KERNEL_VERSION(5, 3, 0)
 #define USE_COPY_FILE_RANGE
@@ -54,6 +57,8 @@
 #define USE_COPY_FILE_RANGE
 #endif /* __linux__ */
 
+#include <event2/buffer.h> /* struct evbuffer_iovec */
+
 #include "transmission.h"
 #include "error.h"
 #include "file.h"
@@ -71,6 +76,9 @@
 #ifndef O_SEQUENTIAL
 #define O_SEQUENTIAL 0
 #endif
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
 #ifndef O_CLOEXEC
 #define O_CLOEXEC 0
 #endif
@@ -436,20 +444,40 @@ bool tr_sys_path_rename(char const* src_path, char const* dst_path, tr_error** e
 }
 
 /* We try to do a fast (in-kernel) copy using a variety of non-portable system
- * calls. If the current implementation does not support in-kernel copying, we
- * use a user-space fallback instead. */
-bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** error)
+ * calls, fastest first: cloning the file, then having the kernel copy all of it,
+ * then copying it a chunk at a time. Each tier picks up where the last one left
+ * off, and the last one is a user-space fallback if nothing else is available. */
+bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_sys_path_copy_method_t* setme_method, tr_error** error)
 {
     TR_ASSERT(src_path != nullptr);
     TR_ASSERT(dst_path != nullptr);
 
+    auto method = TR_SYS_PATH_COPY_CHUNKED;
+
 #if defined(USE_COPYFILE)
-    if (copyfile(src_path, dst_path, nullptr, COPYFILE_CLONE | COPYFILE_ALL) < 0)
+
+    bool copied = false;
+
+#ifdef COPYFILE_CLONE_FORCE
+    /* this fails unless the file can be cloned */
+    if (copyfile(src_path, dst_path, nullptr, COPYFILE_CLONE_FORCE | COPYFILE_ALL) >= 0)
+    {
+        method = TR_SYS_PATH_COPY_CLONE;
+        copied = true;
+    }
+#endif
+
+    if (!copied && copyfile(src_path, dst_path, nullptr, COPYFILE_CLONE | COPYFILE_ALL) < 0)
     {
         set_system_error(error, errno);
         return false;
     }
 
+    if (setme_method != nullptr)
+    {
+        *setme_method = method;
+    }
+
     return true;
 
 #else /* USE_COPYFILE */
@@ -480,64 +508,95 @@ bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** err
 
     uint64_t file_size = info.size;
 
-#if defined(USE_COPY_FILE_RANGE) || defined(USE_SENDFILE64)
+    /* Tier 1: a clone shares the source's blocks, so no data is copied at all. */
+    if (file_size > 0 && tr_sys_file_clone(in, out, nullptr))
+    {
+        method = TR_SYS_PATH_COPY_CLONE;
+        file_size = 0;
+    }
+
+#if defined(USE_COPY_FILE_RANGE)
 
+    /* Tier 2: the kernel copies the data, or has the filesystem do it (e.g. a
+     * server-side copy over NFS). If it can't, e.g. because the files are on
+     * different filesystems, the fallback carries on from wherever it stopped. */
     while (file_size > 0)
     {
-        size_t const chunk_size = std::min(file_size, uint64_t{ SSIZE_MAX });
-        ssize_t const copied =
-#ifdef USE_COPY_FILE_RANGE
-            copy_file_range(in, nullptr, out, nullptr, chunk_size, 0);
-#elif defined(USE_SENDFILE64)
-            sendfile64(out, in, nullptr, chunk_size);
-#else
-#error File copy mechanism not implemented.
-#endif
-        TR_ASSERT(copied == -1 || copied >= 0); /* -1 for error; some non-negative value otherwise. */
-
-        if (copied == -1)
+        uint64_t copied = 0;
+        if (!tr_sys_file_copy_range(in, out, file_size, &copied, nullptr) || copied == 0)
         {
-            set_system_error(error, errno);
             break;
         }
 
-        TR_ASSERT(copied >= 0 && ((uint64_t)copied) <= file_size);
-        TR_ASSERT(copied >= 0 && ((uint64_t)copied) <= chunk_size);
+        TR_ASSERT(copied <= file_size);
+        method = TR_SYS_PATH_COPY_IN_KERNEL;
         file_size -= copied;
     }
 
-#else /* USE_COPY_FILE_RANGE || USE_SENDFILE64 */
-
-    /* Fallback to user-space copy. */
+#endif /* USE_COPY_FILE_RANGE */
 
-    size_t const buflen = 1024 * 1024; /* 1024 KiB buffer */
-    auto* buf = static_cast<char*>(tr_malloc(buflen));
-
-    while (file_size > 0)
+    /* Tier 3: a chunk at a time. */
+    if (file_size > 0)
     {
-        uint64_t const chunk_size = std::min(file_size, uint64_t{ buflen });
-        uint64_t bytes_read;
-        uint64_t bytes_written;
+        method = TR_SYS_PATH_COPY_CHUNKED;
+
+#if defined(USE_SENDFILE64)
 
-        if (!tr_sys_file_read(in, buf, chunk_size, &bytes_read, error))
+        while (file_size > 0)
         {
-            break;
+            size_t const chunk_size = std::min(file_size, uint64_t{ SSIZE_MAX });
+            ssize_t const copied = sendfile64(out, in, nullptr, chunk_size);
+            TR_ASSERT(copied == -1 || copied >= 0); /* -1 for error; some non-negative value otherwise. */
+
+            if (copied == -1)
+            {
+                set_system_error(error, errno);
+                break;
+            }
+
+            if (copied == 0)
+            {
+                break;
+            }
+
+            TR_ASSERT(((uint64_t)copied) <= file_size);
+            TR_ASSERT(((uint64_t)copied) <= chunk_size);
+            file_size -= copied;
         }
 
-        if (!tr_sys_file_write(out, buf, bytes_read, &bytes_written, error))
+#else /* USE_SENDFILE64 */
+
+        /* Fallback to user-space copy. */
+
+        size_t const buflen = 1024 * 1024; /* 1024 KiB buffer */
+        auto* buf = static_cast<char*>(tr_malloc(buflen));
+
+        while (file_size > 0)
         {
-            break;
-        }
+            uint64_t const chunk_size = std::min(file_size, uint64_t{ buflen });
+            uint64_t bytes_read;
+            uint64_t bytes_written;
 
-        TR_ASSERT(bytes_read == bytes_written);
-        TR_ASSERT(bytes_written <= file_size);
-        file_size -= bytes_written;
-    }
+            if (!tr_sys_file_read(in, buf, chunk_size, &bytes_read, error) || bytes_read == 0)
+            {
+                break;
+            }
 
-    /* cleanup */
-    tr_free(buf);
+            if (!tr_sys_file_write(out, buf, bytes_read, &bytes_written, error))
+            {
+                break;
+            }
+
+            TR_ASSERT(bytes_read == bytes_written);
+            TR_ASSERT(bytes_written <= file_size);
+            file_size -= bytes_written;
+        }
 
-#endif /* USE_COPY_FILE_RANGE || USE_SENDFILE64 */
+        /* cleanup */
+        tr_free(buf);
+
+#endif /* USE_SENDFILE64 */
+    }
 
     /* cleanup */
     tr_sys_file_close(out, nullptr);
@@ -545,10 +604,21 @@ bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** err
 
     if (file_size != 0)
     {
+        /* a short read isn't an error to read() or sendfile(), but it is to us */
+        if (error != nullptr && *error == nullptr)
+        {
+            set_system_error(error, EIO);
+        }
+
         tr_error_prefix(error, "Unable to read/write: ");
         return false;
     }
 
+    if (setme_method != nullptr)
+    {
+        *setme_method = method;
+    }
+
     return true;
 
 #endif /* USE_COPYFILE */
@@ -611,7 +681,7 @@ tr_sys_file_t tr_sys_file_open(char const* path, int flags, int permissions, tr_
         int native_value;
     };
 
-    auto constexpr native_map = std::array<native_map_item, 8>{
+    auto constexpr native_map = std::array<native_map_item, 9>{
         { { TR_SYS_FILE_READ | TR_SYS_FILE_WRITE, TR_SYS_FILE_READ | TR_SYS_FILE_WRITE, O_RDWR },
           { TR_SYS_FILE_READ | TR_SYS_FILE_WRITE, TR_SYS_FILE_READ, O_RDONLY },
           { TR_SYS_FILE_READ | TR_SYS_FILE_WRITE, TR_SYS_FILE_WRITE, O_WRONLY },
@@ -619,7 +689,8 @@ tr_sys_file_t tr_sys_file_open(char const* path, int flags, int permissions, tr_
           { TR_SYS_FILE_CREATE_NEW, TR_SYS_FILE_CREATE_NEW, O_CREAT | O_EXCL },
           { TR_SYS_FILE_APPEND, TR_SYS_FILE_APPEND, O_APPEND },
           { TR_SYS_FILE_TRUNCATE, TR_SYS_FILE_TRUNCATE, O_TRUNC },
-          { TR_SYS_FILE_SEQUENTIAL, TR_SYS_FILE_SEQUENTIAL, O_SEQUENTIAL } }
+          { TR_SYS_FILE_SEQUENTIAL, TR_SYS_FILE_SEQUENTIAL, O_SEQUENTIAL },
+          { TR_SYS_FILE_DIRECT, TR_SYS_FILE_DIRECT, O_DIRECT } }
     };
 
     int native_flags = O_BINARY | O_LARGEFILE | O_CLOEXEC;
@@ -640,6 +711,15 @@ tr_sys_file_t tr_sys_file_open(char const* path, int flags, int permissions, tr_
         {
             set_file_for_single_pass(ret);
         }
+
+#ifdef __APPLE__
+
+        if ((flags & TR_SYS_FILE_DIRECT) != 0)
+        {
+            (void)fcntl(ret, F_NOCACHE, 1);
+        }
+
+#endif
     }
     else
     {
@@ -679,6 +759,24 @@ bool tr_sys_file_close(tr_sys_file_t handle, tr_error** error)
     return ret;
 }
 
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+
+#ifdef F_DUPFD_CLOEXEC
+    tr_sys_file_t const ret = fcntl(handle, F_DUPFD_CLOEXEC, 0);
+#else
+    tr_sys_file_t const ret = dup(handle);
+#endif
+
+    if (ret == TR_BAD_SYS_FILE)
+    {
+        set_system_error(error, errno);
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_get_info(tr_sys_file_t handle, tr_sys_path_info* info, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -872,6 +970,104 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    struct evbuffer_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+    /* seek requires signed offset, so it should be in mod range */
+    TR_ASSERT(offset < UINT64_MAX / 2);
+
+    bool ret = true;
+    uint64_t total = 0;
+
+#ifdef HAVE_PWRITEV
+
+    /* the first buffer that isn't completely written yet, and how much of it is */
+    size_t i = 0;
+    size_t skip = 0;
+
+    while (i < iov_count)
+    {
+        auto vec = std::array<struct iovec, 128>{};
+        size_t n = 0;
+
+        for (size_t j = i; j < iov_count && n < std::size(vec); ++j, ++n)
+        {
+            size_t const j_skip = j == i ? skip : 0;
+            vec[n].iov_base = static_cast<char*>(iov[j].iov_base) + j_skip;
+            vec[n].iov_len = iov[j].iov_len - j_skip;
+        }
+
+        ssize_t const my_bytes_written = pwritev(handle, std::data(vec), n, offset + total);
+
+        if (my_bytes_written == -1)
+        {
+            set_system_error(error, errno);
+            ret = false;
+            break;
+        }
+
+        total += my_bytes_written;
+
+        /* move past the parts that were written */
+        auto left = size_t(my_bytes_written);
+        while (i < iov_count && left >= iov[i].iov_len - skip)
+        {
+            left -= iov[i].iov_len - skip;
+            skip = 0;
+            ++i;
+        }
+
+        skip += left;
+
+        if (my_bytes_written == 0 && i < iov_count)
+        {
+            set_system_error(error, EIO);
+            ret = false;
+            break;
+        }
+    }
+
+#else
+
+    for (size_t i = 0; ret && i < iov_count; ++i)
+    {
+        auto const* walk = static_cast<char const*>(iov[i].iov_base);
+        uint64_t left = iov[i].iov_len;
+
+        while (ret && left > 0)
+        {
+            uint64_t n = 0;
+            ret = tr_sys_file_write_at(handle, walk, left, offset + total, &n, error);
+
+            if (ret && n == 0)
+            {
+                set_system_error(error, EIO);
+                ret = false;
+            }
+
+            walk += n;
+            left -= n;
+            total += n;
+        }
+    }
+
+#endif
+
+    if (bytes_written != nullptr)
+    {
+        *bytes_written = total;
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -900,6 +1096,115 @@ bool tr_sys_file_truncate(tr_sys_file_t handle, uint64_t size, tr_error** error)
     return ret;
 }
 
+bool tr_sys_file_find_data(tr_sys_file_t handle, uint64_t offset, uint64_t* data_begin, uint64_t* data_end, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(data_begin != nullptr);
+    TR_ASSERT(data_end != nullptr);
+
+    struct stat sb;
+
+    if (fstat(handle, &sb) == -1)
+    {
+        set_system_error(error, errno);
+        return false;
+    }
+
+    auto const size = std::max(uint64_t(sb.st_size), offset);
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+
+    if (off_t const begin = lseek(handle, offset, SEEK_DATA); begin != -1)
+    {
+        if (off_t const end = lseek(handle, begin, SEEK_HOLE); end != -1)
+        {
+            *data_begin = begin;
+            *data_end = end;
+            return true;
+        }
+    }
+    else if (errno == ENXIO)
+    {
+        /* no data after `offset` */
+        *data_begin = size;
+        *data_end = size;
+        return true;
+    }
+
+    /* EINVAL means the filesystem doesn't support it, so fall back to treating it all as data */
+    if (errno != EINVAL)
+    {
+        set_system_error(error, errno);
+        return false;
+    }
+
+#endif
+
+    *data_begin = offset;
+    *data_end = size;
+    return true;
+}
+
+bool tr_sys_file_clone([[maybe_unused]] tr_sys_file_t in, [[maybe_unused]] tr_sys_file_t out, tr_error** error)
+{
+    TR_ASSERT(in != TR_BAD_SYS_FILE);
+    TR_ASSERT(out != TR_BAD_SYS_FILE);
+
+#if defined(FICLONE)
+
+    if (ioctl(out, FICLONE, in) != -1)
+    {
+        return true;
+    }
+
+    set_system_error(error, errno);
+
+#else
+
+    set_system_error(error, ENOTSUP);
+
+#endif
+
+    return false;
+}
+
+bool tr_sys_file_copy_range(
+    [[maybe_unused]] tr_sys_file_t in,
+    [[maybe_unused]] tr_sys_file_t out,
+    [[maybe_unused]] uint64_t size,
+    uint64_t* bytes_copied,
+    tr_error** error)
+{
+    TR_ASSERT(in != TR_BAD_SYS_FILE);
+    TR_ASSERT(out != TR_BAD_SYS_FILE);
+    TR_ASSERT(bytes_copied != nullptr);
+
+    *bytes_copied = 0;
+
+#if defined(USE_COPY_FILE_RANGE)
+
+    size_t const chunk_size = std::min(size, uint64_t{ SSIZE_MAX });
+    ssize_t const copied = copy_file_range(in, nullptr, out, nullptr, chunk_size, 0);
+    TR_ASSERT(copied == -1 || copied >= 0); /* -1 for error; some non-negative value otherwise. */
+
+    if (copied != -1)
+    {
+        TR_ASSERT(((uint64_t)copied) <= chunk_size);
+        *bytes_copied = copied;
+        return true;
+    }
+
+    set_system_error(error, errno);
+
+#else
+
+    set_system_error(error, ENOTSUP);
+
+#endif
+
+    return false;
+}
+
 bool tr_sys_file_advise(
     [[maybe_unused]] tr_sys_file_t handle,
     [[maybe_unused]] uint64_t offset,
@@ -1046,10 +1351,16 @@ bool tr_sys_file_preallocate(tr_sys_file_t handle, uint64_t size, int flags, tr_
 #ifdef __APPLE__
                 full_preallocate_apple,
 #endif
+            });
+
+        // where the filesystem can't allocate space, the C library's
+        // posix_fallocate() writes to every block that's still a hole
 #ifdef HAVE_POSIX_FALLOCATE
-                full_preallocate_posix,
+        if ((flags & TR_SYS_FILE_PREALLOC_NO_WRITES) == 0)
+        {
+            approaches.push_back(full_preallocate_posix);
+        }
 #endif
-            });
     }
 
     for (auto& approach : approaches) // try until one of them works
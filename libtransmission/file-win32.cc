@@ -13,7 +13,9 @@
 #include <string_view>
 
 #include <shlobj.h> /* SHCreateDirectoryEx() */
-#include <winioctl.h> /* FSCTL_SET_SPARSE */
+#include <winioctl.h> /* FSCTL_SET_SPARSE, FSCTL_QUERY_ALLOCATED_RANGES */
+
+#include <event2/buffer.h> /* struct evbuffer_iovec */
 
 #include "transmission.h"
 #include "crypto-utils.h" /* tr_rand_int() */
@@ -792,7 +794,7 @@ bool tr_sys_path_rename(char const* src_path, char const* dst_path, tr_error** e
     return ret;
 }
 
-bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** error)
+bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_sys_path_copy_method_t* setme_method, tr_error** error)
 {
     TR_ASSERT(src_path != nullptr);
     TR_ASSERT(dst_path != nullptr);
@@ -818,6 +820,12 @@ bool tr_sys_path_copy(char const* src_path, char const* dst_path, tr_error** err
     else
     {
         ret = true;
+
+        /* the copying's done by the system, e.g. as a server-side copy on a network share */
+        if (setme_method != nullptr)
+        {
+            *setme_method = TR_SYS_PATH_COPY_IN_KERNEL;
+        }
     }
 
 out:
@@ -951,6 +959,11 @@ tr_sys_file_t tr_sys_file_open(char const* path, int flags, int /*permissions*/,
         native_flags |= FILE_FLAG_SEQUENTIAL_SCAN;
     }
 
+    if ((flags & TR_SYS_FILE_DIRECT) != 0)
+    {
+        native_flags |= FILE_FLAG_NO_BUFFERING;
+    }
+
     ret = open_file(path, native_access, native_disposition, native_flags, error);
 
     success = ret != TR_BAD_SYS_FILE;
@@ -1008,6 +1021,22 @@ bool tr_sys_file_close(tr_sys_file_t handle, tr_error** error)
     return ret;
 }
 
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+
+    HANDLE const process = GetCurrentProcess();
+    tr_sys_file_t ret = TR_BAD_SYS_FILE;
+
+    if (!DuplicateHandle(process, handle, process, &ret, 0, FALSE, DUPLICATE_SAME_ACCESS))
+    {
+        set_system_error(error, GetLastError());
+        ret = TR_BAD_SYS_FILE;
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_get_info(tr_sys_file_t handle, tr_sys_path_info* info, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -1213,6 +1242,51 @@ bool tr_sys_file_write_at(
     return ret;
 }
 
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    struct evbuffer_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(iov != nullptr || iov_count == 0);
+
+    /* WriteFileGather() needs unbuffered, page-aligned I/O, so write the buffers one at a time */
+    bool ret = true;
+    uint64_t total = 0;
+
+    for (size_t i = 0; ret && i < iov_count; ++i)
+    {
+        auto const* walk = static_cast<char const*>(iov[i].iov_base);
+        uint64_t left = iov[i].iov_len;
+
+        while (ret && left > 0)
+        {
+            uint64_t n = 0;
+            ret = tr_sys_file_write_at(handle, walk, left, offset + total, &n, error);
+
+            if (ret && n == 0)
+            {
+                set_system_error(error, ERROR_WRITE_FAULT);
+                ret = false;
+            }
+
+            walk += n;
+            left -= n;
+            total += n;
+        }
+    }
+
+    if (bytes_written != nullptr)
+    {
+        *bytes_written = total;
+    }
+
+    return ret;
+}
+
 bool tr_sys_file_flush(tr_sys_file_t handle, tr_error** error)
 {
     TR_ASSERT(handle != TR_BAD_SYS_FILE);
@@ -1244,6 +1318,87 @@ bool tr_sys_file_truncate(tr_sys_file_t handle, uint64_t size, tr_error** error)
     return ret;
 }
 
+bool tr_sys_file_find_data(tr_sys_file_t handle, uint64_t offset, uint64_t* data_begin, uint64_t* data_end, tr_error** error)
+{
+    TR_ASSERT(handle != TR_BAD_SYS_FILE);
+    TR_ASSERT(data_begin != nullptr);
+    TR_ASSERT(data_end != nullptr);
+
+    LARGE_INTEGER file_size;
+
+    if (!GetFileSizeEx(handle, &file_size))
+    {
+        set_system_error(error, GetLastError());
+        return false;
+    }
+
+    auto const size = std::max(uint64_t(file_size.QuadPart), offset);
+
+    /* only the first allocated range is wanted, so ERROR_MORE_DATA is fine */
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    query.FileOffset.QuadPart = offset;
+    query.Length.QuadPart = size - offset;
+    FILE_ALLOCATED_RANGE_BUFFER range;
+    DWORD bytes_returned = 0;
+
+    if (DeviceIoControl(
+            handle,
+            FSCTL_QUERY_ALLOCATED_RANGES,
+            &query,
+            sizeof(query),
+            &range,
+            sizeof(range),
+            &bytes_returned,
+            nullptr) ||
+        GetLastError() == ERROR_MORE_DATA)
+    {
+        if (bytes_returned < sizeof(range))
+        {
+            /* no data after `offset` */
+            *data_begin = size;
+            *data_end = size;
+        }
+        else
+        {
+            *data_begin = std::max(uint64_t(range.FileOffset.QuadPart), offset);
+            *data_end = std::min(uint64_t(range.FileOffset.QuadPart + range.Length.QuadPart), size);
+        }
+
+        return true;
+    }
+
+    /* the filesystem doesn't support it, so treat it all as data */
+    *data_begin = offset;
+    *data_end = size;
+    return true;
+}
+
+bool tr_sys_file_clone([[maybe_unused]] tr_sys_file_t in, [[maybe_unused]] tr_sys_file_t out, tr_error** error)
+{
+    TR_ASSERT(in != TR_BAD_SYS_FILE);
+    TR_ASSERT(out != TR_BAD_SYS_FILE);
+
+    /* cloning isn't supported on Windows */
+    set_system_error(error, ERROR_NOT_SUPPORTED);
+    return false;
+}
+
+bool tr_sys_file_copy_range(
+    [[maybe_unused]] tr_sys_file_t in,
+    [[maybe_unused]] tr_sys_file_t out,
+    uint64_t /*size*/,
+    uint64_t* bytes_copied,
+    tr_error** error)
+{
+    TR_ASSERT(in != TR_BAD_SYS_FILE);
+    TR_ASSERT(out != TR_BAD_SYS_FILE);
+    TR_ASSERT(bytes_copied != nullptr);
+
+    *bytes_copied = 0;
+    set_system_error(error, ERROR_NOT_SUPPORTED);
+    return false;
+}
+
 bool tr_sys_file_advise(
     [[maybe_unused]] tr_sys_file_t handle,
     uint64_t /*offset*/,
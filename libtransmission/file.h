@@ -19,6 +19,7 @@
 
 #include "tr-macros.h"
 
+struct evbuffer_iovec;
 struct tr_error;
 
 /**
@@ -68,7 +69,9 @@ enum tr_sys_file_open_flags_t
     TR_SYS_FILE_CREATE_NEW = (1 << 3),
     TR_SYS_FILE_APPEND = (1 << 4),
     TR_SYS_FILE_TRUNCATE = (1 << 5),
-    TR_SYS_FILE_SEQUENTIAL = (1 << 6)
+    TR_SYS_FILE_SEQUENTIAL = (1 << 6),
+    /* bypass the OS page cache; see tr_directIoRead() for how to do I/O with it */
+    TR_SYS_FILE_DIRECT = (1 << 7)
 };
 
 enum tr_seek_origin_t
@@ -99,7 +102,9 @@ enum tr_sys_file_advice_t
 
 enum tr_sys_file_preallocate_flags_t
 {
-    TR_SYS_FILE_PREALLOC_SPARSE = (1 << 0)
+    TR_SYS_FILE_PREALLOC_SPARSE = (1 << 0),
+    /* only allocate space, without writing to the file, so that it's safe to write to it meanwhile */
+    TR_SYS_FILE_PREALLOC_NO_WRITES = (1 << 1)
 };
 
 enum tr_sys_dir_create_flags_t
@@ -107,6 +112,17 @@ enum tr_sys_dir_create_flags_t
     TR_SYS_DIR_CREATE_PARENTS = (1 << 0)
 };
 
+/* how tr_sys_path_copy() copied a file, fastest first */
+enum tr_sys_path_copy_method_t
+{
+    /* the copy shares the original's data blocks, e.g. a reflink. No data was copied */
+    TR_SYS_PATH_COPY_CLONE,
+    /* the kernel or the filesystem copied the data, e.g. with `copy_file_range()` */
+    TR_SYS_PATH_COPY_IN_KERNEL,
+    /* the data was copied a chunk at a time */
+    TR_SYS_PATH_COPY_CHUNKED
+};
+
 enum tr_sys_path_type_t
 {
     TR_SYS_PATH_IS_FILE,
@@ -139,14 +155,23 @@ struct tr_sys_path_info
  * @brief Portability wrapper for various in-kernel file copy functions, with a
  *        fallback to a userspace read/write loop.
  *
- * @param[in]  src_path  Path to source file.
- * @param[in]  dst_path  Path to destination file.
- * @param[out] error     Pointer to error object. Optional, pass `nullptr` if
- *                       you are not interested in error details.
+ * The fastest way that works is used: cloning the file if the filesystem can
+ * do that, then having the kernel copy the whole file, then copying it in chunks.
+ *
+ * @param[in]  src_path     Path to source file.
+ * @param[in]  dst_path     Path to destination file.
+ * @param[out] setme_method How the file was copied. Optional, pass `nullptr` if
+ *                          you are not interested.
+ * @param[out] error        Pointer to error object. Optional, pass `nullptr` if
+ *                          you are not interested in error details.
  *
  * @return `True` on success, `false` otherwise (with `error` set accordingly).
  */
-bool tr_sys_path_copy(char const* src_path, char const* dst_path, struct tr_error** error);
+bool tr_sys_path_copy(
+    char const* src_path,
+    char const* dst_path,
+    tr_sys_path_copy_method_t* setme_method,
+    struct tr_error** error);
 
 /**
  * @brief Portability wrapper for `stat()`.
@@ -335,6 +360,22 @@ tr_sys_file_t tr_sys_file_open_temp(char* path_template, struct tr_error** error
  */
 bool tr_sys_file_close(tr_sys_file_t handle, struct tr_error** error);
 
+/**
+ * @brief Portability wrapper for `dup()`.
+ *
+ * The duplicate refers to the same open file and stays valid after the
+ * original descriptor is closed, which lets another thread finish its I/O
+ * even if the original is evicted from the open files cache meanwhile.
+ *
+ * @param[in]  handle Valid file descriptor.
+ * @param[out] error  Pointer to error object. Optional, pass `nullptr` if you
+ *                    are not interested in error details.
+ *
+ * @return Duplicated file descriptor on success, `TR_BAD_SYS_FILE` otherwise
+ *         (with `error` set accordingly).
+ */
+tr_sys_file_t tr_sys_file_dup(tr_sys_file_t handle, struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `fstat()`.
  *
@@ -448,6 +489,33 @@ bool tr_sys_file_write_at(
     uint64_t* bytes_written,
     struct tr_error** error);
 
+/**
+ * @brief Like `pwritev()`, except that the position is undefined afterwards.
+ *        Not thread-safe.
+ *
+ * Unlike @ref tr_sys_file_write_at, this keeps writing after short writes
+ * until all the buffers are written or an error occurs.
+ *
+ * @param[in]  handle        Valid file descriptor.
+ * @param[in]  iov           Buffers to get data being written from, e.g.
+ *                           the ones returned by `evbuffer_peek()`.
+ * @param[in]  iov_count     Number of buffers in `iov`.
+ * @param[in]  offset        File offset in bytes to start writing from.
+ * @param[out] bytes_written Number of bytes actually written. Optional, pass
+ *                           `nullptr` if you are not interested.
+ * @param[out] error         Pointer to error object. Optional, pass `nullptr`
+ *                          if you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_write_at_v(
+    tr_sys_file_t handle,
+    struct evbuffer_iovec const* iov,
+    size_t iov_count,
+    uint64_t offset,
+    uint64_t* bytes_written,
+    struct tr_error** error);
+
 /**
  * @brief Portability wrapper for `fsync()`.
  *
@@ -489,6 +557,69 @@ bool tr_sys_file_advise(
     tr_sys_file_advice_t advice,
     struct tr_error** error);
 
+/**
+ * @brief Find the next part of a file that has data in it, skipping over holes.
+ *
+ * On filesystems that can't tell holes from data, everything from `offset`
+ * to the end of the file is reported as data. The file position may change.
+ *
+ * @param[in]  handle     Valid file descriptor.
+ * @param[in]  offset     Offset in file to start looking from.
+ * @param[out] data_begin Offset of the first byte of data at or after `offset`,
+ *                        or the file's size if there is none.
+ * @param[out] data_end   Offset where that data ends, i.e. where the next hole
+ *                        or the end of the file begins.
+ * @param[out] error      Pointer to error object. Optional, pass `nullptr` if
+ *                        you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_find_data(
+    tr_sys_file_t handle,
+    uint64_t offset,
+    uint64_t* data_begin,
+    uint64_t* data_end,
+    struct tr_error** error);
+
+/**
+ * @brief Make a file into a clone of another one, sharing its data blocks
+ *        instead of copying them, e.g. a reflink on Btrfs or XFS.
+ *
+ * Only works when the filesystem supports it and both files are on it.
+ *
+ * @param[in]  in    Valid file descriptor to clone.
+ * @param[in]  out   Valid file descriptor, opened for writing, to become the clone.
+ * @param[out] error Pointer to error object. Optional, pass `nullptr` if you
+ *                   are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly).
+ */
+bool tr_sys_file_clone(tr_sys_file_t in, tr_sys_file_t out, struct tr_error** error);
+
+/**
+ * @brief Have the kernel copy data between two files, e.g. with `copy_file_range()`.
+ *
+ * The data is copied from and to both files' current positions, which are then
+ * moved past it, so a user-space copy can carry on from wherever this stopped.
+ * Filesystems that can, such as NFS and SMB, copy it on the server.
+ *
+ * @param[in]  in            Valid file descriptor to copy from.
+ * @param[in]  out           Valid file descriptor, opened for writing, to copy to.
+ * @param[in]  size          Number of bytes to copy.
+ * @param[out] bytes_copied  Number of bytes copied. 0 means `in` is at its end.
+ * @param[out] error         Pointer to error object. Optional, pass `nullptr` if
+ *                           you are not interested in error details.
+ *
+ * @return `True` on success, `false` otherwise (with `error` set accordingly),
+ *         e.g. if the files are on different filesystems that can't do this.
+ */
+bool tr_sys_file_copy_range(
+    tr_sys_file_t in,
+    tr_sys_file_t out,
+    uint64_t size,
+    uint64_t* bytes_copied,
+    struct tr_error** error);
+
 /**
  * @brief Preallocate file to specified size in full or sparse mode.
  *
@@ -15,6 +15,7 @@
 
 #include "transmission.h"
 #include "clients.h"
+#include "crypto-pool.h"
 #include "crypto-utils.h"
 #include "handshake.h"
 #include "log.h"
@@ -101,6 +102,8 @@ enum handshake_state_t
     AWAITING_VC,
     AWAITING_CRYPTO_SELECT,
     AWAITING_PAD_D,
+    /* either way */
+    AWAITING_SECRET,
     /* */
     N_STATES
 };
@@ -124,6 +127,10 @@ struct tr_handshake
 
     std::optional<tr_peer_id_t> peer_id;
 
+    /* where to pick up once the crypto pool has computed the DH secret */
+    ReadState (*after_secret)(tr_handshake* handshake);
+    bool isComputingSecret;
+
     tr_handshake_done_func done_func;
     void* done_func_user_data;
 };
@@ -157,7 +164,8 @@ static char const* getStateName(handshake_state_t const state)
         "awaiting yb", /* AWAITING_YB */
         "awaiting vc", /* AWAITING_VC */
         "awaiting crypto select", /* AWAITING_CRYPTO_SELECT */
-        "awaiting pad d" /* AWAITING_PAD_D */
+        "awaiting pad d", /* AWAITING_PAD_D */
+        "awaiting secret" /* AWAITING_SECRET */
     };
 
     return state < N_STATES ? state_strings[state] : "unknown state";
@@ -211,6 +219,43 @@ static bool buildHandshakeMessage(tr_handshake* handshake, uint8_t* buf)
 
 static ReadState tr_handshakeDone(tr_handshake* handshake, bool isConnected);
 
+static void onSecretComputed(void* vhandshake, bool ok)
+{
+    auto* const handshake = static_cast<tr_handshake*>(vhandshake);
+    auto* const io = handshake->io;
+
+    handshake->isComputingSecret = false;
+
+    /* keep the io around in case the handshake is done with it */
+    tr_peerIoRef(io);
+
+    if (auto const ret = ok ? (*handshake->after_secret)(handshake) : tr_handshakeDone(handshake, false); ret != READ_ERR)
+    {
+        /* the peer may have sent more while we were waiting */
+        tr_peerIoReadAgain(io);
+    }
+
+    tr_peerIoUnref(io);
+}
+
+/* compute the DH secret, on one of the crypto pool's threads if there is one, then carry on with `then` */
+static ReadState computeSecret(tr_handshake* handshake, uint8_t const* peer_public_key, ReadState (*then)(tr_handshake*))
+{
+    auto* const pool = handshake->session->cryptoPool;
+
+    if (pool == nullptr)
+    {
+        bool const ok = tr_cryptoComputeSecret(handshake->crypto, peer_public_key);
+        return ok ? then(handshake) : tr_handshakeDone(handshake, false);
+    }
+
+    handshake->after_secret = then;
+    handshake->isComputingSecret = true;
+    setState(handshake, AWAITING_SECRET);
+    tr_cryptoPoolComputeSecret(pool, handshake->crypto, peer_public_key, onSecretComputed, handshake);
+    return READ_LATER;
+}
+
 enum handshake_parse_err_t
 {
     HANDSHAKE_OK,
@@ -287,7 +332,11 @@ static handshake_parse_err_t parseHandshake(tr_handshake* handshake, struct evbu
 /* 1 A->B: Diffie Hellman Ya, PadA */
 static void sendYa(tr_handshake* handshake)
 {
-    /* add our public key (Ya) */
+    /* add our public key (Ya), using one that was made ahead of time if there is one */
+    if (handshake->session->cryptoPool != nullptr)
+    {
+        tr_cryptoPoolTakeKey(handshake->session->cryptoPool, handshake->crypto);
+    }
 
     int len = 0;
     uint8_t const* const public_key = tr_cryptoGetMyPublicKey(handshake->crypto, &len);
@@ -365,6 +414,8 @@ static auto computeRequestHash(tr_handshake const* handshake, std::string_view n
     return tr_cryptoSecretKeySha1(handshake->crypto, std::data(name), std::size(name), "", 0);
 }
 
+static ReadState sendCryptoProvide(tr_handshake* handshake);
+
 static ReadState readYb(tr_handshake* handshake, struct evbuffer* inbuf)
 {
     uint8_t yb[KEY_LEN];
@@ -401,12 +452,11 @@ static ReadState readYb(tr_handshake* handshake, struct evbuffer* inbuf)
 
     /* compute the secret */
     evbuffer_remove(inbuf, yb, KEY_LEN);
+    return computeSecret(handshake, yb, sendCryptoProvide);
+}
 
-    if (!tr_cryptoComputeSecret(handshake->crypto, yb))
-    {
-        return tr_handshakeDone(handshake, false);
-    }
-
+static ReadState sendCryptoProvide(tr_handshake* handshake)
+{
     /* now send these: HASH('req1', S), HASH('req2', SKEY) xor HASH('req3', S),
      * ENCRYPT(VC, crypto_provide, len(PadC), PadC, len(IA)), ENCRYPT(IA) */
     evbuffer* const outbuf = evbuffer_new();
@@ -713,6 +763,8 @@ static ReadState readPeerId(tr_handshake* handshake, struct evbuffer* inbuf)
     return tr_handshakeDone(handshake, !connected_to_self);
 }
 
+static ReadState sendYb(tr_handshake* handshake);
+
 static ReadState readYa(tr_handshake* handshake, struct evbuffer* inbuf)
 {
     dbgmsg(handshake, "in readYa... need %d, have %zu", KEY_LEN, evbuffer_get_length(inbuf));
@@ -722,15 +774,20 @@ static ReadState readYa(tr_handshake* handshake, struct evbuffer* inbuf)
         return READ_LATER;
     }
 
-    /* read the incoming peer's public key */
+    /* read the incoming peer's public key, and use one of ours that was made ahead of time if there is one */
     uint8_t ya[KEY_LEN];
     evbuffer_remove(inbuf, ya, KEY_LEN);
 
-    if (!tr_cryptoComputeSecret(handshake->crypto, ya))
+    if (handshake->session->cryptoPool != nullptr)
     {
-        return tr_handshakeDone(handshake, false);
+        tr_cryptoPoolTakeKey(handshake->session->cryptoPool, handshake->crypto);
     }
 
+    return computeSecret(handshake, ya, sendYb);
+}
+
+static ReadState sendYb(tr_handshake* handshake)
+{
     auto req1 = computeRequestHash(handshake, "req1"sv);
     if (!req1)
     {
@@ -1058,6 +1115,11 @@ static ReadState canRead(tr_peerIo* io, void* vhandshake, size_t* piece)
             ret = readPadD(handshake, inbuf);
             break;
 
+        case AWAITING_SECRET:
+            /* the crypto pool will call us back */
+            ret = READ_LATER;
+            break;
+
         default:
 #ifdef TR_ENABLE_ASSERTS
             TR_ASSERT_MSG(false, "unhandled handshake state %d", (int)handshake->state);
@@ -1103,6 +1165,11 @@ static bool fireDoneFunc(tr_handshake* handshake, bool isConnected)
 
 static void tr_handshakeFree(tr_handshake* handshake)
 {
+    if (handshake->isComputingSecret)
+    {
+        tr_cryptoPoolCancel(handshake->session->cryptoPool, handshake->crypto);
+    }
+
     if (handshake->io != nullptr)
     {
         tr_peerIoUnref(handshake->io); /* balanced by the ref in tr_handshakeNew */
@@ -8,19 +8,28 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <atomic>
 #include <cstdlib> /* abort() */
 #include <optional>
+#include <string>
 #include <vector>
 
+#include <event2/buffer.h>
+#include <event2/event.h> /* LIBEVENT_VERSION_NUMBER */
+
 #include "transmission.h"
 #include "cache.h" /* tr_cacheReadBlock() */
 #include "crypto-utils.h"
+#include "direct-io.h"
+#include "disk-io.h"
 #include "error.h"
 #include "fdlimit.h"
 #include "file.h"
 #include "inout.h"
 #include "log.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
+#include "prealloc.h"
+#include "session.h"
 #include "stats.h" /* tr_statsFileCreated() */
 #include "torrent.h"
 #include "tr-assert.h"
@@ -41,26 +50,9 @@ enum
 };
 
 /* returns 0 on success, or an errno on failure */
-static int readOrWriteBytes(
-    tr_session* session,
-    tr_torrent* tor,
-    int ioMode,
-    tr_file_index_t file_index,
-    uint64_t file_offset,
-    void* buf,
-    size_t buflen)
+static int getFile(tr_session* session, tr_torrent* tor, bool doWrite, tr_file_index_t file_index, tr_sys_file_t* setme)
 {
     int err = 0;
-    bool const doWrite = ioMode >= TR_IO_WRITE;
-
-    auto const file_size = tor->fileSize(file_index);
-    TR_ASSERT(file_size == 0 || file_offset < file_size);
-    TR_ASSERT(file_offset + buflen <= file_size);
-
-    if (file_size == 0)
-    {
-        return 0;
-    }
 
     /***
     ****  Find the fd
@@ -94,6 +86,8 @@ static int readOrWriteBytes(
             auto const prealloc = (!doWrite || !tor->fileIsWanted(file_index)) ? TR_PREALLOCATE_NONE :
                                                                                  tor->session->preallocationMode;
 
+            auto const file_size = tor->fileSize(file_index);
+
             fd = tr_fdFileCheckout(session, tor->uniqueId, file_index, filename.c_str(), doWrite, prealloc, file_size);
             if (fd == TR_BAD_SYS_FILE)
             {
@@ -110,6 +104,39 @@ static int readOrWriteBytes(
         tr_free(subpath);
     }
 
+    if (err == 0 && doWrite)
+    {
+        tor->markFileWritten(file_index);
+    }
+
+    *setme = fd;
+    return err;
+}
+
+/* returns 0 on success, or an errno on failure */
+static int readOrWriteBytes(
+    tr_session* session,
+    tr_torrent* tor,
+    int ioMode,
+    tr_file_index_t file_index,
+    uint64_t file_offset,
+    void* buf,
+    size_t buflen)
+{
+    bool const doWrite = ioMode >= TR_IO_WRITE;
+
+    auto const file_size = tor->fileSize(file_index);
+    TR_ASSERT(file_size == 0 || file_offset < file_size);
+    TR_ASSERT(file_offset + buflen <= file_size);
+
+    if (file_size == 0)
+    {
+        return 0;
+    }
+
+    auto fd = tr_sys_file_t{};
+    int err = getFile(session, tor, doWrite, file_index, &fd);
+
     /***
     ****  Use the fd
     ***/
@@ -117,10 +144,13 @@ static int readOrWriteBytes(
     if (err == 0)
     {
         tr_error* error = nullptr;
+        bool const direct = tr_fdFileIsDirect(session, tor->uniqueId, file_index);
+        auto const vec = evbuffer_iovec{ buf, buflen };
 
         if (ioMode == TR_IO_READ)
         {
-            if (!tr_sys_file_read_at(fd, buf, buflen, file_offset, nullptr, &error))
+            if (!(direct ? tr_directIoRead(fd, &vec, 1, file_offset, &error) :
+                           tr_sys_file_read_at(fd, buf, buflen, file_offset, nullptr, &error)))
             {
                 err = error->code;
                 tr_logAddTorErr(tor, "read failed for \"%s\": %s", tor->fileSubpath(file_index).c_str(), error->message);
@@ -129,7 +159,10 @@ static int readOrWriteBytes(
         }
         else if (ioMode == TR_IO_WRITE)
         {
-            if (!tr_sys_file_write_at(fd, buf, buflen, file_offset, nullptr, &error))
+            tr_preallocClaim(session, tor->uniqueId, file_index, file_offset, buflen);
+
+            if (!(direct ? tr_directIoWrite(fd, &vec, 1, file_offset, file_size, &error) :
+                           tr_sys_file_write_at(fd, buf, buflen, file_offset, nullptr, &error)))
             {
                 err = error->code;
                 tr_logAddTorErr(tor, "write failed for \"%s\": %s", tor->fileSubpath(file_index).c_str(), error->message);
@@ -138,7 +171,11 @@ static int readOrWriteBytes(
         }
         else if (ioMode == TR_IO_PREFETCH)
         {
-            tr_sys_file_advise(fd, file_offset, buflen, TR_SYS_FILE_ADVICE_WILL_NEED, nullptr);
+            /* don't pull the file into the page cache that it's meant to bypass */
+            if (!direct)
+            {
+                tr_sys_file_advise(fd, file_offset, buflen, TR_SYS_FILE_ADVICE_WILL_NEED, nullptr);
+            }
         }
         else
         {
@@ -202,6 +239,481 @@ int tr_ioWrite(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, uin
     return readOrWritePiece(tor, TR_IO_WRITE, pieceIndex, begin, (uint8_t*)buf, len);
 }
 
+/****
+*****  Vectored and asynchronous IO
+****/
+
+namespace
+{
+
+struct io_segment
+{
+    tr_sys_file_t fd;
+    tr_file_index_t file_index;
+    uint64_t file_offset;
+    size_t len;
+    uint64_t file_size;
+
+    /* whether the file was opened with TR_SYS_FILE_DIRECT */
+    bool is_direct;
+};
+
+struct io_job
+{
+    int ioMode;
+    int torrent_id;
+
+    /* the memory to read into or write from */
+    std::vector<evbuffer_iovec> iov;
+
+    /* where it goes on disk, split at file boundaries */
+    std::vector<io_segment> segments;
+
+    /* whether the segments' descriptors are duplicates that the job must close */
+    bool owns_fds;
+
+    /* one per segment */
+    std::vector<tr_disk_io_file_op> ops;
+
+    /* filled in from the first op that failed */
+    int err = 0;
+    tr_file_index_t err_file_index = 0;
+    std::string errmsg;
+
+    tr_io_done_func callback;
+    void* callback_data;
+};
+
+} // namespace
+
+static void closeSegments(io_job* job)
+{
+    for (auto& segment : job->segments)
+    {
+        if (job->owns_fds && segment.fd != TR_BAD_SYS_FILE)
+        {
+            tr_sys_file_close(segment.fd, nullptr);
+        }
+
+        segment.fd = TR_BAD_SYS_FILE;
+    }
+}
+
+/* take the next `len` bytes' worth of iovecs, splitting the ones that straddle the end */
+static std::vector<evbuffer_iovec> takeIovecs(std::vector<evbuffer_iovec> const& iov, size_t* index, size_t* skip, size_t len)
+{
+    auto ret = std::vector<evbuffer_iovec>{};
+
+    while (len > 0 && *index < std::size(iov))
+    {
+        auto const& vec = iov[*index];
+        size_t const n = std::min(len, vec.iov_len - *skip);
+        ret.push_back({ static_cast<char*>(vec.iov_base) + *skip, n });
+        len -= n;
+        *skip += n;
+
+        if (*skip == vec.iov_len)
+        {
+            ++*index;
+            *skip = 0;
+        }
+    }
+
+    return ret;
+}
+
+/* describe the job as one file op per segment */
+static void buildFileOps(io_job* job)
+{
+    auto index = size_t{};
+    auto skip = size_t{};
+
+    job->ops.clear();
+    job->ops.reserve(std::size(job->segments));
+
+    for (auto const& segment : job->segments)
+    {
+        auto vecs = takeIovecs(job->iov, &index, &skip, segment.len);
+        job->ops.push_back({ segment.fd,
+                             job->ioMode == TR_IO_WRITE,
+                             segment.file_offset,
+                             std::move(vecs),
+                             0,
+                             segment.is_direct,
+                             segment.file_size });
+    }
+}
+
+static void takeFileOpsError(io_job* job)
+{
+    for (size_t i = 0, n = std::size(job->ops); i < n; ++i)
+    {
+        if (int const err = job->ops[i].err; err != 0)
+        {
+            job->err = err;
+            job->err_file_index = job->segments[i].file_index;
+            job->errmsg = tr_strerror(err);
+            break;
+        }
+    }
+}
+
+static void logJobError(tr_torrent* tor, io_job const* job)
+{
+    auto const subpath = tor->fileSubpath(job->err_file_index);
+
+    if (job->ioMode == TR_IO_READ)
+    {
+        tr_logAddTorErr(tor, "read failed for \"%s\": %s", subpath.c_str(), job->errmsg.c_str());
+    }
+    else
+    {
+        tr_logAddTorErr(tor, "write failed for \"%s\": %s", subpath.c_str(), job->errmsg.c_str());
+    }
+}
+
+static void setJobError(tr_torrent* tor, io_job const* job, int err)
+{
+    if (job->ioMode == TR_IO_WRITE && tor->error != TR_STAT_LOCAL_ERROR)
+    {
+        auto const path = tr_strvPath(tor->downloadDir().sv(), tor->fileSubpath(job->err_file_index));
+        tor->setLocalError(tr_strvJoin(tr_strerror(err), " ("sv, path, ")"sv));
+    }
+}
+
+static void ioJobDone(tr_session* session, void* vjob, bool cancelled)
+{
+    auto* const job = static_cast<io_job*>(vjob);
+
+    closeSegments(job);
+
+    if (!cancelled)
+    {
+        takeFileOpsError(job);
+    }
+
+    int const err = cancelled ? ECANCELED : job->err;
+
+    if (!cancelled && err != 0)
+    {
+        if (auto* const tor = tr_torrentFindFromId(session, job->torrent_id); tor != nullptr)
+        {
+            logJobError(tor, job);
+            setJobError(tor, job, err);
+        }
+    }
+
+    if (job->callback != nullptr)
+    {
+        job->callback(session, err, job->callback_data);
+    }
+
+    delete job;
+}
+
+/* Find and open the files on this thread, since that needs the torrent and the
+ * open files cache. A job for a worker thread gets its own duplicates of the
+ * descriptors so that it isn't affected if the cache closes the originals. */
+static int prepareJob(tr_torrent* tor, io_job* job, tr_piece_index_t pieceIndex, uint32_t pieceOffset, size_t buflen)
+{
+    if (pieceIndex >= tor->pieceCount())
+    {
+        return EINVAL;
+    }
+
+    bool const doWrite = job->ioMode >= TR_IO_WRITE;
+    auto [file_index, file_offset] = tor->fileOffset(pieceIndex, pieceOffset);
+    int err = 0;
+
+    while (buflen != 0 && err == 0)
+    {
+        uint64_t const bytes_this_pass = std::min(uint64_t{ buflen }, uint64_t{ tor->fileSize(file_index) - file_offset });
+
+        if (bytes_this_pass != 0)
+        {
+            job->err_file_index = file_index;
+
+            auto fd = tr_sys_file_t{};
+            err = getFile(tor->session, tor, doWrite, file_index, &fd);
+
+            if (err == 0 && job->owns_fds)
+            {
+                tr_error* error = nullptr;
+                fd = tr_sys_file_dup(fd, &error);
+
+                if (fd == TR_BAD_SYS_FILE)
+                {
+                    err = error->code;
+                    tr_logAddTorErr(tor, "couldn't duplicate file descriptor: %s", error->message);
+                    tr_error_free(error);
+                }
+            }
+
+            if (err == 0)
+            {
+                /* a duplicate shares the original's O_DIRECT, so ask how the cached file was opened */
+                job->segments.push_back({ fd,
+                                          file_index,
+                                          file_offset,
+                                          size_t(bytes_this_pass),
+                                          tor->fileSize(file_index),
+                                          tr_fdFileIsDirect(tor->session, tor->uniqueId, file_index) });
+
+                if (doWrite)
+                {
+                    tr_preallocClaim(tor->session, tor->uniqueId, file_index, file_offset, bytes_this_pass);
+                }
+            }
+        }
+
+        buflen -= bytes_this_pass;
+        ++file_index;
+        file_offset = 0;
+    }
+
+    if (err != 0)
+    {
+        setJobError(tor, job, err);
+        closeSegments(job);
+    }
+
+    return err;
+}
+
+static std::vector<evbuffer_iovec> peekIovecs(evbuffer* buf)
+{
+    auto iov = std::vector<evbuffer_iovec>(evbuffer_peek(buf, -1, nullptr, nullptr, 0));
+    evbuffer_peek(buf, -1, nullptr, std::data(iov), std::size(iov));
+    return iov;
+}
+
+/* Queue it behind the first file's device, in the order of the torrent's bytes.
+ * Reading a high-priority torrent or file is the closest thing to someone
+ * waiting on it, e.g. to watch a video as it downloads */
+static tr_disk_io_sched getJobSched(tr_torrent* tor, io_job const* job, tr_piece_index_t pieceIndex, uint32_t pieceOffset)
+{
+    bool const is_urgent = tr_torrentGetPriority(tor) == TR_PRI_HIGH || tor->piecePriority(pieceIndex) == TR_PRI_HIGH;
+
+    auto sched = tr_disk_io_sched{};
+    sched.priority = job->ioMode == TR_IO_READ && is_urgent ? TR_DISK_IO_INTERACTIVE : TR_DISK_IO_NORMAL;
+    sched.object = uint64_t(tor->uniqueId);
+    sched.offset = tor->offset(pieceIndex, pieceOffset);
+
+    if (!std::empty(job->segments))
+    {
+        auto const file_index = job->segments.front().file_index;
+        sched.device = tr_fdFileGetDevice(tor->session, tor->uniqueId, file_index);
+    }
+
+    return sched;
+}
+
+static int submitJob(
+    tr_torrent* tor,
+    void const* owner,
+    int ioMode,
+    tr_piece_index_t pieceIndex,
+    uint32_t pieceOffset,
+    std::vector<evbuffer_iovec>&& iov,
+    size_t len,
+    tr_io_done_func callback,
+    void* callback_data)
+{
+    auto* const io = tor->session->diskIo;
+    TR_ASSERT(io != nullptr);
+
+    auto* const job = new io_job{};
+    job->ioMode = ioMode;
+    job->torrent_id = tr_torrentId(tor);
+    job->iov = std::move(iov);
+    job->owns_fds = true;
+    job->callback = callback;
+    job->callback_data = callback_data;
+
+    if (int const err = prepareJob(tor, job, pieceIndex, pieceOffset, len); err != 0)
+    {
+        delete job;
+        return err;
+    }
+
+    buildFileOps(job);
+    auto const sched = getJobSched(tor, job, pieceIndex, pieceOffset);
+    tr_diskIoSubmitFileOps(io, owner, sched, std::data(job->ops), std::size(job->ops), ioJobDone, job);
+    return 0;
+}
+
+int tr_ioWriteBuf(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin, struct evbuffer* writeme)
+{
+    auto job = io_job{};
+    job.ioMode = TR_IO_WRITE;
+    job.torrent_id = tr_torrentId(tor);
+    job.iov = peekIovecs(writeme);
+    job.owns_fds = false;
+
+    int err = prepareJob(tor, &job, pieceIndex, begin, evbuffer_get_length(writeme));
+
+    if (err == 0)
+    {
+        buildFileOps(&job);
+        tr_diskIoRunFileOps(std::data(job.ops), std::size(job.ops));
+        takeFileOpsError(&job);
+        closeSegments(&job);
+        err = job.err;
+
+        if (err != 0)
+        {
+            logJobError(tor, &job);
+            setJobError(tor, &job, err);
+        }
+    }
+
+    return err;
+}
+
+int tr_ioReadAsync(
+    tr_torrent* tor,
+    void const* owner,
+    tr_piece_index_t pieceIndex,
+    uint32_t begin,
+    uint32_t len,
+    uint8_t* setme,
+    tr_io_done_func callback,
+    void* callback_data)
+{
+    auto iov = std::vector<evbuffer_iovec>{ { setme, len } };
+    return submitJob(tor, owner, TR_IO_READ, pieceIndex, begin, std::move(iov), len, callback, callback_data);
+}
+
+int tr_ioWriteAsync(
+    tr_torrent* tor,
+    void const* owner,
+    tr_piece_index_t pieceIndex,
+    uint32_t begin,
+    struct evbuffer* writeme,
+    tr_io_done_func callback,
+    void* callback_data)
+{
+    auto const len = evbuffer_get_length(writeme);
+    return submitJob(tor, owner, TR_IO_WRITE, pieceIndex, begin, peekIovecs(writeme), len, callback, callback_data);
+}
+
+/****
+*****  Zero-copy reads
+****/
+
+/* libevent only sends POSIX descriptors, and it can only say when it's done
+ * with one since 2.1.2, which is needed to keep count of the duplicates */
+#if !defined(_WIN32) && LIBEVENT_VERSION_NUMBER >= 0x02010200
+#define HAVE_COUNTED_FILE_SEGMENTS
+#endif
+
+#ifdef HAVE_COUNTED_FILE_SEGMENTS
+
+/* The duplicate descriptors that the segments in peers' output buffers are holding.
+ * They're on top of the open files cache's, so they get the same limit; the blocks
+ * past that are copied instead. Atomic because peers' buffers can be freed by the
+ * threads that write them. */
+static std::atomic<size_t> n_file_segments = 0;
+
+static void onFileSegmentFreed(evbuffer_file_segment const* /*segment*/, int /*flags*/, void* /*arg*/)
+{
+    --n_file_segments;
+}
+
+/* returns 0 on success, or an errno on failure */
+static int addFileSegment(tr_torrent* tor, tr_sys_file_t fd, uint64_t file_offset, uint64_t len, evbuffer* buf)
+{
+    if (n_file_segments >= tor->session->openFileLimit)
+    {
+        return ENOTSUP;
+    }
+
+    tr_error* error = nullptr;
+    fd = tr_sys_file_dup(fd, &error);
+
+    if (fd == TR_BAD_SYS_FILE)
+    {
+        int const err = error->code;
+        tr_logAddTorErr(tor, "couldn't duplicate file descriptor: %s", error->message);
+        tr_error_free(error);
+        return err;
+    }
+
+    auto* const segment = evbuffer_file_segment_new(fd, ev_off_t(file_offset), ev_off_t(len), EVBUF_FS_CLOSE_ON_FREE);
+
+    if (segment == nullptr)
+    {
+        tr_sys_file_close(fd, nullptr);
+        return EIO;
+    }
+
+    ++n_file_segments;
+    evbuffer_file_segment_add_cleanup_cb(segment, onFileSegmentFreed, nullptr);
+    int const err = evbuffer_add_file_segment(buf, segment, 0, ev_off_t(len)) == 0 ? 0 : EIO;
+
+    /* the buffer has its own reference, if it took the segment at all;
+     * if not, this closes the duplicate */
+    evbuffer_file_segment_free(segment);
+    return err;
+}
+
+#endif
+
+int tr_ioAddFileSegments(
+    tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    [[maybe_unused]] uint32_t begin,
+    [[maybe_unused]] uint32_t len,
+    [[maybe_unused]] struct evbuffer* buf)
+{
+    if (pieceIndex >= tor->pieceCount())
+    {
+        return EINVAL;
+    }
+
+#ifndef HAVE_COUNTED_FILE_SEGMENTS
+    return ENOTSUP;
+#else
+    auto* const segments = evbuffer_new();
+    auto [file_index, file_offset] = tor->fileOffset(pieceIndex, begin);
+    int err = 0;
+
+    while (len != 0 && err == 0)
+    {
+        uint64_t const bytes_this_pass = std::min(uint64_t{ len }, uint64_t{ tor->fileSize(file_index) - file_offset });
+
+        if (bytes_this_pass != 0)
+        {
+            auto fd = tr_sys_file_t{};
+            err = getFile(tor->session, tor, false, file_index, &fd);
+
+            /* the file is meant to bypass the page cache that sendfile() reads from */
+            if (err == 0 && tr_fdFileIsDirect(tor->session, tor->uniqueId, file_index))
+            {
+                err = ENOTSUP;
+            }
+            else if (err == 0)
+            {
+                err = addFileSegment(tor, fd, file_offset, bytes_this_pass, segments);
+            }
+        }
+
+        len -= bytes_this_pass;
+        ++file_index;
+        file_offset = 0;
+    }
+
+    if (err == 0)
+    {
+        evbuffer_add_buffer(buf, segments);
+    }
+
+    /* this lets go of the segments that were added before one failed */
+    evbuffer_free(segments);
+    return err;
+#endif
+}
+
 /****
 *****
 ****/
@@ -211,12 +723,21 @@ static std::optional<tr_sha1_digest_t> recalculateHash(tr_torrent* tor, tr_piece
     TR_ASSERT(tor != nullptr);
     TR_ASSERT(piece < tor->pieceCount());
 
-    auto bytes_left = size_t(tor->pieceSize(piece));
+    /* usually most or all of the piece was hashed as its blocks arrived */
     auto offset = uint32_t{};
-    tr_ioPrefetch(tor, piece, offset, bytes_left);
+    auto sha = tr_cacheTakePieceHash(tor->session->cache, tor, piece, &offset);
+    if (sha == nullptr)
+    {
+        sha = tr_sha1_init();
+    }
+
+    auto bytes_left = size_t(tor->pieceSize(piece) - offset);
+    if (bytes_left != 0)
+    {
+        tr_ioPrefetch(tor, piece, offset, bytes_left);
+    }
 
-    auto sha = tr_sha1_init();
-    auto buffer = std::vector<uint8_t>(tor->blockSize());
+    auto buffer = std::vector<uint8_t>(std::min(bytes_left, size_t(tor->blockSize())));
     while (bytes_left != 0)
     {
         size_t const len = std::min(bytes_left, std::size(buffer));
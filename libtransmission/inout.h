@@ -12,6 +12,7 @@
 #error only libtransmission should #include this header.
 #endif
 
+struct evbuffer;
 struct tr_torrent;
 
 /**
@@ -33,6 +34,69 @@ int tr_ioPrefetch(tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t begin,
  */
 int tr_ioWrite(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t offset, uint32_t len, uint8_t const* writeme);
 
+/**
+ * Like tr_ioWrite(), but writes the contents of `writeme` without flattening it.
+ * Each file's span of the chain is handed to the kernel in a single vectored write.
+ * `writeme` is left unchanged.
+ * @return 0 on success, or an errno value on failure.
+ */
+int tr_ioWriteBuf(struct tr_torrent* tor, tr_piece_index_t pieceIndex, uint32_t offset, struct evbuffer* writeme);
+
+/**
+ * Adds the block specified by the piece index, offset, and length to `buf`
+ * as references to its files' bytes, so that the block can go from the page
+ * cache to a socket without being copied. The files' descriptors are
+ * duplicated for `buf`, which closes them when it's done with them.
+ * No more duplicates are kept than the open file limit; past that, this
+ * fails with ENOTSUP and the block should be copied instead.
+ * Only the TCP writes of a plaintext peer can send such a buffer.
+ * @return 0 on success, or an errno value on failure, in which case `buf` is left unchanged.
+ */
+int tr_ioAddFileSegments(
+    struct tr_torrent* tor,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    uint32_t len,
+    struct evbuffer* buf);
+
+/**
+ * @brief Called in the libtransmission thread when an asynchronous read or write is done.
+ * @param err 0 on success, ECANCELED if the job was cancelled, or an errno value on failure.
+ */
+using tr_io_done_func = void (*)(tr_session* session, int err, void* user_data);
+
+/**
+ * Like tr_ioRead(), but the reading is done by a disk I/O worker thread.
+ * The files are found and opened before this returns; `setme` must stay
+ * valid until `callback` is called.
+ * @param owner passed to tr_diskIoCancel() to cancel the read
+ * @return 0 if the read was queued, or an errno value on failure, in which case `callback` won't be called.
+ */
+int tr_ioReadAsync(
+    struct tr_torrent* tor,
+    void const* owner,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    uint32_t len,
+    uint8_t* setme,
+    tr_io_done_func callback,
+    void* user_data);
+
+/**
+ * Like tr_ioWriteBuf(), but the writing is done by a disk I/O worker thread.
+ * `writeme` must stay valid and unchanged until `callback` is called.
+ * @param owner passed to tr_diskIoCancel() to cancel the write
+ * @return 0 if the write was queued, or an errno value on failure, in which case `callback` won't be called.
+ */
+int tr_ioWriteAsync(
+    struct tr_torrent* tor,
+    void const* owner,
+    tr_piece_index_t pieceIndex,
+    uint32_t offset,
+    struct evbuffer* writeme,
+    tr_io_done_func callback,
+    void* user_data);
+
 /**
  * @brief Test to see if the piece matches its metainfo's SHA1 checksum.
  */
@@ -8,11 +8,15 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib> /* qsort */
 #include <cstring> /* strcmp, strlen */
+#include <deque>
 #include <mutex>
 #include <string_view>
+#include <thread> /* std::thread::hardware_concurrency() */
+#include <vector>
 
 #include <event2/util.h> /* evutil_ascii_strcasecmp() */
 
@@ -185,10 +189,17 @@ tr_metainfo_builder* tr_metaInfoBuilderCreate(char const* topFileArg)
         [](auto const& a, auto const& b) { return evutil_ascii_strcasecmp(a.filename, b.filename) < 0; });
 
     tr_metaInfoBuilderSetPieceSize(ret, bestPieceSize(ret->totalSize));
+    tr_metaInfoBuilderSetThreadCount(ret, std::thread::hardware_concurrency());
 
     return ret;
 }
 
+void tr_metaInfoBuilderSetThreadCount(tr_metainfo_builder* b, uint32_t count)
+{
+    /* hardware_concurrency() is 0 when it can't tell */
+    b->threadCount = std::clamp(count, uint32_t{ 1 }, TR_MAKEMETA_MAX_THREADS);
+}
+
 static bool isValidPieceSize(uint32_t n)
 {
     bool const isPowerOfTwo = n != 0 && (n & (n - 1)) == 0;
@@ -247,6 +258,78 @@ void tr_metaInfoBuilderFree(tr_metainfo_builder* builder)
 *****
 ****/
 
+namespace
+{
+
+/* several whole pieces, read from disk to be hashed together */
+struct hash_batch
+{
+    std::vector<char> buf;
+    tr_piece_index_t first_piece = 0;
+    std::vector<void const*> data;
+    std::vector<size_t> lengths;
+};
+
+/* One thread reads the files into batches of pieces and the hashing
+ * threads hash them, so that reading and hashing are done in parallel */
+struct hash_pipeline
+{
+    tr_metainfo_builder* builder = nullptr;
+
+    /* where the hashing threads put each piece's hash */
+    std::byte* hashes = nullptr;
+
+    std::vector<hash_batch> batches;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<hash_batch*> free_batches;
+    std::deque<hash_batch*> filled_batches;
+    bool done_reading = false;
+    size_t n_hashers = 0;
+};
+
+} // namespace
+
+static void hashThreadFunc(void* vpipeline)
+{
+    auto* const pipeline = static_cast<hash_pipeline*>(vpipeline);
+    auto hashes = std::vector<tr_sha1_digest_t>{};
+    auto lock = std::unique_lock(pipeline->mutex);
+
+    for (;;)
+    {
+        pipeline->cv.wait(lock, [pipeline]() { return pipeline->done_reading || !std::empty(pipeline->filled_batches); });
+
+        if (std::empty(pipeline->filled_batches))
+        {
+            break;
+        }
+
+        auto* const batch = pipeline->filled_batches.front();
+        pipeline->filled_batches.pop_front();
+        lock.unlock();
+
+        auto const n = std::size(batch->data);
+        hashes.resize(n);
+        tr_sha1_many(std::data(batch->data), std::data(batch->lengths), n, std::data(hashes));
+
+        auto* walk = pipeline->hashes + batch->first_piece * std::size(tr_sha1_digest_t{});
+        for (auto const& hash : hashes)
+        {
+            walk = std::copy(std::begin(hash), std::end(hash), walk);
+        }
+
+        lock.lock();
+        pipeline->builder->pieceIndex += n;
+        pipeline->free_batches.push_back(batch);
+        pipeline->cv.notify_all();
+    }
+
+    --pipeline->n_hashers;
+    pipeline->cv.notify_all();
+}
+
 static std::vector<std::byte> getHashInfo(tr_metainfo_builder* b)
 {
     auto ret = std::vector<std::byte>(std::size(tr_sha1_digest_t{}) * b->pieceCount);
@@ -259,8 +342,6 @@ static std::vector<std::byte> getHashInfo(tr_metainfo_builder* b)
     b->pieceIndex = 0;
     uint64_t totalRemain = b->totalSize;
     uint32_t fileIndex = 0;
-    auto* walk = std::data(ret);
-    auto buf = std::vector<char>(b->pieceSize);
     uint64_t off = 0;
     tr_error* error = nullptr;
 
@@ -274,11 +355,57 @@ static std::vector<std::byte> getHashInfo(tr_metainfo_builder* b)
         return {};
     }
 
-    while (totalRemain != 0)
+    /* Each batch has enough pieces to keep tr_sha1_many() busy, but not so many that
+     * the batches use lots of memory. There are enough batches for every hashing
+     * thread to have one while the next ones are being read, unless the pieces are
+     * so big that they'd take more than MaxPipelineBytes. Then there are fewer
+     * batches, and only as many threads as can be kept busy with them */
+    auto constexpr MaxBatchBytes = uint64_t{ 1024 * 1024 * 4 };
+    auto constexpr MaxBatchPieces = uint64_t{ 8 };
+    auto constexpr MaxPipelineBytes = uint64_t{ 1024 * 1024 * 256 };
+    auto const batchSize = size_t(std::clamp(MaxBatchBytes / b->pieceSize, uint64_t{ 1 }, MaxBatchPieces));
+    auto const batchBytes = uint64_t{ b->pieceSize } * batchSize;
+    auto const nBatches = size_t(std::clamp(MaxPipelineBytes / batchBytes, uint64_t{ 2 }, uint64_t{ b->threadCount } + 2));
+    auto const nThreads = std::clamp(size_t{ b->threadCount }, size_t{ 1 }, nBatches - 1);
+
+    auto pipeline = hash_pipeline{};
+    pipeline.builder = b;
+    pipeline.hashes = std::data(ret);
+    pipeline.batches.resize(nBatches);
+    for (auto& batch : pipeline.batches)
+    {
+        batch.buf.resize(batchBytes);
+        pipeline.free_batches.push_back(&batch);
+    }
+
+    pipeline.n_hashers = nThreads;
+    for (size_t i = 0; i < nThreads; ++i)
     {
-        TR_ASSERT(b->pieceIndex < b->pieceCount);
+        tr_threadNew(hashThreadFunc, &pipeline);
+    }
+
+    tr_piece_index_t piece = 0;
+    hash_batch* batch = nullptr;
 
-        auto* bufptr = std::data(buf);
+    while (totalRemain != 0 && b->result == TR_MAKEMETA_OK)
+    {
+        TR_ASSERT(piece < b->pieceCount);
+
+        if (batch == nullptr)
+        {
+            auto lock = std::unique_lock(pipeline.mutex);
+            pipeline.cv.wait(lock, [&pipeline]() { return !std::empty(pipeline.free_batches); });
+            batch = pipeline.free_batches.front();
+            pipeline.free_batches.pop_front();
+            lock.unlock();
+
+            batch->first_piece = piece;
+            batch->data.clear();
+            batch->lengths.clear();
+        }
+
+        auto* const pieceBegin = std::data(batch->buf) + std::size(batch->data) * b->pieceSize;
+        auto* bufptr = pieceBegin;
         uint32_t const thisPieceSize = std::min(uint64_t{ b->pieceSize }, totalRemain);
         uint64_t leftInPiece = thisPieceSize;
 
@@ -286,7 +413,16 @@ static std::vector<std::byte> getHashInfo(tr_metainfo_builder* b)
         {
             uint64_t const n_this_pass = std::min(b->files[fileIndex].size - off, leftInPiece);
             uint64_t n_read = 0;
-            (void)tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, nullptr);
+            if (!tr_sys_file_read(fd, bufptr, n_this_pass, &n_read, &error) || (n_this_pass != 0 && n_read == 0))
+            {
+                /* the file is unreadable, or shorter than it was when the builder was made */
+                b->my_errno = error != nullptr ? error->code : EIO;
+                tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
+                b->result = TR_MAKEMETA_IO_READ;
+                tr_error_clear(&error);
+                break;
+            }
+
             bufptr += n_read;
             off += n_read;
             leftInPiece -= n_read;
@@ -306,44 +442,62 @@ static std::vector<std::byte> getHashInfo(tr_metainfo_builder* b)
                         b->my_errno = error->code;
                         tr_strlcpy(b->errfile, b->files[fileIndex].filename, sizeof(b->errfile));
                         b->result = TR_MAKEMETA_IO_READ;
-                        tr_error_free(error);
-                        return {};
+                        tr_error_clear(&error);
+                        break;
                     }
                 }
             }
         }
 
-        TR_ASSERT(bufptr - std::data(buf) == (int)thisPieceSize);
-        TR_ASSERT(leftInPiece == 0);
-        auto const digest = tr_sha1(buf);
-        if (!digest)
+        if (b->result != TR_MAKEMETA_OK)
         {
-            b->my_errno = EIO;
-            tr_snprintf(b->errfile, sizeof(b->errfile), "error hashing piece %" PRIu32, b->pieceIndex);
-            b->result = TR_MAKEMETA_IO_READ;
-            return {};
+            break;
         }
 
-        walk = std::copy(std::begin(*digest), std::end(*digest), walk);
+        TR_ASSERT(bufptr - pieceBegin == (int)thisPieceSize);
+        TR_ASSERT(leftInPiece == 0);
+        batch->data.push_back(pieceBegin);
+        batch->lengths.push_back(thisPieceSize);
+        totalRemain -= thisPieceSize;
+        ++piece;
+
+        /* hand it to the hashing threads */
+        if (std::size(batch->data) == batchSize || totalRemain == 0)
+        {
+            auto const lock = std::lock_guard(pipeline.mutex);
+            pipeline.filled_batches.push_back(batch);
+            pipeline.cv.notify_one();
+            batch = nullptr;
+        }
 
         if (b->abortFlag)
         {
             b->result = TR_MAKEMETA_CANCELLED;
             break;
         }
+    }
 
-        totalRemain -= thisPieceSize;
-        ++b->pieceIndex;
+    /* wait for the hashing threads to finish, since they're using our batches */
+    {
+        auto lock = std::unique_lock(pipeline.mutex);
+        pipeline.done_reading = true;
+        pipeline.cv.notify_all();
+        pipeline.cv.wait(lock, [&pipeline]() { return pipeline.n_hashers == 0; });
     }
 
-    TR_ASSERT(b->abortFlag || size_t(walk - std::data(ret)) == std::size(ret));
-    TR_ASSERT(b->abortFlag || !totalRemain);
+    TR_ASSERT(b->result != TR_MAKEMETA_OK || b->pieceIndex == b->pieceCount);
+    TR_ASSERT(b->result != TR_MAKEMETA_OK || !totalRemain);
 
     if (fd != TR_BAD_SYS_FILE)
     {
         tr_sys_file_close(fd, nullptr);
     }
 
+    if (b->result != TR_MAKEMETA_OK)
+    {
+        return {};
+    }
+
     return ret;
 }
 
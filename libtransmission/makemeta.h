@@ -48,6 +48,9 @@ struct tr_metainfo_builder
     uint32_t pieceCount;
     bool isFolder;
 
+    /* how many threads hash the pieces */
+    uint32_t threadCount;
+
     /**
     ***  These are set inside tr_makeMetaInfo()
     ***  by copying the arguments passed to it,
@@ -98,6 +101,16 @@ tr_metainfo_builder* tr_metaInfoBuilderCreate(char const* topFile);
  */
 bool tr_metaInfoBuilderSetPieceSize(tr_metainfo_builder* builder, uint32_t bytes);
 
+/** @brief The most threads that tr_metaInfoBuilderSetThreadCount() will use */
+auto inline constexpr TR_MAKEMETA_MAX_THREADS = uint32_t{ 64 };
+
+/**
+ * Call this before tr_makeMetaInfo() to override the builder.threadCount
+ * value that was set by tr_metainfoBuilderCreate(), which is one thread
+ * for each of the CPU's cores, up to TR_MAKEMETA_MAX_THREADS.
+ */
+void tr_metaInfoBuilderSetThreadCount(tr_metainfo_builder* builder, uint32_t count);
+
 void tr_metaInfoBuilderFree(tr_metainfo_builder*);
 
 /**
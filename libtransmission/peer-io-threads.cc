@@ -0,0 +1,764 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <utility> /* std::exchange() */
+#include <vector>
+
+#include <arc4.h>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+
+#include "transmission.h"
+#include "log.h"
+#include "net.h"
+#include "peer-io-threads.h"
+#include "session.h"
+#include "tr-assert.h"
+#include "trevent.h"
+#include "utils.h"
+
+namespace
+{
+
+/* how much a socket's I/O thread reads ahead of the session thread.
+   This matches the most that event_read_cb() lets pile up in a peer's inbuf */
+auto constexpr ReadBufferMax = size_t{ 256 * 1024 };
+
+/* how much can be waiting for the I/O thread to send it */
+auto constexpr WriteBufferMax = size_t{ 256 * 1024 };
+
+auto constexpr NoOffset = UINT64_MAX;
+
+} // namespace
+
+struct tr_peer_io_thread
+{
+    tr_event_handle* loop = nullptr;
+
+    /* the sockets that have events in this thread's loop. Only touched in this thread */
+    std::vector<tr_threaded_socket*> sockets;
+};
+
+struct tr_peer_io_threads
+{
+    std::vector<tr_peer_io_thread*> threads;
+    size_t next_thread = 0;
+
+    /* sockets that the session thread should call back */
+    std::mutex notify_mutex;
+    std::vector<tr_threaded_socket*> notify_queue;
+    bool notify_posted = false;
+    struct event* notify_event = nullptr;
+};
+
+struct tr_threaded_socket
+{
+    tr_threaded_socket(tr_session* session_in, tr_peer_io_threads* threads_in, tr_peer_io_thread* thread_in, tr_socket_t fd_in)
+        : session{ session_in }
+        , threads{ threads_in }
+        , thread{ thread_in }
+        , fd{ fd_in }
+    {
+    }
+
+    ~tr_threaded_socket()
+    {
+        evbuffer_free(recv_buf);
+        evbuffer_free(send_buf);
+        evbuffer_free(in);
+        evbuffer_free(out);
+        tr_free(enc_key);
+        tr_free(dec_key);
+    }
+
+    std::atomic<int> ref_count = 1;
+
+    tr_session* const session;
+    tr_peer_io_threads* const threads;
+    tr_peer_io_thread* const thread;
+    tr_socket_t const fd;
+
+    /* only touched in the session thread */
+    tr_threaded_socket_cb callback = nullptr;
+    void* user_data = nullptr;
+
+    /* only touched in the I/O thread, or after it's stopped */
+    struct event* read_event = nullptr;
+    struct event* write_event = nullptr;
+    evbuffer* const recv_buf = evbuffer_new();
+    evbuffer* const send_buf = evbuffer_new();
+    uint64_t n_taken = 0; /* how many bytes have been moved from `out` to `send_buf` */
+    std::atomic<bool> is_detached = false;
+
+    std::mutex mutex;
+
+    /* the rest is guarded by `mutex` */
+
+    evbuffer* const in = evbuffer_new(); /* received, and decrypted if need be, for the session thread to read */
+    evbuffer* const out = evbuffer_new(); /* written by the session thread for the I/O thread to send */
+    size_t n_unsent = 0; /* `out` plus `send_buf` */
+    uint64_t n_written = 0; /* how many bytes have been added to `out` */
+
+    struct arc4_context* enc_key = nullptr;
+    struct arc4_context* dec_key = nullptr;
+    uint64_t encrypt_from = NoOffset; /* where in the outgoing stream `enc_key` starts being used */
+
+    int read_error = 0;
+    int write_error = 0;
+    bool read_eof = false;
+    bool read_paused = false;
+    bool resume_posted = false;
+    bool send_posted = false;
+
+    short wanted = 0; /* the events the session thread wants to hear about */
+    bool notify_queued = false;
+    bool is_closed = false;
+};
+
+/***
+****
+***/
+
+static void ref(tr_threaded_socket* ts)
+{
+    ++ts->ref_count;
+}
+
+static void unref(tr_threaded_socket* ts)
+{
+    if (--ts->ref_count == 0)
+    {
+        delete ts;
+    }
+}
+
+static bool is_transient_error(int e)
+{
+#ifdef _WIN32
+    if (e == WSAEWOULDBLOCK)
+    {
+        return true;
+    }
+#endif
+
+#if EWOULDBLOCK != EAGAIN
+    if (e == EWOULDBLOCK)
+    {
+        return true;
+    }
+#endif
+
+    return e == EAGAIN || e == EINTR || e == EINPROGRESS;
+}
+
+static void crypt_buffer(struct arc4_context* key, struct evbuffer* buf, size_t offset, size_t len)
+{
+    auto pos = evbuffer_ptr{};
+    auto iov = evbuffer_iovec{};
+
+    evbuffer_ptr_set(buf, &pos, offset, EVBUFFER_PTR_SET);
+
+    while (len > 0 && evbuffer_peek(buf, len, &pos, &iov, 1) > 0)
+    {
+        auto const n = std::min(len, size_t{ iov.iov_len });
+        arc4_process(key, iov.iov_base, iov.iov_base, n);
+        len -= n;
+
+        if (evbuffer_ptr_set(buf, &pos, n, EVBUFFER_PTR_ADD) != 0)
+        {
+            break;
+        }
+    }
+
+    TR_ASSERT(len == 0);
+}
+
+/***
+****  Calling back the session thread
+***/
+
+static short get_ready_events(tr_threaded_socket const* ts)
+{
+    auto events = short{};
+
+    if (evbuffer_get_length(ts->in) > 0 || ts->read_eof || ts->read_error != 0)
+    {
+        events |= EV_READ;
+    }
+
+    if (ts->n_unsent < WriteBufferMax || ts->write_error != 0)
+    {
+        events |= EV_WRITE;
+    }
+
+    return events & ts->wanted;
+}
+
+/* call with ts->mutex held. Returns true if the session thread needs to be woken up */
+static bool queue_notify(tr_threaded_socket* ts)
+{
+    if (ts->notify_queued || ts->is_closed || get_ready_events(ts) == 0)
+    {
+        return false;
+    }
+
+    auto const lock = std::lock_guard(ts->threads->notify_mutex);
+    ts->notify_queued = true;
+    ref(ts);
+    ts->threads->notify_queue.push_back(ts);
+    return !std::exchange(ts->threads->notify_posted, true);
+}
+
+static void notify_sockets(void* vsession)
+{
+    auto* const session = static_cast<tr_session*>(vsession);
+    auto* const threads = session->peer_io_threads;
+
+    /* the threads were stopped after this was posted */
+    if (threads == nullptr)
+    {
+        return;
+    }
+
+    auto queue = std::vector<tr_threaded_socket*>{};
+
+    {
+        auto const lock = std::lock_guard(threads->notify_mutex);
+        queue.swap(threads->notify_queue);
+        threads->notify_posted = false;
+    }
+
+    for (auto* ts : queue)
+    {
+        auto events = short{};
+
+        {
+            auto const lock = std::lock_guard(ts->mutex);
+            ts->notify_queued = false;
+            events = ts->is_closed ? 0 : get_ready_events(ts);
+        }
+
+        if (events != 0 && ts->callback != nullptr)
+        {
+            ts->callback(ts->user_data, events);
+        }
+
+        unref(ts);
+    }
+}
+
+static void notify_event_cb(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
+{
+    notify_sockets(vsession);
+}
+
+static void wake_session_thread(tr_session* session)
+{
+    if (tr_amInEventThread(session))
+    {
+        /* not right away: we may be in the middle of the callback's caller */
+        event_active(session->peer_io_threads->notify_event, EV_TIMEOUT, 0);
+    }
+    else
+    {
+        tr_runInEventThread(session, notify_sockets, session);
+    }
+}
+
+/***
+****  The I/O thread's side
+***/
+
+static void on_readable(evutil_socket_t fd, short /*what*/, void* vts)
+{
+    auto* const ts = static_cast<tr_threaded_socket*>(vts);
+    auto* key = static_cast<arc4_context*>(nullptr);
+    auto n_buffered = size_t{};
+
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+        key = ts->dec_key;
+        n_buffered = evbuffer_get_length(ts->in);
+
+        /* wait for the session thread to catch up */
+        if (n_buffered >= ReadBufferMax)
+        {
+            event_del(ts->read_event);
+            ts->read_paused = true;
+            return;
+        }
+    }
+
+    EVUTIL_SET_SOCKET_ERROR(0);
+    auto const n = evbuffer_read(ts->recv_buf, fd, int(ReadBufferMax - n_buffered));
+    int const e = EVUTIL_SOCKET_ERROR();
+
+    if (n < 0 && is_transient_error(e))
+    {
+        return;
+    }
+
+    /* decrypt without holding the lock */
+    if (n > 0 && key != nullptr)
+    {
+        crypt_buffer(key, ts->recv_buf, 0, n);
+    }
+
+    auto wake = bool{};
+
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+
+        if (n > 0)
+        {
+            /* the keys arrived while we were reading */
+            if (key == nullptr && ts->dec_key != nullptr)
+            {
+                crypt_buffer(ts->dec_key, ts->recv_buf, 0, n);
+            }
+
+            evbuffer_add_buffer(ts->in, ts->recv_buf);
+        }
+        else
+        {
+            event_del(ts->read_event);
+
+            if (n == 0)
+            {
+                ts->read_eof = true;
+            }
+            else
+            {
+                ts->read_error = e;
+            }
+        }
+
+        wake = queue_notify(ts);
+    }
+
+    if (wake)
+    {
+        wake_session_thread(ts->session);
+    }
+}
+
+static void send_some(tr_threaded_socket* ts)
+{
+    auto const n_old = evbuffer_get_length(ts->send_buf);
+    auto const taken_from = ts->n_taken;
+    auto n_taken = size_t{};
+    auto* key = static_cast<arc4_context*>(nullptr);
+    auto encrypt_from = uint64_t{};
+
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+
+        if (ts->write_error != 0)
+        {
+            return;
+        }
+
+        n_taken = evbuffer_get_length(ts->out);
+        evbuffer_add_buffer(ts->send_buf, ts->out);
+        key = ts->enc_key;
+        encrypt_from = ts->encrypt_from;
+    }
+
+    ts->n_taken += n_taken;
+
+    /* encrypt what we just took, skipping whatever was encrypted before the keys were handed over */
+    if (key != nullptr && ts->n_taken > encrypt_from)
+    {
+        auto const from = std::max(taken_from, encrypt_from);
+        crypt_buffer(key, ts->send_buf, n_old + size_t(from - taken_from), size_t(ts->n_taken - from));
+    }
+
+    if (evbuffer_get_length(ts->send_buf) == 0)
+    {
+        return;
+    }
+
+    EVUTIL_SET_SOCKET_ERROR(0);
+    auto const n = evbuffer_write(ts->send_buf, ts->fd);
+    int const e = EVUTIL_SOCKET_ERROR();
+
+    if (n < 0 && !is_transient_error(e))
+    {
+        auto wake = bool{};
+
+        {
+            auto const lock = std::lock_guard(ts->mutex);
+            ts->write_error = e;
+            wake = queue_notify(ts);
+        }
+
+        if (wake)
+        {
+            wake_session_thread(ts->session);
+        }
+
+        return;
+    }
+
+    if (evbuffer_get_length(ts->send_buf) > 0)
+    {
+        event_add(ts->write_event, nullptr);
+    }
+
+    if (n > 0)
+    {
+        auto wake = bool{};
+
+        {
+            auto const lock = std::lock_guard(ts->mutex);
+            ts->n_unsent -= n;
+            wake = queue_notify(ts);
+        }
+
+        if (wake)
+        {
+            wake_session_thread(ts->session);
+        }
+    }
+}
+
+static void on_writable(evutil_socket_t /*fd*/, short /*what*/, void* vts)
+{
+    send_some(static_cast<tr_threaded_socket*>(vts));
+}
+
+static void detach(tr_threaded_socket* ts)
+{
+    auto& sockets = ts->thread->sockets;
+    sockets.erase(std::remove(std::begin(sockets), std::end(sockets), ts), std::end(sockets));
+
+    event_free(ts->read_event);
+    ts->read_event = nullptr;
+    event_free(ts->write_event);
+    ts->write_event = nullptr;
+    ts->is_detached = true;
+
+    unref(ts);
+}
+
+static void attach_in_thread(void* vts)
+{
+    auto* const ts = static_cast<tr_threaded_socket*>(vts);
+    auto* const base = tr_eventLoopGetBase(ts->thread->loop);
+
+    ts->read_event = event_new(base, ts->fd, EV_READ | EV_PERSIST, on_readable, ts);
+    ts->write_event = event_new(base, ts->fd, EV_WRITE, on_writable, ts);
+    ts->thread->sockets.push_back(ts);
+    event_add(ts->read_event, nullptr);
+
+    /* something may have been written already */
+    send_some(ts);
+}
+
+static void send_in_thread(void* vts)
+{
+    auto* const ts = static_cast<tr_threaded_socket*>(vts);
+
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+        ts->send_posted = false;
+    }
+
+    if (!ts->is_detached)
+    {
+        send_some(ts);
+    }
+
+    unref(ts);
+}
+
+static void resume_in_thread(void* vts)
+{
+    auto* const ts = static_cast<tr_threaded_socket*>(vts);
+
+    if (!ts->is_detached)
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+        ts->resume_posted = false;
+        ts->read_paused = false;
+        event_add(ts->read_event, nullptr);
+    }
+
+    unref(ts);
+}
+
+namespace
+{
+
+struct detach_data
+{
+    tr_threaded_socket* ts;
+    std::promise<void> done;
+};
+
+struct stop_data
+{
+    tr_peer_io_thread* thread;
+    std::promise<void> done;
+};
+
+} // namespace
+
+static void detach_in_thread(void* vdata)
+{
+    auto* const data = static_cast<detach_data*>(vdata);
+
+    if (!data->ts->is_detached)
+    {
+        detach(data->ts);
+    }
+
+    data->done.set_value();
+}
+
+static void stop_in_thread(void* vdata)
+{
+    auto* const data = static_cast<stop_data*>(vdata);
+
+    /* whatever sockets are still here now belong to no one */
+    while (!std::empty(data->thread->sockets))
+    {
+        detach(data->thread->sockets.back());
+    }
+
+    data->done.set_value();
+}
+
+/***
+****  The session thread's side
+***/
+
+static tr_peer_io_threads* get_threads(tr_session* session)
+{
+    auto*& threads = session->peer_io_threads;
+
+    if (threads == nullptr)
+    {
+        threads = new tr_peer_io_threads{};
+        threads->notify_event = event_new(session->event_base, -1, 0, notify_event_cb, session);
+    }
+
+    return threads;
+}
+
+static tr_peer_io_thread* get_thread(tr_session* session, tr_peer_io_threads* threads)
+{
+    auto const n = size_t(std::max(1, session->peerIoThreadCount));
+    auto const i = threads->next_thread++ % n;
+
+    while (std::size(threads->threads) <= i)
+    {
+        auto* const thread = new tr_peer_io_thread{};
+        thread->loop = tr_eventLoopNew();
+        threads->threads.push_back(thread);
+        tr_logAddDebug("Started peer I/O thread #%zu", std::size(threads->threads));
+    }
+
+    return threads->threads[i];
+}
+
+tr_threaded_socket* tr_threadedSocketNew(tr_session* session, tr_socket_t fd, tr_threaded_socket_cb callback, void* user_data)
+{
+    TR_ASSERT(tr_amInEventThread(session));
+    TR_ASSERT(fd != TR_BAD_SOCKET);
+
+    auto* const threads = get_threads(session);
+    auto* const ts = new tr_threaded_socket{ session, threads, get_thread(session, threads), fd };
+    ts->callback = callback;
+    ts->user_data = user_data;
+
+    /* this ref belongs to the I/O thread until the socket is detached from it */
+    ref(ts);
+    tr_runInEventLoop(ts->thread->loop, attach_in_thread, ts);
+
+    return ts;
+}
+
+void tr_threadedSocketFree(tr_threaded_socket* ts)
+{
+    TR_ASSERT(tr_amInEventThread(ts->session));
+
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+        ts->is_closed = true;
+        ts->wanted = 0;
+    }
+
+    ts->callback = nullptr;
+
+    /* wait for the socket to be out of the I/O thread's event loop, so that it can be closed */
+    if (!ts->is_detached)
+    {
+        auto data = detach_data{ ts, {} };
+        auto done = data.done.get_future();
+        tr_runInEventLoop(ts->thread->loop, detach_in_thread, &data);
+        done.wait();
+    }
+
+    unref(ts);
+}
+
+void tr_threadedSocketSetEvents(tr_threaded_socket* ts, short events)
+{
+    auto wake = bool{};
+
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+        ts->wanted = events & (EV_READ | EV_WRITE);
+        wake = queue_notify(ts);
+    }
+
+    if (wake)
+    {
+        wake_session_thread(ts->session);
+    }
+}
+
+int tr_threadedSocketRead(tr_threaded_socket* ts, struct evbuffer* buf, size_t howmuch)
+{
+    auto resume = bool{};
+    auto n = int{};
+
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+        howmuch = std::min(howmuch, evbuffer_get_length(ts->in));
+
+        if (howmuch > 0)
+        {
+            n = evbuffer_remove_buffer(ts->in, buf, howmuch);
+            resume = ts->read_paused && !ts->resume_posted && !ts->is_detached;
+            ts->resume_posted |= resume;
+            EVUTIL_SET_SOCKET_ERROR(0);
+        }
+        else if (ts->read_eof)
+        {
+            n = 0;
+            EVUTIL_SET_SOCKET_ERROR(0);
+        }
+        else
+        {
+            n = -1;
+            EVUTIL_SET_SOCKET_ERROR(ts->read_error != 0 ? ts->read_error : EAGAIN);
+        }
+    }
+
+    if (resume)
+    {
+        ref(ts);
+        tr_runInEventLoop(ts->thread->loop, resume_in_thread, ts);
+    }
+
+    return n;
+}
+
+int tr_threadedSocketWrite(tr_threaded_socket* ts, struct evbuffer* buf, size_t howmuch)
+{
+    auto post = bool{};
+    auto n = int{};
+
+    {
+        auto const lock = std::lock_guard(ts->mutex);
+
+        if (ts->write_error != 0)
+        {
+            EVUTIL_SET_SOCKET_ERROR(ts->write_error);
+            return -1;
+        }
+
+        auto const room = ts->n_unsent < WriteBufferMax ? WriteBufferMax - ts->n_unsent : 0;
+        howmuch = std::min({ howmuch, room, evbuffer_get_length(buf) });
+
+        if (howmuch == 0)
+        {
+            EVUTIL_SET_SOCKET_ERROR(EAGAIN);
+            return -1;
+        }
+
+        n = evbuffer_remove_buffer(buf, ts->out, howmuch);
+        ts->n_unsent += n;
+        ts->n_written += n;
+        post = !ts->send_posted && !ts->is_detached;
+        ts->send_posted |= post;
+        EVUTIL_SET_SOCKET_ERROR(0);
+    }
+
+    if (post)
+    {
+        ref(ts);
+        tr_runInEventLoop(ts->thread->loop, send_in_thread, ts);
+    }
+
+    return n;
+}
+
+void tr_threadedSocketTakeKeys(
+    tr_threaded_socket* ts,
+    struct arc4_context* enc_key,
+    struct arc4_context* dec_key,
+    size_t n_encrypted)
+{
+    TR_ASSERT(tr_amInEventThread(ts->session));
+
+    auto const lock = std::lock_guard(ts->mutex);
+
+    TR_ASSERT(ts->enc_key == nullptr);
+    TR_ASSERT(ts->dec_key == nullptr);
+
+    if (dec_key != nullptr)
+    {
+        crypt_buffer(dec_key, ts->in, 0, evbuffer_get_length(ts->in));
+    }
+
+    ts->enc_key = enc_key;
+    ts->dec_key = dec_key;
+    ts->encrypt_from = ts->n_written + n_encrypted;
+}
+
+void tr_peerIoThreadsClose(tr_session* session)
+{
+    auto* const threads = session->peer_io_threads;
+
+    if (threads == nullptr)
+    {
+        return;
+    }
+
+    for (auto* thread : threads->threads)
+    {
+        auto data = stop_data{ thread, {} };
+        auto done = data.done.get_future();
+        tr_runInEventLoop(thread->loop, stop_in_thread, &data);
+        done.wait();
+
+        tr_eventLoopFree(thread->loop);
+        delete thread;
+    }
+
+    /* a callback may have been posted to the session thread already. It'll see that we're gone */
+    session->peer_io_threads = nullptr;
+
+    for (auto* ts : threads->notify_queue)
+    {
+        unref(ts);
+    }
+
+    event_free(threads->notify_event);
+    delete threads;
+}
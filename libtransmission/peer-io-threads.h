@@ -0,0 +1,77 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+
+#include "net.h" // tr_socket_t
+
+struct arc4_context;
+struct evbuffer;
+struct tr_session;
+struct tr_threaded_socket;
+
+/**
+ * @addtogroup networked_io Networked IO
+ * @{
+ */
+
+/**
+ * A peer's TCP socket that's read, written, and, once the handshake is
+ * over, encrypted and decrypted by one of the session's peer I/O threads.
+ *
+ * The session thread never touches the socket. It reads and writes the
+ * socket's buffers instead, so it still decides how much is read or
+ * written, and all of the bandwidth accounting still happens there.
+ */
+
+/** @brief Called in the session thread when the socket is readable (EV_READ) or writable (EV_WRITE) */
+using tr_threaded_socket_cb = void (*)(void* user_data, short what);
+
+/** @brief Hand a connected TCP socket to one of the session's peer I/O threads */
+tr_threaded_socket* tr_threadedSocketNew(tr_session* session, tr_socket_t fd, tr_threaded_socket_cb callback, void* user_data);
+
+/** @brief Take the socket back from its I/O thread. Once this returns, the socket can be closed */
+void tr_threadedSocketFree(tr_threaded_socket* ts);
+
+/** @brief Set which of EV_READ and EV_WRITE the callback should be called for */
+void tr_threadedSocketSetEvents(tr_threaded_socket* ts, short events);
+
+/**
+ * @brief Move up to `howmuch` received bytes into `buf`.
+ * @return the number of bytes moved; 0 at EOF; or -1, with the socket error set, when nothing can be read
+ */
+int tr_threadedSocketRead(tr_threaded_socket* ts, struct evbuffer* buf, size_t howmuch);
+
+/**
+ * @brief Queue up to `howmuch` bytes from the front of `buf` to be sent.
+ * @return the number of bytes queued, or -1, with the socket error set, when nothing can be queued
+ */
+int tr_threadedSocketWrite(tr_threaded_socket* ts, struct evbuffer* buf, size_t howmuch);
+
+/**
+ * @brief Let the I/O thread do the RC4 from now on. It takes ownership of the keys.
+ *
+ * Bytes that were received but not read yet are decrypted here. The first
+ * `n_encrypted` bytes written after this call are taken to be encrypted already.
+ */
+void tr_threadedSocketTakeKeys(
+    tr_threaded_socket* ts,
+    struct arc4_context* enc_key,
+    struct arc4_context* dec_key,
+    size_t n_encrypted);
+
+/** @brief Stop the session's peer I/O threads */
+void tr_peerIoThreadsClose(tr_session* session);
+
+/* @} */
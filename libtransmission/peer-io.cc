@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <utility> /* std::exchange() */
 
 #include <event2/event.h>
 #include <event2/buffer.h>
@@ -25,6 +26,7 @@
 #include "net.h"
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
 #include "peer-io.h"
+#include "peer-io-threads.h"
 #include "tr-assert.h"
 #include "tr-utp.h"
 #include "trevent.h" /* tr_runInEventThread() */
@@ -260,6 +262,26 @@ static void canReadWrapper(tr_peerIo* io)
     tr_peerIoUnref(io);
 }
 
+void tr_peerIoReadAgain(tr_peerIo* io)
+{
+    TR_ASSERT(tr_isPeerIo(io));
+
+    if (evbuffer_get_length(io->inbuf) != 0)
+    {
+        canReadWrapper(io);
+    }
+}
+
+static int tr_evbuffer_read(tr_peerIo* io, evutil_socket_t fd, size_t howmuch)
+{
+    if (io->threaded_socket != nullptr)
+    {
+        return tr_threadedSocketRead(io->threaded_socket, io->inbuf, howmuch);
+    }
+
+    return evbuffer_read(io->inbuf, fd, (int)howmuch);
+}
+
 static void event_read_cb(evutil_socket_t fd, short /*event*/, void* vio)
 {
     auto* io = static_cast<tr_peerIo*>(vio);
@@ -287,7 +309,7 @@ static void event_read_cb(evutil_socket_t fd, short /*event*/, void* vio)
     }
 
     EVUTIL_SET_SOCKET_ERROR(0);
-    auto const res = evbuffer_read(io->inbuf, fd, (int)howmuch);
+    auto const res = tr_evbuffer_read(io, fd, howmuch);
     int const e = EVUTIL_SOCKET_ERROR();
 
     if (res > 0)
@@ -337,7 +359,8 @@ static int tr_evbuffer_write(tr_peerIo* io, int fd, size_t howmuch)
     char errstr[256];
 
     EVUTIL_SET_SOCKET_ERROR(0);
-    int const n = evbuffer_write_atmost(io->outbuf, fd, howmuch);
+    int const n = io->threaded_socket != nullptr ? tr_threadedSocketWrite(io->threaded_socket, io->outbuf, howmuch) :
+                                                   evbuffer_write_atmost(io->outbuf, fd, howmuch);
     int const e = EVUTIL_SOCKET_ERROR();
     dbgmsg(io, "wrote %d to peer (%s)", n, (n == -1 ? tr_net_strerror(errstr, sizeof(errstr), e) : ""));
 
@@ -422,6 +445,44 @@ FAIL:
     }
 }
 
+/* called when a peer I/O thread has data for us or room for more */
+static void threaded_socket_cb(void* vio, short what)
+{
+    auto* io = static_cast<tr_peerIo*>(vio);
+
+    TR_ASSERT(tr_isPeerIo(io));
+
+    tr_peerIoRef(io);
+
+    if ((what & EV_READ) != 0 && (io->pendingEvents & EV_READ) != 0)
+    {
+        event_read_cb(TR_BAD_SOCKET, EV_READ, io);
+    }
+
+    if ((what & EV_WRITE) != 0 && (io->pendingEvents & EV_WRITE) != 0 && io->threaded_socket != nullptr)
+    {
+        event_write_cb(TR_BAD_SOCKET, EV_WRITE, io);
+    }
+
+    tr_peerIoUnref(io);
+}
+
+static void create_socket_events(tr_peerIo* io)
+{
+    tr_session* const session = io->session;
+    auto const fd = io->socket.handle.tcp;
+
+    if (session->peerIoThreadCount > 0)
+    {
+        io->threaded_socket = tr_threadedSocketNew(session, fd, threaded_socket_cb, io);
+    }
+    else
+    {
+        io->event_read = event_new(session->event_base, fd, EV_READ, event_read_cb, io);
+        io->event_write = event_new(session->event_base, fd, EV_WRITE, event_write_cb, io);
+    }
+}
+
 /**
 ***
 **/
@@ -641,8 +702,7 @@ static tr_peerIo* tr_peerIoNew(
     {
     case TR_PEER_SOCKET_TYPE_TCP:
         dbgmsg(io, "socket (tcp) is %" PRIdMAX, (intmax_t)socket.handle.tcp);
-        io->event_read = event_new(session->event_base, socket.handle.tcp, EV_READ, event_read_cb, io);
-        io->event_write = event_new(session->event_base, socket.handle.tcp, EV_WRITE, event_write_cb, io);
+        create_socket_events(io);
         break;
 
 #ifdef WITH_UTP
@@ -729,7 +789,7 @@ static void event_enable(tr_peerIo* io, short event)
     TR_ASSERT(io->session != nullptr);
     TR_ASSERT(io->session->events != nullptr);
 
-    bool const need_events = io->socket.type == TR_PEER_SOCKET_TYPE_TCP;
+    bool const need_events = io->socket.type == TR_PEER_SOCKET_TYPE_TCP && io->threaded_socket == nullptr;
 
     if (need_events)
     {
@@ -760,6 +820,11 @@ static void event_enable(tr_peerIo* io, short event)
 
         io->pendingEvents |= EV_WRITE;
     }
+
+    if (io->threaded_socket != nullptr)
+    {
+        tr_threadedSocketSetEvents(io->threaded_socket, io->pendingEvents);
+    }
 }
 
 static void event_disable(tr_peerIo* io, short event)
@@ -768,7 +833,7 @@ static void event_disable(tr_peerIo* io, short event)
     TR_ASSERT(io->session != nullptr);
     TR_ASSERT(io->session->events != nullptr);
 
-    bool const need_events = io->socket.type == TR_PEER_SOCKET_TYPE_TCP;
+    bool const need_events = io->socket.type == TR_PEER_SOCKET_TYPE_TCP && io->threaded_socket == nullptr;
 
     if (need_events)
     {
@@ -799,6 +864,11 @@ static void event_disable(tr_peerIo* io, short event)
 
         io->pendingEvents &= ~EV_WRITE;
     }
+
+    if (io->threaded_socket != nullptr)
+    {
+        tr_threadedSocketSetEvents(io->threaded_socket, io->pendingEvents);
+    }
 }
 
 void tr_peerIoSetEnabled(tr_peerIo* io, tr_direction dir, bool isEnabled)
@@ -832,6 +902,12 @@ static void io_close_socket(tr_peerIo* io)
         break;
 
     case TR_PEER_SOCKET_TYPE_TCP:
+        if (io->threaded_socket != nullptr)
+        {
+            tr_threadedSocketFree(io->threaded_socket);
+            io->threaded_socket = nullptr;
+        }
+
         tr_netClose(io->session, io->socket.handle.tcp);
         break;
 
@@ -978,8 +1054,7 @@ int tr_peerIoReconnect(tr_peerIo* io)
         return -1;
     }
 
-    io->event_read = event_new(session->event_base, io->socket.handle.tcp, EV_READ, event_read_cb, io);
-    io->event_write = event_new(session->event_base, io->socket.handle.tcp, EV_WRITE, event_write_cb, io);
+    create_socket_events(io);
 
     event_enable(io, pendingEvents);
     tr_netSetTOS(io->socket.handle.tcp, session->peerSocketTos(), io->addr.type);
@@ -1045,6 +1120,7 @@ void tr_peerIoSetEncryption(tr_peerIo* io, tr_encryption_type encryption_type)
 {
     TR_ASSERT(tr_isPeerIo(io));
     TR_ASSERT(encryption_type == PEER_ENCRYPTION_NONE || encryption_type == PEER_ENCRYPTION_RC4);
+    TR_ASSERT(!io->isCryptoInIoThread);
 
     io->encryption_type = encryption_type;
 }
@@ -1081,6 +1157,32 @@ static inline void processBuffer(
     TR_ASSERT(size == 0);
 }
 
+void tr_peerIoHandshakeDone(tr_peerIo* io)
+{
+    TR_ASSERT(tr_isPeerIo(io));
+    TR_ASSERT(tr_amInEventThread(io->session));
+
+    if (io->threaded_socket == nullptr || io->encryption_type != PEER_ENCRYPTION_RC4 || io->isCryptoInIoThread)
+    {
+        return;
+    }
+
+    /* what's waiting to be read is still encrypted, and it comes before anything the I/O thread decrypts */
+    if (auto const n = evbuffer_get_length(io->inbuf); n > 0)
+    {
+        processBuffer(&io->crypto, io->inbuf, 0, n, &tr_cryptoDecrypt);
+    }
+
+    /* what's waiting to be written is already encrypted */
+    tr_threadedSocketTakeKeys(
+        io->threaded_socket,
+        std::exchange(io->crypto.enc_key, nullptr),
+        std::exchange(io->crypto.dec_key, nullptr),
+        evbuffer_get_length(io->outbuf));
+
+    io->isCryptoInIoThread = true;
+}
+
 static void addDatatype(tr_peerIo* io, size_t byteCount, bool isPieceData)
 {
     auto* const d = datatype_new();
@@ -1089,9 +1191,14 @@ static void addDatatype(tr_peerIo* io, size_t byteCount, bool isPieceData)
     peer_io_push_datatype(io, d);
 }
 
+static constexpr bool needsCrypto(tr_peerIo const* io)
+{
+    return io->encryption_type == PEER_ENCRYPTION_RC4 && !io->isCryptoInIoThread;
+}
+
 static inline void maybeEncryptBuffer(tr_peerIo* io, struct evbuffer* buf, size_t offset, size_t size)
 {
-    if (io->encryption_type == PEER_ENCRYPTION_RC4)
+    if (needsCrypto(io))
     {
         processBuffer(&io->crypto, buf, offset, size, &tr_cryptoEncrypt);
     }
@@ -1112,7 +1219,7 @@ void tr_peerIoWriteBytes(tr_peerIo* io, void const* bytes, size_t byteCount, boo
 
     iovec.iov_len = byteCount;
 
-    if (io->encryption_type == PEER_ENCRYPTION_RC4)
+    if (needsCrypto(io))
     {
         tr_cryptoEncrypt(&io->crypto, iovec.iov_len, bytes, iovec.iov_base);
     }
@@ -1157,30 +1264,6 @@ void evbuffer_add_uint64(struct evbuffer* outbuf, uint64_t addme_hll)
 ****
 ***/
 
-static inline void maybeDecryptBuffer(tr_peerIo* io, struct evbuffer* buf, size_t offset, size_t size)
-{
-    if (io->encryption_type == PEER_ENCRYPTION_RC4)
-    {
-        processBuffer(&io->crypto, buf, offset, size, &tr_cryptoDecrypt);
-    }
-}
-
-void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuffer* outbuf, size_t byteCount)
-{
-    TR_ASSERT(tr_isPeerIo(io));
-    TR_ASSERT(evbuffer_get_length(inbuf) >= byteCount);
-
-    size_t const old_length = evbuffer_get_length(outbuf);
-
-    /* append it to outbuf */
-    struct evbuffer* tmp = evbuffer_new();
-    evbuffer_remove_buffer(inbuf, tmp, byteCount);
-    evbuffer_add_buffer(outbuf, tmp);
-    evbuffer_free(tmp);
-
-    maybeDecryptBuffer(io, outbuf, old_length, byteCount);
-}
-
 void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size_t byteCount)
 {
     TR_ASSERT(tr_isPeerIo(io));
@@ -1194,7 +1277,12 @@ void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size
 
     case PEER_ENCRYPTION_RC4:
         evbuffer_remove(inbuf, bytes, byteCount);
-        tr_cryptoDecrypt(&io->crypto, byteCount, bytes, bytes);
+
+        if (!io->isCryptoInIoThread)
+        {
+            tr_cryptoDecrypt(&io->crypto, byteCount, bytes, bytes);
+        }
+
         break;
 
     default:
@@ -1257,7 +1345,7 @@ static int tr_peerIoTryRead(tr_peerIo* io, size_t howmuch)
                 char err_buf[512];
 
                 EVUTIL_SET_SOCKET_ERROR(0);
-                res = evbuffer_read(io->inbuf, io->socket.handle.tcp, (int)howmuch);
+                res = tr_evbuffer_read(io, io->socket.handle.tcp, howmuch);
                 int const e = EVUTIL_SOCKET_ERROR();
 
                 dbgmsg(io, "read %d from peer (%s)", res, res == -1 ? tr_net_strerror(err_buf, sizeof(err_buf), e) : "");
@@ -36,6 +36,7 @@ class tr_peerIo;
 struct Bandwidth;
 struct evbuffer;
 struct tr_datatype;
+struct tr_threaded_socket;
 
 /**
  * @addtogroup networked_io Networked IO
@@ -122,6 +123,9 @@ public:
     struct event* event_read = nullptr;
     struct event* event_write = nullptr;
 
+    /* set instead of the events when a peer I/O thread does this TCP socket's I/O */
+    struct tr_threaded_socket* threaded_socket = nullptr;
+
     // TODO(ckerr): this could be narrowed to 1 byte
     tr_encryption_type encryption_type = PEER_ENCRYPTION_NONE;
 
@@ -135,6 +139,7 @@ public:
     tr_priority_t priority = TR_PRI_NORMAL;
 
     bool const isSeed;
+    bool isCryptoInIoThread = false;
     bool dhtSupported = false;
     bool extendedProtocolSupported = false;
     bool fastExtensionSupported = false;
@@ -254,6 +259,9 @@ void tr_peerIoSetIOFuncs(tr_peerIo* io, tr_can_read_cb readcb, tr_did_write_cb w
 
 void tr_peerIoClear(tr_peerIo* io);
 
+/** @brief Call the read callback on what's already been read, for when it returned READ_LATER to wait on something else */
+void tr_peerIoReadAgain(tr_peerIo* io);
+
 /**
 ***
 **/
@@ -273,11 +281,30 @@ constexpr tr_crypto* tr_peerIoGetCrypto(tr_peerIo* io)
 
 void tr_peerIoSetEncryption(tr_peerIo* io, tr_encryption_type encryption_type);
 
+/**
+ * @brief Call once the handshake is over and the encryption won't change again.
+ *
+ * If a peer I/O thread has the socket, it takes over the RC4 from here.
+ */
+void tr_peerIoHandshakeDone(tr_peerIo* io);
+
 constexpr bool tr_peerIoIsEncrypted(tr_peerIo const* io)
 {
     return io != nullptr && io->encryption_type == PEER_ENCRYPTION_RC4;
 }
 
+/**
+ * @brief Whether tr_peerIoWriteBuf() can be given the file segments of tr_ioAddFileSegments().
+ *
+ * They're written with sendfile(), so they can't be encrypted, go through uTP,
+ * or be handed to a peer I/O thread.
+ */
+constexpr bool tr_peerIoCanSendFiles(tr_peerIo const* io)
+{
+    return io->socket.type == TR_PEER_SOCKET_TYPE_TCP && io->encryption_type == PEER_ENCRYPTION_NONE &&
+        io->threaded_socket == nullptr;
+}
+
 void evbuffer_add_uint8(struct evbuffer* outbuf, uint8_t byte);
 void evbuffer_add_uint16(struct evbuffer* outbuf, uint16_t hs);
 void evbuffer_add_uint32(struct evbuffer* outbuf, uint32_t hl);
@@ -298,8 +325,6 @@ static inline void evbuffer_add_hton_64(struct evbuffer* buf, uint64_t val)
     evbuffer_add_uint64(buf, val);
 }
 
-void tr_peerIoReadBytesToBuf(tr_peerIo* io, struct evbuffer* inbuf, struct evbuffer* outbuf, size_t byteCount);
-
 void tr_peerIoReadBytes(tr_peerIo* io, struct evbuffer* inbuf, void* bytes, size_t byteCount);
 
 static inline void tr_peerIoReadUint8(tr_peerIo* io, struct evbuffer* inbuf, uint8_t* setme)
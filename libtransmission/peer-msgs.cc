@@ -20,9 +20,12 @@
 
 #include "transmission.h"
 
+#include "block-pool.h"
 #include "cache.h"
 #include "completion.h"
+#include "disk-io.h"
 #include "file.h"
+#include "inout.h"
 #include "log.h"
 #include "peer-io.h"
 #include "peer-mgr.h"
@@ -176,7 +179,8 @@ struct tr_incoming
     uint8_t id = 0;
     uint32_t length = 0; /* includes the +1 for id length */
     struct peer_request blockReq = {}; /* metadata for incoming blocks */
-    struct evbuffer* block = nullptr; /* piece data for incoming blocks */
+    uint8_t* block = nullptr; /* piece data for incoming blocks, in a tr_blockPoolAlloc() block */
+    uint32_t block_bytes_read = 0;
 };
 
 class tr_peerMsgsImpl;
@@ -233,6 +237,8 @@ public:
         , callback_{ callback }
         , callbackData_{ callbackData }
     {
+        tr_peerIoHandshakeDone(io);
+
         if (torrent->allowsPex())
         {
             pex_timer.reset(evtimer_new(torrent->session->event_base, pexPulse, this));
@@ -273,9 +279,13 @@ public:
         set_active(TR_UP, false);
         set_active(TR_DOWN, false);
 
-        if (this->incoming.block != nullptr)
+        tr_blockPoolFree(this->incoming.block);
+
+        /* don't let the disk I/O workers finish reading blocks for us */
+        if (session->diskIo != nullptr)
         {
-            evbuffer_free(this->incoming.block);
+            tr_cacheCancel(session->cache, this);
+            tr_diskIoCancel(session->diskIo, this);
         }
 
         if (this->io != nullptr)
@@ -587,6 +597,9 @@ public:
 
     int prefetchCount = 0;
 
+    /* how much block data is being read from disk to send to this peer */
+    size_t pendingBlockReadBytes = 0;
+
     /* how long the outMessages batch should be allowed to grow before
      * it's flushed -- some messages (like requests >:) should be sent
      * very quickly; others aren't as urgent. */
@@ -1565,7 +1578,7 @@ static bool messageLengthIsCorrect(tr_peerMsgsImpl const* msg, uint8_t id, uint3
     }
 }
 
-static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* block, struct peer_request const* req);
+static int clientGotBlock(tr_peerMsgsImpl* msgs, uint8_t* block, struct peer_request const* req);
 
 static ReadState readBtPiece(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size_t inlen, size_t* setme_piece_bytes_read)
 {
@@ -1589,18 +1602,26 @@ static ReadState readBtPiece(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size
         return READ_NOW;
     }
 
-    if (msgs->incoming.block == nullptr)
+    /* the payload is read straight into the block that the cache will keep */
+    if (req->length > TR_BLOCK_POOL_BLOCK_SIZE)
     {
-        msgs->incoming.block = evbuffer_new();
+        dbgmsg(msgs, "block %u:%u->%u is too big", req->index, req->offset, req->length);
+        return READ_ERR;
     }
 
-    struct evbuffer* const block_buffer = msgs->incoming.block;
+    if (msgs->incoming.block == nullptr)
+    {
+        msgs->incoming.block = static_cast<uint8_t*>(tr_blockPoolAlloc());
+        msgs->incoming.block_bytes_read = 0;
+    }
 
-    /* read in another chunk of data */
-    size_t const nLeft = req->length - evbuffer_get_length(block_buffer);
+    /* read in another chunk of data, decrypting it in place */
+    uint32_t& bytes_read = msgs->incoming.block_bytes_read;
+    size_t const nLeft = req->length - bytes_read;
     size_t const n = std::min(nLeft, inlen);
 
-    tr_peerIoReadBytesToBuf(msgs->io, inbuf, block_buffer, n);
+    tr_peerIoReadBytes(msgs->io, inbuf, msgs->incoming.block + bytes_read, n);
+    bytes_read += n;
 
     msgs->publishClientGotPieceData(n);
     *setme_piece_bytes_read += n;
@@ -1611,16 +1632,17 @@ static ReadState readBtPiece(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, size
         req->index,
         req->offset,
         req->length,
-        (int)(req->length - evbuffer_get_length(block_buffer)));
+        (int)(req->length - bytes_read));
 
-    if (evbuffer_get_length(block_buffer) < req->length)
+    if (bytes_read < req->length)
     {
         return READ_LATER;
     }
 
     /* pass the block along... */
-    int const err = clientGotBlock(msgs, block_buffer, req);
-    evbuffer_drain(block_buffer, evbuffer_get_length(block_buffer));
+    auto* const block = msgs->incoming.block;
+    msgs->incoming.block = nullptr;
+    int const err = clientGotBlock(msgs, block, req);
 
     /* cleanup */
     req->length = 0;
@@ -1882,8 +1904,9 @@ static ReadState readBtMessage(tr_peerMsgsImpl* msgs, struct evbuffer* inbuf, si
     return READ_NOW;
 }
 
-/* returns 0 on success, or an errno on failure */
-static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct peer_request const* req)
+/* `block_data` is a tr_blockPoolAlloc() block that goes to the cache or back to the pool.
+ * returns 0 on success, or an errno on failure */
+static int clientGotBlock(tr_peerMsgsImpl* msgs, uint8_t* block_data, struct peer_request const* req)
 {
     TR_ASSERT(msgs != nullptr);
     TR_ASSERT(req != nullptr);
@@ -1894,12 +1917,14 @@ static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct p
     if (!requestIsValid(msgs, req))
     {
         dbgmsg(msgs, "dropping invalid block %u:%u->%u", req->index, req->offset, req->length);
+        tr_blockPoolFree(block_data);
         return EBADMSG;
     }
 
     if (req->length != msgs->torrent->blockSize(block))
     {
         dbgmsg(msgs, "wrong block size -- expected %u, got %d", msgs->torrent->blockSize(block), req->length);
+        tr_blockPoolFree(block_data);
         return EMSGSIZE;
     }
 
@@ -1908,12 +1933,14 @@ static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct p
     if (!tr_peerMgrDidPeerRequest(msgs->torrent, msgs, block))
     {
         dbgmsg(msgs, "we didn't ask for this message...");
+        tr_blockPoolFree(block_data);
         return 0;
     }
 
     if (msgs->torrent->hasPiece(req->index))
     {
         dbgmsg(msgs, "we did ask for this message, but the piece is already complete...");
+        tr_blockPoolFree(block_data);
         return 0;
     }
 
@@ -1921,7 +1948,7 @@ static int clientGotBlock(tr_peerMsgsImpl* msgs, struct evbuffer* data, struct p
     ***  Save the block
     **/
 
-    int const err = tr_cacheWriteBlock(msgs->session->cache, tor, req->index, req->offset, req->length, data);
+    int const err = tr_cacheAdoptBlock(msgs->session->cache, tor, req->index, req->offset, req->length, block_data);
     if (err != 0)
     {
         return err;
@@ -2074,6 +2101,12 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
         return;
     }
 
+    /* don't ask for more until the disk catches up with what we already have */
+    if (tr_cacheIsWriteBacklogged(msgs->session->cache))
+    {
+        return;
+    }
+
     auto const n_active = tr_peerMgrCountActiveRequestsToPeer(msgs->torrent, msgs);
     if (n_active >= msgs->desired_request_count)
     {
@@ -2100,6 +2133,91 @@ static void updateBlockRequests(tr_peerMsgsImpl* msgs)
     }
 }
 
+/* start a piece message. Its block is added to the message once it's been read */
+static evbuffer* newPieceMessage(struct peer_request const* req)
+{
+    auto* const out = evbuffer_new();
+
+    evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req->length);
+    evbuffer_add_uint8(out, BtPiece);
+    evbuffer_add_uint32(out, req->index);
+    evbuffer_add_uint32(out, req->offset);
+
+    return out;
+}
+
+/* Whether the block can go from its files to the socket without being copied.
+ * Blocks that are in the cache may not be on disk yet, so they're sent from there */
+static bool canSendBlockFromFiles(tr_peerMsgsImpl const* msgs, struct peer_request const* req)
+{
+    return msgs->session->isZeroCopyUploadEnabled && tr_peerIoCanSendFiles(msgs->io) &&
+        !tr_cacheHasBlock(msgs->session->cache, msgs->torrent, req->index, req->offset, req->length);
+}
+
+/* returns the number of bytes sent, or 0 if the block couldn't be sent */
+static size_t sendPieceMessage(tr_peerMsgsImpl* msgs, struct peer_request const* req, evbuffer* out, bool err, time_t now)
+{
+    /* check the piece if it needs checking... */
+    if (!err)
+    {
+        err = !msgs->torrent->ensurePieceIsChecked(req->index);
+        if (err)
+        {
+            auto const errmsg = tr_strvJoin("Please Verify Local Data! Piece #", std::to_string(req->index), " is corrupt.");
+            msgs->torrent->setLocalError(errmsg);
+        }
+    }
+
+    if (err)
+    {
+        if (tr_peerIoSupportsFEXT(msgs->io))
+        {
+            protocolSendReject(msgs, req);
+        }
+
+        return 0;
+    }
+
+    size_t const n = evbuffer_get_length(out);
+    dbgmsg(msgs, "sending block %u:%u->%u", req->index, req->offset, req->length);
+    tr_peerIoWriteBuf(msgs->io, out, true);
+    msgs->clientSentAnythingAt = now;
+    msgs->blocksSentToPeer.add(tr_time(), 1);
+    return n;
+}
+
+/* a block that a disk I/O worker is reading for a peer */
+struct block_read
+{
+    tr_peerMsgsImpl* msgs;
+    struct peer_request req;
+    evbuffer* out;
+    uint8_t* block;
+};
+
+static void onBlockRead(tr_session* /*session*/, int err, void* vjob)
+{
+    auto* const job = static_cast<block_read*>(vjob);
+
+    /* if the read was cancelled, the peer is gone */
+    if (err != ECANCELED)
+    {
+        auto* const msgs = job->msgs;
+        TR_ASSERT(msgs->pendingBlockReadBytes >= job->req.length);
+        msgs->pendingBlockReadBytes -= job->req.length;
+
+        tr_blockPoolAddToEvbuffer(job->out, job->block, job->req.length);
+        sendPieceMessage(msgs, &job->req, job->out, err != 0, tr_time());
+    }
+    else
+    {
+        tr_blockPoolFree(job->block);
+    }
+
+    evbuffer_free(job->out);
+    delete job;
+}
+
 static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
 {
     size_t bytesWritten = 0;
@@ -2196,72 +2314,75 @@ static size_t fillOutputBuffer(tr_peerMsgsImpl* msgs, time_t now)
     ***  Data Blocks
     **/
 
-    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->blockSize() && popNextRequest(msgs, &req))
+    if (tr_peerIoGetWriteBufferSpace(msgs->io, now) >= msgs->torrent->blockSize() + msgs->pendingBlockReadBytes &&
+        popNextRequest(msgs, &req))
     {
         --msgs->prefetchCount;
 
         if (requestIsValid(msgs, &req) && msgs->torrent->hasPiece(req.index))
         {
             uint32_t const msglen = 4 + 1 + 4 + 4 + req.length;
-            struct evbuffer_iovec iovec[1];
-
-            auto* const out = evbuffer_new();
-            evbuffer_expand(out, msglen);
-
-            evbuffer_add_uint32(out, sizeof(uint8_t) + 2 * sizeof(uint32_t) + req.length);
-            evbuffer_add_uint8(out, BtPiece);
-            evbuffer_add_uint32(out, req.index);
-            evbuffer_add_uint32(out, req.offset);
-
-            evbuffer_reserve_space(out, req.length, iovec, 1);
-            bool err = tr_cacheReadBlock(
-                           msgs->session->cache,
-                           msgs->torrent,
-                           req.index,
-                           req.offset,
-                           req.length,
-                           static_cast<uint8_t*>(iovec[0].iov_base)) != 0;
-            iovec[0].iov_len = req.length;
-            evbuffer_commit_space(out, iovec, 1);
-
-            /* check the piece if it needs checking... */
-            if (!err)
+            auto* const out = newPieceMessage(&req);
+            auto* const disk_io = msgs->session->diskIo;
+
+            /* if that doesn't work out, the block is read the usual way */
+            bool const from_files = canSendBlockFromFiles(msgs, &req) &&
+                tr_ioAddFileSegments(msgs->torrent, req.index, req.offset, req.length, out) == 0;
+
+            if (!from_files && disk_io != nullptr &&
+                !tr_cacheHasBlock(msgs->session->cache, msgs->torrent, req.index, req.offset, req.length))
             {
-                err = !msgs->torrent->ensurePieceIsChecked(req.index);
-                if (err)
+                /* read it from disk in the background and send it when it's ready */
+                auto* const block = static_cast<uint8_t*>(tr_blockPoolAlloc());
+                auto* const job = new block_read{ msgs, req, out, block };
+                msgs->pendingBlockReadBytes += req.length;
+
+                if (int const err = tr_cacheReadBlockAsync(
+                        msgs->session->cache,
+                        msgs->torrent,
+                        msgs,
+                        req.index,
+                        req.offset,
+                        req.length,
+                        block,
+                        onBlockRead,
+                        job);
+                    err != 0)
                 {
-                    auto const errmsg = tr_strvJoin(
-                        "Please Verify Local Data! Piece #",
-                        std::to_string(req.index),
-                        " is corrupt.");
-                    msgs->torrent->setLocalError(errmsg);
+                    onBlockRead(msgs->session, err, job);
+                    bytesWritten = 0;
+                    msgs = nullptr;
                 }
-            }
-
-            if (err)
-            {
-                if (fext)
+                else
                 {
-                    protocolSendReject(msgs, &req);
+                    bytesWritten += msglen;
                 }
             }
             else
             {
-                size_t const n = evbuffer_get_length(out);
-                dbgmsg(msgs, "sending block %u:%u->%u", req.index, req.offset, req.length);
-                TR_ASSERT(n == msglen);
-                tr_peerIoWriteBuf(msgs->io, out, true);
-                bytesWritten += n;
-                msgs->clientSentAnythingAt = now;
-                msgs->blocksSentToPeer.add(tr_time(), 1);
-            }
+                bool err = false;
 
-            evbuffer_free(out);
+                if (!from_files)
+                {
+                    auto* const block = static_cast<uint8_t*>(tr_blockPoolAlloc());
+                    err = tr_cacheReadBlock(msgs->session->cache, msgs->torrent, req.index, req.offset, req.length, block) !=
+                        0;
+                    tr_blockPoolAddToEvbuffer(out, block, req.length);
+                }
 
-            if (err)
-            {
-                bytesWritten = 0;
-                msgs = nullptr;
+                size_t const n = sendPieceMessage(msgs, &req, out, err, now);
+                evbuffer_free(out);
+
+                if (n == 0)
+                {
+                    bytesWritten = 0;
+                    msgs = nullptr;
+                }
+                else
+                {
+                    TR_ASSERT(n == msglen);
+                    bytesWritten += n;
+                }
             }
         }
         else if (fext) /* peer needs a reject message */
@@ -7,7 +7,9 @@
  */
 
 #include <algorithm>
+#include <cinttypes> /* SCNu64 */
 #include <cstdarg>
+#include <cstdio> /* fopen(), fgets(), sscanf() */
 #include <cstring>
 #include <list>
 #include <string>
@@ -36,6 +38,9 @@
 #ifdef __HAIKU__
 #include <FindDirectory.h>
 #endif
+#ifdef __APPLE__
+#include <mach/mach.h> /* host_statistics64() */
+#endif
 #include <pthread.h>
 #endif
 
@@ -595,3 +600,66 @@ std::string tr_getSessionIdDir()
 
 #endif
 }
+
+/***
+****
+***/
+
+uint64_t tr_getAvailableMemory()
+{
+#if defined(_WIN32)
+
+    auto status = MEMORYSTATUSEX{};
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? status.ullAvailPhys : 0;
+
+#elif defined(__APPLE__)
+
+    static auto const host = mach_host_self();
+    auto stats = vm_statistics64_data_t{};
+    auto count = mach_msg_type_number_t{ HOST_VM_INFO64_COUNT };
+    if (host_statistics64(host, HOST_VM_INFO64, reinterpret_cast<host_info64_t>(&stats), &count) != KERN_SUCCESS)
+    {
+        return 0;
+    }
+
+    /* inactive pages are the ones that can be reclaimed */
+    return (uint64_t{ stats.free_count } + stats.inactive_count) * vm_page_size;
+
+#else
+
+#ifdef __linux__
+    /* unlike the free page count, this includes the page cache that could be dropped */
+    if (auto* const fp = fopen("/proc/meminfo", "r"); fp != nullptr)
+    {
+        auto kib = uint64_t{};
+        auto found = false;
+        char line[256];
+
+        while (!found && fgets(line, sizeof(line), fp) != nullptr)
+        {
+            found = sscanf(line, "MemAvailable: %" SCNu64 " kB", &kib) == 1;
+        }
+
+        fclose(fp);
+
+        if (found)
+        {
+            return kib * 1024;
+        }
+    }
+#endif
+
+#if defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+    auto const pages = sysconf(_SC_AVPHYS_PAGES);
+    auto const page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0)
+    {
+        return uint64_t(pages) * uint64_t(page_size);
+    }
+#endif
+
+    return 0;
+
+#endif
+}
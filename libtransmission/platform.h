@@ -12,6 +12,7 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstdint> // uint64_t
 #include <string>
 #include <string_view>
 
@@ -56,4 +57,7 @@ tr_thread* tr_threadNew(void (*func)(void*), void* arg);
     @param thread the thread being tested */
 bool tr_amInThread(tr_thread const* thread);
 
+/** @brief Return how much physical memory is free or could easily be freed, or 0 if that's unknown */
+uint64_t tr_getAvailableMemory();
+
 /* @} */
@@ -0,0 +1,473 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <condition_variable>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+#include "error-types.h"
+#include "error.h"
+#include "file.h"
+#include "log.h"
+#include "platform.h" /* tr_threadNew() */
+#include "prealloc.h"
+#include "tr-assert.h"
+#include "utils.h" /* _() */
+
+#define dbgmsg(...) tr_logAddDeepNamed(nullptr, __VA_ARGS__)
+
+/***
+****
+***/
+
+namespace
+{
+
+/* how much is zeroed at a time when the filesystem can't allocate space for us */
+auto constexpr ZeroFillStep = size_t{ 1024 * 1024 };
+
+enum class prealloc_state
+{
+    Queued,
+    Allocating,
+    Done
+};
+
+struct prealloc_job
+{
+    tr_session* session;
+    int torrent_id;
+    tr_file_index_t file_index;
+    std::string filename;
+    uint64_t size;
+
+    prealloc_state state = prealloc_state::Queued;
+    std::atomic<bool> stop = false;
+
+    /* everything before this offset has been allocated */
+    std::atomic<uint64_t> allocated = 0;
+
+    /* The [begin, end) ranges that the torrent has written to past
+     * `allocated`, so that zero-filling must skip them. Held while
+     * zero-filling each step, so that a claim and the zeroes can't race */
+    std::mutex claims_mutex;
+    std::map<uint64_t, uint64_t> claims;
+
+    [[nodiscard]] constexpr bool matches(tr_session const* s, int tor_id) const
+    {
+        return session == s && torrent_id == tor_id;
+    }
+};
+
+} // namespace
+
+/* never destroyed: the preallocation thread is detached and takes one last
+ * look at the list after the final job is done, which can be during exit */
+static auto& prealloc_list{ *new std::list<std::shared_ptr<prealloc_job>>{} };
+
+/* so that writing to a file doesn't need the lock when nothing's being preallocated */
+static std::atomic<size_t> prealloc_list_size = 0;
+
+static bool is_thread_running = false;
+
+static std::mutex prealloc_mutex_;
+
+// signalled when a job stops allocating
+static std::condition_variable prealloc_done_cv_;
+
+/* a torrent's jobs are kept until they're all done, so that its progress adds up */
+static void pruneDoneJobs(tr_session const* session, int torrent_id)
+{
+    auto const is_torrent_job = [session, torrent_id](auto const& job)
+    {
+        return job->matches(session, torrent_id);
+    };
+
+    auto const is_pending = [&is_torrent_job](auto const& job)
+    {
+        return is_torrent_job(job) && job->state != prealloc_state::Done;
+    };
+
+    if (std::none_of(std::begin(prealloc_list), std::end(prealloc_list), is_pending))
+    {
+        prealloc_list.remove_if(is_torrent_job);
+        prealloc_list_size = std::size(prealloc_list);
+    }
+}
+
+/* merge [begin, end) into a map of non-overlapping ranges */
+static void addClaim(std::map<uint64_t, uint64_t>& claims, uint64_t begin, uint64_t end)
+{
+    auto it = claims.upper_bound(begin);
+
+    if (it != std::begin(claims) && std::prev(it)->second >= begin)
+    {
+        --it;
+        begin = it->first;
+        end = std::max(end, it->second);
+        it = claims.erase(it);
+    }
+
+    while (it != std::end(claims) && it->first <= end)
+    {
+        end = std::max(end, it->second);
+        it = claims.erase(it);
+    }
+
+    claims.emplace(begin, end);
+}
+
+/***
+****  Allocating, in the preallocation thread
+***/
+
+/* The fast approaches only allocate space and never touch the file's
+ * contents, so they're safe to use while the torrent is writing to it. */
+static bool allocateFast(prealloc_job* job, tr_sys_file_t fd, tr_error** error)
+{
+    if (!tr_sys_file_preallocate(fd, job->size, TR_SYS_FILE_PREALLOC_NO_WRITES, error))
+    {
+        return false;
+    }
+
+    job->allocated = job->size;
+    return true;
+}
+
+static bool writeZeroes(tr_sys_file_t fd, std::vector<char> const& zeroes, uint64_t begin, uint64_t end, tr_error** error)
+{
+    while (begin < end)
+    {
+        auto const len = std::min(end - begin, uint64_t{ std::size(zeroes) });
+        uint64_t n_written = 0;
+
+        if (!tr_sys_file_write_at(fd, std::data(zeroes), len, begin, &n_written, error))
+        {
+            return false;
+        }
+
+        begin += n_written;
+    }
+
+    return true;
+}
+
+/* the old-fashioned way, skipping whatever the torrent has claimed */
+static bool allocateByZeroFill(prealloc_job* job, tr_sys_file_t fd, tr_error** error)
+{
+    auto const zeroes = std::vector<char>(ZeroFillStep);
+
+    while (!job->stop && job->allocated < job->size)
+    {
+        auto const lock = std::lock_guard(job->claims_mutex);
+
+        auto& claims = job->claims;
+        auto const begin = job->allocated.load();
+        auto const end = std::min(job->size, begin + ZeroFillStep);
+
+        auto it = claims.upper_bound(begin);
+        if (it != std::begin(claims) && std::prev(it)->second > begin)
+        {
+            --it;
+        }
+
+        auto pos = begin;
+        for (; it != std::end(claims) && it->first < end; ++it)
+        {
+            if (pos < it->first && !writeZeroes(fd, zeroes, pos, it->first, error))
+            {
+                return false;
+            }
+
+            pos = std::max(pos, it->second);
+        }
+
+        if (pos < end && !writeZeroes(fd, zeroes, pos, end, error))
+        {
+            return false;
+        }
+
+        job->allocated = end;
+
+        // the claims behind us are no longer needed
+        while (!std::empty(claims) && std::begin(claims)->second <= end)
+        {
+            claims.erase(std::begin(claims));
+        }
+    }
+
+    return true;
+}
+
+static void allocateFile(prealloc_job* job)
+{
+    tr_error* error = nullptr;
+
+    tr_sys_file_t const fd = tr_sys_file_open(job->filename.c_str(), TR_SYS_FILE_WRITE, 0, &error);
+    bool ok = fd != TR_BAD_SYS_FILE;
+
+    if (ok && !allocateFast(job, fd, &error))
+    {
+        dbgmsg("Preallocating (full, normal) failed (%d): %s", error->code, error->message);
+
+        if (!TR_ERROR_IS_ENOSPC(error->code))
+        {
+            tr_error_clear(&error);
+            ok = allocateByZeroFill(job, fd, &error);
+
+            if (!ok)
+            {
+                dbgmsg("Preallocating (full, fallback) failed (%d): %s", error->code, error->message);
+            }
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+
+    if (fd != TR_BAD_SYS_FILE)
+    {
+        tr_sys_file_close(fd, nullptr);
+    }
+
+    if (!ok)
+    {
+        tr_logAddError(
+            _("Couldn't preallocate file \"%1$s\" (%2$s, size: %3$" PRIu64 "): %4$s"),
+            job->filename.c_str(),
+            _("full"),
+            job->size,
+            error->message);
+        tr_error_free(error);
+    }
+    else if (!job->stop)
+    {
+        tr_logAddDebug(
+            _("Preallocated file \"%1$s\" (%2$s, size: %3$" PRIu64 ")"),
+            job->filename.c_str(),
+            _("full"),
+            job->size);
+    }
+}
+
+static void preallocThreadFunc(void* /*user_data*/)
+{
+    for (;;)
+    {
+        auto lock = std::unique_lock(prealloc_mutex_);
+
+        auto const it = std::find_if(
+            std::begin(prealloc_list),
+            std::end(prealloc_list),
+            [](auto const& job) { return job->state == prealloc_state::Queued; });
+        if (it == std::end(prealloc_list))
+        {
+            is_thread_running = false;
+            return;
+        }
+
+        auto const job = *it;
+        job->state = prealloc_state::Allocating;
+        lock.unlock();
+
+        allocateFile(job.get());
+
+        lock.lock();
+        job->state = prealloc_state::Done;
+        pruneDoneJobs(job->session, job->torrent_id);
+        prealloc_done_cv_.notify_all();
+    }
+}
+
+/***
+****
+***/
+
+void tr_preallocAdd(
+    tr_session* session,
+    int torrent_id,
+    tr_file_index_t file_index,
+    char const* filename,
+    uint64_t file_size,
+    uint64_t allocated)
+{
+    TR_ASSERT(filename != nullptr);
+    TR_ASSERT(allocated <= file_size);
+
+    if (file_size == 0)
+    {
+        return;
+    }
+
+    auto const lock = std::lock_guard(prealloc_mutex_);
+
+    // the file is reopened whenever the open files cache has closed it
+    if (std::any_of(
+            std::begin(prealloc_list),
+            std::end(prealloc_list),
+            [session, torrent_id, file_index](auto const& job)
+            { return job->matches(session, torrent_id) && job->file_index == file_index; }))
+    {
+        return;
+    }
+
+    auto job = std::make_shared<prealloc_job>();
+    job->session = session;
+    job->torrent_id = torrent_id;
+    job->file_index = file_index;
+    job->filename = filename;
+    job->size = file_size;
+    job->allocated = allocated;
+    prealloc_list.push_back(std::move(job));
+    prealloc_list_size = std::size(prealloc_list);
+
+    if (!is_thread_running)
+    {
+        is_thread_running = true;
+        tr_threadNew(preallocThreadFunc, nullptr);
+    }
+}
+
+void tr_preallocClaim(tr_session* session, int torrent_id, tr_file_index_t file_index, uint64_t offset, uint64_t length)
+{
+    if (prealloc_list_size == 0)
+    {
+        return;
+    }
+
+    auto lock = std::unique_lock(prealloc_mutex_);
+
+    auto const it = std::find_if(
+        std::begin(prealloc_list),
+        std::end(prealloc_list),
+        [session, torrent_id, file_index](auto const& job)
+        { return job->matches(session, torrent_id) && job->file_index == file_index && job->state != prealloc_state::Done; });
+
+    if (it == std::end(prealloc_list) || offset + length <= (*it)->allocated)
+    {
+        return;
+    }
+
+    // don't hold up writes to other files while waiting for this one
+    auto const job = *it;
+    lock.unlock();
+
+    auto const claims_lock = std::lock_guard(job->claims_mutex);
+
+    if (offset + length > job->allocated)
+    {
+        addClaim(job->claims, offset, offset + length);
+    }
+}
+
+void tr_preallocRemove(tr_session* session, int torrent_id)
+{
+    auto lock = std::unique_lock(prealloc_mutex_);
+
+    auto const is_torrent_job = [session, torrent_id](auto const& job)
+    {
+        return job->matches(session, torrent_id);
+    };
+
+    for (auto& job : prealloc_list)
+    {
+        if (is_torrent_job(job))
+        {
+            job->stop = true;
+        }
+    }
+
+    // wait for the preallocation thread to stop writing, so that it's
+    // safe for the caller to do as it likes with the torrent's files
+    prealloc_done_cv_.wait(
+        lock,
+        [&is_torrent_job]()
+        {
+            return std::none_of(
+                std::begin(prealloc_list),
+                std::end(prealloc_list),
+                [&is_torrent_job](auto const& job)
+                { return is_torrent_job(job) && job->state == prealloc_state::Allocating; });
+        });
+
+    prealloc_list.remove_if(is_torrent_job);
+    prealloc_list_size = std::size(prealloc_list);
+}
+
+void tr_preallocClose(tr_session* session)
+{
+    auto lock = std::unique_lock(prealloc_mutex_);
+
+    auto const is_session_job = [session](auto const& job)
+    {
+        return job->session == session;
+    };
+
+    for (auto& job : prealloc_list)
+    {
+        if (is_session_job(job))
+        {
+            job->stop = true;
+        }
+    }
+
+    prealloc_done_cv_.wait(
+        lock,
+        [&is_session_job]()
+        {
+            return std::none_of(
+                std::begin(prealloc_list),
+                std::end(prealloc_list),
+                [&is_session_job](auto const& job) { return is_session_job(job) && job->state == prealloc_state::Allocating; });
+        });
+
+    prealloc_list.remove_if(is_session_job);
+    prealloc_list_size = std::size(prealloc_list);
+}
+
+bool tr_preallocGetProgress(tr_session* session, int torrent_id, float* setme_progress)
+{
+    *setme_progress = 0;
+
+    if (prealloc_list_size == 0)
+    {
+        return false;
+    }
+
+    auto const lock = std::lock_guard(prealloc_mutex_);
+
+    auto total_size = uint64_t{};
+    auto total_allocated = uint64_t{};
+
+    for (auto const& job : prealloc_list)
+    {
+        if (job->matches(session, torrent_id) && !job->stop)
+        {
+            total_size += job->size;
+            total_allocated += job->state == prealloc_state::Done ? job->size : job->allocated.load();
+        }
+    }
+
+    if (total_size == 0)
+    {
+        return false;
+    }
+
+    *setme_progress = float(double(total_allocated) / total_size);
+    return true;
+}
@@ -0,0 +1,68 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstdint> // uint64_t
+
+#include "transmission.h"
+
+/**
+ * @addtogroup file_io File IO
+ * @{
+ */
+
+/**
+ * @brief Fully preallocate a file in the background.
+ *
+ * This is for TR_PREALLOCATE_FULL, which can mean writing out the whole
+ * file when the filesystem can't allocate space for it any other way.
+ * The torrent can write to the file in the meantime, as long as it calls
+ * tr_preallocClaim() first.
+ *
+ * Everything before `allocated` is taken to be there already, since the
+ * torrent may have written to it, so only what's after it is zeroed.
+ * Does nothing if the file is already being preallocated.
+ */
+void tr_preallocAdd(
+    tr_session* session,
+    int torrent_id,
+    tr_file_index_t file_index,
+    char const* filename,
+    uint64_t file_size,
+    uint64_t allocated = 0);
+
+/**
+ * @brief Must be called before writing to a file that may be getting preallocated.
+ *
+ * Returns right away if that part of the file has already been allocated.
+ * Otherwise, it keeps the preallocation from writing zeroes over it.
+ */
+void tr_preallocClaim(tr_session* session, int torrent_id, tr_file_index_t file_index, uint64_t offset, uint64_t length);
+
+/**
+ * @brief Stop preallocating the torrent's files.
+ *
+ * Once this returns, the files are no longer being written to.
+ */
+void tr_preallocRemove(tr_session* session, int torrent_id);
+
+void tr_preallocClose(tr_session* session);
+
+/**
+ * @brief Get how far along the preallocation of the torrent's files is.
+ *
+ * @return `false` if none of the torrent's files are being preallocated.
+ */
+bool tr_preallocGetProgress(tr_session* session, int torrent_id, float* setme_progress);
+
+/* @} */
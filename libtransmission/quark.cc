@@ -21,7 +21,7 @@ using namespace std::literals;
 namespace
 {
 
-auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
+auto constexpr my_static = std::array<std::string_view, 421>{ ""sv,
                                                               "activeTorrentCount"sv,
                                                               "activity-date"sv,
                                                               "activityDate"sv,
@@ -50,6 +50,8 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "bind-address-ipv4"sv,
                                                               "bind-address-ipv6"sv,
                                                               "bitfield"sv,
+                                                              "blockPoolBytes"sv,
+                                                              "blockPoolBytesUsed"sv,
                                                               "blocklist-date"sv,
                                                               "blocklist-enabled"sv,
                                                               "blocklist-size"sv,
@@ -57,6 +59,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "blocklist-url"sv,
                                                               "blocks"sv,
                                                               "bytesCompleted"sv,
+                                                              "cache-auto-size-enabled"sv,
                                                               "cache-size-mb"sv,
                                                               "clientIsChoked"sv,
                                                               "clientIsInterested"sv,
@@ -82,7 +85,10 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "destination"sv,
                                                               "details-window-height"sv,
                                                               "details-window-width"sv,
+                                                              "device"sv,
                                                               "dht-enabled"sv,
+                                                              "direct-io-enabled"sv,
+                                                              "diskDevices"sv,
                                                               "display-name"sv,
                                                               "dnd"sv,
                                                               "done-date"sv,
@@ -112,9 +118,16 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "errorString"sv,
                                                               "eta"sv,
                                                               "etaIdle"sv,
+                                                              "eventLoopLatencyUsec"sv,
+                                                              "eventLoopMaxLatencyUsec"sv,
+                                                              "eventLoopQueued"sv,
+                                                              "eventLoopRun"sv,
                                                               "failure reason"sv,
                                                               "fields"sv,
                                                               "file-count"sv,
+                                                              "fileCacheCloses"sv,
+                                                              "fileCacheEvictions"sv,
+                                                              "fileCacheOpens"sv,
                                                               "fileStats"sv,
                                                               "filename"sv,
                                                               "files"sv,
@@ -168,6 +181,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "isStalled"sv,
                                                               "isUTP"sv,
                                                               "isUploadingTo"sv,
+                                                              "jobsDone"sv,
                                                               "labels"sv,
                                                               "lastAnnouncePeerCount"sv,
                                                               "lastAnnounceResult"sv,
@@ -180,6 +194,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "lastScrapeSucceeded"sv,
                                                               "lastScrapeTime"sv,
                                                               "lastScrapeTimedOut"sv,
+                                                              "latencyUsec"sv,
                                                               "leecherCount"sv,
                                                               "leftUntilDone"sv,
                                                               "length"sv,
@@ -197,6 +212,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "manualAnnounceTime"sv,
                                                               "max-peers"sv,
                                                               "maxConnectedPeers"sv,
+                                                              "maxLatencyUsec"sv,
                                                               "memory-bytes"sv,
                                                               "memory-units"sv,
                                                               "message-level"sv,
@@ -216,6 +232,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "nodes"sv,
                                                               "nodes6"sv,
                                                               "open-dialog-dir"sv,
+                                                              "open-file-limit"sv,
                                                               "p"sv,
                                                               "path"sv,
                                                               "path.utf-8"sv,
@@ -223,6 +240,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "pausedTorrentCount"sv,
                                                               "peer-congestion-algorithm"sv,
                                                               "peer-id-ttl-hours"sv,
+                                                              "peer-io-threads"sv,
                                                               "peer-limit"sv,
                                                               "peer-limit-global"sv,
                                                               "peer-limit-per-torrent"sv,
@@ -270,6 +288,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "queue-stalled-enabled"sv,
                                                               "queue-stalled-minutes"sv,
                                                               "queuePosition"sv,
+                                                              "queued"sv,
                                                               "rateDownload"sv,
                                                               "rateToClient"sv,
                                                               "rateToPeer"sv,
@@ -277,11 +296,15 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "ratio-limit"sv,
                                                               "ratio-limit-enabled"sv,
                                                               "ratio-mode"sv,
+                                                              "read-cache-size-mb"sv,
+                                                              "readCacheHits"sv,
+                                                              "readCacheMisses"sv,
                                                               "recent-download-dir-1"sv,
                                                               "recent-download-dir-2"sv,
                                                               "recent-download-dir-3"sv,
                                                               "recent-download-dir-4"sv,
                                                               "recheckProgress"sv,
+                                                              "relocate-speed-limit"sv,
                                                               "remote-session-enabled"sv,
                                                               "remote-session-host"sv,
                                                               "remote-session-password"sv,
@@ -306,6 +329,7 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "rpc-version-semver"sv,
                                                               "rpc-whitelist"sv,
                                                               "rpc-whitelist-enabled"sv,
+                                                              "running"sv,
                                                               "scrape"sv,
                                                               "scrape-paused-torrents-enabled"sv,
                                                               "scrapeState"sv,
@@ -383,6 +407,8 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "trackers"sv,
                                                               "trash-can-enabled"sv,
                                                               "trash-original-torrent-files"sv,
+                                                              "udpPacketsReceived"sv,
+                                                              "udpReadWakeups"sv,
                                                               "umask"sv,
                                                               "units"sv,
                                                               "upload-slots-per-torrent"sv,
@@ -406,13 +432,16 @@ auto constexpr my_static = std::array<std::string_view, 392>{ ""sv,
                                                               "ut_recommend"sv,
                                                               "utp-enabled"sv,
                                                               "v"sv,
+                                                              "verify-speed-limit"sv,
+                                                              "verify-threads"sv,
                                                               "version"sv,
                                                               "wanted"sv,
                                                               "warning message"sv,
                                                               "watch-dir"sv,
                                                               "watch-dir-enabled"sv,
                                                               "webseeds"sv,
-                                                              "webseedsSendingToUs"sv };
+                                                              "webseedsSendingToUs"sv,
+                                                              "zero-copy-upload-enabled"sv };
 
 size_t constexpr quarks_are_sorted = ( //
     []() constexpr
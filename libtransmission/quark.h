@@ -52,6 +52,8 @@ enum
     TR_KEY_bind_address_ipv4,
     TR_KEY_bind_address_ipv6,
     TR_KEY_bitfield,
+    TR_KEY_blockPoolBytes,
+    TR_KEY_blockPoolBytesUsed,
     TR_KEY_blocklist_date,
     TR_KEY_blocklist_enabled,
     TR_KEY_blocklist_size,
@@ -59,6 +61,7 @@ enum
     TR_KEY_blocklist_url,
     TR_KEY_blocks,
     TR_KEY_bytesCompleted,
+    TR_KEY_cache_auto_size_enabled,
     TR_KEY_cache_size_mb,
     TR_KEY_clientIsChoked,
     TR_KEY_clientIsInterested,
@@ -84,7 +87,10 @@ enum
     TR_KEY_destination,
     TR_KEY_details_window_height,
     TR_KEY_details_window_width,
+    TR_KEY_device,
     TR_KEY_dht_enabled,
+    TR_KEY_direct_io_enabled,
+    TR_KEY_diskDevices,
     TR_KEY_display_name,
     TR_KEY_dnd,
     TR_KEY_done_date,
@@ -114,9 +120,16 @@ enum
     TR_KEY_errorString,
     TR_KEY_eta,
     TR_KEY_etaIdle,
+    TR_KEY_eventLoopLatencyUsec,
+    TR_KEY_eventLoopMaxLatencyUsec,
+    TR_KEY_eventLoopQueued,
+    TR_KEY_eventLoopRun,
     TR_KEY_failure_reason,
     TR_KEY_fields,
     TR_KEY_file_count,
+    TR_KEY_fileCacheCloses,
+    TR_KEY_fileCacheEvictions,
+    TR_KEY_fileCacheOpens,
     TR_KEY_fileStats,
     TR_KEY_filename,
     TR_KEY_files,
@@ -170,6 +183,7 @@ enum
     TR_KEY_isStalled,
     TR_KEY_isUTP,
     TR_KEY_isUploadingTo,
+    TR_KEY_jobsDone,
     TR_KEY_labels,
     TR_KEY_lastAnnouncePeerCount,
     TR_KEY_lastAnnounceResult,
@@ -182,6 +196,7 @@ enum
     TR_KEY_lastScrapeSucceeded,
     TR_KEY_lastScrapeTime,
     TR_KEY_lastScrapeTimedOut,
+    TR_KEY_latencyUsec,
     TR_KEY_leecherCount,
     TR_KEY_leftUntilDone,
     TR_KEY_length,
@@ -199,6 +214,7 @@ enum
     TR_KEY_manualAnnounceTime,
     TR_KEY_max_peers,
     TR_KEY_maxConnectedPeers,
+    TR_KEY_maxLatencyUsec,
     TR_KEY_memory_bytes,
     TR_KEY_memory_units,
     TR_KEY_message_level,
@@ -218,6 +234,7 @@ enum
     TR_KEY_nodes,
     TR_KEY_nodes6,
     TR_KEY_open_dialog_dir,
+    TR_KEY_open_file_limit,
     TR_KEY_p,
     TR_KEY_path,
     TR_KEY_path_utf_8,
@@ -225,6 +242,7 @@ enum
     TR_KEY_pausedTorrentCount,
     TR_KEY_peer_congestion_algorithm,
     TR_KEY_peer_id_ttl_hours,
+    TR_KEY_peer_io_threads,
     TR_KEY_peer_limit,
     TR_KEY_peer_limit_global,
     TR_KEY_peer_limit_per_torrent,
@@ -272,6 +290,7 @@ enum
     TR_KEY_queue_stalled_enabled,
     TR_KEY_queue_stalled_minutes,
     TR_KEY_queuePosition,
+    TR_KEY_queued,
     TR_KEY_rateDownload,
     TR_KEY_rateToClient,
     TR_KEY_rateToPeer,
@@ -279,11 +298,15 @@ enum
     TR_KEY_ratio_limit,
     TR_KEY_ratio_limit_enabled,
     TR_KEY_ratio_mode,
+    TR_KEY_read_cache_size_mb,
+    TR_KEY_readCacheHits,
+    TR_KEY_readCacheMisses,
     TR_KEY_recent_download_dir_1,
     TR_KEY_recent_download_dir_2,
     TR_KEY_recent_download_dir_3,
     TR_KEY_recent_download_dir_4,
     TR_KEY_recheckProgress,
+    TR_KEY_relocate_speed_limit,
     TR_KEY_remote_session_enabled,
     TR_KEY_remote_session_host,
     TR_KEY_remote_session_password,
@@ -308,6 +331,7 @@ enum
     TR_KEY_rpc_version_semver,
     TR_KEY_rpc_whitelist,
     TR_KEY_rpc_whitelist_enabled,
+    TR_KEY_running,
     TR_KEY_scrape,
     TR_KEY_scrape_paused_torrents_enabled,
     TR_KEY_scrapeState,
@@ -385,6 +409,8 @@ enum
     TR_KEY_trackers,
     TR_KEY_trash_can_enabled,
     TR_KEY_trash_original_torrent_files,
+    TR_KEY_udpPacketsReceived,
+    TR_KEY_udpReadWakeups,
     TR_KEY_umask,
     TR_KEY_units,
     TR_KEY_upload_slots_per_torrent,
@@ -408,6 +434,8 @@ enum
     TR_KEY_ut_recommend,
     TR_KEY_utp_enabled,
     TR_KEY_v,
+    TR_KEY_verify_speed_limit,
+    TR_KEY_verify_threads,
     TR_KEY_version,
     TR_KEY_wanted,
     TR_KEY_warning_message,
@@ -415,6 +443,7 @@ enum
     TR_KEY_watch_dir_enabled,
     TR_KEY_webseeds,
     TR_KEY_webseedsSendingToUs,
+    TR_KEY_zero_copy_upload_enabled,
     TR_N_KEYS
 };
 
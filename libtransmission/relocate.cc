@@ -0,0 +1,745 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "transmission.h"
+#include "cache.h" /* tr_cacheFlushTorrent() */
+#include "disk-io.h"
+#include "error.h"
+#include "fdlimit.h" /* tr_fdTorrentClose() */
+#include "file.h"
+#include "log.h"
+#include "platform.h" /* tr_threadNew() */
+#include "prealloc.h"
+#include "relocate.h"
+#include "torrent.h"
+#include "tr-assert.h"
+#include "trevent.h" /* tr_runInEventThread() */
+#include "utils.h"
+#include "verify.h"
+
+using namespace std::literals;
+
+/***
+****
+***/
+
+namespace
+{
+
+auto constexpr ChunkSize = size_t{ 1024 * 1024 };
+
+/* copies are made under a temporary name, so that nothing at the new
+ * location is clobbered until the torrent switches over to it */
+auto constexpr CopySuffix = ".relocating"sv;
+
+struct relocate_file
+{
+    tr_file_index_t index;
+
+    std::string oldpath;
+    std::string newpath;
+
+    /* where the copy is made, or empty if the file can be renamed into place */
+    std::string tmppath;
+
+    uint64_t size;
+
+    /* the file's tr_torrent::fileWriteCount() before it was copied */
+    uint64_t write_count;
+
+    /* the disk that it's on now */
+    uint64_t device;
+
+    bool is_copied = false;
+};
+
+enum class relocate_state
+{
+    Queued,
+    Copying,
+
+    /* waiting for the libtransmission thread to switch the torrent over */
+    Copied
+};
+
+struct relocate_job
+{
+    tr_torrent* tor;
+    tr_session* session;
+    std::string location;
+    uint64_t location_device;
+
+    double volatile* setme_progress;
+    int volatile* setme_state;
+
+    std::vector<relocate_file> files;
+    uint64_t total_size = 0;
+
+    relocate_state state = relocate_state::Queued;
+    std::atomic<bool> stop = false;
+
+    /* set when a copy failed, so that switchOver() only tells the torrent */
+    bool failed = false;
+
+    /* progress, updated by the relocation thread */
+    std::atomic<uint64_t> bytes_done = 0;
+    std::atomic<size_t> current_file = 0;
+    std::atomic<uint64_t> current_file_bytes_done = 0;
+};
+
+} // namespace
+
+/* never destroyed: the relocation thread is detached, and after tr_relocateClose()
+ * it still takes one last look at the list, which can be during exit */
+static auto& relocate_list{ *new std::list<relocate_job>{} };
+
+static bool is_thread_running = false;
+static std::atomic<uint64_t> relocate_speed_limit = 0;
+
+static std::mutex relocate_mutex_;
+
+// signalled when a job stops copying
+static std::condition_variable relocate_done_cv_;
+
+static void setState(relocate_job* job, int state)
+{
+    if (job->setme_state != nullptr)
+    {
+        *job->setme_state = state;
+    }
+}
+
+static void updateProgress(relocate_job* job)
+{
+    if (job->setme_progress != nullptr && job->total_size != 0)
+    {
+        *job->setme_progress = double(job->bytes_done) / job->total_size;
+    }
+}
+
+static void removeCopies(relocate_job const* job)
+{
+    for (auto const& file : job->files)
+    {
+        if (!std::empty(file.tmppath))
+        {
+            tr_sys_path_remove(file.tmppath.c_str(), nullptr);
+        }
+    }
+}
+
+static std::list<relocate_job>::iterator findJob(relocate_job const* job)
+{
+    return std::find_if(
+        std::begin(relocate_list),
+        std::end(relocate_list),
+        [job](auto const& that) { return &that == job; });
+}
+
+/***
+****  Copying, in the relocation thread
+***/
+
+/* sleep as long as it takes to bring the copying speed down to the limit */
+static void throttleCopy(relocate_job const* job, uint64_t begin_msec, uint64_t bytes_copied)
+{
+    for (;;)
+    {
+        // check the limit each time around, so that changing it takes effect right away
+        auto const speed_limit = relocate_speed_limit.load();
+        if (speed_limit == 0 || job->stop)
+        {
+            break;
+        }
+
+        auto const target_msec = begin_msec + bytes_copied * 1000 / speed_limit;
+        auto const now = tr_time_msec();
+        if (now >= target_msec)
+        {
+            break;
+        }
+
+        tr_wait_msec(std::min(target_msec - now, uint64_t{ 100 }));
+    }
+}
+
+static bool writeAll(tr_sys_file_t fd, char const* buf, uint64_t len, tr_error** error)
+{
+    while (len > 0)
+    {
+        uint64_t n_written = 0;
+        if (!tr_sys_file_write(fd, buf, len, &n_written, error))
+        {
+            return false;
+        }
+
+        buf += n_written;
+        len -= n_written;
+    }
+
+    return true;
+}
+
+static bool copyFile(
+    relocate_job* job,
+    relocate_file const& file,
+    std::vector<char>& buf,
+    uint64_t begin_msec,
+    uint64_t* bytes_copied,
+    tr_error** error)
+{
+    char* const dir = tr_sys_path_dirname(file.tmppath, error);
+    bool const dir_ok = dir != nullptr && tr_sys_dir_create(dir, TR_SYS_DIR_CREATE_PARENTS, 0777, error);
+    tr_free(dir);
+    if (!dir_ok)
+    {
+        return false;
+    }
+
+    tr_sys_file_t const in = tr_sys_file_open(file.oldpath.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, error);
+    if (in == TR_BAD_SYS_FILE)
+    {
+        return false;
+    }
+
+    tr_sys_file_t const out = tr_sys_file_open(
+        file.tmppath.c_str(),
+        TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE | TR_SYS_FILE_TRUNCATE,
+        0666,
+        error);
+    if (out == TR_BAD_SYS_FILE)
+    {
+        tr_sys_file_close(in, nullptr);
+        return false;
+    }
+
+    bool ok = true;
+    uint64_t file_bytes_copied = 0;
+
+    // e.g. between Btrfs subvolumes. The clone shares the original's
+    // blocks, so there's nothing to copy and nothing to throttle
+    bool const cloned = file.size > 0 && tr_sys_file_clone(in, out, nullptr);
+    auto method = cloned ? TR_SYS_PATH_COPY_CLONE : TR_SYS_PATH_COPY_IN_KERNEL;
+    if (cloned)
+    {
+        job->current_file_bytes_done = file.size;
+        job->bytes_done += file.size;
+        updateProgress(job);
+    }
+
+    while (ok && !cloned && !job->stop)
+    {
+        // stay out of the way of the peers' reads and writes on both disks
+        tr_diskIoYield(job->session->diskIo, file.device);
+        tr_diskIoYield(job->session->diskIo, job->location_device);
+
+        // have the kernel copy the chunk, or the server if it's on NFS or SMB.
+        // If it can't, e.g. between filesystems, copy the rest in user space
+        uint64_t n_copied = 0;
+        if (method == TR_SYS_PATH_COPY_IN_KERNEL &&
+            (!tr_sys_file_copy_range(in, out, std::size(buf), &n_copied, nullptr) ||
+             (n_copied == 0 && file_bytes_copied < file.size)))
+        {
+            method = TR_SYS_PATH_COPY_CHUNKED;
+        }
+
+        if (method == TR_SYS_PATH_COPY_CHUNKED)
+        {
+            ok = tr_sys_file_read(in, std::data(buf), std::size(buf), &n_copied, error) &&
+                writeAll(out, std::data(buf), n_copied, error);
+        }
+
+        if (!ok || n_copied == 0)
+        {
+            break;
+        }
+
+        file_bytes_copied += n_copied;
+        *bytes_copied += n_copied;
+        job->current_file_bytes_done = file_bytes_copied;
+        job->bytes_done += n_copied;
+        updateProgress(job);
+        throttleCopy(job, begin_msec, *bytes_copied);
+    }
+
+    tr_sys_file_close(in, nullptr);
+    ok = tr_sys_file_close(out, ok ? error : nullptr) && ok;
+
+    if (ok && !job->stop)
+    {
+        if (method == TR_SYS_PATH_COPY_CLONE)
+        {
+            tr_logAddDebug("Cloned \"%s\" to \"%s\"", file.oldpath.c_str(), file.tmppath.c_str());
+        }
+        else
+        {
+            tr_logAddDebug(
+                "Copied \"%s\" to \"%s\" %s",
+                file.oldpath.c_str(),
+                file.tmppath.c_str(),
+                method == TR_SYS_PATH_COPY_IN_KERNEL ? "in the kernel" : "in chunks");
+        }
+    }
+
+    return ok && !job->stop;
+}
+
+static bool copyFiles(relocate_job* job)
+{
+    auto buf = std::vector<char>(ChunkSize);
+    auto const begin_msec = tr_time_msec();
+    auto bytes_copied = uint64_t{};
+
+    for (size_t i = 0, n = std::size(job->files); i < n && !job->stop; ++i)
+    {
+        auto& file = job->files[i];
+        job->current_file_bytes_done = 0;
+        job->current_file = i;
+
+        if (std::empty(file.tmppath))
+        {
+            // it'll be renamed, which takes no time at all
+            job->bytes_done += file.size;
+        }
+        else
+        {
+            auto const file_bytes_done = job->bytes_done.load();
+            tr_error* error = nullptr;
+
+            if (!copyFile(job, file, buf, begin_msec, &bytes_copied, &error))
+            {
+                if (error != nullptr)
+                {
+                    tr_logAddError(
+                        "error copying \"%s\" to \"%s\": %s",
+                        file.oldpath.c_str(),
+                        file.tmppath.c_str(),
+                        error->message);
+                    tr_error_free(error);
+                }
+
+                return false;
+            }
+
+            // the file may have grown or shrunk since the job was queued
+            job->bytes_done = file_bytes_done + file.size;
+            file.is_copied = true;
+        }
+
+        updateProgress(job);
+    }
+
+    return !job->stop;
+}
+
+static void switchOver(void* vjob);
+
+static void relocateThreadFunc(void* /*user_data*/)
+{
+    for (;;)
+    {
+        auto lock = std::unique_lock(relocate_mutex_);
+
+        auto const it = std::find_if(
+            std::begin(relocate_list),
+            std::end(relocate_list),
+            [](auto const& job) { return job.state == relocate_state::Queued; });
+        if (it == std::end(relocate_list))
+        {
+            is_thread_running = false;
+            return;
+        }
+
+        auto* const job = &*it;
+        job->state = relocate_state::Copying;
+        lock.unlock();
+
+        bool const copied = copyFiles(job);
+
+        if (!copied)
+        {
+            removeCopies(job);
+        }
+
+        lock.lock();
+
+        if (copied || !job->stop)
+        {
+            job->state = relocate_state::Copied;
+            job->failed = !copied;
+            tr_runInEventThread(job->session, switchOver, job);
+        }
+        else
+        {
+            setState(job, TR_LOC_ERROR);
+            relocate_list.erase(findJob(job));
+        }
+
+        relocate_done_cv_.notify_all();
+    }
+}
+
+/***
+****  Switching over, in the libtransmission thread
+***/
+
+/* the copy that was made of the file, if it's still good */
+static relocate_file const* findCopy(
+    relocate_job const* job,
+    tr_torrent const* tor,
+    tr_file_index_t i,
+    std::string const& oldpath)
+{
+    auto const it = std::find_if(
+        std::begin(job->files),
+        std::end(job->files),
+        [i](auto const& file) { return file.index == i; });
+
+    if (it == std::end(job->files) || !it->is_copied || it->oldpath != oldpath)
+    {
+        return nullptr;
+    }
+
+    // if the torrent wrote to the file while it was being copied, the copy's stale
+    if (it->write_count != tor->fileWriteCount(i))
+    {
+        return nullptr;
+    }
+
+    return &*it;
+}
+
+static bool moveFiles(relocate_job const* job, tr_torrent* tor)
+{
+    /* bad idea to move files while they're being verified or preallocated... */
+    tr_verifyRemove(tor);
+    tr_preallocRemove(tor->session, tor->uniqueId);
+
+    /* ...or while they're being written to */
+    tr_cacheFlushTorrent(tor->session->cache, tor);
+    tr_fdTorrentClose(tor->session, tor->uniqueId);
+
+    /* Files that were written to while they were being copied, or that
+     * have turned up since the job was queued, are moved here instead.
+     * FIXME: there are still all kinds of nasty cases, like what
+     * if the target directory runs out of space halfway through... */
+    for (tr_file_index_t i = 0, n = tor->fileCount(); i < n; ++i)
+    {
+        char const* oldbase = nullptr;
+        char* sub = nullptr;
+        if (!tr_torrentFindFile2(tor, i, &oldbase, &sub, nullptr))
+        {
+            continue;
+        }
+
+        auto const oldpath = tr_strvPath(oldbase, sub);
+        auto const newpath = tr_strvPath(job->location, sub);
+        tr_free(sub);
+
+        if (tr_sys_path_is_same(oldpath.c_str(), newpath.c_str(), nullptr))
+        {
+            continue;
+        }
+
+        tr_logAddTorInfo(tor, "moving \"%s\" to \"%s\"", oldpath.c_str(), newpath.c_str());
+
+        tr_error* error = nullptr;
+        bool moved = false;
+
+        if (auto const* const copy = findCopy(job, tor, i, oldpath); copy != nullptr)
+        {
+            moved = tr_sys_path_rename(copy->tmppath.c_str(), newpath.c_str(), &error);
+
+            if (moved && !tr_sys_path_remove(oldpath.c_str(), nullptr))
+            {
+                tr_logAddTorErr(tor, "Unable to remove file at old path \"%s\"", oldpath.c_str());
+            }
+        }
+        else
+        {
+            moved = tr_moveFile(oldpath.c_str(), newpath.c_str(), &error);
+        }
+
+        if (!moved)
+        {
+            tr_logAddTorErr(
+                tor,
+                "error moving \"%s\" to \"%s\": %s",
+                oldpath.c_str(),
+                newpath.c_str(),
+                error != nullptr ? error->message : "");
+            tr_error_free(error);
+            return false;
+        }
+    }
+
+    /* blow away the leftover subdirectories in the old location */
+    tr_torrentDeleteLocalData(tor, tr_sys_path_remove);
+    return true;
+}
+
+static void switchOver(void* vjob)
+{
+    auto* const job = static_cast<relocate_job*>(vjob);
+
+    // if the job was cancelled while it was waiting, the torrent might be gone
+    bool ok = !job->stop;
+
+    if (ok)
+    {
+        auto* const tor = job->tor;
+        TR_ASSERT(tr_isTorrent(tor));
+        auto const lock = tor->unique_lock();
+
+        ok = !job->failed && moveFiles(job, tor);
+
+        if (ok)
+        {
+            /* set the new location and reverify */
+            tr_torrentSetDownloadDir(tor, job->location.c_str());
+            tor->incomplete_dir.clear();
+            tor->current_dir = tor->downloadDir();
+        }
+
+        /* the files are wherever they're going to stay now */
+        tr_torrentCallPendingDoneScript(tor);
+    }
+
+    removeCopies(job);
+
+    auto const lock = std::lock_guard(relocate_mutex_);
+
+    if (ok && job->setme_progress != nullptr)
+    {
+        *job->setme_progress = 1.0;
+    }
+
+    setState(job, ok ? TR_LOC_DONE : TR_LOC_ERROR);
+    relocate_list.erase(findJob(job));
+}
+
+/***
+****
+***/
+
+void tr_relocateAdd(tr_torrent* tor, std::string_view location, double volatile* setme_progress, int volatile* setme_state)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+    TR_ASSERT(tr_amInEventThread(tor->session));
+
+    // a newer move replaces an older one
+    tr_relocateRemove(tor);
+
+    // so that the copies have all of the blocks in the cache
+    tr_cacheFlushTorrent(tor->session->cache, tor);
+
+    auto files = std::vector<relocate_file>{};
+    auto total_size = uint64_t{};
+    auto const location_str = std::string{ location };
+    auto const location_device = tr_diskIoGetDevice(location_str.c_str());
+    auto filename = std::string{};
+
+    for (tr_file_index_t i = 0, n = tor->fileCount(); i < n; ++i)
+    {
+        auto const found = tor->findFile(filename, i);
+        if (!found)
+        {
+            continue;
+        }
+
+        auto newpath = tr_strvPath(location, found->subpath);
+        if (tr_sys_path_is_same(filename.c_str(), newpath.c_str(), nullptr))
+        {
+            continue;
+        }
+
+        auto& file = files.emplace_back();
+        file.index = i;
+        file.oldpath = filename;
+        file.size = found->size;
+        file.write_count = tor->fileWriteCount(i);
+        file.device = tr_diskIoGetDevice(filename.c_str());
+
+        // files that can't be renamed into place have to be copied there first
+        if (file.device != 0 && location_device != 0 && file.device != location_device)
+        {
+            file.tmppath = tr_strvJoin(newpath, CopySuffix);
+        }
+
+        file.newpath = std::move(newpath);
+        total_size += file.size;
+    }
+
+    bool const needs_copies = std::any_of(
+        std::begin(files),
+        std::end(files),
+        [](auto const& file) { return !std::empty(file.tmppath); });
+
+    auto lock = std::unique_lock(relocate_mutex_);
+
+    auto& job = relocate_list.emplace_back();
+    job.tor = tor;
+    job.session = tor->session;
+    job.location = location_str;
+    job.location_device = location_device;
+    job.setme_progress = setme_progress;
+    job.setme_state = setme_state;
+    job.files = std::move(files);
+    job.total_size = total_size;
+
+    // renaming takes no time at all, so the torrent is in its new location as soon as this returns
+    if (!needs_copies)
+    {
+        job.state = relocate_state::Copied;
+        lock.unlock();
+        switchOver(&job);
+        return;
+    }
+
+    if (!is_thread_running)
+    {
+        is_thread_running = true;
+        tr_threadNew(relocateThreadFunc, nullptr);
+    }
+}
+
+void tr_relocateRemove(tr_torrent* tor)
+{
+    TR_ASSERT(tr_isTorrent(tor));
+
+    auto lock = std::unique_lock(relocate_mutex_);
+
+    for (auto it = std::begin(relocate_list); it != std::end(relocate_list);)
+    {
+        if (it->tor != tor || it->stop)
+        {
+            ++it;
+            continue;
+        }
+
+        it->stop = true;
+
+        if (it->state == relocate_state::Queued)
+        {
+            setState(&*it, TR_LOC_ERROR);
+            it = relocate_list.erase(it);
+        }
+        else
+        {
+            // a job that's waiting to switch over is cleaned up by switchOver()
+            ++it;
+        }
+    }
+
+    // wait for the relocation thread to stop copying, so that it's
+    // safe for the caller to do as it likes with the torrent's files
+    relocate_done_cv_.wait(
+        lock,
+        [tor]()
+        {
+            return std::none_of(
+                std::begin(relocate_list),
+                std::end(relocate_list),
+                [tor](auto const& job) { return job.tor == tor && job.state == relocate_state::Copying; });
+        });
+}
+
+void tr_relocateClose(tr_session* /*session*/)
+{
+    auto lock = std::unique_lock(relocate_mutex_);
+
+    for (auto it = std::begin(relocate_list); it != std::end(relocate_list);)
+    {
+        it->stop = true;
+
+        if (it->state == relocate_state::Queued)
+        {
+            setState(&*it, TR_LOC_ERROR);
+            it = relocate_list.erase(it);
+        }
+        else
+        {
+            // switchOver() may not get to run, so don't leave the copies lying around
+            if (it->state == relocate_state::Copied)
+            {
+                removeCopies(&*it);
+            }
+
+            ++it;
+        }
+    }
+
+    relocate_done_cv_.wait(
+        lock,
+        []()
+        {
+            return std::none_of(
+                std::begin(relocate_list),
+                std::end(relocate_list),
+                [](auto const& job) { return job.state == relocate_state::Copying; });
+        });
+}
+
+bool tr_relocateGetProgress(
+    tr_torrent const* tor,
+    float* setme_progress,
+    tr_file_index_t* setme_file,
+    float* setme_file_progress)
+{
+    auto const lock = std::lock_guard(relocate_mutex_);
+
+    auto const it = std::find_if(
+        std::begin(relocate_list),
+        std::end(relocate_list),
+        [tor](auto const& job) { return job.tor == tor && !job.stop; });
+
+    if (it == std::end(relocate_list))
+    {
+        *setme_progress = 0;
+        *setme_file = 0;
+        *setme_file_progress = 0;
+        return false;
+    }
+
+    auto const& job = *it;
+    *setme_progress = job.total_size != 0 ? float(double(job.bytes_done) / job.total_size) : 0;
+
+    if (auto const current = job.current_file.load(); current < std::size(job.files))
+    {
+        auto const& file = job.files[current];
+        auto const file_bytes_done = std::min(job.current_file_bytes_done.load(), file.size);
+        *setme_file = file.index;
+        *setme_file_progress = file.size != 0 ? float(double(file_bytes_done) / file.size) : 0;
+    }
+    else
+    {
+        *setme_file = 0;
+        *setme_file_progress = 0;
+    }
+
+    return true;
+}
+
+void tr_relocateSetSpeedLimit(uint64_t bytes_per_second)
+{
+    relocate_speed_limit = bytes_per_second;
+}
+
+uint64_t tr_relocateGetSpeedLimit()
+{
+    return relocate_speed_limit;
+}
@@ -0,0 +1,67 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstdint> // uint64_t
+#include <string_view>
+
+#include "transmission.h"
+
+/**
+ * @addtogroup file_io File IO
+ * @{
+ */
+
+/**
+ * @brief Move a torrent's files to a new location.
+ *
+ * Files that can't simply be renamed into place are first copied by a
+ * background thread while the torrent keeps using the originals. Once
+ * they're copied, the torrent is switched over to the new location in
+ * the libtransmission thread. If every file can be renamed, that's done
+ * before this returns.
+ *
+ * Must be called in the libtransmission thread.
+ */
+void tr_relocateAdd(
+    tr_torrent* tor,
+    std::string_view location,
+    double volatile* setme_progress,
+    int volatile* setme_state);
+
+/**
+ * @brief Cancel the torrent's move, if it has one, and throw away any copies it has made.
+ *
+ * Must be called in the libtransmission thread.
+ */
+void tr_relocateRemove(tr_torrent* tor);
+
+void tr_relocateClose(tr_session*);
+
+/**
+ * @brief Get how far along the torrent's move is.
+ *
+ * @return `false` if the torrent isn't being moved.
+ */
+bool tr_relocateGetProgress(
+    tr_torrent const* tor,
+    float* setme_progress,
+    tr_file_index_t* setme_file,
+    float* setme_file_progress);
+
+/** @brief Limit how fast files are copied to their new location. 0 means no limit */
+void tr_relocateSetSpeedLimit(uint64_t bytes_per_second);
+
+uint64_t tr_relocateGetSpeedLimit();
+
+/* @} */
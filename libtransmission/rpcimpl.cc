@@ -22,10 +22,13 @@
 
 #include "transmission.h"
 
+#include "block-pool.h" /* tr_blockPoolGetStats() */
+#include "cache.h" /* tr_cacheGetReadStats() */
 #include "completion.h"
 #include "crypto-utils.h"
+#include "disk-io.h" /* tr_diskIoGetDeviceStats() */
 #include "error.h"
-#include "fdlimit.h"
+#include "fdlimit.h" /* tr_fdGetFileStats() */
 #include "file.h"
 #include "log.h"
 #include "platform-quota.h" /* tr_device_info_get_disk_space() */
@@ -37,6 +40,8 @@
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-macros.h"
+#include "tr-udp.h" /* tr_udpGetStats() */
+#include "trevent.h" /* tr_eventLoopGetStats() */
 #include "utils.h"
 #include "variant.h"
 #include "version.h"
@@ -1760,6 +1765,16 @@ static char const* sessionSet(
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    if (tr_variantDictFindBool(args_in, TR_KEY_cache_auto_size_enabled, &boolVal))
+    {
+        tr_sessionSetCacheAutoSizeEnabled(session, boolVal);
+    }
+
+    if (tr_variantDictFindInt(args_in, TR_KEY_read_cache_size_mb, &i))
+    {
+        tr_sessionSetReadCacheLimit_MB(session, i);
+    }
+
     if (tr_variantDictFindInt(args_in, TR_KEY_alt_speed_up, &i))
     {
         tr_sessionSetAltSpeed_KBps(session, TR_UP, i);
@@ -1865,6 +1880,16 @@ static char const* sessionSet(
         tr_sessionSetUTPEnabled(session, boolVal);
     }
 
+    if (tr_variantDictFindInt(args_in, TR_KEY_verify_speed_limit, &i))
+    {
+        tr_sessionSetVerifySpeedLimit_KBps(session, i);
+    }
+
+    if (tr_variantDictFindInt(args_in, TR_KEY_verify_threads, &i))
+    {
+        tr_sessionSetVerifyThreads(session, i);
+    }
+
     if (tr_variantDictFindBool(args_in, TR_KEY_lpd_enabled, &boolVal))
     {
         tr_sessionSetLPDEnabled(session, boolVal);
@@ -1885,6 +1910,11 @@ static char const* sessionSet(
         tr_sessionSetPortForwardingEnabled(session, boolVal);
     }
 
+    if (tr_variantDictFindInt(args_in, TR_KEY_relocate_speed_limit, &i))
+    {
+        tr_sessionSetRelocateSpeedLimit_KBps(session, i);
+    }
+
     if (tr_variantDictFindBool(args_in, TR_KEY_rename_partial_files, &boolVal))
     {
         tr_sessionSetIncompleteFileNamingEnabled(session, boolVal);
@@ -2019,10 +2049,40 @@ static char const* sessionStats(
     tr_sessionGetStats(session, &currentStats);
     tr_sessionGetCumulativeStats(session, &cumulativeStats);
 
+    auto read_cache_hits = uint64_t{};
+    auto read_cache_misses = uint64_t{};
+    tr_cacheGetReadStats(session->cache, &read_cache_hits, &read_cache_misses);
+
+    auto const block_pool = tr_blockPoolGetStats();
+
+    auto files_opened = uint64_t{};
+    auto files_closed = uint64_t{};
+    auto files_evicted = uint64_t{};
+    tr_fdGetFileStats(session, &files_opened, &files_closed, &files_evicted);
+
+    auto const event_loop = tr_eventLoopGetStats(session->events);
+
+    auto udp_read_wakeups = uint64_t{};
+    auto udp_packets_received = uint64_t{};
+    tr_udpGetStats(session, &udp_read_wakeups, &udp_packets_received);
+
     tr_variantDictAddInt(args_out, TR_KEY_activeTorrentCount, running);
+    tr_variantDictAddInt(args_out, TR_KEY_blockPoolBytes, block_pool.n_bytes);
+    tr_variantDictAddInt(args_out, TR_KEY_blockPoolBytesUsed, block_pool.n_used_bytes);
     tr_variantDictAddReal(args_out, TR_KEY_downloadSpeed, tr_sessionGetPieceSpeed_Bps(session, TR_DOWN));
+    tr_variantDictAddInt(args_out, TR_KEY_eventLoopLatencyUsec, event_loop.latency_usec);
+    tr_variantDictAddInt(args_out, TR_KEY_eventLoopMaxLatencyUsec, event_loop.max_latency_usec);
+    tr_variantDictAddInt(args_out, TR_KEY_eventLoopQueued, event_loop.queued);
+    tr_variantDictAddInt(args_out, TR_KEY_eventLoopRun, event_loop.n_run);
+    tr_variantDictAddInt(args_out, TR_KEY_fileCacheCloses, files_closed);
+    tr_variantDictAddInt(args_out, TR_KEY_fileCacheEvictions, files_evicted);
+    tr_variantDictAddInt(args_out, TR_KEY_fileCacheOpens, files_opened);
     tr_variantDictAddInt(args_out, TR_KEY_pausedTorrentCount, total - running);
+    tr_variantDictAddInt(args_out, TR_KEY_readCacheHits, read_cache_hits);
+    tr_variantDictAddInt(args_out, TR_KEY_readCacheMisses, read_cache_misses);
     tr_variantDictAddInt(args_out, TR_KEY_torrentCount, total);
+    tr_variantDictAddInt(args_out, TR_KEY_udpPacketsReceived, udp_packets_received);
+    tr_variantDictAddInt(args_out, TR_KEY_udpReadWakeups, udp_read_wakeups);
     tr_variantDictAddReal(args_out, TR_KEY_uploadSpeed, tr_sessionGetPieceSpeed_Bps(session, TR_UP));
 
     tr_variant* d = tr_variantDictAddDict(args_out, TR_KEY_cumulative_stats, 5);
@@ -2039,6 +2099,25 @@ static char const* sessionStats(
     tr_variantDictAddInt(d, TR_KEY_sessionCount, currentStats.sessionCount);
     tr_variantDictAddInt(d, TR_KEY_uploadedBytes, currentStats.uploadedBytes);
 
+    auto* const devices = tr_variantDictAddList(args_out, TR_KEY_diskDevices, 0);
+    auto const device_stats = session->diskIo != nullptr ? tr_diskIoGetDeviceStats(session->diskIo) :
+                                                           std::vector<tr_disk_io_device_stats>{};
+    for (auto const& stats : device_stats)
+    {
+        d = tr_variantListAddDict(devices, 6);
+        tr_variantDictAddInt(d, TR_KEY_device, stats.device);
+        tr_variantDictAddInt(d, TR_KEY_jobsDone, stats.n_done);
+        tr_variantDictAddInt(d, TR_KEY_latencyUsec, stats.latency_usec);
+        tr_variantDictAddInt(d, TR_KEY_maxLatencyUsec, stats.max_latency_usec);
+        tr_variantDictAddInt(d, TR_KEY_running, stats.running);
+
+        tr_variant* const queued = tr_variantDictAddList(d, TR_KEY_queued, std::size(stats.queued));
+        for (auto const n_queued : stats.queued)
+        {
+            tr_variantListAddInt(queued, n_queued);
+        }
+    }
+
     return nullptr;
 }
 
@@ -2097,6 +2176,10 @@ static void addSessionField(tr_session* s, tr_variant* d, tr_quark key)
         tr_variantDictAddStr(d, key, s->blocklistUrl());
         break;
 
+    case TR_KEY_cache_auto_size_enabled:
+        tr_variantDictAddBool(d, key, tr_sessionIsCacheAutoSizeEnabled(s));
+        break;
+
     case TR_KEY_cache_size_mb:
         tr_variantDictAddInt(d, key, tr_sessionGetCacheLimit_MB(s));
         break;
@@ -2169,6 +2252,14 @@ static void addSessionField(tr_session* s, tr_variant* d, tr_quark key)
         tr_variantDictAddBool(d, key, tr_sessionIsPortForwardingEnabled(s));
         break;
 
+    case TR_KEY_read_cache_size_mb:
+        tr_variantDictAddInt(d, key, tr_sessionGetReadCacheLimit_MB(s));
+        break;
+
+    case TR_KEY_relocate_speed_limit:
+        tr_variantDictAddInt(d, key, tr_sessionGetRelocateSpeedLimit_KBps(s));
+        break;
+
     case TR_KEY_rename_partial_files:
         tr_variantDictAddBool(d, key, tr_sessionIsIncompleteFileNamingEnabled(s));
         break;
@@ -2269,6 +2360,14 @@ static void addSessionField(tr_session* s, tr_variant* d, tr_quark key)
         tr_formatter_get_units(tr_variantDictAddDict(d, key, 0));
         break;
 
+    case TR_KEY_verify_speed_limit:
+        tr_variantDictAddInt(d, key, tr_sessionGetVerifySpeedLimit_KBps(s));
+        break;
+
+    case TR_KEY_verify_threads:
+        tr_variantDictAddInt(d, key, tr_sessionGetVerifyThreads(s));
+        break;
+
     case TR_KEY_version:
         tr_variantDictAddStrView(d, key, LONG_VERSION_STRING);
         break;
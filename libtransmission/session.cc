@@ -6,7 +6,7 @@
  *
  */
 
-#include <algorithm> // std::partial_sort(), std::min(), std::max()
+#include <algorithm> // std::partial_sort(), std::min(), std::max(), std::clamp()
 #include <cerrno> /* ENOENT */
 #include <climits> /* INT_MAX */
 #include <csignal>
@@ -38,7 +38,9 @@
 #include "bandwidth.h"
 #include "blocklist.h"
 #include "cache.h"
+#include "crypto-pool.h"
 #include "crypto-utils.h"
+#include "disk-io.h"
 #include "error-types.h"
 #include "error.h"
 #include "fdlimit.h"
@@ -46,10 +48,13 @@
 #include "log.h"
 #include "net.h"
 #include "peer-io.h"
+#include "peer-io-threads.h"
 #include "peer-mgr.h"
 #include "platform-quota.h" /* tr_device_info_free() */
 #include "platform.h" /* tr_getTorrentDir() */
 #include "port-forwarding.h"
+#include "prealloc.h"
+#include "relocate.h"
 #include "rpc-server.h"
 #include "session-id.h"
 #include "session.h"
@@ -73,10 +78,20 @@ std::recursive_mutex tr_session::session_mutex_;
 
 #ifdef TR_LIGHTWEIGHT
 static auto constexpr DefaultCacheSizeMB = int{ 2 };
+static auto constexpr DefaultReadCacheSizeMB = int{ 0 };
 static auto constexpr DefaultPrefetchEnabled = bool{ false };
+static auto constexpr DiskIoWorkerCount = size_t{ 1 };
+static auto constexpr CryptoPoolWorkerCount = size_t{ 1 };
+static auto constexpr CryptoPoolKeyCount = size_t{ 4 };
+static auto constexpr DefaultVerifyThreads = int{ 1 };
 #else
 static auto constexpr DefaultCacheSizeMB = int{ 4 };
+static auto constexpr DefaultReadCacheSizeMB = int{ 16 };
 static auto constexpr DefaultPrefetchEnabled = bool{ true };
+static auto constexpr DiskIoWorkerCount = size_t{ 4 };
+static auto constexpr CryptoPoolWorkerCount = size_t{ 2 };
+static auto constexpr CryptoPoolKeyCount = size_t{ 32 };
+static auto constexpr DefaultVerifyThreads = int{ 4 };
 #endif
 static auto constexpr SaveIntervalSecs = int{ 360 };
 
@@ -326,9 +341,10 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 69);
+    tr_variantDictReserve(d, 73);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, false);
     tr_variantDictAddStrView(d, TR_KEY_blocklist_url, "http://www.example.com/blocklist"sv);
+    tr_variantDictAddBool(d, TR_KEY_cache_auto_size_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, DefaultCacheSizeMB);
     tr_variantDictAddBool(d, TR_KEY_dht_enabled, true);
     tr_variantDictAddBool(d, TR_KEY_utp_enabled, true);
@@ -342,6 +358,7 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddStr(d, TR_KEY_incomplete_dir, tr_getDefaultDownloadDir());
     tr_variantDictAddBool(d, TR_KEY_incomplete_dir_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_message_level, TR_LOG_INFO);
+    tr_variantDictAddInt(d, TR_KEY_open_file_limit, atoi(TR_DEFAULT_OPEN_FILE_LIMIT_STR));
     tr_variantDictAddInt(d, TR_KEY_download_queue_size, 5);
     tr_variantDictAddBool(d, TR_KEY_download_queue_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_global, atoi(TR_DEFAULT_PEER_LIMIT_GLOBAL_STR));
@@ -354,12 +371,17 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_pex_enabled, true);
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_preallocation, TR_PREALLOCATE_SPARSE);
+    tr_variantDictAddBool(d, TR_KEY_direct_io_enabled, false);
+    tr_variantDictAddBool(d, TR_KEY_zero_copy_upload_enabled, false);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, DefaultPrefetchEnabled);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, 6);
+    tr_variantDictAddInt(d, TR_KEY_peer_io_threads, 0);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, true);
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, 30);
     tr_variantDictAddReal(d, TR_KEY_ratio_limit, 2.0);
     tr_variantDictAddBool(d, TR_KEY_ratio_limit_enabled, false);
+    tr_variantDictAddInt(d, TR_KEY_read_cache_size_mb, DefaultReadCacheSizeMB);
+    tr_variantDictAddInt(d, TR_KEY_relocate_speed_limit, 0);
     tr_variantDictAddBool(d, TR_KEY_rename_partial_files, true);
     tr_variantDictAddBool(d, TR_KEY_rpc_authentication_required, false);
     tr_variantDictAddStrView(d, TR_KEY_rpc_bind_address, "0.0.0.0");
@@ -390,6 +412,8 @@ void tr_sessionGetDefaultSettings(tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_speed_limit_up_enabled, false);
     tr_variantDictAddInt(d, TR_KEY_umask, 022);
     tr_variantDictAddInt(d, TR_KEY_upload_slots_per_torrent, 14);
+    tr_variantDictAddInt(d, TR_KEY_verify_speed_limit, 0);
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, DefaultVerifyThreads);
     tr_variantDictAddStrView(d, TR_KEY_bind_address_ipv4, TR_DEFAULT_BIND_ADDRESS_IPV4);
     tr_variantDictAddStrView(d, TR_KEY_bind_address_ipv6, TR_DEFAULT_BIND_ADDRESS_IPV6);
     tr_variantDictAddBool(d, TR_KEY_start_added_torrents, true);
@@ -402,9 +426,10 @@ void tr_sessionGetSettings(tr_session const* s, tr_variant* d)
 {
     TR_ASSERT(tr_variantIsDict(d));
 
-    tr_variantDictReserve(d, 68);
+    tr_variantDictReserve(d, 72);
     tr_variantDictAddBool(d, TR_KEY_blocklist_enabled, s->useBlocklist());
     tr_variantDictAddStr(d, TR_KEY_blocklist_url, s->blocklistUrl());
+    tr_variantDictAddBool(d, TR_KEY_cache_auto_size_enabled, tr_sessionIsCacheAutoSizeEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_cache_size_mb, tr_sessionGetCacheLimit_MB(s));
     tr_variantDictAddBool(d, TR_KEY_dht_enabled, s->isDHTEnabled);
     tr_variantDictAddBool(d, TR_KEY_utp_enabled, s->isUTPEnabled);
@@ -420,6 +445,7 @@ void tr_sessionGetSettings(tr_session const* s, tr_variant* d)
     tr_variantDictAddStr(d, TR_KEY_incomplete_dir, tr_sessionGetIncompleteDir(s));
     tr_variantDictAddBool(d, TR_KEY_incomplete_dir_enabled, tr_sessionIsIncompleteDirEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_message_level, tr_logGetLevel());
+    tr_variantDictAddInt(d, TR_KEY_open_file_limit, s->openFileLimit);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_global, s->peerLimit);
     tr_variantDictAddInt(d, TR_KEY_peer_limit_per_torrent, s->peerLimitPerTorrent);
     tr_variantDictAddInt(d, TR_KEY_peer_port, tr_sessionGetPeerPort(s));
@@ -431,12 +457,17 @@ void tr_sessionGetSettings(tr_session const* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_pex_enabled, s->isPexEnabled);
     tr_variantDictAddBool(d, TR_KEY_port_forwarding_enabled, tr_sessionIsPortForwardingEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_preallocation, s->preallocationMode);
+    tr_variantDictAddBool(d, TR_KEY_direct_io_enabled, s->isDirectIoEnabled);
+    tr_variantDictAddBool(d, TR_KEY_zero_copy_upload_enabled, s->isZeroCopyUploadEnabled);
     tr_variantDictAddBool(d, TR_KEY_prefetch_enabled, s->isPrefetchEnabled);
     tr_variantDictAddInt(d, TR_KEY_peer_id_ttl_hours, s->peer_id_ttl_hours);
+    tr_variantDictAddInt(d, TR_KEY_peer_io_threads, s->peerIoThreadCount);
     tr_variantDictAddBool(d, TR_KEY_queue_stalled_enabled, tr_sessionGetQueueStalledEnabled(s));
     tr_variantDictAddInt(d, TR_KEY_queue_stalled_minutes, tr_sessionGetQueueStalledMinutes(s));
     tr_variantDictAddReal(d, TR_KEY_ratio_limit, s->desiredRatio);
     tr_variantDictAddBool(d, TR_KEY_ratio_limit_enabled, s->isRatioLimited);
+    tr_variantDictAddInt(d, TR_KEY_read_cache_size_mb, tr_sessionGetReadCacheLimit_MB(s));
+    tr_variantDictAddInt(d, TR_KEY_relocate_speed_limit, tr_sessionGetRelocateSpeedLimit_KBps(s));
     tr_variantDictAddBool(d, TR_KEY_rename_partial_files, tr_sessionIsIncompleteFileNamingEnabled(s));
     tr_variantDictAddBool(d, TR_KEY_rpc_authentication_required, tr_sessionIsRPCPasswordEnabled(s));
     tr_variantDictAddStr(d, TR_KEY_rpc_bind_address, tr_sessionGetRPCBindAddress(s));
@@ -465,6 +496,8 @@ void tr_sessionGetSettings(tr_session const* s, tr_variant* d)
     tr_variantDictAddBool(d, TR_KEY_speed_limit_up_enabled, tr_sessionIsSpeedLimited(s, TR_UP));
     tr_variantDictAddInt(d, TR_KEY_umask, s->umask);
     tr_variantDictAddInt(d, TR_KEY_upload_slots_per_torrent, s->uploadSlotsPerTorrent);
+    tr_variantDictAddInt(d, TR_KEY_verify_speed_limit, tr_sessionGetVerifySpeedLimit_KBps(s));
+    tr_variantDictAddInt(d, TR_KEY_verify_threads, tr_sessionGetVerifyThreads(s));
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv4, tr_address_to_string(&s->bind_ipv4->addr));
     tr_variantDictAddStr(d, TR_KEY_bind_address_ipv6, tr_address_to_string(&s->bind_ipv6->addr));
     tr_variantDictAddBool(d, TR_KEY_start_added_torrents, !tr_sessionGetPaused(s));
@@ -604,6 +637,12 @@ tr_session* tr_sessionInit(char const* config_dir, bool messageQueuingEnabled, t
     session->udp_socket = TR_BAD_SOCKET;
     session->udp6_socket = TR_BAD_SOCKET;
     session->cache = tr_cacheNew(1024 * 1024 * 2);
+#if defined(_WIN32) || (defined(HAVE_PREAD) && defined(HAVE_PWRITE))
+    /* the workers share file offsets with the libtransmission thread,
+     * so they're only safe to use with positional reads and writes */
+    session->diskIo = tr_diskIoNew(session, DiskIoWorkerCount);
+#endif
+    session->cryptoPool = tr_cryptoPoolNew(session, CryptoPoolWorkerCount, CryptoPoolKeyCount);
     session->magicNumber = SESSION_MAGIC_NUMBER;
     session->session_id = tr_session_id_new();
     session->bandwidth = new Bandwidth(nullptr);
@@ -658,6 +697,11 @@ static void onNowTimer(evutil_socket_t /*fd*/, short /*what*/, void* vsession)
 
     tr_dhtUpkeep(session);
 
+    if (tr_cacheUpkeep(session->cache, tr_sessionGetPieceSpeed_Bps(session, TR_DOWN)) != 0)
+    {
+        tr_logAddError("Error while flushing the cache");
+    }
+
     if (session->turtle.isClockEnabled)
     {
         turtleCheckClock(session, &session->turtle);
@@ -809,6 +853,31 @@ static void sessionSetImpl(void* vdata)
         tr_sessionSetCacheLimit_MB(session, i);
     }
 
+    if (tr_variantDictFindBool(settings, TR_KEY_cache_auto_size_enabled, &boolVal))
+    {
+        tr_sessionSetCacheAutoSizeEnabled(session, boolVal);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_read_cache_size_mb, &i))
+    {
+        tr_sessionSetReadCacheLimit_MB(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_threads, &i))
+    {
+        tr_sessionSetVerifyThreads(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_verify_speed_limit, &i))
+    {
+        tr_sessionSetVerifySpeedLimit_KBps(session, i);
+    }
+
+    if (tr_variantDictFindInt(settings, TR_KEY_relocate_speed_limit, &i))
+    {
+        tr_sessionSetRelocateSpeedLimit_KBps(session, i);
+    }
+
     if (tr_variantDictFindInt(settings, TR_KEY_peer_limit_per_torrent, &i))
     {
         tr_sessionSetPeerLimitPerTorrent(session, i);
@@ -873,6 +942,11 @@ static void sessionSetImpl(void* vdata)
         session->peer_id_ttl_hours = i;
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_peer_io_threads, &i))
+    {
+        tr_sessionSetPeerIoThreads(session, i);
+    }
+
     /* torrent queues */
     if (tr_variantDictFindInt(settings, TR_KEY_queue_stalled_minutes, &i))
     {
@@ -915,6 +989,16 @@ static void sessionSetImpl(void* vdata)
         session->preallocationMode = tr_preallocation_mode(i);
     }
 
+    if (tr_variantDictFindBool(settings, TR_KEY_direct_io_enabled, &boolVal))
+    {
+        tr_sessionSetDirectIoEnabled(session, boolVal);
+    }
+
+    if (tr_variantDictFindBool(settings, TR_KEY_zero_copy_upload_enabled, &boolVal))
+    {
+        tr_sessionSetZeroCopyUploadEnabled(session, boolVal);
+    }
+
     if (tr_variantDictFindStrView(settings, TR_KEY_download_dir, &sv))
     {
         session->setDownloadDir(sv);
@@ -993,6 +1077,11 @@ static void sessionSetImpl(void* vdata)
         session->peerLimit = i;
     }
 
+    if (tr_variantDictFindInt(settings, TR_KEY_open_file_limit, &i))
+    {
+        tr_sessionSetOpenFileLimit(session, std::clamp(i, int64_t{ 1 }, int64_t{ UINT16_MAX }));
+    }
+
     /**
     **/
 
@@ -1731,6 +1820,69 @@ uint16_t tr_sessionGetPeerLimit(tr_session const* session)
     return session->peerLimit;
 }
 
+void tr_sessionSetOpenFileLimit(tr_session* session, uint16_t n)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    /* nothing can be read or written without at least one open file */
+    tr_fdSetFileLimit(session, std::max(n, uint16_t{ 1 }));
+}
+
+uint16_t tr_sessionGetOpenFileLimit(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return session->openFileLimit;
+}
+
+void tr_sessionSetDirectIoEnabled(tr_session* session, bool enabled)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    if (session->isDirectIoEnabled != enabled)
+    {
+        session->isDirectIoEnabled = enabled;
+
+        /* the files that are open now were opened the other way */
+        tr_fdSetFileLimit(session, session->openFileLimit);
+    }
+}
+
+bool tr_sessionIsDirectIoEnabled(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return session->isDirectIoEnabled;
+}
+
+void tr_sessionSetZeroCopyUploadEnabled(tr_session* session, bool enabled)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    session->isZeroCopyUploadEnabled = enabled;
+}
+
+bool tr_sessionIsZeroCopyUploadEnabled(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return session->isZeroCopyUploadEnabled;
+}
+
+void tr_sessionSetPeerIoThreads(tr_session* session, int n)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    session->peerIoThreadCount = std::max(n, 0);
+}
+
+int tr_sessionGetPeerIoThreads(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return session->peerIoThreadCount;
+}
+
 void tr_sessionSetPeerLimitPerTorrent(tr_session* session, uint16_t n)
 {
     TR_ASSERT(tr_isSession(session));
@@ -1837,6 +1989,7 @@ static void sessionCloseImplStart(tr_session* session)
     session->nowTimer = nullptr;
 
     tr_verifyClose(session);
+    tr_relocateClose(session);
     tr_sharedClose(session);
     session->rpc_server_.reset();
 
@@ -1870,9 +2023,16 @@ static void sessionCloseImplStart(tr_session* session)
        it won't be idle until the announce events are sent... */
     tr_webClose(session, TR_WEB_CLOSE_WHEN_IDLE);
 
+    /* finish the pending disk writes before freeing the cache that owns them */
+    tr_diskIoFree(session->diskIo);
+    session->diskIo = nullptr;
+
     tr_cacheFree(session->cache);
     session->cache = nullptr;
 
+    /* the last of those writes may have created files that are being preallocated */
+    tr_preallocClose(session);
+
     /* saveTimer is not used at this point, reusing for UDP shutdown wait */
     TR_ASSERT(session->saveTimer == nullptr);
     session->saveTimer = evtimer_new(session->event_base, sessionCloseImplWaitForIdleUdp, session);
@@ -1912,6 +2072,11 @@ static void sessionCloseImplFinish(tr_session* session)
 
     tr_statsClose(session);
     tr_peerMgrFree(session->peerMgr);
+    tr_peerIoThreadsClose(session);
+
+    /* after the peer manager, so that the handshakes' jobs are all cancelled */
+    tr_cryptoPoolFree(session->cryptoPool);
+    session->cryptoPool = nullptr;
 
     closeBlocklists(session);
 
@@ -2246,6 +2411,80 @@ int tr_sessionGetCacheLimit_MB(tr_session const* session)
     return tr_toMemMB(tr_cacheGetLimit(session->cache));
 }
 
+void tr_sessionSetCacheAutoSizeEnabled(tr_session* session, bool enabled)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_cacheSetAutoSize(session->cache, enabled);
+}
+
+bool tr_sessionIsCacheAutoSizeEnabled(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_cacheIsAutoSize(session->cache);
+}
+
+void tr_sessionSetReadCacheLimit_MB(tr_session* session, int mb)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_cacheSetReadLimit(session->cache, tr_toMemBytes(mb));
+}
+
+int tr_sessionGetReadCacheLimit_MB(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_toMemMB(tr_cacheGetReadLimit(session->cache));
+}
+
+/***
+****
+***/
+
+void tr_sessionSetVerifyThreads(tr_session* session, int n)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_verifySetThreadCount(std::max(n, 1));
+}
+
+int tr_sessionGetVerifyThreads(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_verifyGetThreadCount();
+}
+
+void tr_sessionSetVerifySpeedLimit_KBps(tr_session* session, unsigned int KBps)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_verifySetSpeedLimit(tr_toSpeedBytes(KBps));
+}
+
+unsigned int tr_sessionGetVerifySpeedLimit_KBps(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_toSpeedKBps(tr_verifyGetSpeedLimit());
+}
+
+void tr_sessionSetRelocateSpeedLimit_KBps(tr_session* session, unsigned int KBps)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    tr_relocateSetSpeedLimit(tr_toSpeedBytes(KBps));
+}
+
+unsigned int tr_sessionGetRelocateSpeedLimit_KBps(tr_session const* session)
+{
+    TR_ASSERT(tr_isSession(session));
+
+    return tr_toSpeedKBps(tr_relocateGetSpeedLimit());
+}
+
 /***
 ****
 ***/
@@ -49,9 +49,13 @@ struct Bandwidth;
 struct tr_address;
 struct tr_announcer;
 struct tr_announcer_udp;
+struct tr_peer_io_threads;
+struct tr_udp_send_queue;
 struct tr_bindsockets;
 struct tr_blocklistFile;
 struct tr_cache;
+struct tr_cryptoPool;
+struct tr_diskIo;
 struct tr_fdInfo;
 
 struct tr_turtle_info
@@ -285,6 +289,19 @@ public:
     uint16_t peerLimit;
     uint16_t peerLimitPerTorrent;
 
+    /* how many of the torrents' files may be kept open at once */
+    uint16_t openFileLimit;
+
+    /* whether the torrents' files are opened with TR_SYS_FILE_DIRECT */
+    bool isDirectIoEnabled;
+
+    /* whether blocks are sent to plaintext TCP peers straight from their files */
+    bool isZeroCopyUploadEnabled;
+
+    /* how many threads to spread peers' TCP sockets across, or 0 to do their I/O in the session thread */
+    int peerIoThreadCount;
+    struct tr_peer_io_threads* peer_io_threads;
+
     int uploadSlotsPerTorrent;
 
     /* The UDP sockets used for the DHT and uTP. */
@@ -295,6 +312,13 @@ public:
     struct event* udp_event;
     struct event* udp6_event;
 
+    /* how often the UDP sockets woke us up, and how many datagrams those wakeups read */
+    uint64_t udp_read_wakeups;
+    uint64_t udp_packets_received;
+
+    /* datagrams waiting to be sent when the event loop is done with its callbacks */
+    struct tr_udp_send_queue* udp_send_queue;
+
     struct event* utp_timer;
 
     /* The open port on the local machine for incoming peer requests */
@@ -325,6 +349,10 @@ public:
 
     struct tr_cache* cache;
 
+    struct tr_diskIo* diskIo;
+
+    struct tr_cryptoPool* cryptoPool;
+
     struct tr_web* web;
 
     struct tr_session_id* session_id;
@@ -0,0 +1,719 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring> /* memcpy(), memset() */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define TR_SHA1_X86
+#define TR_SHA1_TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define TR_SHA1_X86
+#define TR_SHA1_TARGET(x)
+#endif
+
+#if defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+/* the compiler's been told that every CPU this runs on has the extensions, e.g. Apple silicon */
+#include <arm_neon.h>
+#define TR_SHA1_ARM
+#define TR_SHA1_ARM_TARGET
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#include <arm_neon.h>
+#include <sys/auxv.h> /* getauxval() */
+#include <asm/hwcap.h> /* HWCAP_SHA1 */
+#define TR_SHA1_ARM
+#define TR_SHA1_ARM_HWCAP
+#ifdef __clang__
+#define TR_SHA1_ARM_TARGET __attribute__((target("crypto")))
+#else
+#define TR_SHA1_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+/* GCC and clang can do arithmetic on vectors of any size, using whatever SIMD the target has */
+#ifdef __GNUC__
+#define TR_SHA1_LANES
+#endif
+
+#include "transmission.h"
+#include "crypto-utils.h"
+#include "sha1.h"
+#include "tr-assert.h"
+
+/***
+****
+***/
+
+namespace
+{
+
+auto constexpr BlockSize = size_t{ 64 };
+
+auto constexpr InitialState = std::array<uint32_t, 5>{ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+auto constexpr K0 = uint32_t{ 0x5A827999 };
+auto constexpr K1 = uint32_t{ 0x6ED9EBA1 };
+auto constexpr K2 = uint32_t{ 0x8F1BBCDC };
+auto constexpr K3 = uint32_t{ 0xCA62C1D6 };
+
+using compress_func = void (*)(uint32_t* state, uint8_t const* blocks, size_t n_blocks);
+
+inline uint32_t loadBigEndian(uint8_t const* walk)
+{
+    return uint32_t(walk[0]) << 24 | uint32_t(walk[1]) << 16 | uint32_t(walk[2]) << 8 | uint32_t(walk[3]);
+}
+
+inline uint32_t rotl(uint32_t value, int n)
+{
+    return (value << n) | (value >> (32 - n));
+}
+
+/* Build the padded blocks that come after the last full block of `data`.
+ * Returns how many there are: one, or two if the padding didn't fit */
+size_t makeTail(std::array<uint8_t, BlockSize * 2>& tail, uint8_t const* data, size_t len)
+{
+    auto const n_left = len % BlockSize;
+    auto const n_blocks = n_left + 9 > BlockSize ? 2 : 1;
+
+    tail.fill(0);
+    std::copy_n(data + len - n_left, n_left, std::begin(tail));
+    tail[n_left] = 0x80;
+
+    auto const n_bits = uint64_t(len) * 8;
+    auto* const end = std::data(tail) + n_blocks * BlockSize;
+    for (int i = 0; i < 8; ++i)
+    {
+        end[-1 - i] = uint8_t(n_bits >> (i * 8));
+    }
+
+    return n_blocks;
+}
+
+void storeDigest(uint32_t const* state, tr_sha1_digest_t& setme)
+{
+    for (size_t i = 0; i < 5; ++i)
+    {
+        setme[i * 4 + 0] = std::byte(state[i] >> 24);
+        setme[i * 4 + 1] = std::byte(state[i] >> 16);
+        setme[i * 4 + 2] = std::byte(state[i] >> 8);
+        setme[i * 4 + 3] = std::byte(state[i]);
+    }
+}
+
+/* hash each piece of data in turn */
+void hashEach(compress_func compress, void const* const* data, size_t const* data_lengths, size_t n, tr_sha1_digest_t* setme)
+{
+    auto tail = std::array<uint8_t, BlockSize * 2>{};
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto const* const walk = static_cast<uint8_t const*>(data[i]);
+        auto state = InitialState;
+
+        compress(std::data(state), walk, data_lengths[i] / BlockSize);
+        compress(std::data(state), std::data(tail), makeTail(tail, walk, data_lengths[i]));
+        storeDigest(std::data(state), setme[i]);
+    }
+}
+
+/***
+****  Portable
+***/
+
+void compressPortable(uint32_t* state, uint8_t const* blocks, size_t n_blocks)
+{
+    for (; n_blocks > 0; --n_blocks, blocks += BlockSize)
+    {
+        auto w = std::array<uint32_t, 80>{};
+        for (size_t t = 0; t < 16; ++t)
+        {
+            w[t] = loadBigEndian(blocks + t * 4);
+        }
+
+        for (size_t t = 16; t < 80; ++t)
+        {
+            w[t] = rotl(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+        }
+
+        auto a = state[0];
+        auto b = state[1];
+        auto c = state[2];
+        auto d = state[3];
+        auto e = state[4];
+
+        auto const round = [&a, &b, &c, &d, &e](uint32_t f, uint32_t w_t)
+        {
+            auto const tmp = rotl(a, 5) + f + e + w_t;
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = tmp;
+        };
+
+        for (size_t t = 0; t < 20; ++t)
+        {
+            round(((b & c) | (~b & d)) + K0, w[t]);
+        }
+
+        for (size_t t = 20; t < 40; ++t)
+        {
+            round((b ^ c ^ d) + K1, w[t]);
+        }
+
+        for (size_t t = 40; t < 60; ++t)
+        {
+            round(((b & c) | (b & d) | (c & d)) + K2, w[t]);
+        }
+
+        for (size_t t = 60; t < 80; ++t)
+        {
+            round((b ^ c ^ d) + K3, w[t]);
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+/***
+****  x86 SHA extensions
+***/
+
+#ifdef TR_SHA1_X86
+
+bool cpuHasX86Sha()
+{
+    auto regs = std::array<unsigned int, 4>{};
+
+#ifdef _MSC_VER
+    __cpuidex(reinterpret_cast<int*>(std::data(regs)), 7, 0);
+#else
+    if (__get_cpuid_max(0, nullptr) < 7)
+    {
+        return false;
+    }
+
+    __cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+    auto const has_sha = (regs[1] & (1U << 29)) != 0;
+
+#ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(std::data(regs)), 1);
+#else
+    __cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+    auto const has_sse41 = (regs[2] & (1U << 19)) != 0;
+    auto const has_ssse3 = (regs[2] & (1U << 9)) != 0;
+
+    return has_sha && has_sse41 && has_ssse3;
+}
+
+/* four rounds. `i` has to be a constant, since the round function is an immediate */
+#define TR_SHA1_X86_ROUNDS(i) \
+    do \
+    { \
+        if ((i) == 0) \
+        { \
+            e[0] = _mm_add_epi32(e[0], msg[0]); \
+        } \
+        else \
+        { \
+            e[(i) % 2] = _mm_sha1nexte_epu32(e[(i) % 2], msg[(i) % 4]); \
+        } \
+\
+        e[((i) + 1) % 2] = abcd; \
+\
+        if ((i) >= 3) \
+        { \
+            msg[((i) + 1) % 4] = _mm_sha1msg2_epu32(msg[((i) + 1) % 4], msg[(i) % 4]); \
+        } \
+\
+        abcd = _mm_sha1rnds4_epu32(abcd, e[(i) % 2], (i) / 5); \
+\
+        if ((i) >= 1) \
+        { \
+            msg[((i) + 3) % 4] = _mm_sha1msg1_epu32(msg[((i) + 3) % 4], msg[(i) % 4]); \
+        } \
+\
+        if ((i) >= 2) \
+        { \
+            msg[((i) + 2) % 4] = _mm_xor_si128(msg[((i) + 2) % 4], msg[(i) % 4]); \
+        } \
+    } while (0)
+
+TR_SHA1_TARGET("sha,sse4.1,ssse3") void compressX86Sha(uint32_t* state, uint8_t const* blocks, size_t n_blocks)
+{
+    auto const byte_swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    auto abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(state)), 0x1B);
+    __m128i e[2] = { _mm_set_epi32(int(state[4]), 0, 0, 0), _mm_setzero_si128() };
+
+    for (; n_blocks > 0; --n_blocks, blocks += BlockSize)
+    {
+        auto const abcd_save = abcd;
+        auto const e_save = e[0];
+
+        __m128i msg[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(blocks + i * 16)), byte_swap);
+        }
+
+        TR_SHA1_X86_ROUNDS(0);
+        TR_SHA1_X86_ROUNDS(1);
+        TR_SHA1_X86_ROUNDS(2);
+        TR_SHA1_X86_ROUNDS(3);
+        TR_SHA1_X86_ROUNDS(4);
+        TR_SHA1_X86_ROUNDS(5);
+        TR_SHA1_X86_ROUNDS(6);
+        TR_SHA1_X86_ROUNDS(7);
+        TR_SHA1_X86_ROUNDS(8);
+        TR_SHA1_X86_ROUNDS(9);
+        TR_SHA1_X86_ROUNDS(10);
+        TR_SHA1_X86_ROUNDS(11);
+        TR_SHA1_X86_ROUNDS(12);
+        TR_SHA1_X86_ROUNDS(13);
+        TR_SHA1_X86_ROUNDS(14);
+        TR_SHA1_X86_ROUNDS(15);
+        TR_SHA1_X86_ROUNDS(16);
+        TR_SHA1_X86_ROUNDS(17);
+        TR_SHA1_X86_ROUNDS(18);
+        TR_SHA1_X86_ROUNDS(19);
+
+        e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = uint32_t(_mm_extract_epi32(e[0], 3));
+}
+
+#undef TR_SHA1_X86_ROUNDS
+
+#endif /* TR_SHA1_X86 */
+
+/***
+****  ARMv8 cryptography extensions
+***/
+
+#ifdef TR_SHA1_ARM
+
+bool cpuHasArmSha()
+{
+#ifdef TR_SHA1_ARM_HWCAP
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+#else
+    return true;
+#endif
+}
+
+/* four rounds. `op` is vsha1cq_u32, vsha1pq_u32 or vsha1mq_u32 depending on which rounds they are */
+#define TR_SHA1_ARM_ROUNDS(i, op) \
+    do \
+    { \
+        e[((i) + 1) % 2] = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+        abcd = op(abcd, e[(i) % 2], tmp[(i) % 2]); \
+\
+        if ((i) <= 17) \
+        { \
+            tmp[(i) % 2] = vaddq_u32(msg[((i) + 2) % 4], vdupq_n_u32(Ks[((i) + 2) / 5])); \
+        } \
+\
+        if ((i) >= 1 && (i) <= 16) \
+        { \
+            msg[((i) + 3) % 4] = vsha1su1q_u32(msg[((i) + 3) % 4], msg[((i) + 2) % 4]); \
+        } \
+\
+        if ((i) <= 15) \
+        { \
+            msg[(i) % 4] = vsha1su0q_u32(msg[(i) % 4], msg[((i) + 1) % 4], msg[((i) + 2) % 4]); \
+        } \
+    } while (0)
+
+TR_SHA1_ARM_TARGET void compressArmSha(uint32_t* state, uint8_t const* blocks, size_t n_blocks)
+{
+    static auto constexpr Ks = std::array<uint32_t, 4>{ K0, K1, K2, K3 };
+
+    auto abcd = vld1q_u32(state);
+    uint32_t e[2] = { state[4], 0 };
+
+    for (; n_blocks > 0; --n_blocks, blocks += BlockSize)
+    {
+        auto const abcd_save = abcd;
+        auto const e_save = e[0];
+
+        uint32x4_t msg[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            msg[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(blocks + i * 16)));
+        }
+
+        uint32x4_t tmp[2] = { vaddq_u32(msg[0], vdupq_n_u32(K0)), vaddq_u32(msg[1], vdupq_n_u32(K0)) };
+
+        TR_SHA1_ARM_ROUNDS(0, vsha1cq_u32);
+        TR_SHA1_ARM_ROUNDS(1, vsha1cq_u32);
+        TR_SHA1_ARM_ROUNDS(2, vsha1cq_u32);
+        TR_SHA1_ARM_ROUNDS(3, vsha1cq_u32);
+        TR_SHA1_ARM_ROUNDS(4, vsha1cq_u32);
+        TR_SHA1_ARM_ROUNDS(5, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(6, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(7, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(8, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(9, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(10, vsha1mq_u32);
+        TR_SHA1_ARM_ROUNDS(11, vsha1mq_u32);
+        TR_SHA1_ARM_ROUNDS(12, vsha1mq_u32);
+        TR_SHA1_ARM_ROUNDS(13, vsha1mq_u32);
+        TR_SHA1_ARM_ROUNDS(14, vsha1mq_u32);
+        TR_SHA1_ARM_ROUNDS(15, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(16, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(17, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(18, vsha1pq_u32);
+        TR_SHA1_ARM_ROUNDS(19, vsha1pq_u32);
+
+        e[0] += e_save;
+        abcd = vaddq_u32(abcd, abcd_save);
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e[0];
+}
+
+#undef TR_SHA1_ARM_ROUNDS
+
+#endif /* TR_SHA1_ARM */
+
+/***
+****  Multi-buffer: the same rounds, but on one lane per piece of data
+***/
+
+#ifdef TR_SHA1_LANES
+
+typedef uint32_t lanes4_t __attribute__((vector_size(16)));
+typedef uint32_t lanes8_t __attribute__((vector_size(32)));
+
+#define TR_SHA1_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* one block of every lane. This is inlined into callers that are built for the right SIMD,
+ * so the vector types never cross a function boundary */
+template<typename V, size_t N>
+__attribute__((always_inline)) inline void compressLanes(V* state, std::array<uint8_t const*, N> const& blocks)
+{
+    V w[16];
+    for (size_t t = 0; t < 16; ++t)
+    {
+        for (size_t lane = 0; lane < N; ++lane)
+        {
+            w[t][lane] = loadBigEndian(blocks[lane] + t * 4);
+        }
+    }
+
+    V a = state[0];
+    V b = state[1];
+    V c = state[2];
+    V d = state[3];
+    V e = state[4];
+
+    for (size_t t = 0; t < 80; ++t)
+    {
+        if (t >= 16)
+        {
+            auto const x = w[(t - 3) % 16] ^ w[(t - 8) % 16] ^ w[(t - 14) % 16] ^ w[t % 16];
+            w[t % 16] = TR_SHA1_ROTL(x, 1);
+        }
+
+        V f;
+        if (t < 20)
+        {
+            f = ((b & c) | (~b & d)) + K0;
+        }
+        else if (t < 40)
+        {
+            f = (b ^ c ^ d) + K1;
+        }
+        else if (t < 60)
+        {
+            f = ((b & c) | (b & d) | (c & d)) + K2;
+        }
+        else
+        {
+            f = (b ^ c ^ d) + K3;
+        }
+
+        V const tmp = TR_SHA1_ROTL(a, 5) + f + e + w[t % 16];
+        e = d;
+        d = c;
+        c = TR_SHA1_ROTL(b, 30);
+        b = a;
+        a = tmp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+#undef TR_SHA1_ROTL
+
+/* Keeps every lane busy: when a lane finishes its piece of data, the next one starts on it */
+template<typename V, size_t N>
+__attribute__((always_inline)) inline void hashLanes(
+    void const* const* data,
+    size_t const* data_lengths,
+    size_t n,
+    tr_sha1_digest_t* setme)
+{
+    struct lane_job
+    {
+        size_t index;
+        uint8_t const* data;
+        size_t n_full_blocks;
+        size_t n_blocks;
+        size_t block;
+        std::array<uint8_t, BlockSize * 2> tail;
+    };
+
+    static auto constexpr Idle = std::array<uint8_t, BlockSize>{};
+
+    auto jobs = std::array<lane_job, N>{};
+    auto active = std::array<bool, N>{};
+    auto blocks = std::array<uint8_t const*, N>{};
+    V state[5] = {};
+    size_t next = 0;
+
+    for (;;)
+    {
+        auto n_active = size_t{};
+
+        for (size_t lane = 0; lane < N; ++lane)
+        {
+            if (!active[lane] && next < n)
+            {
+                auto& job = jobs[lane];
+                job.index = next++;
+                job.data = static_cast<uint8_t const*>(data[job.index]);
+                job.n_full_blocks = data_lengths[job.index] / BlockSize;
+                job.n_blocks = job.n_full_blocks + makeTail(job.tail, job.data, data_lengths[job.index]);
+                job.block = 0;
+                active[lane] = true;
+
+                for (size_t i = 0; i < 5; ++i)
+                {
+                    state[i][lane] = InitialState[i];
+                }
+            }
+
+            if (active[lane])
+            {
+                auto const& job = jobs[lane];
+                blocks[lane] = job.block < job.n_full_blocks ?
+                    job.data + job.block * BlockSize :
+                    std::data(job.tail) + (job.block - job.n_full_blocks) * BlockSize;
+                ++n_active;
+            }
+            else
+            {
+                blocks[lane] = std::data(Idle);
+            }
+        }
+
+        if (n_active == 0)
+        {
+            break;
+        }
+
+        compressLanes<V, N>(state, blocks);
+
+        for (size_t lane = 0; lane < N; ++lane)
+        {
+            if (auto& job = jobs[lane]; active[lane] && ++job.block == job.n_blocks)
+            {
+                auto digest_state = std::array<uint32_t, 5>{};
+                for (size_t i = 0; i < 5; ++i)
+                {
+                    digest_state[i] = state[i][lane];
+                }
+
+                storeDigest(std::data(digest_state), setme[job.index]);
+                active[lane] = false;
+            }
+        }
+    }
+}
+
+void hash4Lanes(void const* const* data, size_t const* data_lengths, size_t n, tr_sha1_digest_t* setme)
+{
+    hashLanes<lanes4_t, 4>(data, data_lengths, n, setme);
+}
+
+#ifdef TR_SHA1_X86
+
+bool cpuHasAvx2()
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+TR_SHA1_TARGET("avx2") void hash8Lanes(void const* const* data, size_t const* data_lengths, size_t n, tr_sha1_digest_t* setme)
+{
+    hashLanes<lanes8_t, 8>(data, data_lengths, n, setme);
+}
+
+#endif /* TR_SHA1_X86 */
+
+#endif /* TR_SHA1_LANES */
+
+tr_sha1_engine findBestEngine()
+{
+    for (auto const engine : { TR_SHA1_ENGINE_X86_SHA, TR_SHA1_ENGINE_ARM_SHA, TR_SHA1_ENGINE_8_LANES, TR_SHA1_ENGINE_4_LANES })
+    {
+        if (tr_sha1_engine_is_available(engine))
+        {
+            return engine;
+        }
+    }
+
+    return TR_SHA1_ENGINE_PORTABLE;
+}
+
+} // namespace
+
+/***
+****
+***/
+
+bool tr_sha1_engine_is_available(tr_sha1_engine engine)
+{
+    switch (engine)
+    {
+    case TR_SHA1_ENGINE_PORTABLE:
+        return true;
+
+#ifdef TR_SHA1_X86
+    case TR_SHA1_ENGINE_X86_SHA:
+        {
+            static bool const has_x86_sha = cpuHasX86Sha();
+            return has_x86_sha;
+        }
+#endif
+
+#ifdef TR_SHA1_ARM
+    case TR_SHA1_ENGINE_ARM_SHA:
+        {
+            static bool const has_arm_sha = cpuHasArmSha();
+            return has_arm_sha;
+        }
+#endif
+
+#ifdef TR_SHA1_LANES
+    case TR_SHA1_ENGINE_4_LANES:
+        return true;
+
+#ifdef TR_SHA1_X86
+    case TR_SHA1_ENGINE_8_LANES:
+        {
+            static bool const has_avx2 = cpuHasAvx2();
+            return has_avx2;
+        }
+#endif
+#endif
+
+    default:
+        return false;
+    }
+}
+
+tr_sha1_engine tr_sha1_engine_get_best(void)
+{
+    static auto const best = findBestEngine();
+    return best;
+}
+
+char const* tr_sha1_engine_get_name(tr_sha1_engine engine)
+{
+    switch (engine)
+    {
+    case TR_SHA1_ENGINE_PORTABLE:
+        return "portable";
+
+    case TR_SHA1_ENGINE_X86_SHA:
+        return "x86 SHA extensions";
+
+    case TR_SHA1_ENGINE_ARM_SHA:
+        return "ARMv8 crypto extensions";
+
+    case TR_SHA1_ENGINE_4_LANES:
+        return "4 lanes";
+
+    case TR_SHA1_ENGINE_8_LANES:
+        return "8 lanes (AVX2)";
+
+    default:
+        return "unknown";
+    }
+}
+
+void tr_sha1_many_with_engine(
+    tr_sha1_engine engine,
+    void const* const* data,
+    size_t const* data_lengths,
+    size_t n,
+    tr_sha1_digest_t* setme)
+{
+    TR_ASSERT(tr_sha1_engine_is_available(engine));
+    TR_ASSERT(n == 0 || (data != nullptr && data_lengths != nullptr && setme != nullptr));
+
+    switch (engine)
+    {
+#ifdef TR_SHA1_X86
+    case TR_SHA1_ENGINE_X86_SHA:
+        hashEach(compressX86Sha, data, data_lengths, n, setme);
+        break;
+#endif
+
+#ifdef TR_SHA1_ARM
+    case TR_SHA1_ENGINE_ARM_SHA:
+        hashEach(compressArmSha, data, data_lengths, n, setme);
+        break;
+#endif
+
+#ifdef TR_SHA1_LANES
+    case TR_SHA1_ENGINE_4_LANES:
+        hash4Lanes(data, data_lengths, n, setme);
+        break;
+
+#ifdef TR_SHA1_X86
+    case TR_SHA1_ENGINE_8_LANES:
+        hash8Lanes(data, data_lengths, n, setme);
+        break;
+#endif
+#endif
+
+    default:
+        hashEach(compressPortable, data, data_lengths, n, setme);
+        break;
+    }
+}
+
+void tr_sha1_many(void const* const* data, size_t const* data_lengths, size_t n, tr_sha1_digest_t* setme)
+{
+    tr_sha1_many_with_engine(tr_sha1_engine_get_best(), data, data_lengths, n, setme);
+}
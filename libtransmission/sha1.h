@@ -0,0 +1,61 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#pragma once
+
+#ifndef __TRANSMISSION__
+#error only libtransmission should #include this header.
+#endif
+
+#include <cstddef> // size_t
+
+#include "transmission.h" // tr_sha1_digest_t
+
+/**
+*** Transmission's own SHA1 implementations, used by tr_sha1_many().
+*** The fastest one that the CPU supports is picked at runtime.
+**/
+
+enum tr_sha1_engine
+{
+    /* plain C++, one piece of data at a time */
+    TR_SHA1_ENGINE_PORTABLE,
+
+    /* the x86 SHA extensions, one piece of data at a time */
+    TR_SHA1_ENGINE_X86_SHA,
+
+    /* the ARMv8 cryptography extensions, one piece of data at a time */
+    TR_SHA1_ENGINE_ARM_SHA,
+
+    /* SIMD, four pieces of data at a time */
+    TR_SHA1_ENGINE_4_LANES,
+
+    /* AVX2, eight pieces of data at a time */
+    TR_SHA1_ENGINE_8_LANES,
+
+    TR_SHA1_ENGINE_COUNT
+};
+
+/** @brief Check whether this build and CPU can use the engine */
+bool tr_sha1_engine_is_available(tr_sha1_engine engine);
+
+/** @brief Get the engine that tr_sha1_many() uses */
+tr_sha1_engine tr_sha1_engine_get_best(void);
+
+/** @brief Get a human-readable name for the engine, e.g. for benchmarks */
+char const* tr_sha1_engine_get_name(tr_sha1_engine engine);
+
+/**
+ * @brief tr_sha1_many() with a specific engine, which must be available.
+ */
+void tr_sha1_many_with_engine(
+    tr_sha1_engine engine,
+    void const* const* data,
+    size_t const* data_lengths,
+    size_t n,
+    tr_sha1_digest_t* setme);
@@ -20,6 +20,7 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility> /* std::exchange() */
 #include <vector>
 
 #ifndef _WIN32
@@ -48,6 +49,8 @@
 #include "peer-common.h" /* MAX_BLOCK_SIZE */
 #include "peer-mgr.h"
 #include "platform.h" /* TR_PATH_DELIMITER_STR */
+#include "prealloc.h"
+#include "relocate.h"
 #include "resume.h"
 #include "session.h"
 #include "subprocess.h"
@@ -576,6 +579,7 @@ static void torrentInitFromInfoDict(tr_torrent* tor)
 
     tor->fpm_.reset(tor->info);
     tor->file_mtimes_.resize(tor->fileCount());
+    tor->file_write_counts_.resize(tor->fileCount());
     tor->file_priorities_.reset(&tor->fpm_);
     tor->files_wanted_.reset(&tor->fpm_);
     tor->checked_pieces_ = tr_bitfield{ size_t(tor->pieceCount()) };
@@ -629,6 +633,22 @@ static void callScriptIfEnabled(tr_torrent const* tor, TrScript type)
     }
 }
 
+void tr_torrentCallPendingDoneScript(tr_torrent* tor)
+{
+    if (std::exchange(tor->isDoneScriptPending, false))
+    {
+        callScriptIfEnabled(tor, TR_SCRIPT_ON_TORRENT_DONE);
+    }
+}
+
+static bool isRelocating(tr_torrent const* tor)
+{
+    auto progress = float{};
+    auto file = tr_file_index_t{};
+    auto file_progress = float{};
+    return tr_relocateGetProgress(tor, &progress, &file, &file_progress);
+}
+
 static void refreshCurrentDir(tr_torrent* tor);
 
 static void migrateFile(
@@ -1020,6 +1040,8 @@ tr_stat const* tr_torrentStat(tr_torrent* tor)
     s->leftUntilDone = tor->completion.leftUntilDone();
     s->sizeWhenDone = tor->completion.sizeWhenDone();
     s->recheckProgress = s->activity == TR_STATUS_CHECK ? getVerifyProgress(tor) : 0;
+    s->isRelocating = tr_relocateGetProgress(tor, &s->relocateProgress, &s->relocateFile, &s->relocateFileProgress);
+    s->isPreallocating = tr_preallocGetProgress(tor->session, tor->uniqueId, &s->preallocateProgress);
     s->activityDate = tor->activityDate;
     s->addedDate = tor->addedDate;
     s->doneDate = tor->doneDate;
@@ -1271,6 +1293,9 @@ static void freeTorrent(tr_torrent* tor)
     tr_session* session = tor->session;
     tr_info* inf = &tor->info;
 
+    tr_relocateRemove(tor);
+    tr_preallocRemove(session, tor->uniqueId);
+
     tr_peerMgrRemoveTorrent(tor);
 
     tr_announcerRemoveTorrent(session->announcer, tor);
@@ -1616,13 +1641,14 @@ struct remove_data
     tr_fileFunc deleteFunc;
 };
 
-static void tr_torrentDeleteLocalData(tr_torrent*, tr_fileFunc);
-
 static void removeTorrent(void* vdata)
 {
     auto* const data = static_cast<struct remove_data*>(vdata);
     auto const lock = data->tor->unique_lock();
 
+    tr_relocateRemove(data->tor);
+    tr_preallocRemove(data->tor->session, data->tor->uniqueId);
+
     if (data->deleteFlag)
     {
         tr_torrentDeleteLocalData(data->tor, data->deleteFunc);
@@ -1859,7 +1885,15 @@ void tr_torrent::recheckCompleteness()
         if (this->isDone())
         {
             tr_torrentSave(this);
-            callScriptIfEnabled(this, TR_SCRIPT_ON_TORRENT_DONE);
+
+            /* if the files are still being copied out of the incomplete dir,
+             * the script is called once they're in place */
+            this->isDoneScriptPending = true;
+
+            if (!isRelocating(this))
+            {
+                tr_torrentCallPendingDoneScript(this);
+            }
         }
     }
 }
@@ -2332,7 +2366,7 @@ static void deleteLocalData(tr_torrent* tor, tr_fileFunc func)
     tr_sys_path_remove(tmpdir.c_str(), nullptr);
 }
 
-static void tr_torrentDeleteLocalData(tr_torrent* tor, tr_fileFunc func)
+void tr_torrentDeleteLocalData(tr_torrent* tor, tr_fileFunc func)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
@@ -2370,10 +2404,8 @@ static void setLocationImpl(void* vdata)
     TR_ASSERT(tr_isTorrent(tor));
     auto const lock = tor->unique_lock();
 
-    bool err = false;
     bool const do_move = data->move_from_old_location;
     auto const& location = data->location;
-    double bytesHandled = 0;
 
     tr_logAddDebug(
         "Moving \"%s\" location from currentDir \"%s\" to \"%s\"",
@@ -2383,65 +2415,17 @@ static void setLocationImpl(void* vdata)
 
     tr_sys_dir_create(location.c_str(), TR_SYS_DIR_CREATE_PARENTS, 0777, nullptr);
 
-    if (!tr_sys_path_is_same(location.c_str(), tor->currentDir().c_str(), nullptr))
+    if (do_move && !tr_sys_path_is_same(location.c_str(), tor->currentDir().c_str(), nullptr))
     {
-        /* bad idea to move files while they're being verified... */
-        tr_verifyRemove(tor);
-
-        /* try to move the files.
-         * FIXME: there are still all kinds of nasty cases, like what
-         * if the target directory runs out of space halfway through... */
-        for (tr_file_index_t i = 0, n = tor->fileCount(); !err && i < n; ++i)
-        {
-            auto const file_size = tor->fileSize(i);
-
-            char const* oldbase = nullptr;
-            char* sub = nullptr;
-            if (tr_torrentFindFile2(tor, i, &oldbase, &sub, nullptr))
-            {
-                auto const oldpath = tr_strvPath(oldbase, sub);
-                auto const newpath = tr_strvPath(location, sub);
-
-                tr_logAddDebug("Found file #%d: %s", (int)i, oldpath.c_str());
-
-                if (do_move && !tr_sys_path_is_same(oldpath.c_str(), newpath.c_str(), nullptr))
-                {
-                    tr_error* error = nullptr;
-
-                    tr_logAddTorInfo(tor, "moving \"%s\" to \"%s\"", oldpath.c_str(), newpath.c_str());
-
-                    if (!tr_moveFile(oldpath.c_str(), newpath.c_str(), &error))
-                    {
-                        err = true;
-                        tr_logAddTorErr(
-                            tor,
-                            "error moving \"%s\" to \"%s\": %s",
-                            oldpath.c_str(),
-                            newpath.c_str(),
-                            error->message);
-                        tr_error_free(error);
-                    }
-                }
-
-                tr_free(sub);
-            }
-
-            if (data->setme_progress != nullptr)
-            {
-                bytesHandled += file_size;
-                *data->setme_progress = bytesHandled / tor->totalSize();
-            }
-        }
-
-        if (!err && do_move)
-        {
-            /* blow away the leftover subdirectories in the old location */
-            tr_torrentDeleteLocalData(tor, tr_sys_path_remove);
-        }
+        /* files that have to be copied are moved in the background,
+         * and the torrent is switched over to them when that's done */
+        tr_relocateAdd(tor, location, data->setme_progress, data->setme_state);
     }
-
-    if (!err)
+    else
     {
+        /* a newer location replaces any move that's still in progress */
+        tr_relocateRemove(tor);
+
         /* set the new location and reverify */
         tr_torrentSetDownloadDir(tor, location.c_str());
 
@@ -2450,11 +2434,19 @@ static void setLocationImpl(void* vdata)
             tor->incomplete_dir.clear();
             tor->current_dir = tor->downloadDir();
         }
-    }
 
-    if (data->setme_state != nullptr)
-    {
-        *data->setme_state = err ? TR_LOC_ERROR : TR_LOC_DONE;
+        /* in case the move that it replaced was holding up the done script */
+        tr_torrentCallPendingDoneScript(tor);
+
+        if (data->setme_progress != nullptr)
+        {
+            *data->setme_progress = 1.0;
+        }
+
+        if (data->setme_state != nullptr)
+        {
+            *data->setme_state = TR_LOC_DONE;
+        }
     }
 
     /* cleanup */
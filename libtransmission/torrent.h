@@ -89,9 +89,15 @@ tr_block_span_t tr_torGetFileBlockSpan(tr_torrent const* tor, tr_file_index_t fi
 
 void tr_torrentCheckSeedLimit(tr_torrent* tor);
 
+/** delete the torrent's files in its current location, along with any folders they leave empty */
+void tr_torrentDeleteLocalData(tr_torrent* tor, tr_fileFunc func);
+
 /** save a torrent's .resume file if it's changed since the last time it was saved */
 void tr_torrentSave(tr_torrent* tor);
 
+/** call the done script if it's been waiting for the torrent's files to be moved */
+void tr_torrentCallPendingDoneScript(tr_torrent* tor);
+
 enum tr_verify_state
 {
     TR_VERIFY_NONE,
@@ -367,6 +373,19 @@ public:
         return this->incomplete_dir;
     }
 
+    // how many times the file has been written to. A relocation compares
+    // these to find the files that changed while it was copying them
+    [[nodiscard]] uint64_t fileWriteCount(tr_file_index_t i) const
+    {
+        return i < std::size(file_write_counts_) ? file_write_counts_[i] : 0;
+    }
+
+    void markFileWritten(tr_file_index_t i)
+    {
+        TR_ASSERT(i < std::size(file_write_counts_));
+        ++file_write_counts_[i];
+    }
+
     /// METAINFO - FILES
 
     [[nodiscard]] tr_file_index_t fileCount() const
@@ -734,6 +753,10 @@ public:
     bool isStopping = false;
     bool startAfterVerify = false;
 
+    /* the torrent finished while its files were being copied somewhere else,
+     * so the done script is waiting for them to get there */
+    bool isDoneScriptPending = false;
+
     bool prefetchMagnetMetadata = false;
     bool magnetVerify = false;
 
@@ -771,6 +794,8 @@ public:
 
     std::vector<time_t> file_mtimes_;
 
+    std::vector<uint64_t> file_write_counts_;
+
 private:
     void setFilesWanted(tr_file_index_t const* files, size_t n_files, bool wanted, bool is_bootstrapping)
     {
@@ -59,6 +59,7 @@
 #include "torrent.h"
 #include "tr-assert.h"
 #include "tr-dht.h"
+#include "tr-udp.h" /* tr_udpSendTo() */
 #include "trevent.h"
 #include "utils.h"
 #include "variant.h"
@@ -827,7 +828,18 @@ int dht_random_bytes(void* buf, size_t size)
 
 int dht_sendto(int sockfd, void const* buf, int len, int flags, struct sockaddr const* to, int tolen)
 {
-    return sendto(sockfd, static_cast<char const*>(buf), len, flags, to, tolen);
+    if (session_ == nullptr || flags != 0)
+    {
+        return sendto(sockfd, static_cast<char const*>(buf), len, flags, to, tolen);
+    }
+
+    if (int const err = tr_udpSendTo(session_, buf, len, to, tolen); err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return len;
 }
 
 #if defined(_WIN32) && !defined(__MINGW32__)
@@ -21,8 +21,11 @@ THE SOFTWARE.
 
 */
 
+#include <algorithm> /* std::max() */
+#include <cerrno>
 #include <cstring> /* memcmp(), memcpy(), memset() */
 #include <cstdlib> /* malloc(), free() */
+#include <vector>
 
 #ifdef _WIN32
 #include <io.h> /* dup2() */
@@ -30,6 +33,10 @@ THE SOFTWARE.
 #include <unistd.h> /* dup2() */
 #endif
 
+#ifdef __linux__
+#include <netinet/udp.h> /* UDP_SEGMENT */
+#endif
+
 #include <event2/event.h>
 
 #include <cstdint>
@@ -43,6 +50,7 @@ THE SOFTWARE.
 #include "tr-dht.h"
 #include "tr-utp.h"
 #include "tr-udp.h"
+#include "trevent.h" /* tr_amInEventThread() */
 
 /* Since we use a single UDP socket in order to implement multiple
    uTP sockets, try to set up huge buffers. */
@@ -257,57 +265,493 @@ FAIL:
     }
 }
 
+/* Since most packets we receive here are ÂµTP, make quick inline
+   checks for the other protocols.  The logic is as follows:
+   - all DHT packets start with 'd'
+   - all UDP tracker packets start with a 32-bit (!) "action", which
+     is between 0 and 3
+   - the above cannot be ÂµTP packets, since these start with a 4-bit
+     version number (1). */
+static void dispatch_packet(tr_session* session, unsigned char* buf, int rc, struct sockaddr* from, socklen_t fromlen)
+{
+    if (buf[0] == 'd')
+    {
+        if (tr_sessionAllowsDHT(session))
+        {
+            buf[rc] = '\0'; /* required by the DHT code */
+            tr_dhtCallback(buf, rc, from, fromlen, session);
+        }
+    }
+    else if (rc >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
+    {
+        rc = tau_handle_message(session, buf, rc);
+
+        if (rc == 0)
+        {
+            tr_logAddNamedDbg("UDP", "Couldn't parse UDP tracker packet.");
+        }
+    }
+    else
+    {
+        if (tr_sessionIsUTPEnabled(session))
+        {
+            rc = tr_utpPacket(buf, rc, from, fromlen, session);
+
+            if (rc == 0)
+            {
+                tr_logAddNamedDbg("UDP", "Unexpected UDP packet");
+            }
+        }
+    }
+}
+
+/* With many uTP peers, datagrams arrive faster than the event loop can
+   wake up for each of them, so every wakeup reads as many as it can. */
+
+#define RECV_BATCH_SIZE 32
+#define RECV_PACKET_SIZE 4096
+
+struct recv_slot
+{
+    unsigned char buf[RECV_PACKET_SIZE];
+    struct sockaddr_storage from;
+    socklen_t fromlen;
+    int len;
+};
+
+/* only used in the libtransmission thread */
+static struct recv_slot recv_slots[RECV_BATCH_SIZE];
+
+/* returns how many datagrams were read into recv_slots */
+static int recv_batch(evutil_socket_t s)
+{
+#ifdef HAVE_RECVMMSG
+
+    struct iovec iov[RECV_BATCH_SIZE];
+    struct mmsghdr msgs[RECV_BATCH_SIZE];
+    memset(msgs, 0, sizeof(msgs));
+
+    for (int i = 0; i < RECV_BATCH_SIZE; ++i)
+    {
+        /* leave room for the DHT code's terminating zero */
+        iov[i].iov_base = recv_slots[i].buf;
+        iov[i].iov_len = RECV_PACKET_SIZE - 1;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &recv_slots[i].from;
+        msgs[i].msg_hdr.msg_namelen = sizeof(recv_slots[i].from);
+    }
+
+    int const n = recvmmsg(s, msgs, RECV_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+
+    for (int i = 0; i < n; ++i)
+    {
+        recv_slots[i].fromlen = msgs[i].msg_hdr.msg_namelen;
+        recv_slots[i].len = int(msgs[i].msg_len);
+    }
+
+    return std::max(n, 0);
+
+#else
+
+    /* The socket said it's readable, so the first read won't block.
+       Without MSG_DONTWAIT, any other read could, so only one is done. */
+#ifdef MSG_DONTWAIT
+    int const batch_size = RECV_BATCH_SIZE;
+    int const more_flags = MSG_DONTWAIT;
+#else
+    int const batch_size = 1;
+    int const more_flags = 0;
+#endif
+
+    int n = 0;
+
+    for (; n < batch_size; ++n)
+    {
+        auto* const slot = &recv_slots[n];
+        slot->fromlen = sizeof(slot->from);
+        int const flags = n == 0 ? 0 : more_flags;
+        slot->len = recvfrom(
+            s,
+            reinterpret_cast<char*>(slot->buf),
+            RECV_PACKET_SIZE - 1,
+            flags,
+            (struct sockaddr*)&slot->from,
+            &slot->fromlen);
+
+        if (slot->len < 0)
+        {
+            break;
+        }
+    }
+
+    return n;
+
+#endif
+}
+
 static void event_callback(evutil_socket_t s, [[maybe_unused]] short type, void* vsession)
 {
     TR_ASSERT(tr_isSession(static_cast<tr_session*>(vsession)));
     TR_ASSERT(type == EV_READ);
 
-    unsigned char buf[4096];
-    struct sockaddr_storage from;
     auto* session = static_cast<tr_session*>(vsession);
+    int const n = recv_batch(s);
 
-    socklen_t fromlen = sizeof(from);
-    int rc = recvfrom(s, reinterpret_cast<char*>(buf), 4096 - 1, 0, (struct sockaddr*)&from, &fromlen);
+    ++session->udp_read_wakeups;
+    session->udp_packets_received += n;
 
-    /* Since most packets we receive here are ÂµTP, make quick inline
-       checks for the other protocols.  The logic is as follows:
-       - all DHT packets start with 'd'
-       - all UDP tracker packets start with a 32-bit (!) "action", which
-         is between 0 and 3
-       - the above cannot be ÂµTP packets, since these start with a 4-bit
-         version number (1). */
-    if (rc > 0)
+    /* hand them over in the order they arrived */
+    for (int i = 0; i < n; ++i)
     {
-        if (buf[0] == 'd')
+        auto* const slot = &recv_slots[i];
+
+        if (slot->len > 0)
         {
-            if (tr_sessionAllowsDHT(session))
-            {
-                buf[rc] = '\0'; /* required by the DHT code */
-                tr_dhtCallback(buf, rc, (struct sockaddr*)&from, fromlen, vsession);
-            }
+            dispatch_packet(session, slot->buf, slot->len, (struct sockaddr*)&slot->from, slot->fromlen);
         }
-        else if (rc >= 8 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 && buf[3] <= 3)
+    }
+}
+
+/* Outgoing datagrams are queued while the event loop runs its callbacks
+   and are all sent together afterwards, so that a busy uTP seeder makes a
+   few big syscalls instead of one per packet. Where the kernel can segment
+   UDP itself, a burst of same-sized datagrams to one peer is handed over
+   as a single send. */
+
+#if defined(HAVE_SENDMMSG) && defined(UDP_SEGMENT)
+#define USE_UDP_GSO
+#endif
+
+/* a full queue is sent right away */
+#define SEND_QUEUE_MAX_DATAGRAMS 1024
+
+/* the most that the kernel segments from one send */
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES (63 * 1024)
+
+namespace
+{
+
+struct udp_datagram
+{
+    tr_socket_t sock;
+    struct sockaddr_storage to;
+    socklen_t tolen;
+
+    /* where it is in tr_udp_send_queue::data */
+    size_t offset;
+    size_t len;
+};
+
+} // namespace
+
+struct tr_udp_send_queue
+{
+    std::vector<udp_datagram> datagrams;
+
+    /* the datagrams' payloads, back to back */
+    std::vector<unsigned char> data;
+
+    struct event* flush_event = nullptr;
+
+    /* cleared when the kernel turns down a segmented send */
+    bool gso_works = true;
+};
+
+static void send_one(tr_udp_send_queue const* queue, udp_datagram const& d)
+{
+    (void)sendto(
+        d.sock,
+        reinterpret_cast<char const*>(std::data(queue->data) + d.offset),
+        d.len,
+        0,
+        (struct sockaddr const*)&d.to,
+        d.tolen);
+}
+
+/* how many datagrams, starting at `i`, the kernel could send as one segmented send.
+   They must be going to the same place, and only the last may be shorter */
+static size_t count_gso_run(tr_udp_send_queue const* queue, size_t i)
+{
+    auto const& datagrams = queue->datagrams;
+    auto const& first = datagrams[i];
+    auto total = first.len;
+    auto j = i + 1;
+
+    while (j < std::size(datagrams) && j - i < GSO_MAX_SEGMENTS)
+    {
+        auto const& d = datagrams[j];
+
+        if (d.sock != first.sock || d.tolen != first.tolen || memcmp(&d.to, &first.to, d.tolen) != 0 || d.len > first.len ||
+            total + d.len > GSO_MAX_BYTES)
         {
-            rc = tau_handle_message(session, buf, rc);
+            break;
+        }
 
-            if (rc == 0)
-            {
-                tr_logAddNamedDbg("UDP", "Couldn't parse UDP tracker packet.");
-            }
+        total += d.len;
+        ++j;
+
+        if (d.len < first.len)
+        {
+            break;
         }
-        else
+    }
+
+    return j - i;
+}
+
+#ifdef HAVE_SENDMMSG
+
+/* how many datagrams, starting at `i`, go out as one segmented send */
+static size_t get_gso_run_length(tr_udp_send_queue const* queue, size_t i)
+{
+#ifdef USE_UDP_GSO
+    return queue->gso_works ? count_gso_run(queue, i) : 1;
+#else
+    (void)queue;
+    (void)i;
+    return 1;
+#endif
+}
+
+namespace
+{
+
+union gso_control
+{
+    char buf[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr align;
+};
+
+} // namespace
+
+static void flush_send_queue(tr_udp_send_queue* queue)
+{
+    auto const& datagrams = queue->datagrams;
+    auto const n_datagrams = std::size(datagrams);
+
+    /* one message per datagram, or per run of datagrams that the kernel segments */
+    auto msgs = std::vector<struct mmsghdr>{};
+    auto iovs = std::vector<struct iovec>{};
+    auto controls = std::vector<gso_control>{};
+    auto firsts = std::vector<size_t>{};
+    msgs.reserve(n_datagrams);
+    iovs.reserve(n_datagrams);
+    controls.reserve(n_datagrams);
+    firsts.reserve(n_datagrams);
+
+    for (size_t i = 0; i < n_datagrams;)
+    {
+        auto const& first = datagrams[i];
+        auto const run = get_gso_run_length(queue, i);
+        auto len = size_t{};
+
+        for (size_t j = i; j < i + run; ++j)
+        {
+            len += datagrams[j].len;
+        }
+
+        /* a run's payloads are already next to each other */
+        iovs.push_back({ std::data(queue->data) + first.offset, len });
+
+        auto msg = mmsghdr{};
+        msg.msg_hdr.msg_name = const_cast<sockaddr_storage*>(&first.to);
+        msg.msg_hdr.msg_namelen = first.tolen;
+        msg.msg_hdr.msg_iov = &iovs.back();
+        msg.msg_hdr.msg_iovlen = 1;
+
+#ifdef USE_UDP_GSO
+        if (run > 1)
+        {
+            auto* const control = &controls.emplace_back();
+            memset(control, 0, sizeof(*control));
+            msg.msg_hdr.msg_control = control->buf;
+            msg.msg_hdr.msg_controllen = sizeof(control->buf);
+
+            auto* const cmsg = CMSG_FIRSTHDR(&msg.msg_hdr);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            auto const segment_size = uint16_t(first.len);
+            memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+        }
+#endif
+
+        msgs.push_back(msg);
+        firsts.push_back(i);
+        i += run;
+    }
+
+    /* each sendmmsg() call goes to one socket, so send the messages in runs of the same socket */
+    auto const n_msgs = std::size(msgs);
+
+    for (size_t i = 0; i < n_msgs;)
+    {
+        auto const sock = datagrams[firsts[i]].sock;
+        auto end = i + 1;
+
+        while (end < n_msgs && datagrams[firsts[end]].sock == sock)
+        {
+            ++end;
+        }
+
+        while (i < end)
         {
-            if (tr_sessionIsUTPEnabled(session))
+            int const n = sendmmsg(sock, &msgs[i], end - i, 0);
+
+            if (n > 0)
             {
-                rc = tr_utpPacket(buf, rc, (struct sockaddr*)&from, fromlen, session);
+                i += n;
+                continue;
+            }
 
-                if (rc == 0)
+            /* msgs[i] failed. Like a single sendto(), it's dropped, unless
+               the kernel won't segment it, in which case it's sent unsegmented */
+            if (msgs[i].msg_hdr.msg_control != nullptr && (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT))
+            {
+                tr_logAddNamedDbg("UDP", "The kernel can't segment UDP sends, so they won't be batched that way");
+                queue->gso_works = false;
+
+                auto const next = i + 1 < n_msgs ? firsts[i + 1] : n_datagrams;
+                for (size_t j = firsts[i]; j < next; ++j)
                 {
-                    tr_logAddNamedDbg("UDP", "Unexpected UDP packet");
+                    send_one(queue, datagrams[j]);
                 }
             }
+
+            ++i;
+        }
+    }
+}
+
+#else
+
+static void flush_send_queue(tr_udp_send_queue* queue)
+{
+    for (auto const& d : queue->datagrams)
+    {
+        send_one(queue, d);
+    }
+}
+
+#endif
+
+static void send_queue_flush(tr_session* session)
+{
+    auto* const queue = session->udp_send_queue;
+
+    if (queue != nullptr && !std::empty(queue->datagrams))
+    {
+        flush_send_queue(queue);
+        queue->datagrams.clear();
+        queue->data.clear();
+    }
+}
+
+static void send_queue_event_callback(evutil_socket_t /*s*/, short /*type*/, void* vsession)
+{
+    send_queue_flush(static_cast<tr_session*>(vsession));
+}
+
+static void send_queue_init(tr_session* session)
+{
+    TR_ASSERT(session->udp_send_queue == nullptr);
+
+    auto* const queue = new tr_udp_send_queue{};
+    queue->flush_event = event_new(session->event_base, -1, 0, send_queue_event_callback, session);
+    session->udp_send_queue = queue;
+}
+
+static void send_queue_uninit(tr_session* session)
+{
+    auto* const queue = session->udp_send_queue;
+
+    if (queue != nullptr)
+    {
+        send_queue_flush(session);
+        event_free(queue->flush_event);
+        delete queue;
+        session->udp_send_queue = nullptr;
+    }
+}
+
+int tr_udpSendTo(tr_session* session, void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen)
+{
+    auto sock = tr_socket_t{ TR_BAD_SOCKET };
+
+    if (to->sa_family == AF_INET)
+    {
+        sock = session->udp_socket;
+    }
+    else if (to->sa_family == AF_INET6)
+    {
+        sock = session->udp6_socket;
+    }
+
+    if (sock == TR_BAD_SOCKET)
+    {
+        return EAFNOSUPPORT;
+    }
+
+    auto* const queue = session->udp_send_queue;
+
+    /* the DHT's bootstrap thread pings nodes from outside the event thread */
+    if (queue == nullptr || queue->flush_event == nullptr || size_t(tolen) > sizeof(sockaddr_storage) ||
+        !tr_amInEventThread(session))
+    {
+        if (sendto(sock, static_cast<char const*>(buf), buflen, 0, to, tolen) == -1)
+        {
+            return sockerrno;
         }
+
+        return 0;
     }
+
+    if (std::empty(queue->datagrams))
+    {
+        /* send it once the event loop is done with the callbacks it's running */
+        event_active(queue->flush_event, EV_TIMEOUT, 0);
+    }
+
+    auto d = udp_datagram{};
+    d.sock = sock;
+    memcpy(&d.to, to, tolen);
+    d.tolen = tolen;
+    d.offset = std::size(queue->data);
+    d.len = buflen;
+    queue->datagrams.push_back(d);
+
+    auto const* const bytes = static_cast<unsigned char const*>(buf);
+    queue->data.insert(std::end(queue->data), bytes, bytes + buflen);
+
+    if (std::size(queue->datagrams) >= SEND_QUEUE_MAX_DATAGRAMS)
+    {
+        send_queue_flush(session);
+    }
+
+    return 0;
+}
+
+size_t tr_udpGetSendRunLength(tr_session const* session, size_t first)
+{
+    TR_ASSERT(session->udp_send_queue != nullptr);
+    TR_ASSERT(first < std::size(session->udp_send_queue->datagrams));
+
+    return count_gso_run(session->udp_send_queue, first);
+}
+
+void tr_udpSetSegmentedSendsEnabled(tr_session* session, bool enabled)
+{
+    TR_ASSERT(session->udp_send_queue != nullptr);
+
+    session->udp_send_queue->gso_works = enabled;
+}
+
+void tr_udpGetStats(tr_session const* session, uint64_t* setme_wakeups, uint64_t* setme_packets)
+{
+    *setme_wakeups = session->udp_read_wakeups;
+    *setme_packets = session->udp_packets_received;
 }
 
 void tr_udpInit(tr_session* ss)
@@ -381,6 +825,8 @@ void tr_udpInit(tr_session* ss)
 
     tr_udpSetSocketTOS(ss);
 
+    send_queue_init(ss);
+
     if (ss->isDHTEnabled)
     {
         tr_dhtInit(ss);
@@ -401,6 +847,8 @@ void tr_udpUninit(tr_session* ss)
 {
     tr_dhtUninit(ss);
 
+    send_queue_uninit(ss);
+
     if (ss->udp_socket != TR_BAD_SOCKET)
     {
         tr_netCloseSocket(ss->udp_socket);
@@ -37,4 +37,29 @@ void tr_udpUninit(tr_session*);
 void tr_udpSetSocketBuffers(tr_session*);
 void tr_udpSetSocketTOS(tr_session*);
 
+/** @brief How many times the UDP sockets woke up the event loop, and how many datagrams were read in all */
+void tr_udpGetStats(tr_session const* session, uint64_t* setme_wakeups, uint64_t* setme_packets);
+
+/**
+ * @brief Queue a datagram on the UDP socket that matches `to`'s family.
+ *
+ * The queue is sent, in as few syscalls as possible, once the event loop
+ * is done with the callbacks it's running. Called from any other thread,
+ * the datagram is sent right away.
+ *
+ * @return 0 on success, or an errno if there's no socket for that family
+ */
+int tr_udpSendTo(tr_session* session, void const* buf, size_t buflen, struct sockaddr const* to, socklen_t tolen);
+
+/**
+ * @brief Private function that's exposed here only for unit tests.
+ *
+ * How many of the queued datagrams, starting at `first`, may be sent as one
+ * segmented send, on platforms where the kernel can segment UDP sends.
+ */
+size_t tr_udpGetSendRunLength(tr_session const* session, size_t first);
+
+/** @brief Private function that's exposed here only for unit tests */
+void tr_udpSetSegmentedSendsEnabled(tr_session* session, bool enabled);
+
 bool tau_handle_message(tr_session* session, uint8_t const* msg, size_t msglen);
@@ -132,6 +132,7 @@ char const* tr_getDefaultDownloadDir(void);
 #define TR_DEFAULT_PEER_SOCKET_TOS_STR "default"
 #define TR_DEFAULT_PEER_LIMIT_GLOBAL_STR "200"
 #define TR_DEFAULT_PEER_LIMIT_TORRENT_STR "50"
+#define TR_DEFAULT_OPEN_FILE_LIMIT_STR "32"
 #define TR_DEFAULT_PEER_LIMIT_TORRENT 50
 
 /**
@@ -481,6 +482,26 @@ void tr_sessionSetLPDEnabled(tr_session* session, bool enabled);
 void tr_sessionSetCacheLimit_MB(tr_session* session, int mb);
 int tr_sessionGetCacheLimit_MB(tr_session const* session);
 
+/** @brief Grow the write cache past its limit to hold a few seconds of downloading, if there's memory for it */
+void tr_sessionSetCacheAutoSizeEnabled(tr_session* session, bool enabled);
+bool tr_sessionIsCacheAutoSizeEnabled(tr_session const* session);
+
+/** @brief Set the size of the cache of whole pieces that's used when seeding */
+void tr_sessionSetReadCacheLimit_MB(tr_session* session, int mb);
+int tr_sessionGetReadCacheLimit_MB(tr_session const* session);
+
+/** @brief Set how many torrents on different disks can be verified at once */
+void tr_sessionSetVerifyThreads(tr_session* session, int n);
+int tr_sessionGetVerifyThreads(tr_session const* session);
+
+/** @brief Limit how fast each torrent is read while it's being verified. 0 means no limit */
+void tr_sessionSetVerifySpeedLimit_KBps(tr_session* session, unsigned int KBps);
+unsigned int tr_sessionGetVerifySpeedLimit_KBps(tr_session const* session);
+
+/** @brief Limit how fast files are copied when a torrent is moved to another disk. 0 means no limit */
+void tr_sessionSetRelocateSpeedLimit_KBps(tr_session* session, unsigned int KBps);
+unsigned int tr_sessionGetRelocateSpeedLimit_KBps(tr_session const* session);
+
 tr_encryption_mode tr_sessionGetEncryption(tr_session* session);
 void tr_sessionSetEncryption(tr_session* session, tr_encryption_mode mode);
 
@@ -598,6 +619,44 @@ uint16_t tr_sessionGetIdleLimit(tr_session const*);
 void tr_sessionSetPeerLimit(tr_session*, uint16_t maxGlobalPeers);
 uint16_t tr_sessionGetPeerLimit(tr_session const*);
 
+/** @brief Set how many of the torrents' files may be kept open at once. 0 is taken to mean 1 */
+void tr_sessionSetOpenFileLimit(tr_session*, uint16_t maxOpenFiles);
+uint16_t tr_sessionGetOpenFileLimit(tr_session const*);
+
+/**
+ * @brief Read and write the torrents' files without going through the OS page cache.
+ *
+ * This keeps a seedbox's many files from crowding everything else out of
+ * memory, and leaves the caching to Transmission's own cache instead.
+ * Filesystems that don't support it are read and written normally.
+ */
+void tr_sessionSetDirectIoEnabled(tr_session*, bool enabled);
+bool tr_sessionIsDirectIoEnabled(tr_session const*);
+
+/**
+ * @brief Send blocks to unencrypted TCP peers straight from the files with sendfile().
+ *
+ * The blocks go from the OS page cache to the socket without being copied
+ * into Transmission, which saves a fast seedbox most of its upload's memory
+ * copying. Blocks that are in Transmission's cache are still sent from there.
+ * It has no effect while direct I/O is enabled.
+ */
+void tr_sessionSetZeroCopyUploadEnabled(tr_session*, bool enabled);
+bool tr_sessionIsZeroCopyUploadEnabled(tr_session const*);
+
+/**
+ * @brief Spread peers' TCP sockets across `n` threads, each with its own event loop.
+ *
+ * Those threads do the socket reads and writes, and the MSE encryption once
+ * a peer's handshake is done, so that a fast seedbox isn't held to what one
+ * core can do. Everything else still happens in the session thread.
+ * 0, the default, does all peer I/O in the session thread. A change applies
+ * to the peers that connect afterwards, and the sockets don't use
+ * tr_sessionSetZeroCopyUploadEnabled().
+ */
+void tr_sessionSetPeerIoThreads(tr_session*, int n);
+int tr_sessionGetPeerIoThreads(tr_session const*);
+
 void tr_sessionSetPeerLimitPerTorrent(tr_session*, uint16_t maxPeers);
 uint16_t tr_sessionGetPeerLimitPerTorrent(tr_session const*);
 
@@ -1017,6 +1076,10 @@ enum
  * if move_from_previous_location is `true', the torrent's incompleteDir
  * will be clobberred s.t. additional files being added will be saved
  * to the torrent's downloadDir.
+ *
+ * Files that have to be copied to another disk are copied in the background
+ * while the torrent keeps using them where they are; see tr_stat.isRelocating.
+ * Moving a torrent again before the previous move is done cancels that move.
  */
 void tr_torrentSetLocation(
     tr_torrent* torrent,
@@ -1700,6 +1763,31 @@ struct tr_stat
         @see tr_stat.activity */
     float recheckProgress;
 
+    /** True while the torrent's files are being moved to a new location.
+        The torrent keeps using its old location until the move is done.
+        @see tr_torrentSetLocation() */
+    bool isRelocating;
+
+    /** When isRelocating is true, this is how much of the torrent's data
+        has been moved so far. Range is [0..1] */
+    float relocateProgress;
+
+    /** When isRelocating is true, this is the file being copied right now */
+    tr_file_index_t relocateFile;
+
+    /** When isRelocating is true, this is how much of relocateFile
+        has been copied so far. Range is [0..1] */
+    float relocateFileProgress;
+
+    /** True while space is being set aside for the torrent's files
+        in the background. This happens with TR_PREALLOCATE_FULL,
+        and the torrent can keep downloading in the meantime. */
+    bool isPreallocating;
+
+    /** When isPreallocating is true, this is how much of the space
+        has been set aside so far. Range is [0..1] */
+    float preallocateProgress;
+
     /** How much has been downloaded of the entire torrent.
         Range is [0..1] */
     float percentComplete;
@@ -6,9 +6,13 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
-#include <mutex>
+#include <thread> /* std::this_thread::yield() */
 
 #include <csignal>
 
@@ -18,6 +22,10 @@
 #include <unistd.h> /* read(), write(), pipe() */
 #endif
 
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
 #include <event2/dns.h>
 #include <event2/event.h>
 
@@ -149,78 +157,258 @@ using tr_pipe_end_t = int;
 ****
 ***/
 
+/* the most queued functions that are run before other events get a turn */
+static auto constexpr MaxRunBatch = size_t{ 128 };
+
+struct tr_run_node
+{
+    std::atomic<tr_run_node*> next = nullptr;
+    void (*func)(void*) = nullptr;
+    void* user_data = nullptr;
+    uint64_t queued_usec = 0;
+};
+
+/**
+ * The functions that other threads want run in the loop's thread.
+ *
+ * Any thread can push without locking; only the loop's thread pops.
+ * `back` is the node that was pushed last, and `front` is the next one
+ * to pop. `stub` keeps the list from ever being empty, so that pushing
+ * never has to touch `front`.
+ */
+struct tr_run_queue
+{
+    tr_run_node stub;
+    std::atomic<tr_run_node*> back = &stub;
+    tr_run_node* front = &stub;
+
+    /* how many nodes have been pushed and not run yet. The pusher that
+       makes it nonzero is the one that wakes the loop */
+    std::atomic<size_t> n_queued = 0;
+};
+
 struct tr_event_handle
 {
-    std::recursive_mutex fds_mutex;
+    /* written to wake the loop. Both ends are the same eventfd when there is one */
     tr_pipe_end_t fds[2] = {};
 
-    struct event* pipeEvent = nullptr;
+    tr_run_queue queue;
+
+    struct event* wakeEvent = nullptr;
     struct event_base* base = nullptr;
-    tr_session* session = nullptr;
+    tr_session* session = nullptr; /* nullptr in loops that aren't the session's */
     tr_thread* thread = nullptr;
 
-    bool die = false;
-};
+    std::atomic<bool> is_running = false;
+    std::atomic<bool> die = false;
 
-struct tr_run_data
-{
-    void (*func)(void*);
-    void* user_data;
+    /* for tr_eventLoopGetStats() */
+    std::atomic<uint64_t> n_run = 0;
+    std::atomic<uint64_t> latency_usec = 0;
+    std::atomic<uint64_t> max_latency_usec = 0;
 };
 
 #define dbgmsg(...) tr_logAddDeepNamed("event", __VA_ARGS__)
 
-static void readFromPipe(evutil_socket_t fd, short eventType, void* veh)
+static uint64_t nowUsec()
 {
-    auto* eh = static_cast<tr_event_handle*>(veh);
+    auto const now = std::chrono::steady_clock::now().time_since_epoch();
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
 
-    dbgmsg("readFromPipe: eventType is %hd", eventType);
+static void pushNode(tr_run_queue* queue, tr_run_node* node)
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    auto* const prev = queue->back.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
 
-    /* read the command type */
-    char ch = '\0';
+/* returns nullptr if the queue is empty, or if the next node is still being pushed */
+static tr_run_node* popNode(tr_run_queue* queue)
+{
+    auto* front = queue->front;
+    auto* next = front->next.load(std::memory_order_acquire);
 
-    int ret = 0;
-    do
+    if (front == &queue->stub)
     {
-        ret = piperead(fd, &ch, 1);
-    } while (!eh->die && ret == -1 && errno == EAGAIN);
+        if (next == nullptr)
+        {
+            return nullptr;
+        }
 
-    dbgmsg("command is [%c], ret is %d, errno is %d", ch, ret, (int)errno);
+        queue->front = next;
+        front = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
 
-    switch (ch)
+    if (next != nullptr)
     {
-    case 'r': /* run in libevent thread */
-        {
-            struct tr_run_data data;
-            size_t const nwant = sizeof(data);
-            ev_ssize_t const ngot = piperead(fd, &data, nwant);
+        queue->front = next;
+        return front;
+    }
 
-            if (!eh->die && ngot == (ev_ssize_t)nwant)
-            {
-                dbgmsg("invoking function in libevent thread");
-                (*data.func)(data.user_data);
-            }
+    if (front != queue->back.load(std::memory_order_acquire))
+    {
+        return nullptr;
+    }
 
-            break;
-        }
+    /* `front` is the last node. Put the stub behind it so that it can be popped */
+    pushNode(queue, &queue->stub);
+    next = front->next.load(std::memory_order_acquire);
+
+    if (next != nullptr)
+    {
+        queue->front = next;
+        return front;
+    }
+
+    return nullptr;
+}
+
+static int wakeupNew(tr_pipe_end_t fds[2])
+{
+#ifdef HAVE_EVENTFD
+
+    auto const fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    fds[0] = fds[1] = fd;
+
+#else
+
+    if (pipe(fds) == -1)
+    {
+        return -1;
+    }
 
-    case '\0': /* eof */
+    evutil_make_socket_nonblocking(fds[0]);
+
+#endif
+
+    return 0;
+}
+
+static void wakeupFree(tr_pipe_end_t fds[2])
+{
+    tr_netCloseSocket(fds[0]);
+
+    if (fds[1] != fds[0])
+    {
+        tr_netCloseSocket(fds[1]);
+    }
+}
+
+static void wakeLoop(tr_event_handle* eh)
+{
+#ifdef HAVE_EVENTFD
+    auto const one = uint64_t{ 1 };
+    auto const res = write(eh->fds[1], &one, sizeof(one));
+#else
+    char const ch = 'r';
+    auto const res = pipewrite(eh->fds[1], &ch, 1);
+#endif
+
+    if (res == -1)
+    {
+        tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+    }
+}
+
+static void clearWakeup(tr_pipe_end_t fd)
+{
+#ifdef HAVE_EVENTFD
+    auto value = uint64_t{};
+    [[maybe_unused]] auto const res = read(fd, &value, sizeof(value));
+#else
+    char buf[64];
+
+    while (piperead(fd, buf, sizeof(buf)) == sizeof(buf))
+    {
+    }
+#endif
+}
+
+static void dropQueuedNodes(tr_run_queue* queue)
+{
+    while (queue->n_queued > 0)
+    {
+        auto* const node = popNode(queue);
+
+        if (node == nullptr)
         {
-            dbgmsg("pipe eof reached... removing event listener");
-            event_free(eh->pipeEvent);
-            tr_netCloseSocket(eh->fds[0]);
-            event_base_loopexit(eh->base, nullptr);
-            break;
+            /* someone is still pushing it */
+            std::this_thread::yield();
+            continue;
         }
 
-    default:
+        delete node;
+        --queue->n_queued;
+    }
+}
+
+static void runQueuedNodes(tr_event_handle* eh)
+{
+    auto* const queue = &eh->queue;
+    auto n_run = size_t{};
+    auto latency = eh->latency_usec.load(std::memory_order_relaxed);
+    auto max_latency = eh->max_latency_usec.load(std::memory_order_relaxed);
+    auto const n_before = eh->n_run.load(std::memory_order_relaxed);
+
+    while (n_run < MaxRunBatch && !eh->die)
+    {
+        auto* const node = popNode(queue);
+
+        if (node == nullptr)
         {
-            TR_ASSERT_MSG(false, "unhandled command type %d", (int)ch);
             break;
         }
+
+        auto const node_latency = nowUsec() - node->queued_usec;
+        latency = n_before + n_run == 0 ? node_latency : (latency * 7 + node_latency) / 8;
+        max_latency = std::max(max_latency, node_latency);
+        ++n_run;
+
+        (*node->func)(node->user_data);
+        delete node;
+    }
+
+    eh->n_run.store(n_before + n_run, std::memory_order_relaxed);
+    eh->latency_usec.store(latency, std::memory_order_relaxed);
+    eh->max_latency_usec.store(max_latency, std::memory_order_relaxed);
+
+    /* nobody wakes us for whatever's left, since the queue wasn't empty when it was pushed.
+       So come back to it once the other events have had a turn */
+    if (queue->n_queued.fetch_sub(n_run, std::memory_order_acq_rel) != n_run)
+    {
+        event_active(eh->wakeEvent, EV_READ, 0);
     }
 }
 
+static void onWakeup(evutil_socket_t fd, short eventType, void* veh)
+{
+    auto* eh = static_cast<tr_event_handle*>(veh);
+
+    dbgmsg("onWakeup: eventType is %hd", eventType);
+
+    clearWakeup(fd);
+
+    if (eh->die)
+    {
+        dbgmsg("event loop is closing... removing event listener");
+        event_free(eh->wakeEvent);
+        eh->wakeEvent = nullptr;
+        wakeupFree(eh->fds);
+        event_base_loopexit(eh->base, nullptr);
+        return;
+    }
+
+    runQueuedNodes(eh);
+}
+
 static void logFunc(int severity, char const* message)
 {
     if (severity >= _EVENT_LOG_ERR)
@@ -247,14 +435,19 @@ static void libeventThreadFunc(void* veh)
 
     /* set the struct's fields */
     eh->base = base;
-    eh->session->event_base = base;
-    eh->session->evdns_base = evdns_base_new(base, true);
-    eh->session->events = eh;
 
-    /* listen to the pipe's read fd */
-    eh->pipeEvent = event_new(base, eh->fds[0], EV_READ | EV_PERSIST, readFromPipe, veh);
-    event_add(eh->pipeEvent, nullptr);
+    if (eh->session != nullptr)
+    {
+        eh->session->event_base = base;
+        eh->session->evdns_base = evdns_base_new(base, true);
+        eh->session->events = eh;
+    }
+
+    /* listen for other threads' wakeups */
+    eh->wakeEvent = event_new(base, eh->fds[0], EV_READ | EV_PERSIST, onWakeup, veh);
+    event_add(eh->wakeEvent, nullptr);
     event_set_log_callback(logFunc);
+    eh->is_running = true;
 
     /* loop until all the events are done */
     while (!eh->die)
@@ -264,6 +457,15 @@ static void libeventThreadFunc(void* veh)
 
     /* shut down the thread */
     event_base_free(base);
+    dropQueuedNodes(&eh->queue);
+
+    if (eh->session == nullptr)
+    {
+        /* tr_eventLoopFree() is waiting to delete it */
+        eh->is_running = false;
+        return;
+    }
+
     eh->session->events = nullptr;
     delete eh;
     tr_logAddDebug("Closing libevent thread");
@@ -275,9 +477,9 @@ void tr_eventInit(tr_session* session)
 
     auto* const eh = new tr_event_handle{};
 
-    if (pipe(eh->fds) == -1)
+    if (wakeupNew(eh->fds) == -1)
     {
-        tr_logAddError("Unable to write to pipe() in libtransmission: %s", tr_strerror(errno));
+        tr_logAddError("Unable to create libtransmission event queue: %s", tr_strerror(errno));
     }
 
     eh->session = session;
@@ -302,10 +504,10 @@ void tr_eventClose(tr_session* session)
     session->events->die = true;
     if (tr_logGetDeepEnabled())
     {
-        tr_logAddDeep(__FILE__, __LINE__, nullptr, "closing trevent pipe");
+        tr_logAddDeep(__FILE__, __LINE__, nullptr, "closing trevent loop");
     }
 
-    tr_netCloseSocket(session->events->fds[1]);
+    wakeLoop(session->events);
 }
 
 /**
@@ -317,7 +519,67 @@ bool tr_amInEventThread(tr_session const* session)
     TR_ASSERT(tr_isSession(session));
     TR_ASSERT(session->events != nullptr);
 
-    return tr_amInThread(session->events->thread);
+    return tr_amInEventLoop(session->events);
+}
+
+/**
+***
+**/
+
+tr_event_handle* tr_eventLoopNew()
+{
+    auto* const eh = new tr_event_handle{};
+
+    if (wakeupNew(eh->fds) == -1)
+    {
+        tr_logAddError("Unable to create libtransmission event queue: %s", tr_strerror(errno));
+    }
+
+    eh->thread = tr_threadNew(libeventThreadFunc, eh);
+
+    /* wait until the libevent thread is running */
+    while (!eh->is_running)
+    {
+        tr_wait_msec(1);
+    }
+
+    return eh;
+}
+
+void tr_eventLoopFree(tr_event_handle* eh)
+{
+    TR_ASSERT(eh->session == nullptr);
+    TR_ASSERT(!tr_amInEventLoop(eh));
+
+    eh->die = true;
+    wakeLoop(eh);
+
+    while (eh->is_running)
+    {
+        tr_wait_msec(1);
+    }
+
+    delete eh;
+}
+
+struct event_base* tr_eventLoopGetBase(tr_event_handle const* eh)
+{
+    return eh->base;
+}
+
+bool tr_amInEventLoop(tr_event_handle const* eh)
+{
+    return tr_amInThread(eh->thread);
+}
+
+tr_event_loop_stats tr_eventLoopGetStats(tr_event_handle const* eh)
+{
+    auto stats = tr_event_loop_stats{};
+    stats.queued = eh->queue.n_queued;
+    stats.n_run = eh->n_run;
+    stats.latency_usec = eh->latency_usec;
+    stats.max_latency_usec = eh->max_latency_usec;
+    return stats;
 }
 
 /**
@@ -329,27 +591,27 @@ void tr_runInEventThread(tr_session* session, void (*func)(void*), void* user_da
     TR_ASSERT(tr_isSession(session));
     TR_ASSERT(session->events != nullptr);
 
-    if (tr_amInThread(session->events->thread))
+    tr_runInEventLoop(session->events, func, user_data);
+}
+
+void tr_runInEventLoop(tr_event_handle* e, void (*func)(void*), void* user_data)
+{
+    if (tr_amInThread(e->thread))
     {
         (*func)(user_data);
     }
     else
     {
-        tr_event_handle* e = session->events;
-        auto const lock = std::unique_lock(e->fds_mutex);
-        auto data = tr_run_data{};
-
-        tr_pipe_end_t const fd = e->fds[1];
-        char ch = 'r';
-        ev_ssize_t const res_1 = pipewrite(fd, &ch, 1);
-
-        data.func = func;
-        data.user_data = user_data;
-        ev_ssize_t const res_2 = pipewrite(fd, &data, sizeof(data));
-
-        if (res_1 == -1 || res_2 == -1)
+        auto* const node = new tr_run_node{};
+        node->func = func;
+        node->user_data = user_data;
+        node->queued_usec = nowUsec();
+        pushNode(&e->queue, node);
+
+        /* only the first one in needs to wake the loop up; it runs the rest in the same batch */
+        if (e->queue.n_queued.fetch_add(1, std::memory_order_acq_rel) == 0)
         {
-            tr_logAddError("Unable to write to libtransmisison event queue: %s", tr_strerror(errno));
+            wakeLoop(e);
         }
     }
 }
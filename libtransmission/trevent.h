@@ -12,6 +12,9 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
 #include "tr-macros.h"
 
 void tr_eventInit(tr_session*);
@@ -21,3 +24,40 @@ void tr_eventClose(tr_session*);
 bool tr_amInEventThread(tr_session const*);
 
 void tr_runInEventThread(tr_session*, void (*func)(void*), void* user_data);
+
+/**
+***  Event loops other than the session's, each running in a thread of its own
+**/
+
+struct event_base;
+struct tr_event_handle;
+
+/** @brief Start an event loop and return once its thread is running */
+tr_event_handle* tr_eventLoopNew();
+
+/** @brief Stop an event loop and wait for its thread to finish. Functions still queued for it are dropped */
+void tr_eventLoopFree(tr_event_handle*);
+
+struct event_base* tr_eventLoopGetBase(tr_event_handle const*);
+
+bool tr_amInEventLoop(tr_event_handle const*);
+
+/** @brief What an event loop's queue of functions to run looks like, for tr_eventLoopGetStats() */
+struct tr_event_loop_stats
+{
+    /* the functions that are waiting to be run */
+    size_t queued;
+
+    /* the functions that have been run */
+    uint64_t n_run;
+
+    /* from tr_runInEventLoop() to being run: a moving average, and the most it's been */
+    uint64_t latency_usec;
+    uint64_t max_latency_usec;
+};
+
+/** @brief Get the queue depth and latency of an event loop. Can be called from any thread */
+tr_event_loop_stats tr_eventLoopGetStats(tr_event_handle const*);
+
+/** @brief Run a function in an event loop's thread: right away if called from there, later otherwise */
+void tr_runInEventLoop(tr_event_handle*, void (*func)(void*), void* user_data);
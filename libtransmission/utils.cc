@@ -1203,12 +1203,26 @@ bool tr_moveFile(char const* oldpath, char const* newpath, tr_error** error)
     }
 
     /* Otherwise, copy the file. */
-    if (!tr_sys_path_copy(oldpath, newpath, error))
+    auto method = tr_sys_path_copy_method_t{};
+    if (!tr_sys_path_copy(oldpath, newpath, &method, error))
     {
         tr_error_prefix(error, "Unable to copy: ");
         return false;
     }
 
+    if (method == TR_SYS_PATH_COPY_CLONE)
+    {
+        tr_logAddDebug("Cloned \"%s\" to \"%s\"", oldpath, newpath);
+    }
+    else
+    {
+        tr_logAddDebug(
+            "Copied \"%s\" to \"%s\" %s",
+            oldpath,
+            newpath,
+            method == TR_SYS_PATH_COPY_IN_KERNEL ? "in the kernel" : "in chunks");
+    }
+
     {
         tr_error* my_error = nullptr;
 
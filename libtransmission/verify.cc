@@ -7,14 +7,35 @@
  */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <ctime>
+#include <list>
+#include <map>
 #include <mutex>
+#include <optional>
 #include <set>
+#include <string>
 #include <vector>
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef __APPLE__
+#include <sys/resource.h>
+#endif
+
 #include "transmission.h"
 #include "completion.h"
 #include "crypto-utils.h"
+#include "disk-io.h"
 #include "file.h"
 #include "log.h"
 #include "platform.h"
@@ -27,37 +48,135 @@
 ****
 ***/
 
-static auto constexpr MsecToSleepPerSecondDuringVerify = int{ 100 };
+namespace
+{
 
-static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
+auto constexpr ChunkSize = size_t{ 1024 * 512 };
+
+/* Part of the torrent that's been read from one file. It can hold several pieces,
+ * so that the ones that are wholly inside it can be hashed together */
+struct verify_chunk
 {
-    auto const begin = tr_time();
+    std::vector<std::byte> buf = std::vector<std::byte>(ChunkSize);
+
+    /* where in the torrent the chunk begins */
+    tr_piece_index_t piece = 0;
+    uint32_t piece_offset = 0;
+
+    /* how many of the torrent's bytes this chunk covers */
+    uint64_t len = 0;
+
+    /* how many of those could be read. The pieces past that are bad */
+    uint64_t n_read = 0;
+
+    /* set when the chunk is one whole piece that's in a hole in the file, so nothing was read */
+    bool is_hole = false;
+};
+
+/* Reads a torrent on its own thread, staying a chunk ahead of the hashing:
+ * while one chunk is being hashed, the other one is being filled. */
+struct verify_reader
+{
+    verify_reader(tr_torrent* tor_in, uint64_t device_in, std::atomic<bool> const* stop_in, uint64_t speed_limit_in)
+        : tor{ tor_in }
+        , device{ device_in }
+        , stop{ stop_in }
+        , speed_limit{ speed_limit_in }
+    {
+    }
+
+    tr_torrent* const tor;
+
+    /* the disk that the torrent is on */
+    uint64_t const device;
+
+    /* set when the verify is cancelled */
+    std::atomic<bool> const* const stop;
+
+    /* bytes per second, or 0 for no limit */
+    uint64_t const speed_limit;
+
+    std::array<verify_chunk, 2> chunks;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    /* the chunks that are filled are chunks[next_hash], chunks[next_hash + 1]... */
+    size_t next_hash = 0;
+    size_t n_filled = 0;
+
+    /* set by the hashing thread to tell the reader to stop */
+    bool quit = false;
+
+    /* set by the reader when it's read everything or has stopped */
+    bool is_done = false;
+};
 
+} // namespace
+
+/* Verifying shouldn't get in the way of the disks' other work, so ask the OS to treat
+ * the reader thread's I/O as a lower priority than everything else's */
+static void setLowIoPriority()
+{
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    /* best effort class, lowest level. The idle class could starve verification outright on a busy disk */
+    auto constexpr IoprioWhoProcess = 1;
+    auto constexpr IoprioClassBestEffort = 2;
+    auto constexpr IoprioClassShift = 13;
+    auto constexpr IoprioLowest = 7;
+    syscall(SYS_ioprio_set, IoprioWhoProcess, 0, (IoprioClassBestEffort << IoprioClassShift) | IoprioLowest);
+#elif defined(__APPLE__)
+    setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE);
+#elif defined(_WIN32)
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#endif
+}
+
+/* sleep as long as it takes to bring the reading speed down to the limit */
+static void throttleReader(verify_reader* reader, uint64_t begin_msec, uint64_t bytes_read)
+{
+    if (reader->speed_limit == 0)
+    {
+        return;
+    }
+
+    auto const target_msec = begin_msec + bytes_read * 1000 / reader->speed_limit;
+
+    for (auto now = tr_time_msec(); now < target_msec; now = tr_time_msec())
+    {
+        if (auto const lock = std::lock_guard(reader->mutex); reader->quit || *reader->stop)
+        {
+            break;
+        }
+
+        tr_wait_msec(std::min(target_msec - now, uint64_t{ 100 }));
+    }
+}
+
+static void readerThreadFunc(void* vreader)
+{
+    auto* const reader = static_cast<verify_reader*>(vreader);
+    auto* const tor = reader->tor;
+
+    setLowIoPriority();
+
+    auto const begin_msec = tr_time_msec();
+    auto total_read = uint64_t{};
     tr_sys_file_t fd = TR_BAD_SYS_FILE;
     uint64_t filePos = 0;
-    bool changed = false;
-    bool hadPiece = false;
-    time_t lastSleptAt = 0;
     uint32_t piecePos = 0;
     tr_file_index_t fileIndex = 0;
     tr_file_index_t prevFileIndex = !fileIndex;
     tr_piece_index_t piece = 0;
-    auto buffer = std::vector<std::byte>(1024 * 256);
-    auto sha = tr_sha1_init();
 
-    tr_logAddTorDbg(tor, "%s", "verifying torrent...");
-    tor->verify_progress = 0;
+    /* the current file's next run of data, as far as we know */
+    uint64_t dataBegin = 0;
+    uint64_t dataEnd = 0;
 
-    while (!*stopFlag && piece < tor->pieceCount())
+    while (!*reader->stop && piece < tor->pieceCount())
     {
         auto const file_length = tor->fileSize(fileIndex);
 
-        /* if we're starting a new piece... */
-        if (piecePos == 0)
-        {
-            hadPiece = tor->hasPiece(piece);
-        }
-
         /* if we're starting a new file... */
         if (filePos == 0 && fd == TR_BAD_SYS_FILE && fileIndex != prevFileIndex)
         {
@@ -66,62 +185,121 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
                                        tr_sys_file_open(filename, TR_SYS_FILE_READ | TR_SYS_FILE_SEQUENTIAL, 0, nullptr);
             tr_free(filename);
             prevFileIndex = fileIndex;
+            dataBegin = 0;
+            dataEnd = 0;
         }
 
         /* figure out how much we can read this pass */
-        uint64_t leftInPiece = tor->pieceSize(piece) - piecePos;
-        uint64_t leftInFile = file_length - filePos;
-        uint64_t bytesThisPass = std::min(leftInFile, leftInPiece);
-        bytesThisPass = std::min(bytesThisPass, uint64_t(std::size(buffer)));
+        uint64_t const leftInPiece = tor->pieceSize(piece) - piecePos;
+        uint64_t const leftInFile = file_length - filePos;
+        uint64_t bytesThisPass = std::min(leftInFile, uint64_t{ ChunkSize });
 
-        /* read a bit */
-        if (fd != TR_BAD_SYS_FILE)
+        if (fd != TR_BAD_SYS_FILE && filePos >= dataEnd &&
+            !tr_sys_file_find_data(fd, filePos, &dataBegin, &dataEnd, nullptr))
         {
-            auto numRead = uint64_t{};
-            if (tr_sys_file_read_at(fd, std::data(buffer), bytesThisPass, filePos, &numRead, nullptr) && numRead > 0)
-            {
-                bytesThisPass = numRead;
-                tr_sha1_update(sha, std::data(buffer), bytesThisPass);
-                tr_sys_file_advise(fd, filePos, bytesThisPass, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
-            }
+            dataBegin = filePos;
+            dataEnd = file_length;
         }
 
-        /* move our offsets */
-        leftInPiece -= bytesThisPass;
-        leftInFile -= bytesThisPass;
-        piecePos += bytesThisPass;
-        filePos += bytesThisPass;
+        /* a piece that's entirely in a hole doesn't need to be read */
+        auto const isHole = fd != TR_BAD_SYS_FILE && piecePos == 0 && leftInPiece <= leftInFile &&
+            filePos + leftInPiece <= dataBegin;
+
+        if (isHole)
+        {
+            bytesThisPass = leftInPiece;
+        }
+        else if (fd != TR_BAD_SYS_FILE && filePos < dataBegin)
+        {
+            /* in a hole, but not for this whole piece. Stop at its end, since the next one may be all hole */
+            bytesThisPass = std::min(bytesThisPass, leftInPiece);
+        }
+        else if (fd != TR_BAD_SYS_FILE && filePos < dataEnd && dataEnd < filePos + bytesThisPass)
+        {
+            /* stop at the end of the piece where the data ends, since the ones after it may be all hole */
+            auto const piece_size = tor->pieceSize();
+            auto const toDataEnd = dataEnd - filePos;
+            auto const toPieceEnd = (piece_size - (piecePos + toDataEnd) % piece_size) % piece_size;
+            bytesThisPass = std::min(bytesThisPass, toDataEnd + toPieceEnd);
+        }
 
-        /* if we're finishing a piece... */
-        if (leftInPiece == 0)
+        if (bytesThisPass != 0)
         {
-            auto hash = tr_sha1_final(sha);
-            auto const hasPiece = hash && *hash == tor->pieceHash(piece);
+            /* wait for a free chunk */
+            auto lock = std::unique_lock(reader->mutex);
+            reader->cv.wait(lock, [reader]() { return reader->quit || reader->n_filled < std::size(reader->chunks); });
 
-            if (hasPiece || hadPiece)
+            if (reader->quit)
             {
-                tor->setHasPiece(piece, hasPiece);
-                changed |= hasPiece != hadPiece;
+                break;
             }
 
-            tor->markChanged();
+            auto& chunk = reader->chunks[(reader->next_hash + reader->n_filled) % std::size(reader->chunks)];
+            lock.unlock();
 
-            /* sleeping even just a few msec per second goes a long
-             * way towards reducing IO load... */
-            if (auto const now = tr_time(); lastSleptAt != now)
+            /* read a bit */
+            chunk.piece = piece;
+            chunk.piece_offset = piecePos;
+            chunk.len = bytesThisPass;
+            chunk.n_read = 0;
+            chunk.is_hole = isHole;
+
+            if (!isHole && fd != TR_BAD_SYS_FILE)
+            {
+                /* let the peers' reads and writes on this disk go first */
+                tr_diskIoYield(tor->session->diskIo, reader->device);
+            }
+
+            while (!isHole && fd != TR_BAD_SYS_FILE && chunk.n_read < chunk.len)
+            {
+                auto numRead = uint64_t{};
+                if (!tr_sys_file_read_at(
+                        fd,
+                        std::data(chunk.buf) + chunk.n_read,
+                        chunk.len - chunk.n_read,
+                        filePos + chunk.n_read,
+                        &numRead,
+                        nullptr) ||
+                    numRead == 0)
+                {
+                    break;
+                }
+
+                chunk.n_read += numRead;
+            }
+
+            if (isHole)
+            {
+                chunk.n_read = chunk.len;
+            }
+            else if (chunk.n_read > 0)
             {
-                lastSleptAt = now;
-                tr_wait_msec(MsecToSleepPerSecondDuringVerify);
+                tr_sys_file_advise(fd, filePos, chunk.n_read, TR_SYS_FILE_ADVICE_DONT_NEED, nullptr);
             }
 
-            sha = tr_sha1_init();
+            /* hand it to the hashing thread */
+            lock.lock();
+            ++reader->n_filled;
+            reader->cv.notify_all();
+            lock.unlock();
+
+            total_read += isHole ? 0 : chunk.n_read;
+            throttleReader(reader, begin_msec, total_read);
+        }
+
+        /* move our offsets */
+        piecePos += bytesThisPass;
+        filePos += bytesThisPass;
+
+        /* if we're finishing pieces... */
+        while (piece < tor->pieceCount() && piecePos >= tor->pieceSize(piece))
+        {
+            piecePos -= tor->pieceSize(piece);
             ++piece;
-            tor->verify_progress = piece / double(tor->pieceCount());
-            piecePos = 0;
         }
 
         /* if we're finishing a file... */
-        if (leftInFile == 0)
+        if (filePos == file_length)
         {
             if (fd != TR_BAD_SYS_FILE)
             {
@@ -140,6 +318,162 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
         tr_sys_file_close(fd, nullptr);
     }
 
+    auto const lock = std::lock_guard(reader->mutex);
+    reader->is_done = true;
+    reader->cv.notify_all();
+}
+
+/* The hash of a piece that's all zeroes, which is what a piece in a hole holds.
+ * There are only ever one or two piece sizes per torrent, so these are cached by size */
+static std::optional<tr_sha1_digest_t> getZeroesHash(
+    std::map<uint64_t, std::optional<tr_sha1_digest_t>>& hashes,
+    uint64_t piece_size)
+{
+    if (auto const it = hashes.find(piece_size); it != std::end(hashes))
+    {
+        return it->second;
+    }
+
+    auto const zeroes = std::vector<std::byte>(piece_size);
+    auto sha = tr_sha1_init();
+    tr_sha1_update(sha, std::data(zeroes), std::size(zeroes));
+    return hashes[piece_size] = tr_sha1_final(sha);
+}
+
+static bool verifyTorrent(tr_torrent* tor, uint64_t device, std::atomic<bool> const* stopFlag, uint64_t speed_limit)
+{
+    auto const begin = tr_time();
+
+    bool changed = false;
+    bool pieceIsReadable = true;
+    auto sha = tr_sha1_init();
+    auto zeroes_hashes = std::map<uint64_t, std::optional<tr_sha1_digest_t>>{};
+    auto batch_data = std::vector<void const*>{};
+    auto batch_lengths = std::vector<size_t>{};
+    auto batch_pieces = std::vector<tr_piece_index_t>{};
+    auto batch_hashes = std::vector<tr_sha1_digest_t>{};
+
+    /* `hash` is empty if the piece couldn't be read */
+    auto const finishPiece = [tor, &changed](tr_piece_index_t piece, std::optional<tr_sha1_digest_t> const& hash)
+    {
+        auto const hadPiece = tor->hasPiece(piece);
+        auto const hasPiece = hash && *hash == tor->pieceHash(piece);
+
+        if (hasPiece || hadPiece)
+        {
+            tor->setHasPiece(piece, hasPiece);
+            changed |= hasPiece != hadPiece;
+        }
+
+        tor->markChanged();
+        tor->verify_progress = (piece + 1) / double(tor->pieceCount());
+    };
+
+    tr_logAddTorDbg(tor, "%s", "verifying torrent...");
+    tor->verify_progress = 0;
+
+    auto reader = verify_reader{ tor, device, stopFlag, speed_limit };
+    tr_threadNew(readerThreadFunc, &reader);
+
+    for (;;)
+    {
+        auto lock = std::unique_lock(reader.mutex);
+        reader.cv.wait(lock, [&reader]() { return reader.is_done || reader.n_filled > 0; });
+
+        if (reader.n_filled == 0 || *stopFlag)
+        {
+            break;
+        }
+
+        auto const& chunk = reader.chunks[reader.next_hash];
+        lock.unlock();
+
+        auto piece = chunk.piece;
+        uint64_t piecePos = chunk.piece_offset;
+        batch_data.clear();
+        batch_lengths.clear();
+        batch_pieces.clear();
+
+        for (uint64_t pos = 0; pos < chunk.len;)
+        {
+            auto const piece_size = tor->pieceSize(piece);
+            auto const n = std::min(chunk.len - pos, piece_size - piecePos);
+            auto const is_readable = pos + n <= chunk.n_read;
+
+            if (chunk.is_hole)
+            {
+                finishPiece(piece, getZeroesHash(zeroes_hashes, piece_size));
+            }
+            else if (piecePos == 0 && n == piece_size)
+            {
+                /* the whole piece is here, so hash it along with the others that are */
+                if (is_readable)
+                {
+                    batch_data.push_back(std::data(chunk.buf) + pos);
+                    batch_lengths.push_back(n);
+                    batch_pieces.push_back(piece);
+                }
+                else
+                {
+                    finishPiece(piece, {});
+                }
+            }
+            else
+            {
+                /* the piece is split between chunks, so hash this part of it now */
+                if (is_readable)
+                {
+                    tr_sha1_update(sha, std::data(chunk.buf) + pos, n);
+                }
+
+                pieceIsReadable &= is_readable;
+
+                /* if we're finishing a piece... */
+                if (piecePos + n == piece_size)
+                {
+                    auto hash = tr_sha1_final(sha);
+                    sha = tr_sha1_init();
+                    finishPiece(piece, pieceIsReadable ? hash : std::nullopt);
+                    pieceIsReadable = true;
+                }
+            }
+
+            pos += n;
+            piecePos += n;
+
+            if (piecePos == piece_size)
+            {
+                ++piece;
+                piecePos = 0;
+            }
+        }
+
+        if (!std::empty(batch_pieces))
+        {
+            batch_hashes.resize(std::size(batch_pieces));
+            tr_sha1_many(std::data(batch_data), std::data(batch_lengths), std::size(batch_pieces), std::data(batch_hashes));
+
+            for (size_t i = 0; i < std::size(batch_pieces); ++i)
+            {
+                finishPiece(batch_pieces[i], batch_hashes[i]);
+            }
+        }
+
+        /* give the chunk back to the reader */
+        lock.lock();
+        reader.next_hash = (reader.next_hash + 1) % std::size(reader.chunks);
+        --reader.n_filled;
+        reader.cv.notify_all();
+    }
+
+    /* wait for the reader to finish, since it's using our chunks */
+    {
+        auto lock = std::unique_lock(reader.mutex);
+        reader.quit = true;
+        reader.cv.notify_all();
+        reader.cv.wait(lock, [&reader]() { return reader.is_done; });
+    }
+
     tor->verify_progress.reset();
     tr_sha1_final(sha);
 
@@ -159,6 +493,9 @@ static bool verifyTorrent(tr_torrent* tor, bool* stopFlag)
 ****
 ***/
 
+namespace
+{
+
 struct verify_node
 {
     tr_torrent* torrent;
@@ -166,6 +503,9 @@ struct verify_node
     void* callback_data;
     uint64_t current_size;
 
+    /* the disk that the torrent's on. Only one torrent per disk is verified at a time */
+    uint64_t device;
+
     int compare(verify_node const& that) const
     {
         // higher priority comes before lower priority
@@ -197,50 +537,112 @@ struct verify_node
     }
 };
 
-static struct verify_node currentNode;
-// TODO: refactor s.t. this doesn't leak
+/* a torrent that's being verified right now */
+struct active_verify
+{
+    tr_torrent* torrent;
+    uint64_t device;
+    std::atomic<bool> stop;
+};
+
+} // namespace
+
+// TODO: refactor s.t. these don't leak
 static auto& verify_list{ *new std::set<verify_node>{} };
-static tr_thread* verify_thread = nullptr;
-static bool stopCurrent = false;
+static auto& active_list{ *new std::list<active_verify>{} };
+
+static size_t n_verify_threads = 0;
+static size_t max_verify_threads = 1;
+static uint64_t verify_speed_limit = 0;
 
 static std::mutex verify_mutex_;
 
+// signalled when a torrent is done being verified
+static std::condition_variable verify_done_cv_;
+
+static uint64_t getDevice(tr_torrent const* tor)
+{
+    char* filename = tr_torrentFindFile(tor, 0);
+    auto const path = filename != nullptr ? std::string{ filename } : std::string{ tor->currentDir().sv() };
+    tr_free(filename);
+
+    return tr_diskIoGetDevice(path.c_str());
+}
+
+/* the first queued torrent whose disk isn't already busy being verified */
+static std::set<verify_node>::iterator findStartable()
+{
+    return std::find_if(
+        std::begin(verify_list),
+        std::end(verify_list),
+        [](auto const& node)
+        {
+            return std::none_of(
+                std::begin(active_list),
+                std::end(active_list),
+                [&node](auto const& active) { return active.device == node.device; });
+        });
+}
+
+static void verifyThreadFunc(void* /*user_data*/);
+
+/* call with verify_mutex_ locked */
+static void maybeStartThread()
+{
+    if (n_verify_threads < max_verify_threads && findStartable() != std::end(verify_list))
+    {
+        ++n_verify_threads;
+        tr_threadNew(verifyThreadFunc, nullptr);
+    }
+}
+
 static void verifyThreadFunc(void* /*user_data*/)
 {
     for (;;)
     {
+        auto lock = std::unique_lock(verify_mutex_);
+
+        auto const it = n_verify_threads > max_verify_threads ? std::end(verify_list) : findStartable();
+        if (it == std::end(verify_list))
         {
-            auto const lock = std::lock_guard(verify_mutex_);
+            --n_verify_threads;
+            return;
+        }
 
-            stopCurrent = false;
-            if (std::empty(verify_list))
-            {
-                currentNode.torrent = nullptr;
-                verify_thread = nullptr;
-                return;
-            }
+        auto const node = *it;
+        verify_list.erase(it);
+        auto& active = active_list.emplace_back();
+        active.torrent = node.torrent;
+        active.device = node.device;
+        active.stop = false;
+        auto const speed_limit = verify_speed_limit;
 
-            auto const it = std::begin(verify_list);
-            currentNode = *it;
-            verify_list.erase(it);
-        }
+        // another disk may have something waiting too
+        maybeStartThread();
+        lock.unlock();
 
-        tr_torrent* tor = currentNode.torrent;
+        tr_torrent* tor = node.torrent;
         tr_logAddTorInfo(tor, "%s", _("Verifying torrent"));
         tor->setVerifyState(TR_VERIFY_NOW);
-        auto const changed = verifyTorrent(tor, &stopCurrent);
+        auto const changed = verifyTorrent(tor, node.device, &active.stop, speed_limit);
         tor->setVerifyState(TR_VERIFY_NONE);
         TR_ASSERT(tr_isTorrent(tor));
 
-        if (!stopCurrent && changed)
+        bool const stopped = active.stop;
+
+        if (!stopped && changed)
         {
             tor->setDirty();
         }
 
-        if (currentNode.callback_func != nullptr)
+        if (node.callback_func != nullptr)
         {
-            (*currentNode.callback_func)(tor, stopCurrent, currentNode.callback_data);
+            (*node.callback_func)(tor, stopped, node.callback_data);
         }
+
+        lock.lock();
+        active_list.remove_if([&active](auto const& a) { return &a == &active; });
+        verify_done_cv_.notify_all();
     }
 }
 
@@ -254,33 +656,39 @@ void tr_verifyAdd(tr_torrent* tor, tr_verify_done_func callback_func, void* call
     node.callback_func = callback_func;
     node.callback_data = callback_data;
     node.current_size = tor->hasTotal();
+    node.device = getDevice(tor);
 
     auto const lock = std::lock_guard(verify_mutex_);
     tor->setVerifyState(TR_VERIFY_WAIT);
     verify_list.insert(node);
-
-    if (verify_thread == nullptr)
-    {
-        verify_thread = tr_threadNew(verifyThreadFunc, nullptr);
-    }
+    maybeStartThread();
 }
 
 void tr_verifyRemove(tr_torrent* tor)
 {
     TR_ASSERT(tr_isTorrent(tor));
 
-    verify_mutex_.lock();
+    auto lock = std::unique_lock(verify_mutex_);
 
-    if (tor == currentNode.torrent)
+    auto const is_active = [tor]()
     {
-        stopCurrent = true;
+        return std::any_of(
+            std::begin(active_list),
+            std::end(active_list),
+            [tor](auto const& active) { return active.torrent == tor; });
+    };
 
-        while (stopCurrent)
+    if (is_active())
+    {
+        for (auto& active : active_list)
         {
-            verify_mutex_.unlock();
-            tr_wait_msec(100);
-            verify_mutex_.lock();
+            if (active.torrent == tor)
+            {
+                active.stop = true;
+            }
         }
+
+        verify_done_cv_.wait(lock, [&is_active]() { return !is_active(); });
     }
     else
     {
@@ -301,14 +709,45 @@ void tr_verifyRemove(tr_torrent* tor)
             verify_list.erase(it);
         }
     }
-
-    verify_mutex_.unlock();
 }
 
 void tr_verifyClose(tr_session* /*session*/)
 {
     auto const lock = std::lock_guard(verify_mutex_);
 
-    stopCurrent = true;
+    for (auto& active : active_list)
+    {
+        active.stop = true;
+    }
+
     verify_list.clear();
 }
+
+void tr_verifySetThreadCount(size_t n)
+{
+    auto const lock = std::lock_guard(verify_mutex_);
+
+    max_verify_threads = std::max(n, size_t{ 1 });
+    maybeStartThread();
+}
+
+size_t tr_verifyGetThreadCount()
+{
+    auto const lock = std::lock_guard(verify_mutex_);
+
+    return max_verify_threads;
+}
+
+void tr_verifySetSpeedLimit(uint64_t bytes_per_second)
+{
+    auto const lock = std::lock_guard(verify_mutex_);
+
+    verify_speed_limit = bytes_per_second;
+}
+
+uint64_t tr_verifyGetSpeedLimit()
+{
+    auto const lock = std::lock_guard(verify_mutex_);
+
+    return verify_speed_limit;
+}
@@ -12,6 +12,9 @@
 #error only libtransmission should #include this header.
 #endif
 
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+
 /**
  * @addtogroup file_io File IO
  * @{
@@ -23,4 +26,19 @@ void tr_verifyRemove(tr_torrent* tor);
 
 void tr_verifyClose(tr_session*);
 
+/**
+ * @brief Set how many torrents can be verified at once.
+ *
+ * Torrents on the same disk are always verified one at a time,
+ * so this only matters when they're spread across disks.
+ */
+void tr_verifySetThreadCount(size_t n);
+
+size_t tr_verifyGetThreadCount();
+
+/** @brief Limit how fast each torrent is read while it's being verified. 0 means no limit */
+void tr_verifySetSpeedLimit(uint64_t bytes_per_second);
+
+uint64_t tr_verifyGetSpeedLimit();
+
 /* @} */
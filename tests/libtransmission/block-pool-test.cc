@@ -0,0 +1,96 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+
+#include "block-pool.h"
+
+#include "gtest/gtest.h"
+
+using BlockPoolTest = ::testing::Test;
+
+TEST_F(BlockPoolTest, blocksAreDistinctAndGoBack)
+{
+    auto constexpr N = size_t{ 300 };
+    auto const before = tr_blockPoolGetStats();
+
+    auto blocks = std::vector<uint8_t*>{};
+    for (size_t i = 0; i < N; ++i)
+    {
+        auto* const block = static_cast<uint8_t*>(tr_blockPoolAlloc());
+        ASSERT_NE(nullptr, block);
+        std::memset(block, int(i), TR_BLOCK_POOL_BLOCK_SIZE);
+        blocks.push_back(block);
+    }
+
+    // none of them overlap
+    auto sorted = blocks;
+    std::sort(std::begin(sorted), std::end(sorted));
+    for (size_t i = 1; i < N; ++i)
+    {
+        EXPECT_LE(sorted[i - 1] + TR_BLOCK_POOL_BLOCK_SIZE, sorted[i]);
+    }
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        auto const* const block = blocks[i];
+        EXPECT_TRUE(std::all_of(block, block + TR_BLOCK_POOL_BLOCK_SIZE, [i](auto ch) { return ch == uint8_t(i); }));
+    }
+
+    auto const busy = tr_blockPoolGetStats();
+    EXPECT_EQ(before.n_used_bytes + N * TR_BLOCK_POOL_BLOCK_SIZE, busy.n_used_bytes);
+    EXPECT_LE(busy.n_used_bytes, busy.n_bytes);
+
+    for (auto* const block : blocks)
+    {
+        tr_blockPoolFree(block);
+    }
+
+    // the slabs that emptied out were given back, except for one that's kept for reuse
+    auto const after = tr_blockPoolGetStats();
+    EXPECT_EQ(before.n_used_bytes, after.n_used_bytes);
+    EXPECT_LT(after.n_bytes, busy.n_bytes);
+}
+
+TEST_F(BlockPoolTest, evbufferGivesBlocksBack)
+{
+    auto const before = tr_blockPoolGetStats();
+
+    auto* const buf = evbuffer_new();
+    auto expected = std::vector<uint8_t>{};
+    for (int i = 0; i < 3; ++i)
+    {
+        auto constexpr Len = size_t{ 1000 };
+        auto* const block = static_cast<uint8_t*>(tr_blockPoolAlloc());
+        std::memset(block, 'a' + i, Len);
+        expected.insert(std::end(expected), block, block + Len);
+        tr_blockPoolAddToEvbuffer(buf, block, Len);
+    }
+
+    // the evbuffer refers to the blocks instead of copying them
+    EXPECT_EQ(before.n_used_bytes + 3 * TR_BLOCK_POOL_BLOCK_SIZE, tr_blockPoolGetStats().n_used_bytes);
+    EXPECT_EQ(std::size(expected), evbuffer_get_length(buf));
+
+    auto contents = std::vector<uint8_t>(std::size(expected));
+    evbuffer_copyout(buf, std::data(contents), std::size(contents));
+    EXPECT_EQ(expected, contents);
+
+    // once it's done with a block, the block goes back to the pool
+    evbuffer_drain(buf, 1000);
+    EXPECT_EQ(before.n_used_bytes + 2 * TR_BLOCK_POOL_BLOCK_SIZE, tr_blockPoolGetStats().n_used_bytes);
+
+    evbuffer_free(buf);
+    EXPECT_EQ(before.n_used_bytes, tr_blockPoolGetStats().n_used_bytes);
+}
@@ -0,0 +1,1036 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h> // socketpair()
+#include <unistd.h> // close(), read()
+#endif
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+
+#include "block-pool.h"
+#include "cache.h"
+#include "crypto-utils.h"
+#include "disk-io.h"
+#include "fdlimit.h"
+#include "inout.h"
+#include "peer-common.h" // MAX_BLOCK_SIZE
+#include "platform.h" // tr_getAvailableMemory()
+#include "session.h"
+#include "torrent.h"
+#include "trevent.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class CacheTest : public SessionTest
+{
+protected:
+    // create a torrent made of one file per entry in `file_sizes`,
+    // whose piece hashes match the blocks from blockContents()
+    tr_torrent* createTorrent(uint32_t piece_size, std::vector<uint64_t> const& file_sizes)
+    {
+        auto const total_size = std::accumulate(std::begin(file_sizes), std::end(file_sizes), uint64_t{});
+        auto const n_pieces = (total_size + piece_size - 1) / piece_size;
+
+        auto const block_size = tr_block_info::bestBlockSize(piece_size);
+        auto pieces = std::string{};
+        auto piece_data = std::vector<uint8_t>{};
+        for (uint64_t begin = 0; begin < total_size; begin += piece_size)
+        {
+            piece_data.resize(std::min(uint64_t{ piece_size }, total_size - begin));
+            for (size_t i = 0; i < std::size(piece_data); ++i)
+            {
+                auto const offset = begin + i;
+                piece_data[i] = uint8_t(offset / block_size * 31 + offset % block_size);
+            }
+
+            auto const digest = tr_sha1(piece_data);
+            pieces.append(reinterpret_cast<char const*>(std::data(*digest)), std::size(*digest));
+        }
+
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 1);
+        auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        tr_variantDictAddStrView(info, TR_KEY_name, "cache-test"sv);
+        tr_variantDictAddInt(info, TR_KEY_piece_length, piece_size);
+        EXPECT_EQ(n_pieces * SHA_DIGEST_LENGTH, std::size(pieces));
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+        auto* const files = tr_variantDictAddList(info, TR_KEY_files, std::size(file_sizes));
+        for (size_t i = 0; i < std::size(file_sizes); ++i)
+        {
+            auto* const file = tr_variantListAddDict(files, 2);
+            tr_variantDictAddInt(file, TR_KEY_length, file_sizes[i]);
+            tr_variantListAddStr(tr_variantDictAddList(file, TR_KEY_path, 1), "file-" + std::to_string(i));
+        }
+
+        auto const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC);
+        tr_variantFree(&top);
+
+        auto* const ctor = tr_ctorNew(session_);
+        tr_error* error = nullptr;
+        EXPECT_TRUE(tr_ctorSetMetainfo(ctor, std::data(benc), std::size(benc), &error));
+        EXPECT_EQ(nullptr, error);
+        tr_ctorSetPaused(ctor, TR_FORCE, true);
+        auto* const tor = tr_torrentNew(ctor, nullptr);
+        EXPECT_NE(nullptr, tor);
+        tr_ctorFree(ctor);
+        return tor;
+    }
+
+    void runInEventThread(std::function<void()> func)
+    {
+        struct Data
+        {
+            std::function<void()> func;
+            std::atomic<bool> done = false;
+        };
+
+        auto data = Data{};
+        data.func = std::move(func);
+        tr_runInEventThread(
+            session_,
+            [](void* vdata)
+            {
+                auto* d = static_cast<Data*>(vdata);
+                d->func();
+                d->done = true;
+            },
+            &data);
+        EXPECT_TRUE(waitFor([&data]() { return data.done.load(); }, 20000));
+    }
+
+    struct BlockLocation
+    {
+        tr_piece_index_t piece;
+        uint32_t piece_offset;
+    };
+
+    static BlockLocation blockLoc(tr_torrent const* tor, tr_block_index_t block)
+    {
+        auto const& info = tor->blockInfo();
+        auto const offset = uint64_t{ block } * info.blockSize();
+        auto const piece = info.pieceOf(offset);
+        return { piece, uint32_t(offset - piece * info.pieceSize()) };
+    }
+
+    static std::vector<uint8_t> blockContents(tr_torrent const* tor, tr_block_index_t block)
+    {
+        auto buf = std::vector<uint8_t>(tor->blockSize(block));
+        for (size_t i = 0; i < std::size(buf); ++i)
+        {
+            buf[i] = uint8_t(block * 31 + i);
+        }
+
+        return buf;
+    }
+
+    static int writeBlock(tr_cache* cache, tr_torrent* tor, tr_block_index_t block)
+    {
+        auto const loc = blockLoc(tor, block);
+        auto const contents = blockContents(tor, block);
+        auto* const buf = evbuffer_new();
+        evbuffer_add(buf, std::data(contents), std::size(contents));
+        auto const err = tr_cacheWriteBlock(cache, tor, loc.piece, loc.piece_offset, std::size(contents), buf);
+        evbuffer_free(buf);
+        return err;
+    }
+
+    static bool blockIsCorrect(tr_cache* cache, tr_torrent* tor, tr_block_index_t block)
+    {
+        auto const loc = blockLoc(tor, block);
+        auto buf = std::vector<uint8_t>(tor->blockSize(block));
+        return tr_cacheReadBlock(cache, tor, loc.piece, loc.piece_offset, std::size(buf), std::data(buf)) == 0 &&
+            buf == blockContents(tor, block);
+    }
+
+    static bool blockIsCorrectOnDisk(tr_torrent* tor, tr_block_index_t block)
+    {
+        auto const loc = blockLoc(tor, block);
+        auto buf = std::vector<uint8_t>(tor->blockSize(block));
+        return tr_ioRead(tor, loc.piece, loc.piece_offset, std::size(buf), std::data(buf)) == 0 &&
+            buf == blockContents(tor, block);
+    }
+
+    // write every block to disk and mark all the pieces as complete
+    void makeSeed(tr_torrent* tor)
+    {
+        runInEventThread(
+            [this, tor]()
+            {
+                for (tr_block_index_t block = 0; block < tor->blockCount(); ++block)
+                {
+                    EXPECT_EQ(0, writeBlock(session_->cache, tor, block));
+                }
+
+                EXPECT_EQ(0, tr_cacheFlushTorrent(session_->cache, tor));
+
+                for (tr_piece_index_t piece = 0; piece < tor->pieceCount(); ++piece)
+                {
+                    tor->setHasPiece(piece, true);
+                }
+            });
+    }
+
+    static bool pieceIsCached(tr_cache* cache, tr_torrent* tor, tr_piece_index_t piece)
+    {
+        return tr_cacheHasBlock(cache, tor, piece, 0, 1);
+    }
+
+    static uint64_t readCacheHits(tr_cache const* cache)
+    {
+        auto hits = uint64_t{};
+        auto misses = uint64_t{};
+        tr_cacheGetReadStats(cache, &hits, &misses);
+        return hits;
+    }
+
+    static uint64_t readCacheMisses(tr_cache const* cache)
+    {
+        auto hits = uint64_t{};
+        auto misses = uint64_t{};
+        tr_cacheGetReadStats(cache, &hits, &misses);
+        return misses;
+    }
+
+    std::vector<tr_block_index_t> shuffledBlocks(tr_block_index_t n_blocks)
+    {
+        auto blocks = std::vector<tr_block_index_t>(n_blocks);
+        std::iota(std::begin(blocks), std::end(blocks), 0);
+        std::shuffle(std::begin(blocks), std::end(blocks), std::mt19937{ 42 });
+        return blocks;
+    }
+};
+
+TEST_F(CacheTest, readsBlocksBeforeAndAfterFlushing)
+{
+    auto* const tor = createTorrent(4096, { 50000, 30000 });
+    auto const n_blocks = tor->blockCount();
+    auto const blocks = shuffledBlocks(n_blocks);
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+
+            for (auto const block : blocks)
+            {
+                EXPECT_EQ(0, writeBlock(cache, tor, block));
+            }
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                auto const loc = blockLoc(tor, block);
+                EXPECT_TRUE(tr_cacheHasBlock(cache, tor, loc.piece, loc.piece_offset, 1));
+                EXPECT_TRUE(blockIsCorrect(cache, tor, block));
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_TRUE(blockIsCorrectOnDisk(tor, block));
+            }
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, adoptsPoolBlocks)
+{
+    auto* const tor = createTorrent(16384, { 40000 });
+    auto const n_blocks = tor->blockCount();
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            auto const before = tr_blockPoolGetStats().n_used_bytes;
+
+            // a block that's written twice keeps only the newer data
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                for (tr_block_index_t block = 0; block < n_blocks; ++block)
+                {
+                    auto const loc = blockLoc(tor, block);
+                    auto const contents = blockContents(tor, block);
+                    auto* const data = static_cast<uint8_t*>(tr_blockPoolAlloc());
+                    std::copy(std::begin(contents), std::end(contents), data);
+                    EXPECT_EQ(0, tr_cacheAdoptBlock(cache, tor, loc.piece, loc.piece_offset, std::size(contents), data));
+                }
+            }
+
+            // the cache holds on to the blocks themselves instead of copies of them
+            EXPECT_EQ(before + n_blocks * TR_BLOCK_POOL_BLOCK_SIZE, tr_blockPoolGetStats().n_used_bytes);
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_TRUE(blockIsCorrect(cache, tor, block));
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            tr_diskIoWaitIdle(session_->diskIo);
+            EXPECT_EQ(before, tr_blockPoolGetStats().n_used_bytes);
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_TRUE(blockIsCorrectOnDisk(tor, block));
+            }
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, readsAndWritesWithDirectIo)
+{
+    tr_sessionSetDirectIoEnabled(session_, true);
+    EXPECT_TRUE(tr_sessionIsDirectIoEnabled(session_));
+
+    // files whose boundaries aren't sector-aligned
+    auto const file_sizes = std::vector<uint64_t>{ 50001, 30001 };
+    auto* const tor = createTorrent(16384, file_sizes);
+    auto const n_blocks = tor->blockCount();
+    auto const blocks = shuffledBlocks(n_blocks);
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+
+            for (auto const block : blocks)
+            {
+                EXPECT_EQ(0, writeBlock(cache, tor, block));
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            tr_diskIoWaitIdle(session_->diskIo);
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_TRUE(blockIsCorrectOnDisk(tor, block));
+            }
+        });
+
+    for (tr_file_index_t i = 0; i < std::size(file_sizes); ++i)
+    {
+        auto* const path = tr_torrentFindFile(tor, i);
+        EXPECT_NE(nullptr, path);
+        auto info = tr_sys_path_info{};
+        EXPECT_TRUE(tr_sys_path_get_info(path, 0, &info, nullptr));
+        EXPECT_EQ(file_sizes[i], info.size);
+        tr_free(path);
+    }
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+#ifndef _WIN32
+
+TEST_F(CacheTest, blocksCanBeSentFromTheirFiles)
+{
+    // files whose boundaries are in the middle of blocks
+    auto* const tor = createTorrent(16384, { 50001, 30001 });
+    auto const n_blocks = tor->blockCount();
+    makeSeed(tor);
+
+    auto fds = std::array<int, 2>{};
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, std::data(fds)));
+
+    runInEventThread(
+        [&]()
+        {
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                auto const loc = blockLoc(tor, block);
+                auto const expected = blockContents(tor, block);
+                auto* const buf = evbuffer_new();
+                EXPECT_EQ(0, tr_ioAddFileSegments(tor, loc.piece, loc.piece_offset, std::size(expected), buf));
+                EXPECT_EQ(std::size(expected), evbuffer_get_length(buf));
+
+                // the segments are sent with sendfile(), so read them back from the other end
+                auto contents = std::vector<uint8_t>{};
+                while (evbuffer_get_length(buf) != 0 || std::size(contents) < std::size(expected))
+                {
+                    if (evbuffer_get_length(buf) != 0)
+                    {
+                        ASSERT_LT(0, evbuffer_write(buf, fds[0]));
+                    }
+
+                    auto chunk = std::array<uint8_t, 4096>{};
+                    auto const n = read(fds[1], std::data(chunk), std::size(chunk));
+                    ASSERT_LT(0, n);
+                    contents.insert(std::end(contents), std::begin(chunk), std::begin(chunk) + n);
+                }
+
+                EXPECT_EQ(expected, contents);
+                evbuffer_free(buf);
+            }
+
+            // the buffers' descriptors are kept within the open file limit
+            tr_sessionSetOpenFileLimit(session_, 1);
+            auto* const held = evbuffer_new();
+            auto* const copied = evbuffer_new();
+            EXPECT_EQ(0, tr_ioAddFileSegments(tor, 0, 0, tor->blockSize(0), held));
+            EXPECT_EQ(ENOTSUP, tr_ioAddFileSegments(tor, 0, 0, tor->blockSize(0), copied));
+            EXPECT_EQ(0U, evbuffer_get_length(copied));
+            evbuffer_free(held);
+            EXPECT_EQ(0, tr_ioAddFileSegments(tor, 0, 0, tor->blockSize(0), copied));
+            evbuffer_free(copied);
+
+            // files that bypass the page cache that sendfile() reads from aren't sent that way,
+            // but not every filesystem lets them be opened like that
+            tr_sessionSetDirectIoEnabled(session_, true);
+            auto* const buf = evbuffer_new();
+            auto const err = tr_ioAddFileSegments(tor, 0, 0, tor->blockSize(0), buf);
+            if (tr_fdFileIsDirect(session_, tr_torrentId(tor), 0))
+            {
+                EXPECT_EQ(ENOTSUP, err);
+                EXPECT_EQ(0U, evbuffer_get_length(buf));
+            }
+            else
+            {
+                EXPECT_EQ(0, err);
+            }
+
+            evbuffer_free(buf);
+        });
+
+    close(fds[0]);
+    close(fds[1]);
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+#endif
+
+TEST_F(CacheTest, trimsWhenFull)
+{
+    auto* const tor = createTorrent(4096, { 200000 });
+    auto const n_blocks = tor->blockCount();
+    auto const blocks = shuffledBlocks(n_blocks);
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            auto const old_limit = tr_cacheGetLimit(cache);
+
+            // only room for 8 blocks, so most of them get flushed while they're being written
+            tr_cacheSetLimit(cache, 8 * MAX_BLOCK_SIZE);
+
+            for (auto const block : blocks)
+            {
+                EXPECT_EQ(0, writeBlock(cache, tor, block));
+                EXPECT_TRUE(blockIsCorrect(cache, tor, block));
+            }
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_TRUE(blockIsCorrect(cache, tor, block));
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            tr_cacheSetLimit(cache, old_limit);
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_TRUE(blockIsCorrectOnDisk(tor, block));
+            }
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, autoSizeFollowsDownloadRate)
+{
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            auto const old_limit = tr_cacheGetLimit(cache);
+            auto constexpr Floor = int64_t{ 1024 * 1024 };
+            auto constexpr Rate = uint64_t{ 8 * 1024 * 1024 };
+
+            tr_cacheSetLimit(cache, Floor);
+            EXPECT_EQ(0, tr_cacheSetAutoSize(cache, true));
+            EXPECT_TRUE(tr_cacheIsAutoSize(cache));
+            EXPECT_EQ(Floor, tr_cacheGetCurrentLimit(cache));
+
+            // it grows right away, if there's the memory for it
+            EXPECT_EQ(0, tr_cacheUpkeep(cache, Rate));
+            auto const grown = tr_cacheGetCurrentLimit(cache);
+            EXPECT_GE(grown, Floor);
+            if (tr_getAvailableMemory() > 64 * Rate)
+            {
+                EXPECT_GT(grown, int64_t(Rate));
+            }
+
+            // ...but it shrinks slowly, and never below the limit that was set
+            EXPECT_EQ(0, tr_cacheUpkeep(cache, 0));
+            auto const shrunk = tr_cacheGetCurrentLimit(cache);
+            EXPECT_LE(shrunk, grown);
+            EXPECT_GE(shrunk, Floor);
+            if (grown > Floor)
+            {
+                EXPECT_GT(shrunk, grown / 2);
+            }
+
+            EXPECT_EQ(Floor, tr_cacheGetLimit(cache));
+
+            EXPECT_EQ(0, tr_cacheSetAutoSize(cache, false));
+            EXPECT_EQ(Floor, tr_cacheGetCurrentLimit(cache));
+            tr_cacheSetLimit(cache, old_limit);
+        });
+}
+
+TEST_F(CacheTest, flushesDataThatsBeenDirtyTooLong)
+{
+    auto* const tor = createTorrent(4096, { 50000 });
+    auto const n_blocks = tor->blockCount();
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_EQ(0, writeBlock(cache, tor, block));
+            }
+
+            // it's all still new
+            EXPECT_EQ(0, tr_cacheUpkeep(cache, 0));
+            tr_diskIoWaitIdle(session_->diskIo);
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                auto const loc = blockLoc(tor, block);
+                EXPECT_TRUE(tr_cacheHasBlock(cache, tor, loc.piece, loc.piece_offset, tor->blockSize(block)));
+            }
+
+            // a minute later, it's been dirty for too long
+            tr_timeUpdate(tr_time() + 60);
+            EXPECT_EQ(0, tr_cacheUpkeep(cache, 0));
+            tr_diskIoWaitIdle(session_->diskIo);
+            tr_timeUpdate(time(nullptr));
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                auto const loc = blockLoc(tor, block);
+                EXPECT_FALSE(tr_cacheHasBlock(cache, tor, loc.piece, loc.piece_offset, tor->blockSize(block)));
+                EXPECT_TRUE(blockIsCorrectOnDisk(tor, block));
+            }
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, reportsWriteBacklog)
+{
+    auto* const tor = createTorrent(65536, { 4 * 1024 * 1024 });
+    auto const n_blocks = tor->blockCount();
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            auto const old_limit = tr_cacheGetLimit(cache);
+            EXPECT_FALSE(tr_cacheIsWriteBacklogged(cache));
+
+            // the finished writes can't be collected while this is running in the event thread,
+            // so the flushed blocks pile up as if the disk couldn't keep up
+            tr_cacheSetLimit(cache, 8 * MAX_BLOCK_SIZE);
+            auto backlogged = false;
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_EQ(0, writeBlock(cache, tor, block));
+                backlogged |= tr_cacheIsWriteBacklogged(cache);
+            }
+
+            EXPECT_TRUE(backlogged);
+
+            tr_diskIoWaitIdle(session_->diskIo);
+            EXPECT_FALSE(tr_cacheIsWriteBacklogged(cache));
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            tr_cacheSetLimit(cache, old_limit);
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, flushFile)
+{
+    // three files whose boundaries fall in the middle of blocks
+    auto* const tor = createTorrent(4096, { 10000, 10000, 10000 });
+    auto const n_blocks = tor->blockCount();
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_EQ(0, writeBlock(cache, tor, block));
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushFile(cache, tor, 1));
+
+            auto const [begin, end] = tr_torGetFileBlockSpan(tor, 1);
+            for (auto block = begin; block < end; ++block)
+            {
+                EXPECT_TRUE(blockIsCorrectOnDisk(tor, block));
+            }
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+
+            for (tr_block_index_t block = 0; block < n_blocks; ++block)
+            {
+                EXPECT_TRUE(blockIsCorrectOnDisk(tor, block));
+            }
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, piecesAreHashedAsTheyArrive)
+{
+    auto constexpr BlocksPerPiece = 4;
+    auto constexpr PieceSize = uint32_t{ BlocksPerPiece * MAX_BLOCK_SIZE };
+    auto* const tor = createTorrent(PieceSize, { 3 * PieceSize });
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+
+            // piece 0 arrives out of order, piece 1 in order,
+            // and piece 2 is missing its first block
+            for (tr_block_index_t const block : { 3, 1, 2, 0, 9, 10, 11, 4, 5, 6, 7 })
+            {
+                EXPECT_EQ(0, writeBlock(cache, tor, block));
+            }
+
+            // flushing the blocks to disk doesn't lose the pieces' hashes
+            EXPECT_EQ(0, tr_cacheFlushFile(cache, tor, 0));
+
+            // piece 2 can only be hashed up to where the blocks that were flushed begin
+            EXPECT_EQ(0, writeBlock(cache, tor, 8));
+
+            // scribble over piece 0 on disk. Its hash was computed from memory,
+            // so the first check passes; after that it has to be read from disk
+            auto const garbage = std::vector<uint8_t>(PieceSize, 0xFF);
+            EXPECT_EQ(0, tr_ioWrite(tor, 0, 0, PieceSize, std::data(garbage)));
+            EXPECT_TRUE(tr_ioTestPiece(tor, 0));
+            EXPECT_FALSE(tr_ioTestPiece(tor, 0));
+
+            EXPECT_TRUE(tr_ioTestPiece(tor, 1));
+            EXPECT_TRUE(tr_ioTestPiece(tor, 2));
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, readCacheReadsWholePieces)
+{
+    auto constexpr PieceSize = uint32_t{ 32768 };
+    auto* const tor = createTorrent(PieceSize, { 4 * PieceSize });
+    makeSeed(tor);
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            tr_cacheSetReadLimit(cache, 8 * PieceSize);
+            auto const hits = readCacheHits(cache);
+            auto const misses = readCacheMisses(cache);
+
+            // the first block of a piece is a miss that brings in the rest of the piece
+            EXPECT_FALSE(pieceIsCached(cache, tor, 1));
+            EXPECT_TRUE(blockIsCorrect(cache, tor, 2));
+            EXPECT_EQ(misses + 1, readCacheMisses(cache));
+            EXPECT_TRUE(pieceIsCached(cache, tor, 1));
+            EXPECT_TRUE(tr_cacheHasBlock(cache, tor, 1, MAX_BLOCK_SIZE, MAX_BLOCK_SIZE));
+
+            EXPECT_TRUE(blockIsCorrect(cache, tor, 3));
+            EXPECT_EQ(hits + 1, readCacheHits(cache));
+            EXPECT_EQ(misses + 1, readCacheMisses(cache));
+
+            // downloading a piece again makes its cached copy stale
+            EXPECT_EQ(0, writeBlock(cache, tor, 3));
+            EXPECT_FALSE(pieceIsCached(cache, tor, 1));
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            EXPECT_FALSE(pieceIsCached(cache, tor, 1));
+            tr_cacheSetReadLimit(cache, 0);
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(CacheTest, readCacheIsScanResistant)
+{
+    auto constexpr PieceSize = uint32_t{ 32768 };
+    auto constexpr NumPieces = tr_piece_index_t{ 16 };
+    auto* const tor = createTorrent(PieceSize, { NumPieces * PieceSize });
+    makeSeed(tor);
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            tr_cacheSetReadLimit(cache, 4 * PieceSize);
+
+            auto const read_piece = [&](tr_piece_index_t piece)
+            {
+                auto const block = tor->blockSpanForPiece(piece).begin;
+                EXPECT_TRUE(blockIsCorrect(cache, tor, block));
+            };
+
+            // read piece 0, let it fall out of the cache, and then read it again
+            for (tr_piece_index_t piece = 0; piece <= 4; ++piece)
+            {
+                read_piece(piece);
+            }
+
+            EXPECT_FALSE(pieceIsCached(cache, tor, 0));
+            read_piece(0);
+            EXPECT_TRUE(pieceIsCached(cache, tor, 0));
+
+            // now it's a hot piece, so a scan of all the others doesn't evict it
+            for (tr_piece_index_t piece = 5; piece < NumPieces; ++piece)
+            {
+                read_piece(piece);
+            }
+
+            EXPECT_TRUE(pieceIsCached(cache, tor, 0));
+            EXPECT_FALSE(pieceIsCached(cache, tor, 5));
+
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            tr_cacheSetReadLimit(cache, 0);
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+namespace
+{
+
+struct AsyncRead
+{
+    std::vector<uint8_t> buf;
+    int err = -1;
+    std::atomic<bool> done = false;
+};
+
+void onAsyncRead(tr_session* /*session*/, int err, void* vread)
+{
+    auto* read = static_cast<AsyncRead*>(vread);
+    read->err = err;
+    read->done = true;
+}
+
+} // namespace
+
+TEST_F(CacheTest, readCacheAsync)
+{
+    ASSERT_NE(nullptr, session_->diskIo);
+
+    auto constexpr PieceSize = uint32_t{ 32768 };
+    auto* const tor = createTorrent(PieceSize, { 4 * PieceSize });
+    makeSeed(tor);
+
+    // both blocks of piece 2 are wanted while the piece is loading,
+    // and a read for piece 3 is cancelled before it finishes
+    auto reads = std::array<AsyncRead, 3>{};
+    auto const blocks = std::array<tr_block_index_t, 3>{ 4, 5, 6 };
+    void const* const owner = &reads;
+    void const* const cancelled_owner = &reads[2];
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            tr_cacheSetReadLimit(cache, 8 * PieceSize);
+
+            for (size_t i = 0; i < std::size(reads); ++i)
+            {
+                auto const loc = blockLoc(tor, blocks[i]);
+                reads[i].buf.resize(tor->blockSize(blocks[i]));
+                EXPECT_EQ(
+                    0,
+                    tr_cacheReadBlockAsync(
+                        cache,
+                        tor,
+                        i == 2 ? cancelled_owner : owner,
+                        loc.piece,
+                        loc.piece_offset,
+                        std::size(reads[i].buf),
+                        std::data(reads[i].buf),
+                        onAsyncRead,
+                        &reads[i]));
+            }
+
+            tr_cacheCancel(cache, cancelled_owner);
+            EXPECT_TRUE(reads[2].done);
+            EXPECT_EQ(ECANCELED, reads[2].err);
+        });
+
+    EXPECT_TRUE(waitFor([&reads]() { return reads[0].done && reads[1].done; }, 5000));
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        EXPECT_EQ(0, reads[i].err);
+        EXPECT_EQ(blockContents(tor, blocks[i]), reads[i].buf);
+    }
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            EXPECT_TRUE(pieceIsCached(cache, tor, 2));
+            tr_diskIoWaitIdle(session_->diskIo);
+            EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+            tr_cacheSetReadLimit(cache, 0);
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+// Times how long it takes to fill a large cache in random order,
+// look up every block, and then flush it all to disk.
+TEST_F(CacheTest, DISABLED_benchmark)
+{
+    // small blocks keep the memory use down while still having as many
+    // blocks as a full 256 MiB cache of 16 KiB blocks
+    auto constexpr NumBlocks = uint64_t{ 16384 };
+    auto constexpr BlockSize = uint32_t{ 1024 };
+    auto* const tor = createTorrent(BlockSize, { NumBlocks * BlockSize });
+    auto const blocks = shuffledBlocks(NumBlocks);
+
+    runInEventThread(
+        [&]()
+        {
+            using clock = std::chrono::steady_clock;
+            auto* const cache = session_->cache;
+            auto const old_limit = tr_cacheGetLimit(cache);
+            tr_cacheSetLimit(cache, NumBlocks * MAX_BLOCK_SIZE);
+
+            auto const contents = std::vector<uint8_t>(BlockSize);
+            auto* const buf = evbuffer_new();
+
+            auto const start = clock::now();
+            for (auto const block : blocks)
+            {
+                auto const loc = blockLoc(tor, block);
+                evbuffer_add(buf, std::data(contents), std::size(contents));
+                tr_cacheWriteBlock(cache, tor, loc.piece, loc.piece_offset, BlockSize, buf);
+            }
+
+            auto const written = clock::now();
+            for (auto const block : blocks)
+            {
+                auto const loc = blockLoc(tor, block);
+                EXPECT_TRUE(tr_cacheHasBlock(cache, tor, loc.piece, loc.piece_offset, BlockSize));
+            }
+
+            auto const looked_up = clock::now();
+            tr_cacheSetLimit(cache, NumBlocks * MAX_BLOCK_SIZE / 2);
+            auto const trimmed = clock::now();
+            tr_cacheFlushTorrent(cache, tor);
+            auto const flushed = clock::now();
+
+            evbuffer_free(buf);
+            tr_cacheSetLimit(cache, old_limit);
+
+            auto const usec = [](auto duration)
+            {
+                return static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+            };
+            printf(
+                "%llu blocks: write %lld us, lookup %lld us, trim %lld us, flush %lld us\n",
+                static_cast<unsigned long long>(NumBlocks),
+                usec(written - start),
+                usec(looked_up - written),
+                usec(trimmed - looked_up),
+                usec(flushed - trimmed));
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+// How many bytes get copied to put a downloaded byte into the cache, comparing
+// the peers' route (straight into a pool block that the cache adopts) with the
+// evbuffer route that webseeds take and that peers used to take.
+TEST_F(CacheTest, DISABLED_receiveBenchmark)
+{
+    auto constexpr NumBlocks = uint64_t{ 2048 };
+    auto constexpr BlockSize = uint32_t{ MAX_BLOCK_SIZE };
+    auto constexpr HeaderSize = size_t{ 13 }; // a piece message's length, id, index, and offset
+    auto constexpr ReadSize = size_t{ 4096 }; // how much a socket read usually hands over
+    auto* const tor = createTorrent(BlockSize, { NumBlocks * BlockSize });
+
+    // the piece messages, as they'd come off the wire
+    auto const stream = std::vector<uint8_t>(NumBlocks * (HeaderSize + BlockSize), 'x');
+    auto const* const stream_begin = std::data(stream);
+    auto const* const stream_end = stream_begin + std::size(stream);
+
+    // count the bytes in `buf` that aren't references to the stream
+    auto const countCopiedBytes = [stream_begin, stream_end](evbuffer* buf)
+    {
+        auto iov = std::vector<evbuffer_iovec>(evbuffer_peek(buf, -1, nullptr, nullptr, 0));
+        evbuffer_peek(buf, -1, nullptr, std::data(iov), std::size(iov));
+
+        auto n = uint64_t{};
+        for (auto const& vec : iov)
+        {
+            auto const* const base = static_cast<uint8_t const*>(vec.iov_base);
+            n += base >= stream_begin && base < stream_end ? 0 : vec.iov_len;
+        }
+
+        return n;
+    };
+
+    // returns the bytes copied per downloaded byte and how long it took
+    auto const receive = [&](bool adopt)
+    {
+        auto* const cache = session_->cache;
+        auto* const in = evbuffer_new();
+        auto* const incoming = evbuffer_new();
+        auto fed = size_t{};
+        auto copied = uint64_t{};
+
+        auto const feed = [&]()
+        {
+            auto const n = std::min(ReadSize, std::size(stream) - fed);
+            evbuffer_add_reference(in, stream_begin + fed, n, nullptr, nullptr);
+            fed += n;
+        };
+
+        auto const start = std::chrono::steady_clock::now();
+        for (tr_block_index_t block = 0; block < NumBlocks; ++block)
+        {
+            while (evbuffer_get_length(in) < HeaderSize)
+            {
+                feed();
+            }
+
+            auto header = std::array<uint8_t, HeaderSize>{};
+            evbuffer_remove(in, std::data(header), std::size(header));
+
+            auto* const data = adopt ? static_cast<uint8_t*>(tr_blockPoolAlloc()) : nullptr;
+            for (uint32_t got = 0; got < BlockSize;)
+            {
+                if (evbuffer_get_length(in) == 0)
+                {
+                    feed();
+                }
+
+                auto const n = std::min(size_t{ BlockSize - got }, evbuffer_get_length(in));
+                if (adopt)
+                {
+                    evbuffer_remove(in, data + got, n);
+                    copied += n;
+                }
+                else
+                {
+                    evbuffer_remove_buffer(in, incoming, n);
+                }
+
+                got += n;
+            }
+
+            auto const loc = blockLoc(tor, block);
+            if (adopt)
+            {
+                tr_cacheAdoptBlock(cache, tor, loc.piece, loc.piece_offset, BlockSize, data);
+            }
+            else
+            {
+                copied += countCopiedBytes(incoming) + BlockSize;
+                tr_cacheWriteBlock(cache, tor, loc.piece, loc.piece_offset, BlockSize, incoming);
+            }
+        }
+
+        auto const elapsed = std::chrono::steady_clock::now() - start;
+        evbuffer_free(incoming);
+        evbuffer_free(in);
+        EXPECT_EQ(0, tr_cacheFlushTorrent(cache, tor));
+        tr_diskIoWaitIdle(session_->diskIo);
+
+        auto const usec = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        return std::make_pair(double(copied) / (NumBlocks * BlockSize), static_cast<long long>(usec));
+    };
+
+    runInEventThread(
+        [&]()
+        {
+            auto* const cache = session_->cache;
+            auto const old_limit = tr_cacheGetLimit(cache);
+            tr_cacheSetLimit(cache, NumBlocks * MAX_BLOCK_SIZE);
+
+            auto const [evbuffer_copies, evbuffer_usec] = receive(false);
+            auto const [block_copies, block_usec] = receive(true);
+
+            tr_cacheSetLimit(cache, old_limit);
+
+            printf(
+                "%llu blocks: evbuffer route %.3f bytes copied per byte in %lld us, pool block route %.3f in %lld us\n",
+                static_cast<unsigned long long>(NumBlocks),
+                evbuffer_copies,
+                evbuffer_usec,
+                block_copies,
+                block_usec);
+            EXPECT_LT(block_copies, evbuffer_copies);
+        });
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+} // namespace test
+
+} // namespace libtransmission
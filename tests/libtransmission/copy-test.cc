@@ -7,6 +7,7 @@
  */
 
 #include <algorithm>
+#include <string_view>
 
 #include "transmission.h"
 #include "error.h"
@@ -36,10 +37,13 @@ protected:
         auto const path2 = tr_strvPath(sandboxDir(), filename2);
 
         tr_error* err = nullptr;
+        auto method = tr_sys_path_copy_method_t{};
         /* Copy it. */
-        EXPECT_TRUE(tr_sys_path_copy(path1.c_str(), path2.c_str(), &err));
+        EXPECT_TRUE(tr_sys_path_copy(path1.c_str(), path2.c_str(), &method, &err));
         EXPECT_EQ(nullptr, err);
         tr_error_clear(&err);
+        EXPECT_TRUE(
+            method == TR_SYS_PATH_COPY_CLONE || method == TR_SYS_PATH_COPY_IN_KERNEL || method == TR_SYS_PATH_COPY_CHUNKED);
 
         EXPECT_TRUE(filesAreIdentical(path1.c_str(), path2.c_str()));
 
@@ -48,7 +52,7 @@ protected:
         tr_sys_path_remove(path2.c_str(), nullptr);
     }
 
-private:
+protected:
     uint64_t fillBufferFromFd(tr_sys_file_t fd, uint64_t bytes_remaining, char* buf, size_t buf_len)
     {
         memset(buf, 0, buf_len);
@@ -128,6 +132,74 @@ TEST_F(CopyTest, copy)
     testImpl(filename1, filename2, random_file_length);
 }
 
+TEST_F(CopyTest, clone)
+{
+    auto const path1 = tr_strvPath(sandboxDir(), "orig-blob.txt");
+    auto const path2 = tr_strvPath(sandboxDir(), "clone-blob.txt");
+    auto constexpr Contents = std::string_view{ "hello, world!" };
+    createFileWithContents(path1, std::data(Contents), std::size(Contents));
+
+    auto const in = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ, 0, nullptr);
+    auto const out = tr_sys_file_open(path2.c_str(), TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+    EXPECT_NE(TR_BAD_SYS_FILE, in);
+    EXPECT_NE(TR_BAD_SYS_FILE, out);
+
+    /* Not every filesystem can share extents, but it should say so if it can't. */
+    tr_error* err = nullptr;
+    if (tr_sys_file_clone(in, out, &err))
+    {
+        EXPECT_EQ(nullptr, err);
+        tr_sys_file_close(out, nullptr);
+        EXPECT_TRUE(filesAreIdentical(path1.c_str(), path2.c_str()));
+    }
+    else
+    {
+        EXPECT_NE(nullptr, err);
+        tr_error_clear(&err);
+        tr_sys_file_close(out, nullptr);
+    }
+
+    tr_sys_file_close(in, nullptr);
+}
+
+TEST_F(CopyTest, copyRange)
+{
+    auto const path1 = tr_strvPath(sandboxDir(), "orig-blob.txt");
+    auto const path2 = tr_strvPath(sandboxDir(), "range-blob.txt");
+    auto constexpr Contents = std::string_view{ "hello, world!" };
+    createFileWithContents(path1, std::data(Contents), std::size(Contents));
+
+    auto const in = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ, 0, nullptr);
+    auto const out = tr_sys_file_open(path2.c_str(), TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+    EXPECT_NE(TR_BAD_SYS_FILE, in);
+    EXPECT_NE(TR_BAD_SYS_FILE, out);
+
+    /* Copy the first part in the kernel, if it can, and the rest by hand from where that left off. */
+    tr_error* err = nullptr;
+    auto n_copied = uint64_t{};
+    if (tr_sys_file_copy_range(in, out, 5, &n_copied, &err))
+    {
+        EXPECT_EQ(nullptr, err);
+        EXPECT_EQ(5U, n_copied);
+    }
+    else
+    {
+        EXPECT_NE(nullptr, err);
+        EXPECT_EQ(0U, n_copied);
+        tr_error_clear(&err);
+    }
+
+    char buf[64];
+    auto n_read = uint64_t{};
+    EXPECT_TRUE(tr_sys_file_read(in, buf, sizeof(buf), &n_read, nullptr));
+    EXPECT_EQ(std::size(Contents) - n_copied, n_read);
+    EXPECT_TRUE(tr_sys_file_write(out, buf, n_read, nullptr, nullptr));
+    tr_sys_file_close(out, nullptr);
+    tr_sys_file_close(in, nullptr);
+
+    EXPECT_TRUE(filesAreIdentical(path1.c_str(), path2.c_str()));
+}
+
 } // namespace test
 
 } // namespace libtransmission
@@ -0,0 +1,250 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "transmission.h"
+
+#include "crypto.h"
+#include "crypto-pool.h"
+#include "session.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+namespace
+{
+
+auto constexpr SomeHash = tr_sha1_digest_t{
+    std::byte{ 0 },  std::byte{ 1 },  std::byte{ 2 },  std::byte{ 3 },  std::byte{ 4 },  std::byte{ 5 },  std::byte{ 6 },
+    std::byte{ 7 },  std::byte{ 8 },  std::byte{ 9 },  std::byte{ 10 }, std::byte{ 11 }, std::byte{ 12 }, std::byte{ 13 },
+    std::byte{ 14 }, std::byte{ 15 }, std::byte{ 16 }, std::byte{ 17 }, std::byte{ 18 }, std::byte{ 19 },
+};
+
+struct Job
+{
+    std::atomic<bool> done = false;
+    bool ok = false;
+    bool in_event_thread = false;
+    tr_session* session = nullptr;
+};
+
+void onJobDone(void* vjob, bool ok)
+{
+    auto* const job = static_cast<Job*>(vjob);
+    job->ok = ok;
+    job->in_event_thread = tr_amInEventThread(job->session);
+    job->done = true;
+}
+
+auto secretHash(tr_crypto const& crypto)
+{
+    return tr_cryptoSecretKeySha1(&crypto, "req1", 4, "", 0);
+}
+
+} // namespace
+
+class CryptoPoolTest : public SessionTest
+{
+protected:
+    void runInSessionThread(std::function<void()> func)
+    {
+        auto done = std::atomic<bool>{ false };
+        auto data = std::make_pair(&func, &done);
+
+        tr_runInEventThread(
+            session_,
+            [](void* vdata)
+            {
+                auto* const pair = static_cast<decltype(data)*>(vdata);
+                (*pair->first)();
+                *pair->second = true;
+            },
+            &data);
+
+        EXPECT_TRUE(waitFor([&done]() { return done.load(); }, 5000));
+    }
+};
+
+TEST_F(CryptoPoolTest, makesKeysAheadOfTime)
+{
+    auto* const pool = session_->cryptoPool;
+    ASSERT_NE(nullptr, pool);
+    EXPECT_TRUE(waitFor([pool]() { return tr_cryptoPoolGetKeyCount(pool) > 0; }, 5000));
+
+    auto ours = tr_crypto{ &SomeHash, false };
+    EXPECT_TRUE(tr_cryptoPoolTakeKey(pool, &ours));
+    EXPECT_NE(nullptr, ours.dh);
+
+    // it already has one
+    auto* const dh = ours.dh;
+    EXPECT_FALSE(tr_cryptoPoolTakeKey(pool, &ours));
+    EXPECT_EQ(dh, ours.dh);
+
+    // and the key works
+    auto theirs = tr_crypto{ &SomeHash, true };
+    auto len = int{};
+    EXPECT_TRUE(tr_cryptoComputeSecret(&ours, tr_cryptoGetMyPublicKey(&theirs, &len)));
+    EXPECT_TRUE(tr_cryptoComputeSecret(&theirs, tr_cryptoGetMyPublicKey(&ours, &len)));
+    EXPECT_EQ(secretHash(theirs), secretHash(ours));
+}
+
+TEST_F(CryptoPoolTest, computesSecrets)
+{
+    auto* const pool = session_->cryptoPool;
+    ASSERT_NE(nullptr, pool);
+
+    // one with a key and one that the pool has to make a key for
+    auto len = int{};
+    auto with_key = tr_crypto{ &SomeHash, true };
+    tr_cryptoGetMyPublicKey(&with_key, &len);
+    auto without_key = tr_crypto{ &SomeHash, true };
+
+    for (auto* const ours : { &with_key, &without_key })
+    {
+        auto theirs = tr_crypto{ &SomeHash, false };
+        uint8_t const* const their_key = tr_cryptoGetMyPublicKey(&theirs, &len);
+
+        auto job = Job{};
+        job.session = session_;
+        runInSessionThread(
+            [pool, ours, their_key, &job]()
+            {
+                tr_cryptoPoolComputeSecret(pool, ours, their_key, onJobDone, &job);
+            });
+
+        EXPECT_TRUE(waitFor([&job]() { return job.done.load(); }, 5000));
+        EXPECT_TRUE(job.ok);
+        EXPECT_TRUE(job.in_event_thread);
+        EXPECT_NE(nullptr, ours->dh);
+        EXPECT_NE(nullptr, ours->mySecret);
+
+        EXPECT_TRUE(tr_cryptoComputeSecret(&theirs, tr_cryptoGetMyPublicKey(ours, &len)));
+        EXPECT_EQ(secretHash(theirs), secretHash(*ours));
+    }
+}
+
+TEST_F(CryptoPoolTest, doesNotCallBackCancelledJobs)
+{
+    auto* const pool = session_->cryptoPool;
+    ASSERT_NE(nullptr, pool);
+
+    auto theirs = tr_crypto{ &SomeHash, false };
+    auto len = int{};
+    uint8_t const* const their_key = tr_cryptoGetMyPublicKey(&theirs, &len);
+
+    auto cancelled = tr_crypto{ &SomeHash, true };
+    auto cancelled_job = Job{};
+    cancelled_job.session = session_;
+    auto other = tr_crypto{ &SomeHash, true };
+    auto other_job = Job{};
+    other_job.session = session_;
+
+    runInSessionThread(
+        [&]()
+        {
+            tr_cryptoPoolComputeSecret(pool, &cancelled, their_key, onJobDone, &cancelled_job);
+            tr_cryptoPoolCancel(pool, &cancelled);
+            tr_cryptoPoolComputeSecret(pool, &other, their_key, onJobDone, &other_job);
+        });
+
+    EXPECT_TRUE(waitFor([&other_job]() { return other_job.done.load(); }, 5000));
+    EXPECT_TRUE(other_job.ok);
+    EXPECT_FALSE(cancelled_job.done);
+}
+
+// Compares how many handshakes' worth of Diffie-Hellman the libtransmission thread
+// gets through when it does the math itself and when the crypto pool does it.
+TEST_F(CryptoPoolTest, DISABLED_handshakeBenchmark)
+{
+    auto constexpr NumHandshakes = size_t{ 1000 };
+
+    auto* const pool = session_->cryptoPool;
+    ASSERT_NE(nullptr, pool);
+
+    // the peers' side isn't part of what's measured
+    auto peers = std::vector<std::unique_ptr<tr_crypto>>{};
+    for (size_t i = 0; i < NumHandshakes; ++i)
+    {
+        auto len = int{};
+        peers.push_back(std::make_unique<tr_crypto>(&SomeHash, false));
+        tr_cryptoGetMyPublicKey(peers.back().get(), &len);
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto const perSec = [](auto duration)
+    {
+        return NumHandshakes / std::chrono::duration<double>(duration).count();
+    };
+
+    // the way it was: a new key pair and the secret, in the libtransmission thread
+    auto inline_cryptos = std::vector<std::unique_ptr<tr_crypto>>{};
+    auto inline_elapsed = clock::duration{};
+    runInSessionThread(
+        [&]()
+        {
+            auto const start = clock::now();
+            for (auto const& peer : peers)
+            {
+                inline_cryptos.push_back(std::make_unique<tr_crypto>(&SomeHash, true));
+                EXPECT_TRUE(tr_cryptoComputeSecret(inline_cryptos.back().get(), peer->myPublicKey));
+            }
+            inline_elapsed = clock::now() - start;
+        });
+
+    // with the pool: the libtransmission thread only queues the jobs and picks up the results
+    auto pooled_cryptos = std::vector<std::unique_ptr<tr_crypto>>{};
+    auto jobs = std::vector<Job>(NumHandshakes);
+    auto const start = clock::now();
+    auto busy = clock::duration{};
+    runInSessionThread(
+        [&]()
+        {
+            auto const submit_start = clock::now();
+            for (size_t i = 0; i < NumHandshakes; ++i)
+            {
+                jobs[i].session = session_;
+                pooled_cryptos.push_back(std::make_unique<tr_crypto>(&SomeHash, true));
+                tr_cryptoPoolTakeKey(pool, pooled_cryptos.back().get());
+                tr_cryptoPoolComputeSecret(pool, pooled_cryptos.back().get(), peers[i]->myPublicKey, onJobDone, &jobs[i]);
+            }
+            busy += clock::now() - submit_start;
+        });
+    auto const all_done = [&jobs]()
+    {
+        return std::all_of(std::begin(jobs), std::end(jobs), [](auto const& job) { return job.done.load(); });
+    };
+    EXPECT_TRUE(waitFor(all_done, 60000));
+    auto const pooled_elapsed = clock::now() - start;
+
+    for (auto const& job : jobs)
+    {
+        EXPECT_TRUE(job.done);
+        EXPECT_TRUE(job.ok);
+    }
+
+    printf("%-40s %8.0f handshakes/s\n", "in the libtransmission thread", perSec(inline_elapsed));
+    printf("%-40s %8.0f handshakes/s\n", "with the crypto pool", perSec(pooled_elapsed));
+    printf("%-40s %8.0f handshakes/s\n", "queueing them in libtransmission thread", perSec(busy));
+}
+
+} // namespace test
+
+} // namespace libtransmission
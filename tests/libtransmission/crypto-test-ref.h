@@ -27,6 +27,7 @@
 #define tr_cryptoSetTorrentHash tr_cryptoSetTorrentHash_
 #define tr_cryptoGetTorrentHash tr_cryptoGetTorrentHash_
 #define tr_cryptoHasTorrentHash tr_cryptoHasTorrentHash_
+#define tr_cryptoNewKey tr_cryptoNewKey_
 #define tr_cryptoComputeSecret tr_cryptoComputeSecret_
 #define tr_cryptoGetMyPublicKey tr_cryptoGetMyPublicKey_
 #define tr_cryptoDecryptInit tr_cryptoDecryptInit_
@@ -85,6 +86,7 @@
 #undef tr_cryptoSetTorrentHash
 #undef tr_cryptoGetTorrentHash
 #undef tr_cryptoHasTorrentHash
+#undef tr_cryptoNewKey
 #undef tr_cryptoComputeSecret
 #undef tr_cryptoGetMyPublicKey
 #undef tr_cryptoDecryptInit
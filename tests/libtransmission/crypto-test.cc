@@ -7,16 +7,20 @@
  */
 
 #include <array>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <numeric>
 #include <string>
 #include <string_view>
 #include <unordered_set>
+#include <vector>
 
 #include "transmission.h"
 
 #include "crypto.h"
 #include "crypto-utils.h"
+#include "sha1.h"
 #include "utils.h"
 
 #include "crypto-test-ref.h"
@@ -121,6 +125,105 @@ TEST(Crypto, sha1)
     EXPECT_EQ("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"sv, tr_sha1_to_string(*hash5));
 }
 
+TEST(Crypto, sha1Many)
+{
+    // lengths around the block and padding boundaries, and more of them than there are lanes
+    auto const lengths = std::vector<size_t>{ 0, 1, 3, 55, 56, 57, 63, 64, 65, 119, 120, 127, 128, 129, 1000, 16391, 3, 70000 };
+
+    auto buffers = std::vector<std::vector<char>>{};
+    auto data = std::vector<void const*>{};
+    auto expected = std::vector<tr_sha1_digest_t>{};
+    for (auto const len : lengths)
+    {
+        auto& buf = buffers.emplace_back(len);
+        tr_rand_buffer(std::data(buf), std::size(buf));
+        data.push_back(std::data(buf));
+        expected.push_back(*tr_sha1(buf));
+    }
+
+    EXPECT_TRUE(tr_sha1_engine_is_available(TR_SHA1_ENGINE_PORTABLE));
+    EXPECT_TRUE(tr_sha1_engine_is_available(tr_sha1_engine_get_best()));
+
+    for (int i = 0; i < TR_SHA1_ENGINE_COUNT; ++i)
+    {
+        auto const engine = tr_sha1_engine(i);
+        if (!tr_sha1_engine_is_available(engine))
+        {
+            continue;
+        }
+
+        auto hashes = std::vector<tr_sha1_digest_t>(std::size(lengths));
+        tr_sha1_many_with_engine(engine, std::data(data), std::data(lengths), std::size(lengths), std::data(hashes));
+        EXPECT_EQ(expected, hashes) << tr_sha1_engine_get_name(engine);
+    }
+
+    auto hashes = std::vector<tr_sha1_digest_t>(std::size(lengths));
+    tr_sha1_many(std::data(data), std::data(lengths), std::size(lengths), std::data(hashes));
+    EXPECT_EQ(expected, hashes);
+
+    // a known answer, in case tr_sha1() and tr_sha1_many() are both wrong
+    auto const test = "test"sv;
+    auto const* const test_data = static_cast<void const*>(std::data(test));
+    auto const test_length = std::size(test);
+    tr_sha1_many(&test_data, &test_length, 1, std::data(hashes));
+    EXPECT_EQ("a94a8fe5ccb19ba61c4c0873d391e987982fbbd3"sv, tr_sha1_to_string(hashes.front()));
+}
+
+// Compares how fast each of the SHA1 engines that this CPU can run hashes
+// a batch of pieces, against hashing them one at a time with the crypto library.
+TEST(Crypto, DISABLED_sha1Benchmark)
+{
+    auto constexpr PieceSize = size_t{ 256 * 1024 };
+    auto constexpr NumPieces = size_t{ 256 };
+    auto constexpr TotalMiB = double(PieceSize * NumPieces) / (1024 * 1024);
+
+    auto buf = std::vector<char>(PieceSize * NumPieces);
+    tr_rand_buffer(std::data(buf), std::size(buf));
+
+    auto data = std::vector<void const*>{};
+    auto const lengths = std::vector<size_t>(NumPieces, PieceSize);
+    for (size_t i = 0; i < NumPieces; ++i)
+    {
+        data.push_back(std::data(buf) + i * PieceSize);
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto const mibPerSec = [](auto duration)
+    {
+        return TotalMiB / std::chrono::duration<double>(duration).count();
+    };
+
+    auto expected = std::vector<tr_sha1_digest_t>{};
+    auto const library_start = clock::now();
+    for (auto const* const piece : data)
+    {
+        expected.push_back(*tr_sha1(std::string_view{ static_cast<char const*>(piece), PieceSize }));
+    }
+
+    printf("%-24s %8.1f MiB/s\n", "crypto library", mibPerSec(clock::now() - library_start));
+
+    for (int i = 0; i < TR_SHA1_ENGINE_COUNT; ++i)
+    {
+        auto const engine = tr_sha1_engine(i);
+        if (!tr_sha1_engine_is_available(engine))
+        {
+            continue;
+        }
+
+        auto hashes = std::vector<tr_sha1_digest_t>(NumPieces);
+        auto const start = clock::now();
+        tr_sha1_many_with_engine(engine, std::data(data), std::data(lengths), NumPieces, std::data(hashes));
+        auto const elapsed = clock::now() - start;
+
+        EXPECT_EQ(expected, hashes);
+        printf(
+            "%-24s %8.1f MiB/s%s\n",
+            tr_sha1_engine_get_name(engine),
+            mibPerSec(elapsed),
+            engine == tr_sha1_engine_get_best() ? " (used by tr_sha1_many)" : "");
+    }
+}
+
 TEST(Crypto, ssha1)
 {
     struct LocalTest
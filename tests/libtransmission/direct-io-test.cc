@@ -0,0 +1,125 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+
+#include "direct-io.h"
+#include "file.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class DirectIoTest : public SandboxedTest
+{
+protected:
+    static auto constexpr FileSize = uint64_t{ 3 * 1024 * 1024 + 123 };
+
+    void SetUp() override
+    {
+        SandboxedTest::SetUp();
+
+        path_ = tr_strvPath(sandboxDir(), "direct-io-test");
+        createFileWithContents(path_, "");
+
+        // not every filesystem supports it, but the aligned I/O works either way
+        auto constexpr Flags = TR_SYS_FILE_READ | TR_SYS_FILE_WRITE;
+        fd_ = tr_sys_file_open(path_.c_str(), Flags | TR_SYS_FILE_DIRECT, 0, nullptr);
+        if (fd_ == TR_BAD_SYS_FILE)
+        {
+            fd_ = tr_sys_file_open(path_.c_str(), Flags, 0, nullptr);
+        }
+
+        EXPECT_NE(TR_BAD_SYS_FILE, fd_);
+        expected_.resize(FileSize);
+    }
+
+    void TearDown() override
+    {
+        tr_sys_file_close(fd_, nullptr);
+
+        SandboxedTest::TearDown();
+    }
+
+    // write `len` bytes of `value` at `offset`, split across a few iovecs
+    void write(uint64_t offset, size_t len, char value)
+    {
+        auto buf = std::vector<char>(len, value);
+        auto const split = len / 3;
+        auto const iov = std::vector<evbuffer_iovec>{ { std::data(buf), split },
+                                                      { std::data(buf) + split, len - split } };
+
+        EXPECT_TRUE(tr_directIoWrite(fd_, std::data(iov), std::size(iov), offset, FileSize, nullptr));
+        std::fill_n(std::begin(expected_) + offset, len, value);
+    }
+
+    void expectContents(uint64_t offset, size_t len) const
+    {
+        auto buf = std::vector<char>(len);
+        auto const split = len / 2;
+        auto const iov = std::vector<evbuffer_iovec>{ { std::data(buf), split },
+                                                      { std::data(buf) + split, len - split } };
+
+        EXPECT_TRUE(tr_directIoRead(fd_, std::data(iov), std::size(iov), offset, nullptr));
+        EXPECT_TRUE(std::equal(std::begin(buf), std::end(buf), std::begin(expected_) + offset));
+    }
+
+    uint64_t fileSize() const
+    {
+        auto info = tr_sys_path_info{};
+        EXPECT_TRUE(tr_sys_path_get_info(path_.c_str(), 0, &info, nullptr));
+        return info.size;
+    }
+
+    std::string path_;
+    tr_sys_file_t fd_ = TR_BAD_SYS_FILE;
+    std::vector<char> expected_;
+};
+
+TEST_F(DirectIoTest, unalignedWritesKeepTheirNeighbors)
+{
+    // neighbors that share sectors
+    write(100, 1000, 'a');
+    write(1100, 5000, 'b');
+    write(50, 20, 'c');
+
+    // across several windows
+    write(4096 * 3 + 7, 2 * 1024 * 1024, 'd');
+
+    // the very end of the file
+    write(FileSize - 10, 10, 'e');
+    EXPECT_EQ(FileSize, fileSize());
+
+    expectContents(0, FileSize);
+    expectContents(1099, 2);
+    expectContents(FileSize - 4200, 4200);
+}
+
+TEST_F(DirectIoTest, readsPastTheEndAsZeroes)
+{
+    write(0, 5000, 'a');
+
+    // the last sector was padded out, and there's nothing at all after it
+    EXPECT_EQ(8192, fileSize());
+    expectContents(4000, 8192);
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,547 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#define setenv(key, value, unused) SetEnvironmentVariableA(key, value)
+#define unsetenv(key) SetEnvironmentVariableA(key, nullptr)
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib> // setenv(), unsetenv()
+#include <string>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "transmission.h"
+
+#include "disk-io.h"
+#include "file.h"
+#include "inout.h"
+#include "session.h"
+#include "torrent.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+using DiskIoTest = SessionTest;
+
+namespace
+{
+
+struct TestJob
+{
+    std::atomic<bool> const* release = nullptr;
+    std::atomic<bool> worked = false;
+    std::atomic<bool> worked_in_event_thread = false;
+    std::atomic<bool> done = false;
+    std::atomic<bool> done_in_event_thread = false;
+    std::atomic<bool> cancelled = false;
+    tr_session* session = nullptr;
+};
+
+void testJobWork(void* vjob)
+{
+    auto* job = static_cast<TestJob*>(vjob);
+
+    while (job->release != nullptr && !*job->release)
+    {
+        tr_wait_msec(10);
+    }
+
+    job->worked_in_event_thread = tr_amInEventThread(job->session);
+    job->worked = true;
+}
+
+void testJobDone(tr_session* session, void* vjob, bool cancelled)
+{
+    auto* job = static_cast<TestJob*>(vjob);
+    job->done_in_event_thread = tr_amInEventThread(session);
+    job->cancelled = cancelled;
+    job->done = true;
+}
+
+template<size_t N>
+struct SubmitData
+{
+    tr_session* session = nullptr;
+    std::array<TestJob, N>* jobs = nullptr;
+    std::array<void const*, N> owners = {};
+    bool submitted = false;
+};
+
+template<size_t N>
+void submitJobs(void* vdata)
+{
+    auto* data = static_cast<SubmitData<N>*>(vdata);
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        tr_diskIoSubmit(data->session->diskIo, data->owners[i], {}, testJobWork, testJobDone, &(*data->jobs)[i]);
+    }
+
+    data->submitted = true;
+}
+
+struct WaitForData
+{
+    tr_session* session = nullptr;
+    TestJob quick;
+    TestJob slow;
+    std::atomic<bool> slow_was_done = true;
+    std::atomic<bool> waited = false;
+};
+
+void waitForQuickJob(void* vdata)
+{
+    auto* data = static_cast<WaitForData*>(vdata);
+    auto* const io = data->session->diskIo;
+
+    // the quick one goes first, even with only one worker
+    tr_diskIoSubmit(io, nullptr, { TR_DISK_IO_INTERACTIVE }, testJobWork, testJobDone, &data->quick);
+    tr_diskIoSubmit(io, nullptr, { TR_DISK_IO_BACKGROUND }, testJobWork, testJobDone, &data->slow);
+
+    tr_diskIoWaitFor(
+        io,
+        [](void const* vjob) { return static_cast<TestJob const*>(vjob)->done.load(); },
+        &data->quick);
+    data->slow_was_done = data->slow.done.load();
+    data->waited = true;
+}
+
+struct RoundTripData
+{
+    tr_torrent* tor = nullptr;
+    std::vector<uint8_t> written;
+    evbuffer* writeme = nullptr;
+    std::vector<uint8_t> read;
+    int write_err = -1;
+    int read_err = -1;
+    std::atomic<bool> done = false;
+};
+
+void onRoundTripRead(tr_session* /*session*/, int err, void* vdata)
+{
+    auto* data = static_cast<RoundTripData*>(vdata);
+    data->read_err = err;
+    data->done = true;
+}
+
+void onRoundTripWritten(tr_session* /*session*/, int err, void* vdata)
+{
+    auto* data = static_cast<RoundTripData*>(vdata);
+    data->write_err = err;
+
+    if (err != 0 ||
+        tr_ioReadAsync(data->tor, data, 1, 0, std::size(data->read), std::data(data->read), onRoundTripRead, data) != 0)
+    {
+        data->done = true;
+    }
+}
+
+void startRoundTrip(void* vdata)
+{
+    auto* data = static_cast<RoundTripData*>(vdata);
+
+    // write it in two chunks so that the write is a vectored one
+    auto const half = std::size(data->written) / 2;
+    evbuffer_add(data->writeme, std::data(data->written), half);
+    evbuffer_add(data->writeme, std::data(data->written) + half, std::size(data->written) - half);
+
+    auto const err = tr_ioWriteAsync(data->tor, data, 1, 0, data->writeme, onRoundTripWritten, data);
+    if (err != 0)
+    {
+        data->done = true;
+    }
+}
+
+struct FileOpsData
+{
+    tr_session* session = nullptr;
+    std::string filename;
+    bool use_ring = true;
+    bool has_ring = false;
+    std::vector<uint8_t> written;
+    std::vector<uint8_t> read;
+    size_t n_jobs_done = 0;
+    bool done = false;
+};
+
+void onFileOpsDone(tr_session* /*session*/, void* vdata, bool /*cancelled*/)
+{
+    ++static_cast<FileOpsData*>(vdata)->n_jobs_done;
+}
+
+void runFileOps(void* vdata)
+{
+    auto* data = static_cast<FileOpsData*>(vdata);
+    auto* const session = data->session;
+    auto* const session_io = session->diskIo;
+
+    // the fallback pool has to be the session's, since that's where its finished jobs get dispatched
+    if (!data->use_ring)
+    {
+        session->diskIo = tr_diskIoNew(session, 2);
+    }
+
+    auto* const io = session->diskIo;
+    data->has_ring = tr_diskIoHasRing(io);
+
+    auto const fd = tr_sys_file_open(
+        data->filename.c_str(),
+        TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE | TR_SYS_FILE_TRUNCATE,
+        0600,
+        nullptr);
+
+    // write the whole file as one job, with each op split across two buffers
+    auto constexpr OpSize = size_t{ 16384 };
+    auto const n_ops = std::size(data->written) / OpSize;
+    auto ops = std::vector<tr_disk_io_file_op>{};
+    for (size_t i = 0; i < n_ops; ++i)
+    {
+        auto* const walk = std::data(data->written) + i * OpSize;
+        auto iov = std::vector<evbuffer_iovec>{ { walk, OpSize / 2 }, { walk + OpSize / 2, OpSize / 2 } };
+        ops.push_back({ fd, true, i * OpSize, iov, -1 });
+    }
+
+    tr_diskIoSubmitFileOps(io, data, {}, std::data(ops), std::size(ops), onFileOpsDone, data);
+    tr_diskIoWaitIdle(io);
+
+    // read it back with one job per op so that they can all be in flight at once
+    auto read_ops = std::vector<tr_disk_io_file_op>{};
+    for (size_t i = 0; i < n_ops; ++i)
+    {
+        auto iov = std::vector<evbuffer_iovec>{ { std::data(data->read) + i * OpSize, OpSize } };
+        read_ops.push_back({ fd, false, i * OpSize, iov, -1 });
+    }
+
+    for (auto& op : read_ops)
+    {
+        tr_diskIoSubmitFileOps(io, data, {}, &op, 1, onFileOpsDone, data);
+    }
+
+    tr_diskIoWaitIdle(io);
+
+    for (auto const& op : ops)
+    {
+        EXPECT_EQ(0, op.err);
+    }
+
+    for (auto const& op : read_ops)
+    {
+        EXPECT_EQ(0, op.err);
+    }
+
+    tr_sys_file_close(fd, nullptr);
+
+    if (!data->use_ring)
+    {
+        tr_diskIoFree(io);
+        session->diskIo = session_io;
+    }
+
+    data->done = true;
+}
+
+struct ScheduleJob
+{
+    int id = 0;
+    std::vector<int>* order = nullptr;
+    std::atomic<bool>* started = nullptr;
+    std::atomic<bool> const* release = nullptr;
+};
+
+void scheduleJobWork(void* vjob)
+{
+    auto* job = static_cast<ScheduleJob*>(vjob);
+
+    if (job->started != nullptr)
+    {
+        *job->started = true;
+    }
+
+    while (job->release != nullptr && !*job->release)
+    {
+        tr_wait_msec(10);
+    }
+
+    job->order->push_back(job->id);
+}
+
+void scheduleJobDone(tr_session* /*session*/, void* /*vjob*/, bool /*cancelled*/)
+{
+}
+
+struct ScheduleData
+{
+    tr_session* session = nullptr;
+    std::vector<int> order;
+    std::vector<tr_disk_io_device_stats> busy_stats;
+    std::vector<tr_disk_io_device_stats> idle_stats;
+    bool done = false;
+};
+
+void runSchedule(void* vdata)
+{
+    auto* data = static_cast<ScheduleData*>(vdata);
+    auto* const session = data->session;
+    auto* const session_io = session->diskIo;
+
+    // one worker, so the jobs have to take turns
+    auto* const io = tr_diskIoNew(session, 1);
+    session->diskIo = io;
+
+    auto constexpr Device = uint64_t{ 1 };
+    auto started = std::atomic<bool>{ false };
+    auto release = std::atomic<bool>{ false };
+
+    // keep the worker busy until everything else is queued
+    auto blocker = ScheduleJob{ 0, &data->order, &started, &release };
+    tr_diskIoSubmit(io, data, { TR_DISK_IO_NORMAL, Device, 0, 0 }, scheduleJobWork, scheduleJobDone, &blocker);
+    while (!started)
+    {
+        tr_wait_msec(10);
+    }
+
+    auto background = ScheduleJob{ 1, &data->order };
+    auto normal30 = ScheduleJob{ 30, &data->order };
+    auto normal10 = ScheduleJob{ 10, &data->order };
+    auto normal20 = ScheduleJob{ 20, &data->order };
+    auto interactive = ScheduleJob{ 2, &data->order };
+    tr_diskIoSubmit(io, data, { TR_DISK_IO_BACKGROUND, Device, 0, 0 }, scheduleJobWork, scheduleJobDone, &background);
+    tr_diskIoSubmit(io, data, { TR_DISK_IO_NORMAL, Device, 0, 30 }, scheduleJobWork, scheduleJobDone, &normal30);
+    tr_diskIoSubmit(io, data, { TR_DISK_IO_NORMAL, Device, 0, 10 }, scheduleJobWork, scheduleJobDone, &normal10);
+    tr_diskIoSubmit(io, data, { TR_DISK_IO_NORMAL, Device, 0, 20 }, scheduleJobWork, scheduleJobDone, &normal20);
+    tr_diskIoSubmit(io, data, { TR_DISK_IO_INTERACTIVE, Device, 0, 40 }, scheduleJobWork, scheduleJobDone, &interactive);
+
+    data->busy_stats = tr_diskIoGetDeviceStats(io);
+    release = true;
+    tr_diskIoWaitIdle(io);
+    data->idle_stats = tr_diskIoGetDeviceStats(io);
+
+    tr_diskIoFree(io);
+    session->diskIo = session_io;
+    data->done = true;
+}
+
+} // namespace
+
+TEST_F(DiskIoTest, jobsAreDoneInEventThread)
+{
+    ASSERT_NE(nullptr, session_->diskIo);
+
+    auto constexpr N = size_t{ 16 };
+    auto jobs = std::array<TestJob, N>{};
+    for (auto& job : jobs)
+    {
+        job.session = session_;
+    }
+
+    auto data = SubmitData<N>{};
+    data.session = session_;
+    data.jobs = &jobs;
+    tr_runInEventThread(session_, submitJobs<N>, &data);
+
+    auto const all_done = [&jobs]()
+    {
+        return std::all_of(std::begin(jobs), std::end(jobs), [](auto const& job) { return job.done.load(); });
+    };
+    EXPECT_TRUE(waitFor(all_done, 2000));
+
+    for (auto const& job : jobs)
+    {
+        EXPECT_TRUE(job.worked);
+        EXPECT_FALSE(job.worked_in_event_thread);
+        EXPECT_TRUE(job.done_in_event_thread);
+        EXPECT_FALSE(job.cancelled);
+    }
+}
+
+TEST_F(DiskIoTest, waitForOnlyWaitsForWhatItsTold)
+{
+    ASSERT_NE(nullptr, session_->diskIo);
+
+    auto release = std::atomic<bool>{ false };
+    auto data = WaitForData{};
+    data.session = session_;
+    data.quick.session = session_;
+    data.slow.session = session_;
+    data.slow.release = &release;
+    tr_runInEventThread(session_, waitForQuickJob, &data);
+
+    EXPECT_TRUE(waitFor([&data]() { return data.waited.load(); }, 2000));
+    EXPECT_TRUE(data.quick.done);
+    EXPECT_FALSE(data.slow_was_done);
+
+    release = true;
+    EXPECT_TRUE(waitFor([&data]() { return data.slow.done.load(); }, 2000));
+}
+
+TEST_F(DiskIoTest, cancel)
+{
+    ASSERT_NE(nullptr, session_->diskIo);
+
+    // none of the jobs can finish until they're released,
+    // so they're all still queued or running when some are cancelled
+    auto constexpr N = size_t{ 8 };
+    auto release = std::atomic<bool>{ false };
+    auto jobs = std::array<TestJob, N>{};
+    auto const* const cancelled_owner = &release;
+    auto const* const other_owner = &jobs;
+
+    auto data = SubmitData<N>{};
+    data.session = session_;
+    data.jobs = &jobs;
+    for (size_t i = 0; i < N; ++i)
+    {
+        jobs[i].session = session_;
+        jobs[i].release = &release;
+        data.owners[i] = i + 1 < N ? static_cast<void const*>(cancelled_owner) : static_cast<void const*>(other_owner);
+    }
+
+    tr_runInEventThread(session_, submitJobs<N>, &data);
+    EXPECT_TRUE(waitFor([&data]() { return data.submitted; }, 2000));
+
+    struct CancelData
+    {
+        tr_session* session;
+        void const* owner;
+        bool cancelled;
+    };
+
+    auto cancel_data = CancelData{ session_, cancelled_owner, false };
+    auto const cancel = [](void* vdata) noexcept
+    {
+        auto* cdata = static_cast<CancelData*>(vdata);
+        tr_diskIoCancel(cdata->session->diskIo, cdata->owner);
+        cdata->cancelled = true;
+    };
+    tr_runInEventThread(session_, cancel, &cancel_data);
+    EXPECT_TRUE(waitFor([&cancel_data]() { return cancel_data.cancelled; }, 2000));
+
+    release = true;
+
+    auto const all_done = [&jobs]()
+    {
+        return std::all_of(std::begin(jobs), std::end(jobs), [](auto const& job) { return job.done.load(); });
+    };
+    EXPECT_TRUE(waitFor(all_done, 2000));
+
+    for (size_t i = 0; i + 1 < N; ++i)
+    {
+        EXPECT_TRUE(jobs[i].cancelled);
+    }
+
+    EXPECT_FALSE(jobs[N - 1].cancelled);
+    EXPECT_TRUE(jobs[N - 1].worked);
+}
+
+TEST_F(DiskIoTest, schedulesByPriorityThenOffset)
+{
+    auto data = ScheduleData{};
+    data.session = session_;
+
+    tr_runInEventThread(session_, runSchedule, &data);
+    EXPECT_TRUE(waitFor([&data]() { return data.done; }, 5000));
+
+    // the interactive job goes first, then the normal ones in the order they're on disk
+    auto const expected_order = std::vector<int>{ 0, 2, 10, 20, 30, 1 };
+    EXPECT_EQ(expected_order, data.order);
+
+    ASSERT_EQ(1U, std::size(data.busy_stats));
+    auto const& busy = data.busy_stats.front();
+    EXPECT_EQ(1U, busy.device);
+    EXPECT_EQ(1U, busy.running);
+    EXPECT_EQ(1U, busy.queued[TR_DISK_IO_INTERACTIVE]);
+    EXPECT_EQ(3U, busy.queued[TR_DISK_IO_NORMAL]);
+    EXPECT_EQ(1U, busy.queued[TR_DISK_IO_BACKGROUND]);
+
+    ASSERT_EQ(1U, std::size(data.idle_stats));
+    auto const& idle = data.idle_stats.front();
+    EXPECT_EQ(0U, idle.running);
+    EXPECT_EQ(0U, idle.queued[TR_DISK_IO_NORMAL]);
+    EXPECT_EQ(std::size(expected_order), idle.n_done);
+    EXPECT_GE(idle.max_latency_usec, idle.latency_usec);
+}
+
+TEST_F(DiskIoTest, readAndWriteBlocks)
+{
+    auto* const tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+
+    auto data = RoundTripData{};
+    data.tor = tor;
+    data.written.resize(tor->blockSize());
+    data.read.resize(tor->blockSize());
+    for (size_t i = 0; i < std::size(data.written); ++i)
+    {
+        data.written[i] = uint8_t(i * 7);
+    }
+
+    data.writeme = evbuffer_new();
+
+    tr_runInEventThread(session_, startRoundTrip, &data);
+    EXPECT_TRUE(waitFor([&data]() { return data.done.load(); }, 2000));
+    EXPECT_EQ(0, data.write_err);
+    EXPECT_EQ(0, data.read_err);
+    EXPECT_EQ(data.written, data.read);
+
+    // cleanup
+    evbuffer_free(data.writeme);
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(DiskIoTest, fileOps)
+{
+    ASSERT_NE(nullptr, session_->diskIo);
+
+    // io_uring may not be available here, but the thread pool always is
+    for (bool const use_ring : { true, false })
+    {
+        if (!use_ring)
+        {
+            setenv("TR_NO_IO_URING", "1", 1);
+        }
+
+        auto data = FileOpsData{};
+        data.session = session_;
+        data.filename = tr_strvPath(sandboxDir(), "file-ops");
+        data.use_ring = use_ring;
+        data.written.resize(1024 * 1024);
+        data.read.resize(std::size(data.written));
+        for (size_t i = 0; i < std::size(data.written); ++i)
+        {
+            data.written[i] = uint8_t(i * 13 + i / 4096);
+        }
+
+        tr_runInEventThread(session_, runFileOps, &data);
+        EXPECT_TRUE(waitFor([&data]() { return data.done; }, 5000));
+        EXPECT_EQ(1 + std::size(data.written) / 16384, data.n_jobs_done);
+        EXPECT_EQ(data.written, data.read);
+
+        if (!use_ring)
+        {
+            EXPECT_FALSE(data.has_ring);
+            unsetenv("TR_NO_IO_URING");
+        }
+    }
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,142 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "transmission.h"
+
+#include "fdlimit.h"
+#include "session.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class FdLimitTest : public SessionTest
+{
+protected:
+    static auto constexpr TorrentId = int{ 1 };
+
+    tr_sys_file_t checkout(tr_file_index_t i) const
+    {
+        auto const path = tr_strvPath(sandboxDir(), "file-" + std::to_string(i));
+        return tr_fdFileCheckout(session_, TorrentId, i, path.c_str(), true, TR_PREALLOCATE_NONE, 0);
+    }
+
+    bool isCached(tr_file_index_t i) const
+    {
+        return tr_fdFileGetCached(session_, TorrentId, i, false) != TR_BAD_SYS_FILE;
+    }
+
+    struct Stats
+    {
+        uint64_t opened;
+        uint64_t closed;
+        uint64_t evicted;
+    };
+
+    Stats getStats() const
+    {
+        auto stats = Stats{};
+        tr_fdGetFileStats(session_, &stats.opened, &stats.closed, &stats.evicted);
+        return stats;
+    }
+};
+
+TEST_F(FdLimitTest, evictsLeastRecentlyUsed)
+{
+    tr_sessionSetOpenFileLimit(session_, 2);
+    EXPECT_EQ(2, tr_sessionGetOpenFileLimit(session_));
+    auto const before = getStats();
+
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(0));
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(1));
+    EXPECT_TRUE(isCached(1));
+    EXPECT_TRUE(isCached(0));
+
+    // file 0 was just used, so file 1 is the one to go
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(2));
+    EXPECT_TRUE(isCached(0));
+    EXPECT_FALSE(isCached(1));
+    EXPECT_TRUE(isCached(2));
+
+    auto stats = getStats();
+    EXPECT_EQ(before.opened + 3, stats.opened);
+    EXPECT_EQ(before.closed + 1, stats.closed);
+    EXPECT_EQ(before.evicted + 1, stats.evicted);
+
+    // closing the torrent's files isn't an eviction
+    tr_fdTorrentClose(session_, TorrentId);
+    EXPECT_FALSE(isCached(0));
+    EXPECT_FALSE(isCached(2));
+
+    stats = getStats();
+    EXPECT_EQ(before.closed + 3, stats.closed);
+    EXPECT_EQ(before.evicted + 1, stats.evicted);
+}
+
+TEST_F(FdLimitTest, keepsAtLeastOneFileOpen)
+{
+    tr_sessionSetOpenFileLimit(session_, 0);
+    EXPECT_EQ(1, tr_sessionGetOpenFileLimit(session_));
+
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(0));
+    EXPECT_TRUE(isCached(0));
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(1));
+    EXPECT_FALSE(isCached(0));
+    EXPECT_TRUE(isCached(1));
+
+    tr_fdTorrentClose(session_, TorrentId);
+}
+
+TEST_F(FdLimitTest, remembersHowFilesWereOpened)
+{
+    tr_sessionSetDirectIoEnabled(session_, false);
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(0));
+    EXPECT_FALSE(tr_fdFileIsDirect(session_, TorrentId, 0));
+
+    // not every filesystem can bypass the page cache, so see whether the sandbox's can
+    auto const path = tr_strvPath(sandboxDir(), "file-0");
+    auto const fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_DIRECT, 0, nullptr);
+    auto const can_bypass = fd != TR_BAD_SYS_FILE;
+    if (can_bypass)
+    {
+        tr_sys_file_close(fd, nullptr);
+    }
+
+    tr_sessionSetDirectIoEnabled(session_, true);
+    EXPECT_FALSE(isCached(0));
+    EXPECT_NE(TR_BAD_SYS_FILE, checkout(0));
+    EXPECT_EQ(can_bypass, tr_fdFileIsDirect(session_, TorrentId, 0));
+
+    tr_fdTorrentClose(session_, TorrentId);
+    EXPECT_FALSE(tr_fdFileIsDirect(session_, TorrentId, 0));
+    tr_sessionSetDirectIoEnabled(session_, false);
+}
+
+TEST_F(FdLimitTest, reopensReadOnlyFilesForWriting)
+{
+    auto const path = tr_strvPath(sandboxDir(), "file-0");
+    createFileWithContents(path, "hello");
+
+    EXPECT_NE(TR_BAD_SYS_FILE, tr_fdFileCheckout(session_, TorrentId, 0, path.c_str(), false, TR_PREALLOCATE_NONE, 5));
+    EXPECT_TRUE(isCached(0));
+    EXPECT_EQ(TR_BAD_SYS_FILE, tr_fdFileGetCached(session_, TorrentId, 0, true));
+
+    EXPECT_NE(TR_BAD_SYS_FILE, tr_fdFileCheckout(session_, TorrentId, 0, path.c_str(), true, TR_PREALLOCATE_NONE, 5));
+    EXPECT_NE(TR_BAD_SYS_FILE, tr_fdFileGetCached(session_, TorrentId, 0, true));
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -6,6 +6,8 @@
  *
  */
 
+#include <event2/buffer.h>
+
 #include "transmission.h"
 #include "error.h"
 #include "file.h"
@@ -16,6 +18,7 @@
 #include <array>
 #include <cstring>
 #include <string>
+#include <vector>
 
 #ifndef _WIN32
 #include <sys/types.h>
@@ -1139,6 +1142,39 @@ TEST_F(FileTest, fileReadWriteSeek)
     tr_sys_path_remove(path1.c_str(), nullptr);
 }
 
+TEST_F(FileTest, fileWriteAtV)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path1 = tr_strvPath(test_dir, "a"sv);
+    auto const fd = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+
+    // use more buffers than fit in a single system call
+    auto contents = std::array<char, 300>{};
+    auto iov = std::array<evbuffer_iovec, 300>{};
+    for (size_t i = 0; i < contents.size(); ++i)
+    {
+        contents[i] = char('a' + i % 26);
+        iov[i] = { &contents[i], 1 };
+    }
+
+    uint64_t n;
+    tr_error* err = nullptr;
+    EXPECT_TRUE(tr_sys_file_write_at_v(fd, iov.data(), iov.size(), 10, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(contents.size(), n);
+
+    auto buf = std::array<char, 300>{};
+    EXPECT_TRUE(tr_sys_file_read_at(fd, buf.data(), buf.size(), 10, &n, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(buf.size(), n);
+    EXPECT_EQ(contents, buf);
+
+    tr_sys_file_close(fd, nullptr);
+
+    tr_sys_path_remove(path1.c_str(), nullptr);
+}
+
 TEST_F(FileTest, fileTruncate)
 {
     auto const test_dir = createTestDir(currentTestName());
@@ -1184,6 +1220,48 @@ TEST_F(FileTest, fileTruncate)
     tr_sys_path_remove(path1.c_str(), nullptr);
 }
 
+TEST_F(FileTest, fileFindData)
+{
+    auto const test_dir = createTestDir(currentTestName());
+
+    auto const path1 = tr_strvPath(test_dir, "a"sv);
+    auto fd = tr_sys_file_open(path1.c_str(), TR_SYS_FILE_READ | TR_SYS_FILE_WRITE | TR_SYS_FILE_CREATE, 0600, nullptr);
+
+    // a file with some data in the middle and holes around it, if the filesystem supports holes
+    auto constexpr FileSize = uint64_t{ 4 * 1024 * 1024 };
+    auto constexpr DataOffset = uint64_t{ 1024 * 1024 };
+    auto const data = std::vector<char>(4096, 'x');
+    EXPECT_TRUE(tr_sys_file_truncate(fd, FileSize, nullptr));
+    EXPECT_TRUE(tr_sys_file_write_at(fd, std::data(data), std::size(data), DataOffset, nullptr, nullptr));
+
+    tr_error* err = nullptr;
+    auto begin = uint64_t{};
+    auto end = uint64_t{};
+    EXPECT_TRUE(tr_sys_file_find_data(fd, 0, &begin, &end, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_LE(begin, DataOffset);
+    EXPECT_GE(end, DataOffset + std::size(data));
+    EXPECT_LE(end, FileSize);
+
+    // whatever follows the data is either more data or a hole that runs to the end of the file
+    if (end < FileSize)
+    {
+        EXPECT_TRUE(tr_sys_file_find_data(fd, end, &begin, &end, &err));
+        EXPECT_EQ(nullptr, err);
+        EXPECT_EQ(FileSize, begin);
+        EXPECT_EQ(FileSize, end);
+    }
+
+    // there's never any data past the end of the file
+    EXPECT_TRUE(tr_sys_file_find_data(fd, FileSize, &begin, &end, &err));
+    EXPECT_EQ(nullptr, err);
+    EXPECT_EQ(FileSize, begin);
+    EXPECT_EQ(FileSize, end);
+
+    tr_sys_file_close(fd, nullptr);
+    tr_sys_path_remove(path1.c_str(), nullptr);
+}
+
 TEST_F(FileTest, filePreallocate)
 {
     auto const test_dir = createTestDir(currentTestName());
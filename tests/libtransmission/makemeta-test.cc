@@ -306,6 +306,51 @@ TEST_F(MakemetaTest, singleDirectoryRandomPayload)
     }
 }
 
+TEST_F(MakemetaTest, piecesAreHashedInParallel)
+{
+    auto constexpr PieceSize = uint32_t{ 16384 };
+
+    // several files, with pieces that span them
+    auto const top = tr_strvPath(sandboxDir(), "folder");
+    auto const file_sizes = std::array<size_t, 3>{ 100000, 7, 250001 };
+    auto contents = std::string{};
+    for (size_t i = 0; i < std::size(file_sizes); ++i)
+    {
+        auto payload = std::string(file_sizes[i], '\0');
+        tr_rand_buffer(std::data(payload), std::size(payload));
+        auto path = tr_strvPath(top, "file-" + std::to_string(i));
+        createFileWithContents(path, std::data(payload), std::size(payload));
+        contents += payload;
+    }
+
+    for (auto const thread_count : { 1U, 4U })
+    {
+        auto* const builder = tr_metaInfoBuilderCreate(top.c_str());
+        EXPECT_TRUE(tr_metaInfoBuilderSetPieceSize(builder, PieceSize));
+        tr_metaInfoBuilderSetThreadCount(builder, thread_count);
+        EXPECT_EQ(thread_count, builder->threadCount);
+
+        auto const torrent_file = tr_strvJoin(top, ".torrent"sv);
+        tr_makeMetaInfo(builder, torrent_file.c_str(), nullptr, 0, nullptr, false, nullptr);
+        EXPECT_TRUE(waitFor([builder]() { return builder->isDone; }, 5000));
+        EXPECT_EQ(TR_MAKEMETA_OK, builder->result);
+        EXPECT_EQ(builder->pieceCount, builder->pieceIndex);
+
+        auto metainfo = tr_torrent_metainfo{};
+        EXPECT_TRUE(metainfo.parseTorrentFile(torrent_file));
+        EXPECT_EQ(std::size(contents), metainfo.totalSize());
+        EXPECT_EQ(builder->pieceCount, metainfo.pieceCount());
+
+        for (tr_piece_index_t piece = 0; piece < metainfo.pieceCount(); ++piece)
+        {
+            auto const expected = tr_sha1(std::string_view{ contents }.substr(size_t{ piece } * PieceSize, PieceSize));
+            EXPECT_EQ(*expected, metainfo.pieceHash(piece)) << piece;
+        }
+
+        tr_metaInfoBuilderFree(builder);
+    }
+}
+
 } // namespace test
 
 } // namespace libtransmission
@@ -9,6 +9,10 @@
 #include <string>
 #include <utility>
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
 #include <event2/buffer.h>
 
 #include "transmission.h"
@@ -189,6 +193,82 @@ TEST_F(MoveTest, setLocation)
     tr_torrentRemove(tor, true, tr_sys_path_remove);
 }
 
+TEST_F(MoveTest, setLocationToAnotherDisk)
+{
+#ifdef _WIN32
+    GTEST_SKIP();
+#else
+    // files are only copied in the background when they can't be renamed into place,
+    // so the target has to be on a different filesystem than the sandbox
+    auto target_dir = std::string{ "/dev/shm/transmission-test-XXXXXX" };
+    struct stat sb_target;
+    struct stat sb_sandbox;
+    if (!tr_sys_dir_create_temp(std::data(target_dir), nullptr) || stat(target_dir.c_str(), &sb_target) != 0 ||
+        stat(tr_sessionGetConfigDir(session_), &sb_sandbox) != 0 || sb_target.st_dev == sb_sandbox.st_dev)
+    {
+        tr_sys_path_remove(target_dir.c_str(), nullptr);
+        GTEST_SKIP();
+    }
+
+    // init a torrent.
+    auto* tor = zeroTorrentInit();
+    zeroTorrentPopulate(tor, true);
+    auto const old_dir = std::string{ tor->currentDir().sv() };
+    auto const old_filename = makeString(tr_torrentFindFile(tor, 0));
+
+    // this slow, the copying won't be finished for a long time
+    tr_sessionSetRelocateSpeedLimit_KBps(session_, 1);
+    EXPECT_EQ(1U, tr_sessionGetRelocateSpeedLimit_KBps(session_));
+
+    // as if it had just finished downloading into an incomplete dir
+    tor->isDoneScriptPending = true;
+
+    auto state = int{ -1 };
+    auto progress = double{ -1 };
+    tr_torrentSetLocation(tor, target_dir.c_str(), true, &progress, &state);
+    auto const is_copying = [tor]()
+    {
+        auto const* const st = tr_torrentStat(tor);
+        return st->isRelocating && st->relocateProgress > 0;
+    };
+    EXPECT_TRUE(waitFor(is_copying, 5000));
+    EXPECT_EQ(TR_LOC_MOVING, state);
+    EXPECT_LT(progress, 1.0);
+    EXPECT_LT(tr_torrentStat(tor)->relocateProgress, 1.0F);
+    EXPECT_LT(tr_torrentStat(tor)->relocateFile, tr_torrentFileCount(tor));
+
+    // the torrent keeps using its files where they are until the copying's done,
+    // and the done script waits to be told where they end up
+    EXPECT_EQ(old_dir, tor->currentDir().sv());
+    EXPECT_EQ(old_filename, makeString(tr_torrentFindFile(tor, 0)));
+    EXPECT_TRUE(tor->isDoneScriptPending);
+
+    // lifting the limit lets the copying finish
+    tr_sessionSetRelocateSpeedLimit_KBps(session_, 0);
+    EXPECT_TRUE(waitFor([&state]() { return state != TR_LOC_MOVING; }, 5000));
+    EXPECT_EQ(TR_LOC_DONE, state);
+    EXPECT_EQ(1.0, progress);
+    EXPECT_FALSE(tr_torrentStat(tor)->isRelocating);
+    EXPECT_FALSE(tr_sys_path_exists(old_filename.c_str(), nullptr));
+    EXPECT_FALSE(tor->isDoneScriptPending);
+
+    // confirm the torrent is still complete after being moved
+    blockingTorrentVerify(tor);
+    EXPECT_EQ(0, tr_torrentStat(tor)->leftUntilDone);
+
+    // confirm the files really got moved
+    auto const n = tr_torrentFileCount(tor);
+    for (tr_file_index_t i = 0; i < n; ++i)
+    {
+        EXPECT_EQ(tr_strvPath(target_dir, tr_torrentFile(tor, i).name), makeString(tr_torrentFindFile(tor, i)));
+    }
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+    EXPECT_TRUE(waitFor([&target_dir]() { return tr_sys_path_remove(target_dir.c_str(), nullptr); }, 5000));
+#endif
+}
+
 } // namespace test
 
 } // namespace libtransmission
@@ -0,0 +1,302 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/util.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+#include "transmission.h"
+
+#include "crypto.h"
+#include "crypto-utils.h"
+#include "peer-io-threads.h"
+#include "session.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+namespace
+{
+
+auto constexpr SomeHash = tr_sha1_digest_t{
+    std::byte{ 0 },  std::byte{ 1 },  std::byte{ 2 },  std::byte{ 3 },  std::byte{ 4 },  std::byte{ 5 },  std::byte{ 6 },
+    std::byte{ 7 },  std::byte{ 8 },  std::byte{ 9 },  std::byte{ 10 }, std::byte{ 11 }, std::byte{ 12 }, std::byte{ 13 },
+    std::byte{ 14 }, std::byte{ 15 }, std::byte{ 16 }, std::byte{ 17 }, std::byte{ 18 }, std::byte{ 19 },
+};
+
+// the session thread's end of a socket pair
+struct Connection
+{
+    Connection() = default;
+    Connection(Connection const&) = delete;
+    Connection& operator=(Connection const&) = delete;
+
+    ~Connection()
+    {
+        evbuffer_free(received);
+        evbuffer_free(outgoing);
+    }
+
+    tr_threaded_socket* ts = nullptr;
+    evbuffer* const received = evbuffer_new();
+    evbuffer* const outgoing = evbuffer_new();
+    std::atomic<size_t> n_received = 0;
+    std::atomic<bool> got_eof = false;
+};
+
+void flushOutgoing(Connection* conn)
+{
+    while (evbuffer_get_length(conn->outgoing) > 0 &&
+           tr_threadedSocketWrite(conn->ts, conn->outgoing, evbuffer_get_length(conn->outgoing)) > 0)
+    {
+    }
+
+    tr_threadedSocketSetEvents(conn->ts, evbuffer_get_length(conn->outgoing) > 0 ? EV_READ | EV_WRITE : EV_READ);
+}
+
+void onSocketEvent(void* vconn, short what)
+{
+    auto* const conn = static_cast<Connection*>(vconn);
+
+    if ((what & EV_READ) != 0)
+    {
+        for (;;)
+        {
+            auto const n = tr_threadedSocketRead(conn->ts, conn->received, SIZE_MAX);
+
+            if (n > 0)
+            {
+                conn->n_received += n;
+                continue;
+            }
+
+            if (n == 0)
+            {
+                tr_threadedSocketSetEvents(conn->ts, 0);
+                conn->got_eof = true;
+            }
+
+            break;
+        }
+    }
+
+    if ((what & EV_WRITE) != 0)
+    {
+        flushOutgoing(conn);
+    }
+}
+
+std::vector<char> randomPayload(size_t len)
+{
+    auto payload = std::vector<char>(len);
+    tr_rand_buffer(std::data(payload), std::size(payload));
+    return payload;
+}
+
+} // namespace
+
+class PeerIoThreadsTest : public SessionTest
+{
+protected:
+    void SetUp() override
+    {
+        SessionTest::SetUp();
+
+        tr_sessionSetPeerIoThreads(session_, 2);
+
+        ASSERT_EQ(0, evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, std::data(fds_)));
+        evutil_make_socket_nonblocking(fds_[0]);
+
+        runInSessionThread([this]() { conn_.ts = tr_threadedSocketNew(session_, fds_[0], onSocketEvent, &conn_); });
+        runInSessionThread([this]() { tr_threadedSocketSetEvents(conn_.ts, EV_READ); });
+    }
+
+    void TearDown() override
+    {
+        runInSessionThread([this]() { tr_threadedSocketFree(conn_.ts); });
+        evutil_closesocket(fds_[0]);
+
+        if (fds_[1] != TR_BAD_SOCKET)
+        {
+            evutil_closesocket(fds_[1]);
+        }
+
+        SessionTest::TearDown();
+    }
+
+    void runInSessionThread(std::function<void()> func)
+    {
+        auto done = std::atomic<bool>{ false };
+        auto data = std::make_pair(&func, &done);
+
+        tr_runInEventThread(
+            session_,
+            [](void* vdata)
+            {
+                auto* const pair = static_cast<decltype(data)*>(vdata);
+                (*pair->first)();
+                *pair->second = true;
+            },
+            &data);
+
+        EXPECT_TRUE(waitFor([&done]() { return done.load(); }, 5000));
+    }
+
+    // send from the other end of the socket pair
+    void peerSend(std::vector<char> const& payload)
+    {
+        for (size_t sent = 0; sent < std::size(payload);)
+        {
+            auto const n = send(fds_[1], std::data(payload) + sent, std::size(payload) - sent, 0);
+            ASSERT_GT(n, 0);
+            sent += n;
+        }
+    }
+
+    // receive from the other end of the socket pair
+    std::vector<char> peerRecv(size_t len)
+    {
+        auto payload = std::vector<char>(len);
+
+        for (size_t got = 0; got < len;)
+        {
+            auto const n = recv(fds_[1], std::data(payload) + got, len - got, 0);
+            EXPECT_GT(n, 0);
+
+            if (n <= 0)
+            {
+                break;
+            }
+
+            got += n;
+        }
+
+        return payload;
+    }
+
+    void write(void const* data, size_t len)
+    {
+        runInSessionThread(
+            [this, data, len]()
+            {
+                evbuffer_add(conn_.outgoing, data, len);
+                flushOutgoing(&conn_);
+            });
+    }
+
+    // wait until `len` bytes have been received in all, and take the ones that haven't been taken yet
+    std::vector<char> waitForReceived(size_t len)
+    {
+        EXPECT_TRUE(waitFor([this, len]() { return conn_.n_received >= len; }, 5000));
+        EXPECT_EQ(len, conn_.n_received);
+
+        auto payload = std::vector<char>(evbuffer_get_length(conn_.received));
+        evbuffer_remove(conn_.received, std::data(payload), std::size(payload));
+        return payload;
+    }
+
+    std::array<evutil_socket_t, 2> fds_ = { TR_BAD_SOCKET, TR_BAD_SOCKET };
+    Connection conn_;
+};
+
+TEST_F(PeerIoThreadsTest, receives)
+{
+    // more than the I/O thread reads ahead, so it has to wait for us
+    auto const payload = randomPayload(1024 * 1024 + 1);
+    peerSend(payload);
+
+    EXPECT_EQ(payload, waitForReceived(std::size(payload)));
+}
+
+TEST_F(PeerIoThreadsTest, sends)
+{
+    // more than the I/O thread buffers, so we have to wait for room
+    auto const payload = randomPayload(1024 * 1024 + 1);
+    write(std::data(payload), std::size(payload));
+
+    EXPECT_EQ(payload, peerRecv(std::size(payload)));
+}
+
+TEST_F(PeerIoThreadsTest, seesEof)
+{
+    evutil_closesocket(fds_[1]);
+    fds_[1] = TR_BAD_SOCKET;
+
+    EXPECT_TRUE(waitFor([this]() { return conn_.got_eof.load(); }, 5000));
+}
+
+TEST_F(PeerIoThreadsTest, encryptsOnceItHasTheKeys)
+{
+    auto ours = tr_crypto{ &SomeHash, false };
+    auto theirs = tr_crypto{ &SomeHash, true };
+    auto key_len = int{};
+    EXPECT_TRUE(tr_cryptoComputeSecret(&ours, tr_cryptoGetMyPublicKey(&theirs, &key_len)));
+    EXPECT_TRUE(tr_cryptoComputeSecret(&theirs, tr_cryptoGetMyPublicKey(&ours, &key_len)));
+    tr_cryptoEncryptInit(&ours);
+    tr_cryptoDecryptInit(&ours);
+    tr_cryptoEncryptInit(&theirs);
+    tr_cryptoDecryptInit(&theirs);
+
+    // plaintext, before the keys are handed over
+    auto const hello = randomPayload(68);
+    peerSend(hello);
+    EXPECT_EQ(hello, waitForReceived(std::size(hello)));
+    write(std::data(hello), std::size(hello));
+    EXPECT_EQ(hello, peerRecv(std::size(hello)));
+
+    // something that we encrypted ourselves but didn't write before handing over the keys
+    auto const prefix = randomPayload(100);
+    auto encrypted_prefix = std::vector<char>(std::size(prefix));
+    tr_cryptoEncrypt(&ours, std::size(prefix), std::data(prefix), std::data(encrypted_prefix));
+
+    runInSessionThread(
+        [this, &ours, &encrypted_prefix]()
+        {
+            tr_threadedSocketTakeKeys(
+                conn_.ts,
+                std::exchange(ours.enc_key, nullptr),
+                std::exchange(ours.dec_key, nullptr),
+                std::size(encrypted_prefix));
+        });
+
+    write(std::data(encrypted_prefix), std::size(encrypted_prefix));
+    auto const payload = randomPayload(512 * 1024);
+    write(std::data(payload), std::size(payload));
+
+    auto got = peerRecv(std::size(prefix) + std::size(payload));
+    tr_cryptoDecrypt(&theirs, std::size(got), std::data(got), std::data(got));
+    EXPECT_EQ(prefix, std::vector<char>(std::begin(got), std::begin(got) + std::size(prefix)));
+    EXPECT_EQ(payload, std::vector<char>(std::begin(got) + std::size(prefix), std::end(got)));
+
+    // what the peer sends now is decrypted for us
+    auto encrypted_payload = payload;
+    tr_cryptoEncrypt(&theirs, std::size(payload), std::data(payload), std::data(encrypted_payload));
+    peerSend(encrypted_payload);
+    EXPECT_EQ(payload, waitForReceived(std::size(hello) + std::size(payload)));
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,125 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+
+#include "file.h"
+#include "prealloc.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class PreallocTest : public SessionTest
+{
+protected:
+    static auto constexpr TorrentId = int{ 1 };
+    static auto constexpr FileIndex = tr_file_index_t{ 0 };
+
+    std::string createEmptyFile() const
+    {
+        auto const path = tr_strvPath(sandboxDir(), "prealloc-test");
+        createFileWithContents(path, "");
+        return path;
+    }
+
+    bool isPreallocating() const
+    {
+        auto progress = float{};
+        return tr_preallocGetProgress(session_, TorrentId, &progress);
+    }
+};
+
+TEST_F(PreallocTest, writesArentZeroedOut)
+{
+    auto const path = createEmptyFile();
+    auto constexpr FileSize = uint64_t{ 4 * 1024 * 1024 + 123 };
+    auto constexpr WriteOffset = uint64_t{ 1024 * 1024 + 5 };
+    auto const payload = std::vector<char>(16 * 1024, 'x');
+
+    tr_preallocAdd(session_, TorrentId, FileIndex, path.c_str(), FileSize);
+
+    // write to the file while it's being preallocated
+    tr_preallocClaim(session_, TorrentId, FileIndex, WriteOffset, std::size(payload));
+    auto fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_WRITE, 0, nullptr);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+    EXPECT_TRUE(tr_sys_file_write_at(fd, std::data(payload), std::size(payload), WriteOffset, nullptr, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    EXPECT_TRUE(waitFor([this]() { return !isPreallocating(); }, 5000));
+
+    auto info = tr_sys_path_info{};
+    EXPECT_TRUE(tr_sys_path_get_info(path.c_str(), 0, &info, nullptr));
+    EXPECT_EQ(FileSize, info.size);
+
+    auto contents = std::vector<char>(FileSize);
+    fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_READ, 0, nullptr);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+    EXPECT_TRUE(tr_sys_file_read_at(fd, std::data(contents), std::size(contents), 0, nullptr, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    for (uint64_t i = 0; i < FileSize; ++i)
+    {
+        auto const expected = i >= WriteOffset && i < WriteOffset + std::size(payload) ? 'x' : '\0';
+        if (contents[i] != expected)
+        {
+            ADD_FAILURE() << "unexpected byte at offset " << i;
+            break;
+        }
+    }
+}
+
+TEST_F(PreallocTest, resumesFromTheFilesEnd)
+{
+    auto const path = tr_strvPath(sandboxDir(), "prealloc-test");
+    auto const head = std::string(100 * 1024, 'y');
+    auto constexpr FileSize = uint64_t{ 2 * 1024 * 1024 };
+    createFileWithContents(path, head.c_str());
+
+    // as if the session had stopped after that much had been preallocated or downloaded
+    tr_preallocAdd(session_, TorrentId, FileIndex, path.c_str(), FileSize, std::size(head));
+    EXPECT_TRUE(waitFor([this]() { return !isPreallocating(); }, 5000));
+
+    auto info = tr_sys_path_info{};
+    EXPECT_TRUE(tr_sys_path_get_info(path.c_str(), 0, &info, nullptr));
+    EXPECT_EQ(FileSize, info.size);
+
+    auto contents = std::vector<char>(FileSize);
+    auto const fd = tr_sys_file_open(path.c_str(), TR_SYS_FILE_READ, 0, nullptr);
+    EXPECT_NE(TR_BAD_SYS_FILE, fd);
+    EXPECT_TRUE(tr_sys_file_read_at(fd, std::data(contents), std::size(contents), 0, nullptr, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    auto const tail_size = FileSize - std::size(head);
+    EXPECT_EQ(head, std::string(std::data(contents), std::size(head)));
+    EXPECT_EQ(std::string(tail_size, '\0'), std::string(std::data(contents) + std::size(head), tail_size));
+}
+
+TEST_F(PreallocTest, removeStopsPreallocating)
+{
+    auto const path = createEmptyFile();
+
+    tr_preallocAdd(session_, TorrentId, FileIndex, path.c_str(), 64 * 1024 * 1024);
+    tr_preallocRemove(session_, TorrentId);
+    EXPECT_FALSE(isPreallocating());
+
+    // nothing to wait for after that
+    tr_preallocClaim(session_, TorrentId, FileIndex, 0, 1);
+}
+
+} // namespace test
+
+} // namespace libtransmission
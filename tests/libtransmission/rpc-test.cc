@@ -7,6 +7,7 @@
  */
 
 #include "transmission.h"
+#include "disk-io.h"
 #include "rpcimpl.h"
 #include "utils.h"
 #include "variant.h"
@@ -97,7 +98,7 @@ TEST_F(RpcTest, sessionGet)
     EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
 
     // what we expected
-    auto const expected_keys = std::array<tr_quark, 55>{
+    auto const expected_keys = std::array<tr_quark, 60>{
         TR_KEY_alt_speed_down,
         TR_KEY_alt_speed_enabled,
         TR_KEY_alt_speed_time_begin,
@@ -110,6 +111,7 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_blocklist_enabled,
         TR_KEY_blocklist_size,
         TR_KEY_blocklist_url,
+        TR_KEY_cache_auto_size_enabled,
         TR_KEY_cache_size_mb,
         TR_KEY_config_dir,
         TR_KEY_dht_enabled,
@@ -131,6 +133,8 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_port_forwarding_enabled,
         TR_KEY_queue_stalled_enabled,
         TR_KEY_queue_stalled_minutes,
+        TR_KEY_read_cache_size_mb,
+        TR_KEY_relocate_speed_limit,
         TR_KEY_rename_partial_files,
         TR_KEY_rpc_version,
         TR_KEY_rpc_version_minimum,
@@ -152,6 +156,8 @@ TEST_F(RpcTest, sessionGet)
         TR_KEY_trash_original_torrent_files,
         TR_KEY_units,
         TR_KEY_utp_enabled,
+        TR_KEY_verify_speed_limit,
+        TR_KEY_verify_threads,
         TR_KEY_version,
     };
 
@@ -188,6 +194,92 @@ TEST_F(RpcTest, sessionGet)
     tr_torrentRemove(tor, false, nullptr);
 }
 
+TEST_F(RpcTest, sessionStats)
+{
+    auto const rpc_response_func = [](tr_session* /*session*/, tr_variant* response, void* setme) noexcept
+    {
+        *static_cast<tr_variant*>(setme) = *response;
+        tr_variantInitBool(response, false);
+    };
+
+    tr_variant request;
+    tr_variantInitDict(&request, 1);
+    tr_variantDictAddStrView(&request, TR_KEY_method, "session-stats");
+    tr_variant response;
+    tr_rpc_request_exec_json(session_, &request, rpc_response_func, &response);
+    tr_variantFree(&request);
+
+    EXPECT_TRUE(tr_variantIsDict(&response));
+    tr_variant* args;
+    EXPECT_TRUE(tr_variantDictFindDict(&response, TR_KEY_arguments, &args));
+
+    // what we expected
+    auto const expected_keys = std::array<tr_quark, 21>{
+        TR_KEY_activeTorrentCount,
+        TR_KEY_blockPoolBytes,
+        TR_KEY_blockPoolBytesUsed,
+        TR_KEY_cumulative_stats,
+        TR_KEY_current_stats,
+        TR_KEY_diskDevices,
+        TR_KEY_downloadSpeed,
+        TR_KEY_eventLoopLatencyUsec,
+        TR_KEY_eventLoopMaxLatencyUsec,
+        TR_KEY_eventLoopQueued,
+        TR_KEY_eventLoopRun,
+        TR_KEY_fileCacheCloses,
+        TR_KEY_fileCacheEvictions,
+        TR_KEY_fileCacheOpens,
+        TR_KEY_pausedTorrentCount,
+        TR_KEY_readCacheHits,
+        TR_KEY_readCacheMisses,
+        TR_KEY_torrentCount,
+        TR_KEY_udpPacketsReceived,
+        TR_KEY_udpReadWakeups,
+        TR_KEY_uploadSpeed,
+    };
+
+    // what we got
+    std::set<tr_quark> actual_keys;
+    tr_quark key;
+    tr_variant* val;
+    size_t n = 0;
+    while ((tr_variantDictChild(args, n++, &key, &val)))
+    {
+        actual_keys.insert(key);
+    }
+
+    auto missing_keys = std::vector<tr_quark>{};
+    std::set_difference(
+        std::begin(expected_keys),
+        std::end(expected_keys),
+        std::begin(actual_keys),
+        std::end(actual_keys),
+        std::inserter(missing_keys, std::begin(missing_keys)));
+    EXPECT_EQ(decltype(missing_keys){}, missing_keys);
+
+    auto unexpected_keys = std::vector<tr_quark>{};
+    std::set_difference(
+        std::begin(actual_keys),
+        std::end(actual_keys),
+        std::begin(expected_keys),
+        std::end(expected_keys),
+        std::inserter(unexpected_keys, std::begin(unexpected_keys)));
+    EXPECT_EQ(decltype(unexpected_keys){}, unexpected_keys);
+
+    // one entry per disk, with a queue length for each priority class
+    tr_variant* devices = nullptr;
+    EXPECT_TRUE(tr_variantDictFindList(args, TR_KEY_diskDevices, &devices));
+    for (size_t i = 0, n_devices = tr_variantListSize(devices); i < n_devices; ++i)
+    {
+        tr_variant* queued = nullptr;
+        EXPECT_TRUE(tr_variantDictFindList(tr_variantListChild(devices, i), TR_KEY_queued, &queued));
+        EXPECT_EQ(size_t{ TR_DISK_IO_N_PRIORITIES }, tr_variantListSize(queued));
+    }
+
+    // cleanup
+    tr_variantFree(&response);
+}
+
 } // namespace test
 
 } // namespace libtransmission
@@ -0,0 +1,155 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "transmission.h"
+
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+namespace
+{
+
+auto constexpr NumProducers = size_t{ 4 };
+auto constexpr NumPerProducer = size_t{ 10000 };
+
+struct Results
+{
+    tr_event_handle* loop = nullptr;
+
+    // only touched in the loop's thread until `n_run` says it's done
+    std::array<std::vector<size_t>, NumProducers> seen;
+    bool all_in_loop = true;
+
+    std::atomic<size_t> n_run = 0;
+};
+
+struct Call
+{
+    Results* results;
+    size_t producer;
+    size_t seq;
+};
+
+void record(void* vcall)
+{
+    auto const* const call = static_cast<Call const*>(vcall);
+    auto* const results = call->results;
+
+    results->seen[call->producer].push_back(call->seq);
+    results->all_in_loop &= tr_amInEventLoop(results->loop);
+    ++results->n_run;
+}
+
+} // namespace
+
+TEST(EventLoop, runsEveryFunctionOnceInOrder)
+{
+    auto results = Results{};
+    results.loop = tr_eventLoopNew();
+
+    auto calls = std::vector<Call>{};
+    calls.reserve(NumProducers * NumPerProducer);
+    for (size_t producer = 0; producer < NumProducers; ++producer)
+    {
+        for (size_t seq = 0; seq < NumPerProducer; ++seq)
+        {
+            calls.push_back(Call{ &results, producer, seq });
+        }
+    }
+
+    auto producers = std::vector<std::thread>{};
+    for (size_t producer = 0; producer < NumProducers; ++producer)
+    {
+        producers.emplace_back(
+            [&results, &calls, producer]()
+            {
+                for (size_t seq = 0; seq < NumPerProducer; ++seq)
+                {
+                    tr_runInEventLoop(results.loop, record, &calls[producer * NumPerProducer + seq]);
+                }
+            });
+    }
+
+    for (auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    auto const n_total = NumProducers * NumPerProducer;
+    EXPECT_TRUE(waitFor([&results, n_total]() { return results.n_run == n_total; }, 10000));
+    EXPECT_TRUE(results.all_in_loop);
+
+    // each producer's functions are run in the order they were queued
+    for (auto const& seen : results.seen)
+    {
+        ASSERT_EQ(NumPerProducer, std::size(seen));
+
+        for (size_t seq = 0; seq < NumPerProducer; ++seq)
+        {
+            EXPECT_EQ(seq, seen[seq]);
+        }
+    }
+
+    auto const stats = tr_eventLoopGetStats(results.loop);
+    EXPECT_EQ(0U, stats.queued);
+    EXPECT_EQ(n_total, stats.n_run);
+    EXPECT_LE(stats.latency_usec, stats.max_latency_usec);
+
+    tr_eventLoopFree(results.loop);
+}
+
+TEST(EventLoop, runsRightAwayInItsOwnThread)
+{
+    struct Data
+    {
+        tr_event_handle* loop;
+        std::atomic<bool> done;
+        bool ran_right_away;
+    };
+
+    auto data = Data{ tr_eventLoopNew(), false, false };
+
+    tr_runInEventLoop(
+        data.loop,
+        [](void* vdata)
+        {
+            auto* const outer = static_cast<Data*>(vdata);
+            auto ran = false;
+
+            tr_runInEventLoop(
+                outer->loop,
+                [](void* vran) { *static_cast<bool*>(vran) = true; },
+                &ran);
+
+            outer->ran_right_away = ran;
+            outer->done = true;
+        },
+        &data);
+
+    EXPECT_TRUE(waitFor([&data]() { return data.done.load(); }, 5000));
+    EXPECT_TRUE(data.ran_right_away);
+    EXPECT_EQ(1U, tr_eventLoopGetStats(data.loop).n_run);
+
+    tr_eventLoopFree(data.loop);
+}
+
+} // namespace test
+
+} // namespace libtransmission
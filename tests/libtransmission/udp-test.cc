@@ -0,0 +1,287 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <event2/util.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "transmission.h"
+
+#include "session.h"
+#include "tr-udp.h"
+#include "trevent.h"
+
+#include "test-fixtures.h"
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+namespace
+{
+
+auto loopbackAddress(tr_port port)
+{
+    auto sin = sockaddr_in{};
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(port);
+    return sin;
+}
+
+// a socket on the loopback interface for the session to send to
+class Receiver
+{
+public:
+    Receiver()
+        : sock_{ socket(AF_INET, SOCK_DGRAM, 0) }
+    {
+        auto addr = loopbackAddress(0);
+        auto addrlen = socklen_t{ sizeof(addr) };
+        EXPECT_NE(TR_BAD_SOCKET, sock_);
+        EXPECT_EQ(0, bind(sock_, (sockaddr const*)&addr, sizeof(addr)));
+        EXPECT_EQ(0, getsockname(sock_, (sockaddr*)&addr, &addrlen));
+        EXPECT_EQ(0, evutil_make_socket_nonblocking(sock_));
+        to_ = addr;
+    }
+
+    Receiver(Receiver const&) = delete;
+    Receiver& operator=(Receiver const&) = delete;
+
+    ~Receiver()
+    {
+        evutil_closesocket(sock_);
+    }
+
+    sockaddr const* to() const
+    {
+        return (sockaddr const*)&to_;
+    }
+
+    // wait for `n` datagrams
+    std::vector<std::string> receive(size_t n) const
+    {
+        auto received = std::vector<std::string>{};
+        auto buf = std::array<char, 2048>{};
+
+        waitFor(
+            [this, n, &received, &buf]()
+            {
+                for (;;)
+                {
+                    auto const len = recv(sock_, std::data(buf), std::size(buf), 0);
+                    if (len < 0)
+                    {
+                        break;
+                    }
+
+                    received.emplace_back(std::data(buf), len);
+                }
+
+                return std::size(received) >= n;
+            },
+            5000);
+
+        return received;
+    }
+
+private:
+    tr_socket_t const sock_;
+    sockaddr_in to_ = {};
+};
+
+} // namespace
+
+class UdpTest : public SessionTest
+{
+protected:
+    void runInSessionThread(std::function<void()> func)
+    {
+        auto done = std::atomic<bool>{ false };
+        auto data = std::make_pair(&func, &done);
+
+        tr_runInEventThread(
+            session_,
+            [](void* vdata)
+            {
+                auto* const pair = static_cast<decltype(data)*>(vdata);
+                (*pair->first)();
+                *pair->second = true;
+            },
+            &data);
+
+        EXPECT_TRUE(waitFor([&done]() { return done.load(); }, 5000));
+    }
+
+    std::pair<uint64_t, uint64_t> getStats()
+    {
+        auto wakeups = uint64_t{};
+        auto packets = uint64_t{};
+        runInSessionThread([this, &wakeups, &packets]() { tr_udpGetStats(session_, &wakeups, &packets); });
+        return { wakeups, packets };
+    }
+};
+
+TEST_F(UdpTest, readsDatagramsInBatches)
+{
+    auto constexpr NumDatagrams = uint64_t{ 20 };
+
+    ASSERT_NE(TR_BAD_SOCKET, session_->udp_socket);
+    auto const to = loopbackAddress(session_->udp_port);
+
+    auto const sock = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(TR_BAD_SOCKET, sock);
+
+    auto const [wakeups_before, packets_before] = getStats();
+
+    // send them all while the session thread is busy, so that they're all waiting when it gets to them.
+    // They look like DHT messages, which are dropped because the DHT is turned off
+    runInSessionThread(
+        [sock, &to]()
+        {
+            auto constexpr Payload = std::array<char, 8>{ 'd', 'u', 'm', 'm', 'y', '!', '!', '!' };
+
+            for (uint64_t i = 0; i < NumDatagrams; ++i)
+            {
+                EXPECT_EQ(
+                    int(std::size(Payload)),
+                    sendto(sock, std::data(Payload), std::size(Payload), 0, (sockaddr const*)&to, sizeof(to)));
+            }
+        });
+
+    auto packets = packets_before;
+    auto wakeups = wakeups_before;
+    auto const all_read = [this, &wakeups, &packets, packets_before = packets_before]()
+    {
+        std::tie(wakeups, packets) = getStats();
+        return packets - packets_before >= NumDatagrams;
+    };
+    EXPECT_TRUE(waitFor(all_read, 5000));
+    EXPECT_EQ(NumDatagrams, packets - packets_before);
+
+    // a wakeup reads as many as are waiting, where reads can be told not to block
+    EXPECT_LE(1U, wakeups - wakeups_before);
+#ifdef MSG_DONTWAIT
+    EXPECT_GT(NumDatagrams, wakeups - wakeups_before);
+#endif
+
+    evutil_closesocket(sock);
+}
+
+TEST_F(UdpTest, groupsDatagramsForSegmentedSends)
+{
+    ASSERT_NE(TR_BAD_SOCKET, session_->udp_socket);
+    auto const a = Receiver{};
+    auto const b = Receiver{};
+
+    auto const queue = [this](Receiver const& to, size_t len)
+    {
+        auto const payload = std::string(len, 'x');
+        EXPECT_EQ(0, tr_udpSendTo(session_, std::data(payload), std::size(payload), to.to(), sizeof(sockaddr_in)));
+    };
+
+    // nothing else is sending, so the queue starts out empty
+    runInSessionThread(
+        [this, &a, &b, &queue]()
+        {
+            for (int i = 0; i < 5; ++i)
+            {
+                queue(a, 100);
+            }
+
+            queue(a, 50); // only the last may be shorter
+            queue(a, 100);
+            queue(b, 100); // not the same place
+            queue(b, 200); // longer
+
+            EXPECT_EQ(6U, tr_udpGetSendRunLength(session_, 0));
+            EXPECT_EQ(5U, tr_udpGetSendRunLength(session_, 1));
+            EXPECT_EQ(1U, tr_udpGetSendRunLength(session_, 6));
+            EXPECT_EQ(1U, tr_udpGetSendRunLength(session_, 7));
+            EXPECT_EQ(1U, tr_udpGetSendRunLength(session_, 8));
+        });
+    EXPECT_EQ(7U, std::size(a.receive(7)));
+    EXPECT_EQ(2U, std::size(b.receive(2)));
+
+    // no more than 64 segments
+    runInSessionThread(
+        [this, &a, &queue]()
+        {
+            for (int i = 0; i < 70; ++i)
+            {
+                queue(a, 100);
+            }
+
+            EXPECT_EQ(64U, tr_udpGetSendRunLength(session_, 0));
+            EXPECT_EQ(6U, tr_udpGetSendRunLength(session_, 64));
+        });
+    EXPECT_EQ(70U, std::size(a.receive(70)));
+
+    // no more than 63 KiB
+    runInSessionThread(
+        [this, &a, &queue]()
+        {
+            for (int i = 0; i < 50; ++i)
+            {
+                queue(a, 1400);
+            }
+
+            EXPECT_EQ(46U, tr_udpGetSendRunLength(session_, 0));
+            EXPECT_EQ(4U, tr_udpGetSendRunLength(session_, 46));
+        });
+    EXPECT_EQ(50U, std::size(a.receive(50)));
+}
+
+TEST_F(UdpTest, sendsQueuedDatagrams)
+{
+    ASSERT_NE(TR_BAD_SOCKET, session_->udp_socket);
+    auto const receiver = Receiver{};
+
+    auto expected = std::vector<std::string>{};
+    for (char c = 'a'; c < 'k'; ++c)
+    {
+        expected.emplace_back(100, c);
+    }
+    expected.emplace_back(30, 'z');
+
+    // once segmented, if the kernel can, and once a datagram at a time
+    for (auto const segmented : { true, false })
+    {
+        runInSessionThread(
+            [this, &receiver, &expected, segmented]()
+            {
+                tr_udpSetSegmentedSendsEnabled(session_, segmented);
+
+                for (auto const& payload : expected)
+                {
+                    auto const* const to = receiver.to();
+                    EXPECT_EQ(0, tr_udpSendTo(session_, std::data(payload), std::size(payload), to, sizeof(sockaddr_in)));
+                }
+            });
+
+        EXPECT_EQ(expected, receiver.receive(std::size(expected)));
+    }
+}
+
+} // namespace test
+
+} // namespace libtransmission
@@ -0,0 +1,250 @@
+/*
+ * This file Copyright (C) Mnemosyne LLC
+ *
+ * It may be used under the GNU GPL versions 2 or 3
+ * or any future license endorsed by Mnemosyne LLC.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "transmission.h"
+
+#include "crypto-utils.h"
+#include "file.h"
+#include "torrent.h"
+#include "variant.h"
+
+#include "test-fixtures.h"
+
+using namespace std::literals;
+
+namespace libtransmission
+{
+
+namespace test
+{
+
+class VerifyTest : public SessionTest
+{
+protected:
+    // create a torrent made of one file per entry in `file_sizes`,
+    // and write all of its files into the download directory.
+    // The torrent's bytes in [zeroes_begin...zeroes_end) are all zeroes
+    tr_torrent* createTorrent(
+        std::string const& name,
+        uint32_t piece_size,
+        std::vector<uint64_t> const& file_sizes,
+        uint64_t zeroes_begin = 0,
+        uint64_t zeroes_end = 0)
+    {
+        auto const seed = uint8_t(std::size(name));
+        auto const byteAt = [seed, zeroes_begin, zeroes_end](uint64_t offset)
+        {
+            return offset >= zeroes_begin && offset < zeroes_end ? uint8_t{ 0 } : uint8_t(offset * 7 + offset / 4096 + seed);
+        };
+        auto const total_size = std::accumulate(std::begin(file_sizes), std::end(file_sizes), uint64_t{});
+
+        auto pieces = std::string{};
+        auto piece_data = std::vector<uint8_t>{};
+        for (uint64_t begin = 0; begin < total_size; begin += piece_size)
+        {
+            piece_data.resize(std::min(uint64_t{ piece_size }, total_size - begin));
+            for (size_t i = 0; i < std::size(piece_data); ++i)
+            {
+                piece_data[i] = byteAt(begin + i);
+            }
+
+            auto const digest = tr_sha1(piece_data);
+            pieces.append(reinterpret_cast<char const*>(std::data(*digest)), std::size(*digest));
+        }
+
+        auto const dir = tr_strvPath(tr_sessionGetDownloadDir(session_), name);
+        tr_sys_dir_create(dir.c_str(), TR_SYS_DIR_CREATE_PARENTS, 0700, nullptr);
+
+        auto offset = uint64_t{};
+        for (size_t i = 0; i < std::size(file_sizes); ++i)
+        {
+            auto contents = std::vector<uint8_t>(file_sizes[i]);
+            for (auto& ch : contents)
+            {
+                ch = byteAt(offset++);
+            }
+
+            auto const filename = tr_strvPath(dir, "file-" + std::to_string(i));
+            EXPECT_TRUE(tr_saveFile(filename, { reinterpret_cast<char const*>(std::data(contents)), std::size(contents) }));
+        }
+
+        auto top = tr_variant{};
+        tr_variantInitDict(&top, 1);
+        auto* const info = tr_variantDictAddDict(&top, TR_KEY_info, 4);
+        tr_variantDictAddStr(info, TR_KEY_name, name);
+        tr_variantDictAddInt(info, TR_KEY_piece_length, piece_size);
+        tr_variantDictAddRaw(info, TR_KEY_pieces, std::data(pieces), std::size(pieces));
+        auto* const files = tr_variantDictAddList(info, TR_KEY_files, std::size(file_sizes));
+        for (size_t i = 0; i < std::size(file_sizes); ++i)
+        {
+            auto* const file = tr_variantListAddDict(files, 2);
+            tr_variantDictAddInt(file, TR_KEY_length, file_sizes[i]);
+            tr_variantListAddStr(tr_variantDictAddList(file, TR_KEY_path, 1), "file-" + std::to_string(i));
+        }
+
+        auto const benc = tr_variantToStr(&top, TR_VARIANT_FMT_BENC);
+        tr_variantFree(&top);
+
+        auto* const ctor = tr_ctorNew(session_);
+        tr_error* error = nullptr;
+        EXPECT_TRUE(tr_ctorSetMetainfo(ctor, std::data(benc), std::size(benc), &error));
+        EXPECT_EQ(nullptr, error);
+        tr_ctorSetPaused(ctor, TR_FORCE, true);
+        auto* const tor = tr_torrentNew(ctor, nullptr);
+        EXPECT_NE(nullptr, tor);
+        tr_ctorFree(ctor);
+        return tor;
+    }
+
+    struct VerifyResult
+    {
+        std::atomic<bool> done = false;
+        std::atomic<bool> aborted = false;
+    };
+
+    static void onVerifyDone(tr_torrent* /*tor*/, bool aborted, void* vresult)
+    {
+        auto* const result = static_cast<VerifyResult*>(vresult);
+        result->aborted = aborted;
+        result->done = true;
+    }
+};
+
+TEST_F(VerifyTest, verifiesManyTorrentsAtOnce)
+{
+    auto constexpr PieceSize = uint32_t{ 32768 };
+    auto constexpr NumTorrents = size_t{ 6 };
+
+    tr_sessionSetVerifyThreads(session_, 3);
+    EXPECT_EQ(3, tr_sessionGetVerifyThreads(session_));
+
+    auto torrents = std::vector<tr_torrent*>{};
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        // file sizes that don't line up with the pieces
+        torrents.push_back(createTorrent("verify-" + std::to_string(i), PieceSize, { 100000 + i * 1000, 30000, 70000 }));
+    }
+
+    // scribble on a piece of the first torrent and remove a file from the second
+    auto* const bad_piece_tor = torrents[0];
+    auto* const missing_file_tor = torrents[1];
+    auto const bad_piece_file = makeString(tr_torrentFindFile(bad_piece_tor, 0));
+    auto const fd = tr_sys_file_open(bad_piece_file.c_str(), TR_SYS_FILE_WRITE, 0, nullptr);
+    EXPECT_TRUE(tr_sys_file_write_at(fd, "garbage", 7, PieceSize + 5, nullptr, nullptr));
+    tr_sys_file_close(fd, nullptr);
+    auto const missing_file = makeString(tr_torrentFindFile(missing_file_tor, 1));
+    EXPECT_TRUE(tr_sys_path_remove(missing_file.c_str(), nullptr));
+
+    auto results = std::vector<VerifyResult>(NumTorrents);
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        tr_torrentVerify(torrents[i], onVerifyDone, &results[i]);
+    }
+
+    auto const all_done = [&results]()
+    {
+        return std::all_of(std::begin(results), std::end(results), [](auto const& result) { return result.done.load(); });
+    };
+    EXPECT_TRUE(waitFor(all_done, 10000));
+
+    for (size_t i = 0; i < NumTorrents; ++i)
+    {
+        auto* const tor = torrents[i];
+        EXPECT_FALSE(results[i].aborted);
+
+        for (tr_piece_index_t piece = 0; piece < tor->pieceCount(); ++piece)
+        {
+            if (tor == bad_piece_tor)
+            {
+                EXPECT_EQ(piece != 1, tor->hasPiece(piece));
+            }
+            else if (tor == missing_file_tor)
+            {
+                // the second file covers bytes [100000...130000)
+                auto const [begin, end] = tor->piecesInFile(1);
+                EXPECT_EQ(piece < begin || piece >= end, tor->hasPiece(piece)) << piece;
+            }
+            else
+            {
+                EXPECT_TRUE(tor->hasPiece(piece));
+            }
+        }
+    }
+
+    // cleanup
+    for (auto* const tor : torrents)
+    {
+        tr_torrentRemove(tor, true, tr_sys_path_remove);
+    }
+}
+
+TEST_F(VerifyTest, piecesInHolesAreMissing)
+{
+    auto constexpr PieceSize = uint32_t{ 32768 };
+    auto constexpr FileSize = uint64_t{ PieceSize * 32 };
+
+    // pieces [8...16) are all zeroes, so they're good even if they're in a hole
+    auto* const tor = createTorrent("verify-holes", PieceSize, { FileSize }, PieceSize * 8, PieceSize * 16);
+
+    // throw away everything after the first four pieces, leaving a hole where they were
+    auto const filename = makeString(tr_torrentFindFile(tor, 0));
+    auto const fd = tr_sys_file_open(filename.c_str(), TR_SYS_FILE_WRITE, 0, nullptr);
+    EXPECT_TRUE(tr_sys_file_truncate(fd, PieceSize * 4, nullptr));
+    EXPECT_TRUE(tr_sys_file_truncate(fd, FileSize, nullptr));
+    tr_sys_file_close(fd, nullptr);
+
+    auto result = VerifyResult{};
+    tr_torrentVerify(tor, onVerifyDone, &result);
+    EXPECT_TRUE(waitFor([&result]() { return result.done.load(); }, 5000));
+    EXPECT_FALSE(result.aborted);
+
+    for (tr_piece_index_t piece = 0; piece < tor->pieceCount(); ++piece)
+    {
+        EXPECT_EQ(piece < 4 || (piece >= 8 && piece < 16), tor->hasPiece(piece)) << piece;
+    }
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+TEST_F(VerifyTest, canBeStoppedWhileThrottled)
+{
+    auto* const tor = createTorrent("verify-throttled", 32768, { 4 * 1024 * 1024 });
+
+    // this slow, the verify won't finish before it's restarted
+    tr_sessionSetVerifySpeedLimit_KBps(session_, 1);
+    EXPECT_EQ(1U, tr_sessionGetVerifySpeedLimit_KBps(session_));
+
+    auto first = VerifyResult{};
+    tr_torrentVerify(tor, onVerifyDone, &first);
+    EXPECT_TRUE(waitFor([tor]() { return tr_torrentStat(tor)->activity == TR_STATUS_CHECK; }, 5000));
+
+    // starting a new verify stops the current one
+    tr_sessionSetVerifySpeedLimit_KBps(session_, 0);
+    auto second = VerifyResult{};
+    tr_torrentVerify(tor, onVerifyDone, &second);
+    EXPECT_TRUE(waitFor([&first]() { return first.done.load(); }, 5000));
+    EXPECT_TRUE(first.aborted);
+
+    EXPECT_TRUE(waitFor([&second]() { return second.done.load(); }, 5000));
+    EXPECT_FALSE(second.aborted);
+    EXPECT_EQ(0, tr_torrentStat(tor)->leftUntilDone);
+
+    // cleanup
+    tr_torrentRemove(tor, true, tr_sys_path_remove);
+}
+
+} // namespace test
+
+} // namespace libtransmission
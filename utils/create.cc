@@ -33,13 +33,14 @@ char constexpr Usage[] = "Usage: transmission-create [options] <file|directory>"
 
 uint32_t constexpr KiB = 1024;
 
-auto constexpr Options = std::array<tr_option, 8>{
+auto constexpr Options = std::array<tr_option, 9>{
     { { 'p', "private", "Allow this torrent to only be used with the specified tracker(s)", "p", false, nullptr },
       { 'r', "source", "Set the source for private trackers", "r", true, "<source>" },
       { 'o', "outfile", "Save the generated .torrent to this filename", "o", true, "<file>" },
       { 's', "piecesize", "Set the piece size in KiB, overriding the preferred default", "s", true, "<KiB>" },
       { 'c', "comment", "Add a comment", "c", true, "<comment>" },
       { 't', "tracker", "Add a tracker's announce URL", "t", true, "<url>" },
+      { 'T', "threads", "Set how many threads hash the pieces, overriding one per CPU core", "T", true, "<count>" },
       { 'V', "version", "Show version number and exit", "V", false, nullptr },
       { 0, nullptr, nullptr, nullptr, false, nullptr } }
 };
@@ -52,6 +53,7 @@ struct app_options
     char const* infile = nullptr;
     char const* source = nullptr;
     uint32_t piecesize_kib = 0;
+    uint32_t threads = 0;
     bool is_private = false;
     bool show_version = false;
 };
@@ -103,6 +105,25 @@ int parseCommandLine(app_options& options, int argc, char const* const* argv)
             options.source = optarg;
             break;
 
+        case 'T':
+            {
+                char* endptr = nullptr;
+                auto const n = strtoul(optarg, &endptr, 10);
+
+                if (endptr == optarg || *endptr != '\0' || n < 1 || n > TR_MAKEMETA_MAX_THREADS)
+                {
+                    fprintf(
+                        stderr,
+                        "ERROR: The thread count must be a number from 1 to %" PRIu32 "\n",
+                        TR_MAKEMETA_MAX_THREADS);
+                    return 1;
+                }
+
+                options.threads = n;
+            }
+
+            break;
+
         case TR_OPT_UNK:
             options.infile = optarg;
             break;
@@ -209,6 +230,11 @@ int tr_main(int argc, char* argv[])
         tr_metaInfoBuilderSetPieceSize(b, options.piecesize_kib * KiB);
     }
 
+    if (options.threads != 0)
+    {
+        tr_metaInfoBuilderSetThreadCount(b, options.threads);
+    }
+
     printf(
         b->fileCount > 1 ? " %" PRIu32 " files, %s\n" : " %" PRIu32 " file, %s\n",
         b->fileCount,